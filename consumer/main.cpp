@@ -6,6 +6,8 @@
 #include <stdexcept>
 #include <iostream>
 #include <initializer_list>
+#include <memory>
+#include <vector>
 #include <boost/exception/diagnostic_information.hpp>
 #include <boost/optional/optional.hpp>
 #include <boost/thread.hpp>
@@ -26,7 +28,10 @@ void signalHandler( int signo )
 }
 
 
-void waitTermination( boost::thread_group& threads, std::initializer_list< int > signals = { SIGINT, SIGTERM, SIGQUIT } )
+void waitTermination(
+     boost::thread_group& threads,
+     const std::vector< std::unique_ptr< edi::ts::rabbitmq_client::SimpleClient > >& clients,
+     std::initializer_list< int > signals = { SIGINT, SIGTERM, SIGQUIT } )
 {
      sigset_t sset;
 
@@ -44,56 +49,50 @@ void waitTermination( boost::thread_group& threads, std::initializer_list< int >
      int sig = 0;
      sigwait( &sset, &sig );
 
-     std::cout << "termination signal " << sig << " has been caught\n" << "interrupting threads...\n";
+     /// Поток, ожидающий сообщения внутри rabbitmq-c, не находится в точке прерывания boost::thread,
+     /// поэтому вместо interrupt_all() используется кооперативная остановка подписчиков
+     std::cout << "termination signal " << sig << " has been caught\n" << "stopping consumers...\n";
 
-     threads.interrupt_all();
+     for( const auto& each: clients )
+     {
+          each->requestStop();
+     }
+
+     threads.join_all();
 }
 
 
 void worker(
-     const std::string& hostname, const int port,
-     const std::string& username, const std::string& password,
-     const std::string& virtualHost,
+     edi::ts::rabbitmq_client::SimpleClient& client,
      const std::string& exchange,
-     const std::string& routingKey,
      const std::string& queueName,
-     const boost::optional< boost::posix_time::time_duration >& timeout = boost::none,
-     const boost::optional< boost::chrono::milliseconds >& processingDelay = boost::none )
+     const boost::posix_time::time_duration& drainDeadline,
+     const boost::optional< boost::posix_time::time_duration >& timeout = boost::none )
 {
-     using edi::ts::rabbitmq_client::Connection;
      using edi::ts::rabbitmq_client::ConnectionError;
-     using edi::ts::rabbitmq_client::SimpleClient;
-
-     const Connection::Parameters params(
-          hostname,
-          port,
-          username,
-          password,
-          virtualHost
-     );
+     using edi::ts::rabbitmq_client::Delivery;
 
-     Connection connection( params );
      bool reconnect = false;
-     while( true )
+     while( !client.stopRequested() )
      {
           try
           {
                if( reconnect )
                {
-                    connection.reconnect();
+                    client.reconnect();
                     reconnect = false;
                }
 
-               SimpleClient::bind( connection, exchange, queueName );
-               while( true )
+               client.bind( exchange, queueName );
+               while( !client.stopRequested() )
                {
-                    const auto& env = SimpleClient::consumeMessage( connection, timeout );
+                    const auto& env = client.consumeMessage( timeout );
                     if( env )
                     {
                          std::cout << "Got message:\n" << env->message << "\n";
-                         SimpleClient::ackMessage( connection, env->deliveryTag );
+                         client.ackMessage( env->deliveryTag );
                     }
-                    else
+                    else if( !client.stopRequested() )
                     {
                          std::cout << "No message consumed.\n";
                     }
@@ -110,6 +109,17 @@ void worker(
                return;
           }
      }
+
+     /// Сообщения, уже выданные брокером этому подписчику, обрабатываются до закрытия канала
+     const bool stopped = client.drainAndStop(
+          drainDeadline,
+          []( const Delivery& delivery )
+          {
+               std::cout << "Got message while stopping:\n" << delivery.message() << "\n";
+          }
+     );
+
+     std::cout << ( stopped ? "consumer stopped\n" : "consumer stop deadline exceeded\n" );
 }
 
 
@@ -123,25 +133,33 @@ int main()
           const auto password = "123456";
           const auto virtualHost = "b2b";
           const auto exchange = "amq.direct";
-          const auto routingKey = "billing";
           const auto queueName = "billing";
           const boost::posix_time::seconds timeout( 5
                );
-          const boost::chrono::milliseconds procDelay( 0 );
+          const boost::posix_time::seconds drainDeadline( 3 );
 
+          using edi::ts::rabbitmq_client::Connection;
+          using edi::ts::rabbitmq_client::SimpleClient;
+
+          const Connection::Parameters params( hostname, port, username, password, virtualHost );
+
+          std::vector< std::unique_ptr< SimpleClient > > clients;
           boost::thread_group tg;
 
           for( int i=0; i < 1; ++i )
           {
+               clients.emplace_back( new SimpleClient( params ) );
+               auto& client = *clients.back();
+
                tg.create_thread(
                     [ & ]()
                     {
-                         worker( hostname, port, username, password, virtualHost, exchange, routingKey, queueName, timeout, procDelay );
+                         worker( client, exchange, queueName, drainDeadline, timeout );
                     }
                );
           }
 
-          waitTermination( tg );
+          waitTermination( tg, clients );
 
           std::cout << "Done.\n";
      }
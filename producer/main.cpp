@@ -1,45 +1,428 @@
 /// @file
-/// @brief
+/// @brief Генератор нагрузки: публикация сообщений с заданной скоростью и размером, получение их обратно
+/// и измерение сквозной задержки и пропускной способности
 /// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
 
+#include <atomic>
+#include <csignal>
+#include <cstring>
+#include <random>
 #include <stdexcept>
 #include <iostream>
+#include <iomanip>
+#include <boost/chrono/system_clocks.hpp>
 #include <boost/exception/diagnostic_information.hpp>
+#include <boost/program_options.hpp>
+#include <boost/thread.hpp>
+#include <rabbitmq_client/error.h>
 #include <rabbitmq_client/simple_client.h>
+#include <rabbitmq_client/topology.h>
+#include <utils/latency_stats.h>
 
 
-int main()
+namespace {
+
+
+using edi::ts::rabbitmq_client::Connection;
+using edi::ts::rabbitmq_client::ConnectionError;
+using edi::ts::rabbitmq_client::SimpleClient;
+using edi::ts::rabbitmq_client::Topology;
+
+typedef boost::chrono::steady_clock Clock;
+
+
+/// Устанавливается обработчиком сигналов и рабочими потоками при ошибке
+std::atomic< bool > interrupted{ false };
+
+
+void signalHandler( int signo )
+{
+     if( signo == SIGINT || signo == SIGTERM )
+     {
+          interrupted = true;
+     }
+}
+
+
+/// Метка времени отправки, встраиваемая в начало тела сообщения
+/// @note Используются часы реального времени, чтобы задержку можно было измерить и получателем в другом процессе
+/// (на другом узле - при синхронизированных часах)
+std::uint64_t wallclockMicroseconds()
+{
+     return boost::chrono::duration_cast< boost::chrono::microseconds >(
+          boost::chrono::system_clock::now().time_since_epoch() ).count();
+}
+
+
+const std::size_t TIMESTAMP_SIZE = sizeof( std::uint64_t );
+
+
+/// Распределение размеров сообщений
+class MessageSize
+{
+public:
+     enum class Distribution { Fixed, Uniform, Exponential };
+
+     MessageSize( Distribution distribution, std::size_t size, std::size_t min, std::size_t max )
+          : distribution_( distribution )
+          , size_( std::max( size, TIMESTAMP_SIZE ) )
+          , min_( std::max( min, TIMESTAMP_SIZE ) )
+          , max_( std::max( max, size_ ) )
+     {
+          if( distribution_ != Distribution::Fixed && min_ > max_ )
+          {
+               BOOST_THROW_EXCEPTION( std::invalid_argument( "minimum message size exceeds maximum" ) );
+          }
+     }
+
+     /// Возвращает размер очередного сообщения (не меньше размера метки времени и не больше max)
+     template< typename Random >
+     std::size_t next( Random& random ) const
+     {
+          switch( distribution_ )
+          {
+               case Distribution::Fixed:
+                    return size_;
+               case Distribution::Uniform:
+                    return std::uniform_int_distribution< std::size_t >( min_, max_ )( random );
+               case Distribution::Exponential:
+                    {
+                         const auto value = std::exponential_distribution< double >( 1.0 / size_ )( random );
+                         return std::min( max_, std::max( min_, static_cast< std::size_t >( value ) ) );
+                    }
+          }
+          return size_;
+     }
+
+     /// Максимально возможный размер сообщения
+     std::size_t max() const { return distribution_ == Distribution::Fixed ? size_ : max_; }
+
+private:
+     const Distribution distribution_;
+     const std::size_t size_;
+     const std::size_t min_;
+     const std::size_t max_;
+};
+
+
+MessageSize::Distribution parseDistribution( const std::string& name )
+{
+     if( name == "fixed" ) return MessageSize::Distribution::Fixed;
+     if( name == "uniform" ) return MessageSize::Distribution::Uniform;
+     if( name == "exponential" ) return MessageSize::Distribution::Exponential;
+     BOOST_THROW_EXCEPTION( std::invalid_argument( "unknown size distribution: " + name ) );
+}
+
+
+/// Общие для всех потоков параметры и счетчики теста
+struct LoadTest
+{
+     LoadTest( const Connection::Parameters& p, const SimpleClient::QueueParameters& q, const MessageSize& s )
+          : params( p ), queue( q ), size( s )
+     {}
+
+     const Connection::Parameters params;
+     const SimpleClient::QueueParameters queue;
+     const MessageSize size;
+     double ratePerPublisher = 0;  ///< скорость одного публикатора, сообщений в секунду (0 - без ограничения)
+
+     std::atomic< bool > publishing{ true };
+     std::atomic< bool > consuming{ true };
+
+     std::atomic< std::uint64_t > published{ 0 };
+     std::atomic< std::uint64_t > publishedBytes{ 0 };
+     std::atomic< std::uint64_t > consumed{ 0 };
+     std::atomic< std::uint64_t > consumedBytes{ 0 };
+
+     boost::mutex latencyMutex;
+     LatencyStats latency;
+};
+
+
+void publisher( LoadTest& test, unsigned seed )
+{
+     std::mt19937_64 random( seed );
+
+     /// Заполнитель тела сообщения формируется один раз; случайное содержимое исключает влияние сжатия на канале
+     std::string filler( test.size.max(), '\0' );
+     for( auto& each: filler )
+     {
+          each = static_cast< char >( random() );
+     }
+
+     SimpleClient client( test.params );
+     std::string body;
+
+     const bool paced = test.ratePerPublisher > 0;
+     const auto interval = paced
+          ? boost::chrono::duration_cast< Clock::duration >( boost::chrono::duration< double >( 1.0 / test.ratePerPublisher ) )
+          : Clock::duration::zero();
+     auto due = Clock::now();
+     auto dueWallclock = wallclockMicroseconds();
+
+     while( test.publishing && !interrupted )
+     {
+          /// В режиме заданной скорости в сообщение записывается запланированное, а не фактическое время отправки:
+          /// иначе задержки самого публикатора (coordinated omission) выпадали бы из измерений
+          std::uint64_t timestamp = wallclockMicroseconds();
+          if( paced )
+          {
+               boost::this_thread::sleep_until( due );
+               timestamp = dueWallclock;
+               due += interval;
+               dueWallclock += boost::chrono::duration_cast< boost::chrono::microseconds >( interval ).count();
+          }
+
+          const auto size = test.size.next( random );
+          body.assign( reinterpret_cast< const char* >( &timestamp ), TIMESTAMP_SIZE );
+          body.append( filler, 0, size - TIMESTAMP_SIZE );
+
+          try
+          {
+               client.publishMessage( test.queue, body );
+          }
+          catch( const ConnectionError& e )
+          {
+               std::cerr << "publisher: connection error: " << e.what() << "\n";
+               continue;
+          }
+
+          ++test.published;
+          test.publishedBytes += size;
+     }
+}
+
+
+void consumer( LoadTest& test )
 {
-     using edi::ts::rabbitmq_client::Connection;
-     using edi::ts::rabbitmq_client::SimpleClient;
+     const boost::posix_time::milliseconds pollInterval( 100 );
 
+     SimpleClient::ConsumerParameters consumerParams;
+     consumerParams.prefetchCount = 1000;
+
+     LatencyStats latency;
+     std::unique_ptr< SimpleClient > client;
+
+     while( test.consuming && !interrupted )
+     {
+          try
+          {
+               if( !client )
+               {
+                    client.reset( new SimpleClient( test.params ) );
+                    client->bind( test.queue, consumerParams );
+               }
+
+               const auto delivery = client->consumeDelivery( pollInterval );
+               if( !delivery )
+               {
+                    continue;
+               }
+
+               const auto now = wallclockMicroseconds();
+               const auto body = delivery->body();
+               if( body.size() >= TIMESTAMP_SIZE )
+               {
+                    std::uint64_t sent = 0;
+                    std::memcpy( &sent, body.data(), TIMESTAMP_SIZE );
+                    latency.add( now > sent ? now - sent : 0 );
+               }
+
+               client->ackMessage( delivery->deliveryTag() );
+
+               ++test.consumed;
+               test.consumedBytes += body.size();
+          }
+          catch( const ConnectionError& e )
+          {
+               std::cerr << "consumer: connection error: " << e.what() << "\n";
+               client.reset();
+               boost::this_thread::sleep_for( boost::chrono::seconds( 1 ) );
+          }
+     }
+
+     boost::lock_guard< boost::mutex > lock( test.latencyMutex );
+     test.latency.merge( latency );
+}
+
+
+/// Выполняет тело рабочего потока; ошибка потока завершает тест, не завершая процесс аварийно
+template< typename Body >
+void runGuarded( const char* name, Body body )
+{
      try
      {
-          const auto hostname = "10.0.10.229";
-          const auto port = 5672;
-          const auto username = "edi-ts";
-          const auto password = "123456";
-          const auto virtualHost = "b2b";
-          const auto exchange = "amq.direct";
-          const auto routingKey = "billing";
-          const auto queueName = "billing";
-          const auto message =
-               "My Bonny is over the ocean,\n"
-               "My Bonny is over the sea,\n"
-               "My Bonny is over the ocean\n"
-               "So bring back my Bonny to me..";
+          body();
+     }
+     catch( const std::exception& e )
+     {
+          std::cerr << name << " failed: " << boost::diagnostic_information( e ) << "\n";
+          interrupted = true;
+     }
+}
+
+
+void printRate( const char* title, std::uint64_t messages, std::uint64_t bytes, double seconds )
+{
+     std::cout << title << ": " << messages << " msgs, "
+          << messages / seconds << " msg/s, "
+          << bytes / seconds / ( 1024 * 1024 ) << " MB/s\n";
+}
+
+
+} // namespace {unnamed}
+
 
-          const Connection::Parameters params( hostname, port, username, password, virtualHost );
-          Connection connection( params );
+int main( int argc, char** argv )
+{
+     namespace po = boost::program_options;
+
+     try
+     {
+          po::options_description options( "Usage: producer [options]" );
+          options.add_options()
+               ( "help,h", "show this help" )
+               ( "host", po::value< std::string >()->default_value( "localhost" ), "broker host" )
+               ( "port", po::value< int >()->default_value( 5672 ), "broker port" )
+               ( "user", po::value< std::string >()->default_value( "guest" ), "user name" )
+               ( "password", po::value< std::string >()->default_value( "guest" ), "password" )
+               ( "vhost", po::value< std::string >()->default_value( "/" ), "virtual host" )
+               ( "exchange,e", po::value< std::string >()->default_value( "amq.direct" ), "exchange to publish to" )
+               ( "routing-key,r", po::value< std::string >()->default_value( "loadgen" ), "routing key" )
+               ( "queue,q", po::value< std::string >()->default_value( "loadgen" ), "queue to consume from (declared and bound to the exchange)" )
+               ( "rate", po::value< double >()->default_value( 0 ), "total publish rate, msg/s (0 - unbounded)" )
+               ( "size", po::value< std::size_t >()->default_value( 1024 ), "message size, bytes (mean for exponential distribution)" )
+               ( "size-dist", po::value< std::string >()->default_value( "fixed" ), "message size distribution: fixed, uniform or exponential" )
+               ( "size-min", po::value< std::size_t >()->default_value( 0 ), "minimum message size for uniform and exponential distributions" )
+               ( "size-max", po::value< std::size_t >()->default_value( 65536 ), "maximum message size for uniform and exponential distributions" )
+               ( "publishers,p", po::value< unsigned >()->default_value( 1 ), "publisher threads (one connection each)" )
+               ( "consumers,c", po::value< unsigned >()->default_value( 1 ), "consumer threads (one connection each)" )
+               ( "duration,d", po::value< unsigned >()->default_value( 10 ), "test duration, s" )
+               ( "drain", po::value< unsigned >()->default_value( 5 ), "time to wait for in-flight messages after publishing stops, s" );
 
-          /// Публикуем N сообщений только в exchange (как и полагается)
-          for( int i = 0; i < 5; ++i )
+          po::variables_map vm;
+          po::store( po::parse_command_line( argc, argv, options ), vm );
+
+          if( vm.count( "help" ) )
+          {
+               std::cout << options << "\n";
+               return 0;
+          }
+          po::notify( vm );
+
+          std::signal( SIGINT, signalHandler );
+          std::signal( SIGTERM, signalHandler );
+
+          const Connection::Parameters params(
+               vm[ "host" ].as< std::string >(),
+               vm[ "port" ].as< int >(),
+               vm[ "user" ].as< std::string >(),
+               vm[ "password" ].as< std::string >(),
+               vm[ "vhost" ].as< std::string >()
+          );
+          const SimpleClient::QueueParameters queue(
+               vm[ "exchange" ].as< std::string >(),
+               vm[ "routing-key" ].as< std::string >(),
+               vm[ "queue" ].as< std::string >()
+          );
+          const MessageSize size(
+               parseDistribution( vm[ "size-dist" ].as< std::string >() ),
+               vm[ "size" ].as< std::size_t >(),
+               vm[ "size-min" ].as< std::size_t >(),
+               vm[ "size-max" ].as< std::size_t >()
+          );
+          const auto publishers = vm[ "publishers" ].as< unsigned >();
+          const auto consumers = vm[ "consumers" ].as< unsigned >();
+          const auto duration = boost::chrono::seconds( vm[ "duration" ].as< unsigned >() );
+          const auto drain = boost::chrono::seconds( vm[ "drain" ].as< unsigned >() );
+
+          LoadTest test( params, queue, size );
+          if( publishers )
+          {
+               test.ratePerPublisher = vm[ "rate" ].as< double >() / publishers;
+          }
+
+          /// Очередь объявляется и связывается до запуска публикаторов: иначе сообщения, опубликованные до связывания
+          /// очереди подписчиками, не попали бы в нее
+          if( consumers )
+          {
+               SimpleClient::QueueDeclaration declaration( queue.queueName );
+               declaration.durable = false;
+
+               Topology setup;
+               setup.declare( declaration );
+               if( !queue.exchange.empty() )
+               {
+                    setup.bind( queue.exchange, queue.queueName, queue.routingKey );
+               }
+
+               const auto report = setup.apply( Connection( params ) );
+               if( report.failures )
+               {
+                    const auto& failed = report.declarations[ 0 ].ok ? report.bindings[ 0 ] : report.declarations[ 0 ];
+                    BOOST_THROW_EXCEPTION( std::runtime_error( "cannot set up queue " + queue.queueName + ": " + failed.error ) );
+               }
+          }
+
+          boost::thread_group consumerThreads;
+          for( unsigned i = 0; i < consumers; ++i )
+          {
+               consumerThreads.create_thread( [ &test ](){ runGuarded( "consumer", [ &test ](){ consumer( test ); } ); } );
+          }
+
+          boost::thread_group publisherThreads;
+          for( unsigned i = 0; i < publishers; ++i )
+          {
+               publisherThreads.create_thread( [ &test, i ](){ runGuarded( "publisher", [ &test, i ](){ publisher( test, i + 1 ); } ); } );
+          }
+
+          std::cout << std::fixed << std::setprecision( 1 );
+
+          /// Раз в секунду выводится текущая скорость публикации и получения
+          const auto started = Clock::now();
+          std::uint64_t lastPublished = 0;
+          std::uint64_t lastConsumed = 0;
+          while( !interrupted && Clock::now() - started < duration )
+          {
+               boost::this_thread::sleep_for( boost::chrono::seconds( 1 ) );
+
+               const std::uint64_t published = test.published;
+               const std::uint64_t consumed = test.consumed;
+               std::cout << "published " << published - lastPublished << " msg/s, consumed " << consumed - lastConsumed << " msg/s\n";
+               lastPublished = published;
+               lastConsumed = consumed;
+          }
+
+          test.publishing = false;
+          publisherThreads.join_all();
+          const auto publishElapsed = boost::chrono::duration< double >( Clock::now() - started ).count();
+
+          const auto drainDeadline = Clock::now() + drain;
+          while( consumers && !interrupted && test.consumed < test.published && Clock::now() < drainDeadline )
           {
-               std::cout << "Publishing message!\n";
-               SimpleClient::publishMessage( connection, exchange, routingKey, message );
+               boost::this_thread::sleep_for( boost::chrono::milliseconds( 100 ) );
           }
 
-          std::cout << "Done.\n";
+          test.consuming = false;
+          consumerThreads.join_all();
+          const auto consumeElapsed = boost::chrono::duration< double >( Clock::now() - started ).count();
+
+          std::cout << "\n";
+          printRate( "published", test.published, test.publishedBytes, publishElapsed );
+          if( consumers )
+          {
+               printRate( "consumed", test.consumed, test.consumedBytes, consumeElapsed );
+               std::cout << "end-to-end latency, us: "
+                    << "p50 " << test.latency.percentile( 0.5 )
+                    << ", p99 " << test.latency.percentile( 0.99 )
+                    << ", p999 " << test.latency.percentile( 0.999 )
+                    << ", max " << test.latency.max() << "\n";
+          }
+     }
+     catch( const po::error& e )
+     {
+          std::cerr << e.what() << "\n";
+          return 1;
      }
      catch( const std::exception& e )
      {
@@ -0,0 +1,450 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <string>
+#include <vector>
+#include <poll.h>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/optional/optional.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <rabbitmq_client/error.h>
+#include <rabbitmq_client/simple_client.h>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+
+/// Стратегии (policies) настройки BasicClient
+namespace policy {
+
+
+/// @brief Однократное переподключение при разрыве соединения (как в SimpleClient)
+/// @details Публикация, объявление и связывание повторяются на новом соединении. Подтверждения не повторяются:
+/// идентификаторы доставки прежнего соединения недействительны, а неподтвержденные сообщения брокер доставит
+/// повторно, поэтому после переподключения ошибка передается дальше.
+struct ReconnectOnce
+{
+     template< typename Operation >
+     static void retry( Connection& connection, Operation&& operation )
+     {
+          try
+          {
+               operation();
+               return;
+          }
+          catch( const ConnectionError& )
+          {}
+
+          connection.reconnect();
+          operation();
+     }
+
+     template< typename Operation >
+     static void settle( Connection& connection, Operation&& operation )
+     {
+          try
+          {
+               operation();
+          }
+          catch( const ConnectionError& )
+          {
+               connection.reconnect();
+               throw;
+          }
+     }
+};
+
+
+/// Без переподключения: ошибки соединения передаются вызывающему без дополнительных действий
+struct NoReconnect
+{
+     template< typename Operation >
+     static void retry( Connection&, Operation&& operation )
+     {
+          operation();
+     }
+
+     template< typename Operation >
+     static void settle( Connection&, Operation&& operation )
+     {
+          operation();
+     }
+};
+
+
+/// Явное подтверждение сообщений (доставка не менее одного раза)
+struct ManualAck
+{
+     static const bool NO_ACK = false;
+};
+
+
+/// @brief Подписка без подтверждений (no_ack, доставка не более одного раза)
+/// @details Брокер считает сообщение подтвержденным в момент отправки; методы подтверждения клиента
+/// при этой стратегии не компилируются
+struct AutoAck
+{
+     static const bool NO_ACK = true;
+};
+
+
+/// Ошибки передаются исключениями
+struct ThrowOnError
+{
+     typedef void Status;
+
+     template< typename Operation >
+     static void invoke( Operation&& operation, std::string& )
+     {
+          operation();
+     }
+
+     template< typename Result, typename Operation >
+     static Result get( Operation&& operation, Result&&, std::string& )
+     {
+          return operation();
+     }
+};
+
+
+/// @brief Ошибки возвращаются результатом операции
+/// @details Операция возвращает false (получение - пустой результат), текст ошибки доступен через
+/// BasicClient::lastError()
+struct ReturnStatus
+{
+     typedef bool Status;
+
+     template< typename Operation >
+     static bool invoke( Operation&& operation, std::string& error )
+     {
+          try
+          {
+               operation();
+               return true;
+          }
+          catch( const std::exception& e )
+          {
+               error = e.what();
+               return false;
+          }
+     }
+
+     template< typename Result, typename Operation >
+     static Result get( Operation&& operation, Result&& fallback, std::string& error )
+     {
+          try
+          {
+               return operation();
+          }
+          catch( const std::exception& e )
+          {
+               error = e.what();
+               return std::move( fallback );
+          }
+     }
+};
+
+
+/// Клиент используется одним потоком: синхронизация отсутствует
+struct SingleThreaded
+{
+     struct Lock
+     {
+          explicit Lock( SingleThreaded& ) {}
+     };
+
+     /// Выполняет получение @a operation( timeout ) с ожиданием внутри операции
+     template< typename Operation >
+     static auto receive( Lock&, const Connection&, const boost::optional< boost::posix_time::time_duration >& timeout, Operation&& operation )
+          -> decltype( operation( timeout ) )
+     {
+          return operation( timeout );
+     }
+};
+
+
+/// @brief Вызовы клиента из разных потоков сериализуются мьютексом
+/// @details Ожидание сообщений выполняется без блокировки: поток-подписчик ждет данных в сокете (poll()),
+/// отпустив мьютекс, а получает их под мьютексом без ожидания. Поэтому публикация из других потоков не ждет
+/// окончания таймаута получения, в том числе неограниченного.
+struct Synchronized
+{
+     struct Lock
+     {
+          explicit Lock( Synchronized& owner ) : guard( owner.mutex ) {}
+          boost::unique_lock< boost::mutex > guard;
+     };
+
+     /// @brief Выполняет получение @a operation( timeout ), ожидая данных вне мьютекса
+     /// @details Ожидание разбивается на интервалы не длиннее WAIT_SLICE_MS: сокет, закрытый переподключением
+     /// из другого потока во время ожидания, заменяется сокетом нового соединения не позднее следующего интервала
+     template< typename Operation >
+     static auto receive( Lock& lock, const Connection& connection, const boost::optional< boost::posix_time::time_duration >& timeout, Operation&& operation )
+          -> decltype( operation( timeout ) )
+     {
+          using boost::posix_time::microsec_clock;
+
+          const auto deadline = timeout
+               ? boost::make_optional( microsec_clock::universal_time() + *timeout )
+               : boost::none;
+
+          while( true )
+          {
+               /// Уже принятые и поступившие в сокет данные забираются без ожидания
+               auto result = operation( boost::make_optional( boost::posix_time::time_duration() ) );
+               if( result )
+               {
+                    return result;
+               }
+
+               int waitMs = WAIT_SLICE_MS;
+               if( deadline )
+               {
+                    const auto left = ( *deadline - microsec_clock::universal_time() ).total_milliseconds();
+                    if( left <= 0 )
+                    {
+                         return result;
+                    }
+                    waitMs = static_cast< int >( std::min< std::int64_t >( left, WAIT_SLICE_MS ) );
+               }
+
+               pollfd fd = { SimpleClient::socketDescriptor( connection ), POLLIN, 0 };
+
+               lock.guard.unlock();
+               ::poll( &fd, 1, waitMs );
+               lock.guard.lock();
+          }
+     }
+
+     static const int WAIT_SLICE_MS = 100;
+
+     boost::mutex mutex;
+};
+
+
+} // namespace policy
+
+
+/// @brief Клиент, поведение которого задается стратегиями на этапе компиляции
+/// @details В отличие от SimpleClient, который на каждом вызове проверяет включенные возможности (фильтр повторов,
+/// шифрование, контроль целостности и т.п.) и всегда переподключается через doReconnectOnError, BasicClient
+/// содержит только выбранное поведение: стратегия переподключения (ReconnectOnce, NoReconnect), подтверждения
+/// (ManualAck, AutoAck), обработки ошибок (ThrowOnError, ReturnStatus) и синхронизации (SingleThreaded,
+/// Synchronized) подставляются в код операций, а неиспользуемые ветви не компилируются. Операции выполняются
+/// функциями соединения SimpleClient.
+///
+/// @code
+/// // Подписчик "не более одного раза" без переподключений и без подтверждений
+/// AtMostOnceConsumer consumer( params );
+/// consumer.bind( SimpleClient::QueueParameters( "amq.direct", "key", "queue" ) );
+/// while( const auto envelope = consumer.consumeMessage() ) { ... }
+/// @endcode
+///
+/// Клиент владеет соединением либо работает с соединением вызывающей стороны (BasicClient( Connection& )):
+/// во втором случае он заменяет статические функции SimpleClient, поэтому один набор методов обслуживает оба
+/// варианта использования, различающихся в SimpleClient дублирующимися статическими и нестатическими методами.
+///
+/// @note Ограничение: SimpleClient не является конфигурацией BasicClient, и его дублирующиеся статический и
+/// нестатический интерфейсы сохраняются без изменений. SimpleClient реализует операции соединения, на которых
+/// построен BasicClient (и другие классы библиотеки), и хранит состояние дополнительных возможностей (фильтр
+/// повторов, шифрование, claim-check, карантин, таймеры), которых в BasicClient нет. Новый код, которому эти
+/// возможности не нужны, использует BasicClient: ReliableClient вместо объекта SimpleClient и DirectClient вместо
+/// его статических функций.
+template<
+     typename ReconnectPolicy = policy::ReconnectOnce,
+     typename AckPolicy = policy::ManualAck,
+     typename ErrorPolicy = policy::ThrowOnError,
+     typename ThreadingPolicy = policy::SingleThreaded
+>
+class BasicClient
+{
+public:
+     /// Результат операции: void при ThrowOnError, bool при ReturnStatus
+     typedef typename ErrorPolicy::Status Status;
+
+     /// @brief Устанавливает соединение
+     /// @throw ConnectionError в случае если все попытки подключения закончились неудачей
+     explicit BasicClient( const Connection::Parameters& params )
+          : owned_( new Connection( params ) )
+          , connection_( *owned_ )
+     {}
+
+     /// @brief Работает с соединением @a connection вызывающей стороны (соединение должно пережить клиент)
+     /// @note С NoReconnect и SingleThreaded (DirectClient) операции эквивалентны статическим функциям SimpleClient
+     explicit BasicClient( Connection& connection )
+          : connection_( connection )
+     {}
+
+     BasicClient( const BasicClient& ) = delete;
+     BasicClient& operator=( const BasicClient& ) = delete;
+
+     /// @see SimpleClient::publishMessage()
+     Status publishMessage( const std::string& exchange, const std::string& routingKey, const std::string& message )
+     {
+          typename ThreadingPolicy::Lock lock( sync_ );
+          return ErrorPolicy::invoke(
+               [ & ](){ ReconnectPolicy::retry( connection_, [ & ](){ SimpleClient::publishMessage( connection_, exchange, routingKey, message ); } ); },
+               lastError_
+          );
+     }
+
+     /// @see SimpleClient::declareQueue()
+     /// @return имя очереди (пустая строка при ошибке, если ошибки не передаются исключениями)
+     std::string declareQueue( const SimpleClient::QueueDeclaration& declaration )
+     {
+          typename ThreadingPolicy::Lock lock( sync_ );
+          return ErrorPolicy::get(
+               [ & ]()
+               {
+                    std::string name;
+                    ReconnectPolicy::retry( connection_, [ & ](){ name = SimpleClient::declareQueue( connection_, declaration ); } );
+                    return name;
+               },
+               std::string(),
+               lastError_
+          );
+     }
+
+     /// @brief Связывает точку публикации с очередью и подписывается на нее
+     /// @details Признак @a consumer.noAck задается стратегией подтверждения (AutoAck - подписка без подтверждений)
+     /// @see SimpleClient::bind()
+     Status bind( const SimpleClient::QueueParameters& params, SimpleClient::ConsumerParameters consumer = SimpleClient::ConsumerParameters() )
+     {
+          consumer.noAck = AckPolicy::NO_ACK;
+
+          typename ThreadingPolicy::Lock lock( sync_ );
+          return ErrorPolicy::invoke(
+               [ & ]()
+               {
+                    ReconnectPolicy::retry( connection_,
+                         [ & ](){ SimpleClient::bind( connection_, params.exchange, params.queueName, params.routingKey, consumer ); } );
+               },
+               lastError_
+          );
+     }
+
+     /// @see SimpleClient::consumeMessage()
+     /// @note При Synchronized ожидание не блокирует вызовы клиента из других потоков
+     boost::optional< SimpleClient::Envelope > consumeMessage(
+          const boost::optional< boost::posix_time::time_duration >& timeout = boost::none
+     )
+     {
+          typename ThreadingPolicy::Lock lock( sync_ );
+          return ErrorPolicy::get(
+               [ & ]()
+               {
+                    return ThreadingPolicy::receive( lock, connection_, timeout,
+                         [ this ]( const boost::optional< boost::posix_time::time_duration >& wait ){ return SimpleClient::consumeMessage( connection_, wait ); } );
+               },
+               boost::optional< SimpleClient::Envelope >(),
+               lastError_
+          );
+     }
+
+     /// @see SimpleClient::consumeMessages()
+     /// @note При Synchronized ожидание не блокирует вызовы клиента из других потоков
+     std::size_t consumeMessages(
+          std::vector< SimpleClient::Envelope >& envelopes,
+          std::size_t maxCount,
+          const boost::optional< boost::posix_time::time_duration >& timeout = boost::none
+     )
+     {
+          typename ThreadingPolicy::Lock lock( sync_ );
+          return ErrorPolicy::get(
+               [ & ]()
+               {
+                    return ThreadingPolicy::receive( lock, connection_, timeout,
+                         [ & ]( const boost::optional< boost::posix_time::time_duration >& wait ){ return SimpleClient::consumeMessages( connection_, envelopes, maxCount, wait ); } );
+               },
+               std::size_t( 0 ),
+               lastError_
+          );
+     }
+
+     /// @see SimpleClient::ackMessage()
+     Status ackMessage( std::uint64_t deliveryTag, bool multiple = false )
+     {
+          static_assert( !AckPolicy::NO_ACK, "messages are not acknowledged by an AutoAck client" );
+
+          typename ThreadingPolicy::Lock lock( sync_ );
+          return ErrorPolicy::invoke(
+               [ & ](){ ReconnectPolicy::settle( connection_, [ & ](){ SimpleClient::ackMessage( connection_, deliveryTag, multiple ); } ); },
+               lastError_
+          );
+     }
+
+     /// @see SimpleClient::nackMessage()
+     Status nackMessage( std::uint64_t deliveryTag, bool multiple = false, bool requeue = true )
+     {
+          static_assert( !AckPolicy::NO_ACK, "messages are not acknowledged by an AutoAck client" );
+
+          typename ThreadingPolicy::Lock lock( sync_ );
+          return ErrorPolicy::invoke(
+               [ & ](){ ReconnectPolicy::settle( connection_, [ & ](){ SimpleClient::nackMessage( connection_, deliveryTag, multiple, requeue ); } ); },
+               lastError_
+          );
+     }
+
+     /// @see SimpleClient::rejectMessage()
+     Status rejectMessage( std::uint64_t deliveryTag, bool requeue = true )
+     {
+          static_assert( !AckPolicy::NO_ACK, "messages are not acknowledged by an AutoAck client" );
+
+          typename ThreadingPolicy::Lock lock( sync_ );
+          return ErrorPolicy::invoke(
+               [ & ](){ ReconnectPolicy::settle( connection_, [ & ](){ SimpleClient::rejectMessage( connection_, deliveryTag, requeue ); } ); },
+               lastError_
+          );
+     }
+
+     /// @see Connection::reconnect()
+     Status reconnect()
+     {
+          typename ThreadingPolicy::Lock lock( sync_ );
+          return ErrorPolicy::invoke( [ this ](){ connection_.reconnect(); }, lastError_ );
+     }
+
+     /// @brief Текст последней ошибки, возвращенной результатом операции (ReturnStatus)
+     /// @note При Synchronized текст может быть перезаписан ошибкой операции другого потока
+     const std::string& lastError() const
+     {
+          return lastError_;
+     }
+
+     /// Соединение клиента для функций SimpleClient, не представленных в BasicClient
+     Connection& connection()
+     {
+          return connection_;
+     }
+
+private:
+     std::unique_ptr< Connection > owned_;
+     Connection& connection_;
+     ThreadingPolicy sync_;
+     std::string lastError_;
+};
+
+
+/// Конфигурация, соответствующая SimpleClient: переподключение, явные подтверждения, исключения, один поток
+typedef BasicClient<> ReliableClient;
+
+/// Подписчик "не более одного раза": без подтверждений и без переподключений
+typedef BasicClient< policy::NoReconnect, policy::AutoAck > AtMostOnceConsumer;
+
+/// Операции над соединением вызывающей стороны без переподключений (статические функции SimpleClient)
+typedef BasicClient< policy::NoReconnect > DirectClient;
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
@@ -0,0 +1,126 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <boost/optional/optional.hpp>
+#include <boost/utility/string_ref.hpp>
+#include <amqp.h>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+
+/// @brief Тело сообщения, размещенное в сегменте разделяемой памяти (см. ClaimCheck)
+/// @details Сегмент отображается в память при получении сообщения; тело доступно без копирования,
+/// пока жив объект. Отображение не зависит от удаления сегмента: после release() другими получателями
+/// данные остаются доступны до уничтожения объекта.
+class ClaimCheckPayload
+{
+public:
+     ~ClaimCheckPayload();
+
+     ClaimCheckPayload( const ClaimCheckPayload& ) = delete;
+     ClaimCheckPayload& operator=( const ClaimCheckPayload& ) = delete;
+
+     /// Тело сообщения
+     boost::string_ref body() const;
+
+     /// Имя сегмента разделяемой памяти
+     const std::string& name() const { return name_; }
+
+     /// @brief Уменьшает счетчик ссылок сегмента; последний получатель удаляет сегмент
+     /// @note Повторные вызовы для одного объекта игнорируются
+     void release();
+
+private:
+     friend class ClaimCheck;
+
+     ClaimCheckPayload( const std::string& name, char* base, std::size_t mapped );
+
+     const std::string name_;
+     char* const base_;
+     const std::size_t mapped_;
+     bool released_ = false;
+};
+
+
+/// @brief Передача больших сообщений между процессами одного узла в обход брокера (claim-check)
+/// @details Тело сообщения размером не меньше порога записывается в сегмент разделяемой памяти (/dev/shm),
+/// а через брокер публикуется только короткое сообщение-ссылка с пустым телом и заголовками
+/// x-claim-check (имя сегмента) и x-claim-check-size (размер тела). Получатель отображает сегмент в память
+/// и читает тело без копирования.
+///
+/// Сегмент содержит счетчик ссылок, равный кол-ву получателей сообщения (Parameters::consumers; для
+/// fanout-маршрутизации - кол-во очередей). Каждый получатель уменьшает счетчик при подтверждении сообщения,
+/// последний удаляет сегмент. При повторной доставке неподтвержденного сообщения сегмент остается доступен.
+///
+/// @attention Отправитель и получатель должны работать на одном узле. Сегменты сообщений, которые так и не были
+/// получены (истек TTL, очередь удалена), не удаляются автоматически - для их удаления предназначен purge().
+///
+/// @note Имена сегментов, принимаемые получателем, ограничены префиксом Parameters::prefix, поэтому сообщение
+/// не может заставить получателя отобразить произвольный сегмент разделяемой памяти.
+class ClaimCheck
+{
+public:
+     /// Имя заголовка со ссылкой на сегмент
+     static const char* const HEADER;
+
+     /// Имя заголовка с размером тела сообщения
+     static const char* const SIZE_HEADER;
+
+     /// Параметры передачи
+     struct Parameters
+     {
+          Parameters()
+               : threshold( 1024 * 1024 ), prefix( "rabbitmq-claim" ), consumers( 1 )
+          {}
+
+          std::size_t threshold;        ///< минимальный размер тела, передаваемого через разделяемую память, байт
+          std::string prefix;           ///< префикс имен сегментов
+          std::uint32_t consumers;      ///< кол-во получателей каждого сообщения
+     };
+
+     explicit ClaimCheck( const Parameters& = Parameters() );
+
+     /// Возвращает true, если тело размером @a size следует передавать через разделяемую память
+     bool applies( std::size_t size ) const { return size >= params_.threshold; }
+
+     /// @brief Записывает тело сообщения в новый сегмент
+     /// @return имя сегмента
+     /// @throw std::runtime_error в случае ошибок создания сегмента
+     std::string store( boost::string_ref body );
+
+     /// Удаляет сегмент, не дожидаясь получателей (например, если опубликовать ссылку на него не удалось)
+     void discard( const std::string& name );
+
+     /// @brief Возвращает имя сегмента, на который ссылается сообщение со свойствами @a properties
+     /// @return boost::none, если сообщение не является ссылкой или имя сегмента не соответствует префиксу
+     boost::optional< std::string > reference( const amqp_basic_properties_t& properties ) const;
+
+     /// @brief Отображает сегмент в память
+     /// @throw std::runtime_error если сегмент не существует (например, сообщение получено на другом узле)
+     /// или поврежден
+     std::shared_ptr< ClaimCheckPayload > open( const std::string& name ) const;
+
+     /// @brief Удаляет сегменты с префиксом Parameters::prefix, созданные ранее @a maxAge секунд назад
+     /// @return кол-во удаленных сегментов
+     std::size_t purge( unsigned maxAge ) const;
+
+private:
+     const Parameters params_;
+     const std::string namePrefix_;
+     std::atomic< std::uint64_t > counter_;
+};
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
@@ -0,0 +1,250 @@
+/// @file
+/// @brief Кодеки сообщений для типизированной публикации и получения (SimpleClient::publish(), SimpleClient::consume())
+/// @details Кодек - специализация шаблона Codec< T >, выбираемая на этапе компиляции по типу сообщения:
+/// - сообщения protobuf (типы с методами ByteSizeLong(), SerializeWithCachedSizesToArray(), ParseFromArray()) -
+/// ProtobufCodec; заголовки protobuf библиотекой не подключаются;
+/// - объекты FlatBuffers Object API (типы с вложенным TableType, генерируются flatc --gen-object-api) -
+/// FlatBufferCodec, если при сборке доступен flatbuffers/flatbuffers.h;
+/// - тривиально копируемые типы - PodCodec (байты объекта без преобразования);
+/// - std::string - тело сообщения как есть.
+///
+/// Кодек определяет:
+/// - тип Buffer - буфер кодирования, повторно используемый между публикациями одного потока;
+/// - static const char* contentType() - значение свойства content_type;
+/// - static boost::string_ref encode( const T&, Buffer& ) - тело сообщения: байты объекта или содержимое буфера,
+/// передаваемые в кадры сообщения без промежуточной строки;
+/// - static bool decode( boost::string_ref body, T& ) - разбор тела непосредственно из буфера доставки.
+///
+/// Для собственных типов кодек задается явной специализацией:
+/// @code
+/// template<> struct Codec< Order > { typedef std::string Buffer; static const char* contentType(); ... };
+/// @endcode
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <boost/utility/string_ref.hpp>
+#include <rabbitmq_client/delivery.h>
+
+#if !defined( RABBITMQ_CLIENT_NO_FLATBUFFERS ) && defined( __has_include )
+#if __has_include( <flatbuffers/flatbuffers.h> )
+#include <flatbuffers/flatbuffers.h>
+#define RABBITMQ_CLIENT_HAS_FLATBUFFERS 1
+#endif
+#endif
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+
+/// @brief Полученное сообщение вместе с разобранным телом
+/// @details Доставка сохраняется для подтверждения и доступа к свойствам и заголовкам
+template< typename T >
+struct TypedDelivery
+{
+     TypedDelivery( Delivery&& d, T&& v )
+          : delivery( std::move( d ) ), value( std::move( v ) )
+     {}
+
+     Delivery delivery;
+     T value;
+};
+
+
+/// Тело сообщения - байты тривиально копируемого объекта (порядок байт и выравнивание платформы отправителя)
+template< typename T >
+struct PodCodec
+{
+     static_assert( std::is_trivially_copyable< T >::value, "PodCodec requires a trivially copyable type" );
+
+     struct Buffer {};
+
+     static const char* contentType()
+     {
+          return "application/octet-stream";
+     }
+
+     static boost::string_ref encode( const T& value, Buffer& )
+     {
+          return boost::string_ref( reinterpret_cast< const char* >( &value ), sizeof( T ) );
+     }
+
+     static bool decode( boost::string_ref body, T& value )
+     {
+          if( body.size() != sizeof( T ) )
+          {
+               return false;
+          }
+          std::memcpy( &value, body.data(), sizeof( T ) );
+          return true;
+     }
+};
+
+
+/// Тело сообщения - строка без преобразования
+struct StringCodec
+{
+     struct Buffer {};
+
+     static const char* contentType()
+     {
+          return "application/octet-stream";
+     }
+
+     static boost::string_ref encode( const std::string& value, Buffer& )
+     {
+          return value;
+     }
+
+     static bool decode( boost::string_ref body, std::string& value )
+     {
+          value.assign( body.data(), body.size() );
+          return true;
+     }
+};
+
+
+/// @brief Сообщение protobuf
+/// @details Размер вычисляется один раз, сообщение сериализуется в повторно используемый буфер
+template< typename T >
+struct ProtobufCodec
+{
+     typedef std::string Buffer;
+
+     static const char* contentType()
+     {
+          return "application/x-protobuf";
+     }
+
+     static boost::string_ref encode( const T& value, Buffer& buffer )
+     {
+          buffer.resize( value.ByteSizeLong() );
+          value.SerializeWithCachedSizesToArray( reinterpret_cast< std::uint8_t* >( &buffer[ 0 ] ) );
+          return buffer;
+     }
+
+     static bool decode( boost::string_ref body, T& value )
+     {
+          return value.ParseFromArray( body.data(), static_cast< int >( body.size() ) );
+     }
+};
+
+
+#ifdef RABBITMQ_CLIENT_HAS_FLATBUFFERS
+
+/// @brief Объект FlatBuffers Object API
+/// @details Объект упаковывается построителем, повторно используемым между публикациями; тело сообщения -
+/// буфер построителя. При получении буфер проверяется (flatbuffers::Verifier) и распаковывается в объект.
+template< typename T >
+struct FlatBufferCodec
+{
+     typedef typename T::TableType Table;
+     typedef flatbuffers::FlatBufferBuilder Buffer;
+
+     static const char* contentType()
+     {
+          return "application/x-flatbuffers";
+     }
+
+     static boost::string_ref encode( const T& value, Buffer& builder )
+     {
+          builder.Clear();
+          builder.Finish( Table::Pack( builder, &value ) );
+          return boost::string_ref( reinterpret_cast< const char* >( builder.GetBufferPointer() ), builder.GetSize() );
+     }
+
+     static bool decode( boost::string_ref body, T& value )
+     {
+          const auto data = reinterpret_cast< const std::uint8_t* >( body.data() );
+          flatbuffers::Verifier verifier( data, body.size() );
+          if( !verifier.VerifyBuffer< Table >( nullptr ) )
+          {
+               return false;
+          }
+          flatbuffers::GetRoot< Table >( data )->UnPackTo( &value );
+          return true;
+     }
+};
+
+#endif
+
+
+namespace codec {
+
+
+template< typename T >
+struct Void
+{
+     typedef void type;
+};
+
+
+template< typename T, typename Enable = void >
+struct IsProtobufMessage : std::false_type {};
+
+template< typename T >
+struct IsProtobufMessage< T, typename Void< decltype(
+     std::declval< const T& >().ByteSizeLong(),
+     std::declval< const T& >().SerializeWithCachedSizesToArray( static_cast< std::uint8_t* >( nullptr ) ),
+     std::declval< T& >().ParseFromArray( static_cast< const void* >( nullptr ), 0 )
+) >::type > : std::true_type {};
+
+
+template< typename T, typename Enable = void >
+struct IsFlatBufferObject : std::false_type {};
+
+#ifdef RABBITMQ_CLIENT_HAS_FLATBUFFERS
+template< typename T >
+struct IsFlatBufferObject< T, typename Void< typename T::TableType >::type > : std::true_type {};
+#endif
+
+
+/// Кодек по умолчанию для типа, не относящегося к другим категориям
+template< typename T, typename Enable = void >
+struct DefaultCodec
+{
+     static_assert( sizeof( T ) == 0, "no codec for the message type: specialize Codec< T >" );
+};
+
+template< typename T >
+struct DefaultCodec< T, typename std::enable_if< std::is_trivially_copyable< T >::value && !std::is_pointer< T >::value >::type >
+     : PodCodec< T >
+{};
+
+
+template< typename T >
+struct SelectCodec
+{
+     typedef typename std::conditional<
+          IsProtobufMessage< T >::value,
+          ProtobufCodec< T >,
+#ifdef RABBITMQ_CLIENT_HAS_FLATBUFFERS
+          typename std::conditional< IsFlatBufferObject< T >::value, FlatBufferCodec< T >, DefaultCodec< T > >::type
+#else
+          DefaultCodec< T >
+#endif
+     >::type Type;
+};
+
+
+} // namespace codec
+
+
+/// Кодек сообщений типа @a T (см. описание файла)
+template< typename T >
+struct Codec : codec::SelectCodec< T >::Type {};
+
+template<>
+struct Codec< std::string > : StringCodec {};
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
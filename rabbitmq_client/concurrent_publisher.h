@@ -0,0 +1,107 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#pragma once
+
+#include <atomic>
+#include <future>
+#include <memory>
+#include <string>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <rabbitmq_client/mpsc_ring.h>
+#include <rabbitmq_client/simple_client.h>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+
+/// @brief Потокобезопасный публикатор сообщений с выделенным потоком ввода-вывода
+/// @details Любой поток помещает сообщение в неблокирующую очередь MpscRing и сразу возвращает управление.
+/// Единственный поток ввода-вывода владеет соединением, забирает сообщения из очереди пачками и публикует их;
+/// на время публикации пачки сокет переводится в режим TCP_CORK, поэтому кадры нескольких сообщений
+/// объединяются в полноразмерные TCP-сегменты.
+///
+/// При разрыве соединения поток ввода-вывода переподключается и повторяет публикацию сообщения однократно
+/// (аналогично SimpleClient::publishMessage()).
+///
+/// @note Результат публикации означает передачу сообщения в сокет (подтверждения брокера не используются)
+class ConcurrentPublisher
+{
+public:
+     /// Параметры публикатора
+     struct Parameters
+     {
+          Parameters()
+               : capacity( 65536 ), batchSize( 256 )
+          {}
+
+          std::size_t capacity;     ///< емкость очереди сообщений (степень двойки)
+          std::size_t batchSize;    ///< максимальное кол-во сообщений, публикуемых за один проход
+     };
+
+     /// Конструктор. Устанавливает соединение и запускает поток ввода-вывода
+     /// @throw ConnectionError в случае если все попытки подключения закончились неудачей
+     ConcurrentPublisher( const Connection::Parameters&, const Parameters& = Parameters() );
+
+     /// Публикует оставшиеся в очереди сообщения и останавливает поток ввода-вывода
+     ~ConcurrentPublisher();
+
+     ConcurrentPublisher( const ConcurrentPublisher& ) = delete;
+     ConcurrentPublisher& operator=( const ConcurrentPublisher& ) = delete;
+
+     /// @brief Помещает сообщение в очередь на публикацию без ожидания результата
+     /// @return false, если очередь заполнена или публикатор остановлен
+     /// @see SimpleClient::publishMessage()
+     bool tryPublish( std::string exchange, std::string routingKey, std::string message );
+
+     /// @brief Помещает сообщение в очередь на публикацию
+     /// @return future с результатом публикации; если очередь заполнена - содержит исключение std::runtime_error
+     /// @see SimpleClient::publishMessage()
+     std::future< void > publish( std::string exchange, std::string routingKey, std::string message );
+
+private:
+     /// Сообщение в очереди на публикацию
+     struct Message
+     {
+          std::string exchange;
+          std::string routingKey;
+          std::string body;
+          std::unique_ptr< std::promise< void > > result;
+     };
+
+     /// Помещает сообщение в очередь и при необходимости будит поток ввода-вывода
+     bool enqueue( Message& message );
+
+     /// Тело потока ввода-вывода
+     void run();
+
+     /// Публикует пачку сообщений из очереди. Возвращает кол-во опубликованных сообщений
+     std::size_t publishBatch();
+
+     /// Публикует одно сообщение с однократной попыткой переподключения
+     void publishOne( Message& message );
+
+     /// Включает/выключает режим TCP_CORK для сокета соединения
+     void cork( bool enable );
+
+     Connection connection_;
+     const std::size_t batchSize_;
+     MpscRing< Message > ring_;
+
+     std::atomic< bool > stop_;
+     std::atomic< bool > sleeping_;
+     boost::mutex sleepMutex_;
+     boost::condition_variable sleepCondition_;
+
+     boost::thread worker_;
+};
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
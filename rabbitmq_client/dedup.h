@@ -0,0 +1,78 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <boost/optional/optional.hpp>
+#include <amqp.h>
+#include <rabbitmq_client/mapped_file.h>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+
+/// @brief Фильтр повторно доставленных сообщений
+/// @details Фильтр хранит 64-битные отпечатки ключей уже обработанных сообщений. Ключом служит
+/// свойство message_id либо значение заголовка, указанного в параметрах. Сообщения без ключа не фильтруются.
+///
+/// Отпечатки хранятся в множественно-ассоциативной таблице ограниченного размера: каждая корзина занимает
+/// ровно одну строку кэша (8 отпечатков, таблица выровнена по границе строки), поэтому проверка стоит одного обращения к памяти и не требует
+/// предварительной проверки фильтром Блума. При заполнении корзины вытесняется самый старый отпечаток.
+///
+/// При указании пути к файлу таблица размещается в отображенном в память файле и сохраняется
+/// между перезапусками процесса.
+///
+/// @note Класс не является потокобезопасным
+class DeduplicationFilter
+{
+public:
+     /// Параметры фильтра
+     struct Parameters
+     {
+          explicit Parameters( std::size_t cap )
+               : capacity( cap )
+          {}
+
+          std::size_t capacity = 0;     ///< кол-во запоминаемых ключей (округляется вверх)
+          std::string header;           ///< имя заголовка с ключом (пустая строка - используется message_id)
+          std::string persistPath;      ///< путь к файлу таблицы (пустая строка - таблица хранится только в памяти)
+     };
+
+     /// @throw std::runtime_error в случае ошибок открытия файла или несовпадения его формата
+     explicit DeduplicationFilter( const Parameters& );
+
+     /// Вычисляет отпечаток ключа сообщения или возвращает boost::none, если ключ в сообщении отсутствует
+     boost::optional< std::uint64_t > fingerprint( const amqp_basic_properties_t& ) const;
+
+     /// Возвращает true, если сообщение с таким отпечатком уже было обработано
+     bool contains( std::uint64_t fingerprint ) const;
+
+     /// Запоминает отпечаток обработанного сообщения
+     void insert( std::uint64_t fingerprint );
+
+private:
+     struct Header;
+
+     /// Инициализирует или проверяет заголовок таблицы
+     void initTable( char* data, bool created );
+
+     const std::string header_;
+     std::uint64_t bucketCount_ = 0;
+
+     std::unique_ptr< MappedFile > file_;
+     std::unique_ptr< void, void(*)( void* ) > memory_;     ///< таблица без файла, выровнена по строке кэша
+
+     std::uint64_t* buckets_ = nullptr;
+     std::uint8_t* cursors_ = nullptr;
+};
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
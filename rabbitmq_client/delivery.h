@@ -0,0 +1,172 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/optional/optional.hpp>
+#include <boost/utility/string_ref.hpp>
+#include <boost/variant.hpp>
+#include <amqp.h>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+
+struct HeaderValue;
+class ClaimCheckPayload;
+
+/// Таблица заголовков сообщения (field table в терминах AMQP)
+typedef std::map< std::string, HeaderValue > HeaderTable;
+
+/// Массив значений заголовка (field array в терминах AMQP)
+typedef std::vector< HeaderValue > HeaderArray;
+
+
+/// @brief Значение заголовка сообщения
+/// @details Целые числа со знаком приводятся к std::int64_t, без знака - к std::uint64_t, числа с плавающей
+/// точкой - к double; строки и байтовые массивы - к std::string. Метка времени хранится как std::uint64_t.
+/// Значения неподдерживаемых типов (decimal, void) представлены boost::blank.
+struct HeaderValue
+{
+     typedef boost::variant<
+          boost::blank,
+          bool,
+          std::int64_t,
+          std::uint64_t,
+          double,
+          std::string,
+          boost::recursive_wrapper< HeaderTable >,
+          boost::recursive_wrapper< HeaderArray >
+     > Value;
+
+     Value value;
+};
+
+
+/// Свойства сообщения (basic properties в терминах AMQP); неустановленные свойства равны boost::none
+struct MessageProperties
+{
+     boost::optional< std::string > contentType;
+     boost::optional< std::string > contentEncoding;
+     boost::optional< std::uint8_t > deliveryMode;
+     boost::optional< std::uint8_t > priority;
+     boost::optional< std::string > correlationId;
+     boost::optional< std::string > replyTo;
+     boost::optional< std::string > expiration;
+     boost::optional< std::string > messageId;
+     boost::optional< std::uint64_t > timestamp;
+     boost::optional< std::string > type;
+     boost::optional< std::string > userId;
+     boost::optional< std::string > appId;
+     boost::optional< std::string > clusterId;
+};
+
+
+/// Преобразует значение поля таблицы rabbitmq-c в HeaderValue
+HeaderValue decodeField( const amqp_field_value_t& );
+
+/// Преобразует таблицу rabbitmq-c в HeaderTable
+HeaderTable decodeTable( const amqp_table_t& );
+
+
+/// @brief Полученное из очереди сообщение со всеми данными доставки
+/// @details В отличие от SimpleClient::Envelope объект владеет исходной структурой amqp_envelope_t
+/// и ничего не преобразует при получении. Тело сообщения доступно без копирования, а exchange, routing key,
+/// свойства и заголовки сообщения преобразуются в типы C++ только при первом обращении к ним
+/// (с сохранением результата). Таким образом обработчики, читающие только тело сообщения,
+/// не несут расходов на разбор метаданных.
+///
+/// @note Объект допускает только перемещение. Методы класса не являются потокобезопасными.
+class Delivery
+{
+public:
+     /// Принимает во владение @a envelope (освобождается в деструкторе вызовом amqp_destroy_envelope())
+     explicit Delivery( const amqp_envelope_t& envelope );
+     ~Delivery();
+
+     Delivery( Delivery&& );
+     Delivery& operator=( Delivery&& );
+
+     Delivery( const Delivery& ) = delete;
+     Delivery& operator=( const Delivery& ) = delete;
+
+     /// @brief Возвращает тело сообщения без копирования (действительно, пока жив объект)
+     /// @note Для сообщения-ссылки (claim-check) с присоединенным телом возвращается тело из разделяемой памяти,
+     /// для зашифрованного сообщения - расшифрованное тело
+     boost::string_ref body() const;
+
+     /// Возвращает копию тела сообщения
+     std::string message() const;
+
+     /// Идентификатор сообщения (для подтверждения доставки)
+     std::uint64_t deliveryTag() const { return envelope_.delivery_tag; }
+
+     /// Признак повторной доставки сообщения
+     bool redelivered() const { return envelope_.redelivered != 0; }
+
+     /// Точка публикации, через которую было опубликовано сообщение
+     const std::string& exchange() const;
+
+     /// Ключ маршрутизации, с которым было опубликовано сообщение
+     const std::string& routingKey() const;
+
+     /// Метка подписчика, получившего сообщение
+     const std::string& consumerTag() const;
+
+     /// Свойства сообщения
+     const MessageProperties& properties() const;
+
+     /// Все заголовки сообщения
+     const HeaderTable& headers() const;
+
+     /// @brief Значение одного заголовка @a name или boost::none при его отсутствии
+     /// @note Преобразуется только запрошенный заголовок, без разбора всей таблицы
+     boost::optional< HeaderValue > header( const std::string& name ) const;
+
+     /// Исходная структура rabbitmq-c (для низкоуровневого доступа)
+     const amqp_envelope_t& native() const { return envelope_; }
+
+     /// Присоединяет тело сообщения-ссылки, отображенное из разделяемой памяти (см. ClaimCheck)
+     void attachPayload( const std::shared_ptr< ClaimCheckPayload >& payload ) { payload_ = payload; }
+
+     /// Присоединенное тело сообщения-ссылки или nullptr
+     const std::shared_ptr< ClaimCheckPayload >& payload() const { return payload_; }
+
+     /// Заменяет тело сообщения расшифрованным (см. PayloadCipher)
+     void replaceBody( std::string&& body ) { body_ = std::move( body ); }
+
+     /// Отмечает доставку номером соединения, в котором она получена (см. FairConsumer)
+     void stampEpoch( std::uint64_t epoch ) { epoch_ = epoch; }
+
+     /// Номер соединения, в котором получена доставка (0, если не отмечена)
+     std::uint64_t epoch() const { return epoch_; }
+
+private:
+     void release();
+
+     amqp_envelope_t envelope_;
+     bool owned_ = true;
+
+     mutable boost::optional< std::string > exchange_;
+     mutable boost::optional< std::string > routingKey_;
+     mutable boost::optional< std::string > consumerTag_;
+     mutable boost::optional< MessageProperties > properties_;
+     mutable boost::optional< HeaderTable > headers_;
+
+     std::shared_ptr< ClaimCheckPayload > payload_;
+     boost::optional< std::string > body_;
+     std::uint64_t epoch_ = 0;
+};
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
@@ -0,0 +1,91 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <boost/utility/string_ref.hpp>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+
+/// @brief Шифрование тела сообщения (envelope encryption) алгоритмом AES-256-GCM
+/// @details Тело сообщения шифруется на стороне клиента и хранится в брокере только в зашифрованном виде.
+/// Зашифрованное тело имеет вид:
+/// @code
+/// nonce (12 байт) | шифртекст | тег аутентификации (16 байт)
+/// @endcode
+/// Идентификатор ключа передается в заголовке x-key-id и дополнительно аутентифицируется (AAD), поэтому
+/// ключи можно заменять без остановки обмена: новые сообщения шифруются активным ключом, а сообщения,
+/// зашифрованные прежними ключами, расшифровываются, пока эти ключи не удалены.
+///
+/// Для каждого ключа однократно создаются контексты OpenSSL (EVP) с развернутым ключом, которые затем
+/// используются повторно: на сообщение приходится только установка nonce. OpenSSL использует инструкции
+/// AES-NI и PCLMULQDQ при их наличии.
+///
+/// Nonce (96 бит) выбирается случайно (RAND_bytes) для каждого сообщения независимо от объекта, которым
+/// выполняется шифрование, поэтому ключ может использоваться несколькими процессами одновременно. Вероятность
+/// повтора nonce остается пренебрежимо малой до 2^32 сообщений на ключ, после чего ключ следует заменить.
+///
+/// @note Класс не является потокобезопасным
+/// @see SimpleClient::setEncryption()
+class PayloadCipher
+{
+public:
+     /// Имя заголовка с идентификатором ключа
+     static const char* const KEY_ID_HEADER;
+
+     static const std::size_t KEY_SIZE = 32;       ///< размер ключа, байт
+     static const std::size_t NONCE_SIZE = 12;     ///< размер nonce, байт
+     static const std::size_t TAG_SIZE = 16;       ///< размер тега аутентификации, байт
+
+     PayloadCipher();
+     ~PayloadCipher();
+
+     PayloadCipher( const PayloadCipher& ) = delete;
+     PayloadCipher& operator=( const PayloadCipher& ) = delete;
+
+     /// @brief Добавляет (или заменяет) ключ @a keyId; первый добавленный ключ становится активным
+     /// @throw std::invalid_argument если размер ключа не равен KEY_SIZE или идентификатор пуст
+     /// @throw std::runtime_error в случае ошибок OpenSSL
+     void addKey( const std::string& keyId, const std::string& key );
+
+     /// @brief Делает ключ @a keyId активным (используемым для шифрования)
+     /// @throw std::invalid_argument если ключ не добавлен
+     void setActiveKey( const std::string& keyId );
+
+     /// Удаляет ключ; сообщения, зашифрованные им, больше не расшифровываются
+     void removeKey( const std::string& keyId );
+
+     /// Идентификатор активного ключа (пустая строка, если ключей нет)
+     const std::string& activeKey() const;
+
+     /// @brief Шифрует @a plain активным ключом в @a sealed
+     /// @details Буфер @a sealed переиспользуется: при повторных вызовах с тем же буфером память не выделяется
+     /// @return идентификатор ключа, которым зашифровано сообщение
+     /// @throw std::logic_error если ключей нет
+     /// @throw std::runtime_error в случае ошибок OpenSSL
+     const std::string& encrypt( boost::string_ref plain, std::string& sealed );
+
+     /// @brief Расшифровывает @a sealed ключом @a keyId в @a plain
+     /// @return false, если ключ неизвестен или сообщение не прошло аутентификацию (искажено или подделано)
+     bool decrypt( const std::string& keyId, boost::string_ref sealed, std::string& plain );
+
+private:
+     struct Key;
+
+     std::map< std::string, std::unique_ptr< Key > > keys_;
+     Key* active_ = nullptr;
+};
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
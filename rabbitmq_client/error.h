@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <stdexcept>
 #include <string>
 #include <amqp.h>
@@ -21,6 +22,50 @@ struct ConnectionError : std::runtime_error
 };
 
 
+/// Тип исключения, генерируемый при истечении времени ожидания ответа
+struct TimeoutError : std::runtime_error
+{
+     TimeoutError( const std::string& msg ) : std::runtime_error( msg ) {}
+};
+
+
+/// Тип исключения, генерируемый при переполнении журнала неотправленных сообщений
+struct SpoolOverflowError : std::runtime_error
+{
+     SpoolOverflowError( const std::string& msg ) : std::runtime_error( msg ) {}
+};
+
+
+/// @brief Тип исключения, генерируемый при несовпадении контрольной суммы тела полученного сообщения
+/// @note Сообщение не подтверждается; его следует отклонить (SimpleClient::nackMessage(), SimpleClient::failMessage())
+struct IntegrityError : std::runtime_error
+{
+     IntegrityError( const std::string& msg, std::uint64_t tag ) : std::runtime_error( msg ), deliveryTag( tag ) {}
+
+     std::uint64_t deliveryTag;    ///< идентификатор доставки искаженного сообщения
+};
+
+
+/// @brief Тип исключения, генерируемый при получении сообщения-ссылки, тело которого недоступно: сегмент
+/// разделяемой памяти не существует (например, сообщение получено на другом узле) или поврежден (см. ClaimCheck)
+/// @note Сообщение не подтверждается; его следует отклонить (SimpleClient::nackMessage(), SimpleClient::failMessage())
+struct ClaimCheckError : IntegrityError
+{
+     ClaimCheckError( const std::string& msg, std::uint64_t tag ) : IntegrityError( msg, tag ) {}
+};
+
+
+/// @brief Тип исключения, генерируемый при получении сообщения, тело которого не соответствует кодеку типа
+/// (SimpleClient::consume()): другой content_type или неразбираемое тело
+/// @note Сообщение не подтверждается; его следует отклонить (SimpleClient::rejectMessage(), SimpleClient::failMessage())
+struct CodecError : std::runtime_error
+{
+     CodecError( const std::string& msg, std::uint64_t tag ) : std::runtime_error( msg ), deliveryTag( tag ) {}
+
+     std::uint64_t deliveryTag;    ///< идентификатор доставки сообщения
+};
+
+
 void ensureNoErrors( int status, const std::string& context );
 
 
@@ -0,0 +1,166 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/optional/optional.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <rabbitmq_client/simple_client.h>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+
+/// @brief Подписчик нескольких очередей одного соединения с взвешенным справедливым распределением сообщений
+/// @details SimpleClient::consumeMessage() возвращает доставки в порядке их поступления в канал, поэтому
+/// очередь с большим потоком сообщений задерживает сообщения малонагруженной очереди. FairConsumer подписывается
+/// на все очереди в канале 1 одного соединения, раскладывает принятые доставки по буферам очередей и выдает их
+/// в порядке, определяемом на стороне клиента:
+/// - очереди с большим приоритетом (Queue::priority) обслуживаются первыми: сообщение очереди с меньшим
+/// приоритетом выдается, только если в буферах очередей с большим приоритетом сообщений нет;
+/// - очереди с одинаковым приоритетом обслуживаются циклически с учетом дефицита (deficit round-robin):
+/// на очередном круге очередь получает Parameters::quantum * Queue::weight байт и выдает сообщения, пока
+/// их суммарный размер не превышает накопленный дефицит. Доля очереди в объеме выдаваемых сообщений
+/// пропорциональна ее весу независимо от размеров сообщений.
+///
+/// Объем буферов ограничен ограничениями prefetchCount подписок (basic.qos для каждой подписки). Ограничение
+/// очереди с большим потоком определяет, сколько ее сообщений может находиться в сокете перед сообщением
+/// срочной очереди: при наличии очередей, чувствительных к задержкам, ограничения остальных очередей следует
+/// задавать небольшими. Если ограничение очереди не задано, общее Parameters::prefetchBudget распределяется между
+/// очередями пропорционально весам.
+///
+/// @code
+/// FairConsumer::Parameters params;
+/// params.queues.push_back( FairConsumer::Queue( "urgent" ).withPriority( 1 ) );
+/// params.queues.push_back( FairConsumer::Queue( "bulk" ).withWeight( 4 ).withPrefetch( 50 ) );
+/// FairConsumer consumer( connectionParams, params );
+/// while( const auto delivery = consumer.consume( boost::posix_time::seconds( 1 ) ) )
+/// {
+///      handle( consumer.queueOf( *delivery ), delivery->body() );
+///      consumer.ack( *delivery );
+/// }
+/// @endcode
+///
+/// @note Методы класса не являются потокобезопасными
+class FairConsumer
+{
+public:
+     /// Параметры подписки на очередь
+     struct Queue
+     {
+          explicit Queue( const std::string& queue )
+               : queueName( queue )
+          {}
+
+          Queue& withWeight( std::uint32_t w ) { weight = w; return *this; }
+          Queue& withPriority( std::int32_t p ) { priority = p; return *this; }
+          Queue& withPrefetch( std::uint16_t count ) { prefetchCount = count; return *this; }
+
+          std::string queueName;
+          std::uint32_t weight = 1;                           ///< доля очереди среди очередей того же приоритета
+          std::int32_t priority = 0;                          ///< приоритет обслуживания (больше - раньше)
+          boost::optional< std::uint16_t > prefetchCount;     ///< ограничение неподтвержденных сообщений очереди
+     };
+
+     /// Параметры подписчика
+     struct Parameters
+     {
+          Parameters()
+               : quantum( 16 * 1024 )
+               , prefetchBudget( 1000 )
+          {}
+
+          std::vector< Queue > queues;
+          std::size_t quantum;                 ///< объем сообщений, выдаваемый очереди единичного веса за круг, байт
+          std::size_t prefetchBudget;          ///< ограничение prefetchCount, распределяемое по весам
+     };
+
+     /// @brief Устанавливает соединение и подписывается на очереди
+     /// @throw std::invalid_argument если не заданы очереди, вес очереди или квант равен нулю
+     /// @throw ConnectionError в случае если все попытки подключения закончились неудачей
+     /// @throw std::runtime_error если подписка на очередь отклонена брокером
+     FairConsumer( const Connection::Parameters&, const Parameters& );
+
+     FairConsumer( const FairConsumer& ) = delete;
+     FairConsumer& operator=( const FairConsumer& ) = delete;
+
+     /// @brief Получает следующее по расписанию сообщение
+     /// @details Перед выбором забирает из соединения все уже принятые доставки; ожидание (не дольше @a timeout)
+     /// выполняется, только если буферы всех очередей пусты. При разрыве соединения переподключается:
+     /// сообщения буферов и неподтвержденные сообщения брокер доставит повторно.
+     /// @return boost::none при таймауте
+     /// @throw ConnectionError в случае если все попытки переподключения закончились неудачей
+     boost::optional< Delivery > consume( const boost::optional< boost::posix_time::time_duration >& timeout = boost::none );
+
+     /// Имя очереди, из которой получено сообщение
+     const std::string& queueOf( const Delivery& delivery ) const;
+
+     /// @brief Подтверждает сообщение
+     /// @details При разрыве соединения переподключается и передает ошибку: идентификаторы доставки прежнего
+     /// соединения недействительны, сообщение будет доставлено повторно
+     /// @throw ConnectionError также для доставки, полученной до переподключения (в том числе выполненного
+     /// внутри consume()): ее идентификатор в новом канале относится к другому сообщению
+     void ack( const Delivery& delivery );
+
+     /// @see ack()
+     void nack( const Delivery& delivery, bool requeue = true );
+
+     /// Кол-во сообщений в буферах очередей
+     std::size_t buffered() const;
+
+     /// Переподключается и заново подписывается на очереди; содержимое буферов отбрасывается
+     void reconnect();
+
+private:
+     /// Состояние очереди в расписании
+     struct State
+     {
+          std::deque< Delivery > buffer;
+          std::size_t deficit = 0;      ///< объем, который очередь еще может выдать на текущем круге
+          bool inTurn = false;          ///< дефицит текущего круга начислен
+     };
+
+     /// Очереди одного приоритета в порядке кругового обхода
+     struct Level
+     {
+          std::vector< std::size_t > queues;
+          std::size_t cursor = 0;
+     };
+
+     /// Подписывается на все очереди одним обменом с брокером (Topology)
+     void subscribe();
+
+     /// Раскладывает по буферам доставки, уже принятые из соединения
+     void collect();
+
+     /// Помещает доставку в буфер очереди ее подписки, отмечая ее номером текущего соединения
+     void enqueue( Delivery&& delivery );
+
+     /// Проверяет, что доставка получена в текущем соединении
+     void ensureCurrent( const Delivery& delivery ) const;
+
+     /// Выбирает следующее сообщение по расписанию (boost::none, если буферы пусты)
+     boost::optional< Delivery > schedule();
+
+     const Parameters params_;
+     Connection connection_;
+
+     std::vector< std::uint16_t > prefetch_;
+     std::vector< State > states_;
+     std::vector< Level > levels_;         ///< по убыванию приоритета
+     std::unordered_map< std::string, std::size_t > tags_;
+     std::uint64_t epoch_ = 1;             ///< номер соединения, увеличивается при каждом переподключении
+};
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
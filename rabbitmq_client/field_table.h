@@ -0,0 +1,66 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+#include <amqp.h>
+#include <rabbitmq_client/delivery.h>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+
+/// @brief Таблица полей AMQP (аргументы объявления очередей и подписок, заголовки сообщений)
+/// @details Хранит значения в типах C++ (HeaderValue) и формирует по ним структуру amqp_table_t
+/// библиотеки rabbitmq-c. Соответствие типов: bool - boolean, std::int64_t - long ('l'),
+/// std::uint64_t - unsigned long ('L'), double - double, std::string - длинная строка ('S'),
+/// HeaderTable - вложенная таблица, HeaderArray - массив.
+///
+/// @note Для аргументов брокера RabbitMQ целые числа следует передавать как std::int64_t.
+class FieldTable
+{
+public:
+     FieldTable() = default;
+     FieldTable( const FieldTable& rhs );
+     FieldTable& operator=( const FieldTable& rhs );
+
+     /// Устанавливает (или заменяет) значение поля @a key
+     FieldTable& set( const std::string& key, const HeaderValue::Value& value );
+
+     /// Устанавливает (или заменяет) значение поля @a key типа timestamp ('T'): время в секундах от начала эпохи UNIX
+     FieldTable& setTimestamp( const std::string& key, std::uint64_t seconds );
+
+     /// Возвращает true, если таблица пуста
+     bool empty() const { return fields_.empty(); }
+
+     /// @brief Возвращает таблицу в формате rabbitmq-c
+     /// @attention Результат ссылается на данные объекта и действителен до его изменения, уничтожения
+     /// или следующего вызова native()
+     amqp_table_t native() const;
+
+private:
+     void encode( const HeaderValue& value, amqp_field_value_t& out ) const;
+     amqp_table_t encodeTable( const std::vector< std::pair< const std::string*, const HeaderValue* > >& fields ) const;
+
+     std::vector< std::pair< std::string, HeaderValue > > fields_;
+
+     /// Имена полей верхнего уровня, передаваемых как timestamp
+     std::vector< std::string > timestamps_;
+
+     /// Хранилища элементов таблиц и массивов rabbitmq-c, формируемых в native()
+     mutable std::deque< std::vector< amqp_table_entry_t > > tables_;
+     mutable std::deque< std::vector< amqp_field_value_t > > arrays_;
+};
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
@@ -0,0 +1,41 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <boost/utility/string_ref.hpp>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+
+/// @brief Контроль целостности тела сообщения
+/// @details Контрольная сумма CRC-32C (Castagnoli) тела сообщения передается в заголовке x-crc32c
+/// и проверяется получателем. Позволяет обнаружить искажение данных между публикующей и получающей
+/// сторонами (например, неисправным прокси), которое не обнаруживается на уровне TCP.
+///
+/// На процессорах x86-64 с поддержкой SSE4.2 сумма вычисляется инструкцией crc32 (несколько ГБ/с на ядро),
+/// иначе - табличным алгоритмом (slicing-by-8). Реализация выбирается один раз при первом вызове.
+///
+/// @see SimpleClient::setIntegrityCheck()
+struct Integrity
+{
+     /// Имя заголовка с контрольной суммой
+     static const char* const HEADER;
+
+     /// @brief Вычисляет CRC-32C @a data
+     /// @param crc сумма предшествующих данных (для вычисления по частям)
+     static std::uint32_t crc32c( boost::string_ref data, std::uint32_t crc = 0 );
+
+     /// Возвращает true, если используется аппаратное вычисление суммы
+     static bool hardwareAccelerated();
+};
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
@@ -0,0 +1,68 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+
+/// @brief Файл фиксированного размера, отображенный в память процесса
+/// @details Файл создается при отсутствии и расширяется до размера @a size. Если файл уже существует и его
+/// размер больше или равен @a size, содержимое файла сохраняется (используется для восстановления состояния
+/// после перезапуска процесса).
+///
+/// В режиме Mode::ReadOnly файл открывается только для чтения (O_RDONLY, PROT_READ): он не создается и не
+/// расширяется, а запись в отображенную область недопустима.
+class MappedFile
+{
+public:
+     /// Режим доступа к файлу
+     enum class Mode
+     {
+          ReadWrite,     ///< создает и расширяет файл при необходимости
+          ReadOnly       ///< файл должен существовать и иметь размер не меньше @a size
+     };
+
+     /// @throw std::runtime_error в случае ошибок открытия или отображения файла, а также если в режиме
+     /// Mode::ReadOnly файл меньше @a size
+     MappedFile( const std::string& path, std::size_t size, Mode mode = Mode::ReadWrite );
+     ~MappedFile();
+
+     MappedFile( const MappedFile& ) = delete;
+     MappedFile& operator=( const MappedFile& ) = delete;
+
+     /// Возвращает указатель на начало отображенной области
+     char* data() const { return data_; }
+
+     /// Возвращает размер отображенной области
+     std::size_t size() const { return size_; }
+
+     /// Возвращает путь к файлу
+     const std::string& path() const { return path_; }
+
+     /// Возвращает true, если файл был создан (или расширен) при открытии, т.е. его содержимое не инициализировано
+     bool created() const { return created_; }
+
+     /// Синхронно сбрасывает изменения на диск
+     /// @throw std::runtime_error в случае ошибки
+     void flush();
+
+private:
+     std::string path_;
+     std::size_t size_ = 0;
+     int fd_ = -1;
+     char* data_ = nullptr;
+     bool created_ = false;
+};
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
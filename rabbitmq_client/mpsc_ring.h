@@ -0,0 +1,122 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <boost/throw_exception.hpp>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+
+/// @brief Ограниченная неблокирующая очередь с множеством писателей и одним читателем (MPSC)
+/// @details Кольцевой буфер ячеек с порядковыми номерами (схема Д. Вьюкова): писатели захватывают ячейку
+/// атомарным увеличением позиции записи, а готовность ячейки публикуется через ее порядковый номер,
+/// поэтому ни писатели, ни читатель не используют блокировок. Позиции записи и чтения разнесены
+/// по разным строкам кэша.
+///
+/// @note Метод pop() должен вызываться только из одного потока
+template< typename T >
+class MpscRing
+{
+public:
+     /// @param capacity емкость очереди, должна быть степенью двойки
+     explicit MpscRing( std::size_t capacity )
+          : cells_( new Cell[ capacity ] )
+          , mask_( capacity - 1 )
+          , enqueuePos_( 0 )
+     {
+          if( capacity < 2 || ( capacity & mask_ ) != 0 )
+          {
+               BOOST_THROW_EXCEPTION( std::runtime_error( "ring capacity must be a power of two" ) );
+          }
+          for( std::size_t i = 0; i < capacity; ++i )
+          {
+               cells_[ i ].sequence.store( i, std::memory_order_relaxed );
+          }
+     }
+
+     MpscRing( const MpscRing& ) = delete;
+     MpscRing& operator=( const MpscRing& ) = delete;
+
+     /// Помещает @a value в очередь. Возвращает false (не изменяя @a value), если очередь заполнена
+     bool push( T& value )
+     {
+          auto pos = enqueuePos_.load( std::memory_order_relaxed );
+          Cell* cell = nullptr;
+
+          while( true )
+          {
+               cell = &cells_[ pos & mask_ ];
+               const auto seq = cell->sequence.load( std::memory_order_acquire );
+               const auto diff = static_cast< std::intptr_t >( seq ) - static_cast< std::intptr_t >( pos );
+
+               if( diff == 0 )
+               {
+                    if( enqueuePos_.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) )
+                    {
+                         break;
+                    }
+               }
+               else if( diff < 0 )
+               {
+                    return false;
+               }
+               else
+               {
+                    pos = enqueuePos_.load( std::memory_order_relaxed );
+               }
+          }
+
+          cell->value = std::move( value );
+          cell->sequence.store( pos + 1, std::memory_order_release );
+          return true;
+     }
+
+     /// Извлекает элемент из очереди в @a value. Возвращает false, если очередь пуста
+     bool pop( T& value )
+     {
+          auto& cell = cells_[ dequeuePos_ & mask_ ];
+          if( cell.sequence.load( std::memory_order_acquire ) != dequeuePos_ + 1 )
+          {
+               return false;
+          }
+
+          value = std::move( cell.value );
+          cell.sequence.store( dequeuePos_ + mask_ + 1, std::memory_order_release );
+          ++dequeuePos_;
+          return true;
+     }
+
+     /// Возвращает true, если очередь пуста (только для потока-читателя)
+     bool empty() const
+     {
+          return cells_[ dequeuePos_ & mask_ ].sequence.load( std::memory_order_acquire ) != dequeuePos_ + 1;
+     }
+
+private:
+     struct Cell
+     {
+          std::atomic< std::size_t > sequence;
+          T value;
+     };
+
+     std::unique_ptr< Cell[] > cells_;
+     const std::size_t mask_;
+
+     alignas( 64 ) std::atomic< std::size_t > enqueuePos_;
+     alignas( 64 ) std::size_t dequeuePos_ = 0;
+};
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
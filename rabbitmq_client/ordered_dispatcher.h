@@ -0,0 +1,161 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/optional/optional.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <rabbitmq_client/simple_client.h>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+
+/// @brief Параллельная обработка сообщений с сохранением порядка внутри ключа
+/// @details Сообщения распределяются по полосам (lanes) - рабочим потокам с собственной очередью - по хешу
+/// ключа: ключа маршрутизации, значения заголовка или префикса message_id. Сообщения одного ключа
+/// (например, одного счета) всегда попадают в одну полосу и обрабатываются строго по порядку, а сообщения
+/// разных ключей обрабатываются параллельно.
+///
+/// Получение сообщений и подтверждения выполняет поток, вызывающий poll() (SimpleClient не потокобезопасен).
+/// Полосы завершают обработку в произвольном порядке, поэтому подтверждения объединяются: одно подтверждение
+/// с флагом multiple отправляется для наибольшего идентификатора доставки, все предшествующие которому
+/// сообщения уже обработаны. Сообщения, обработка которых завершилась ошибкой, до этого по отдельности
+/// передаются в SimpleClient::failMessage().
+///
+/// Пример кода
+/// @code
+/// OrderedDispatcher::Parameters params;
+/// params.key = OrderedDispatcher::KeySource::Header;
+/// params.header = "account";
+///
+/// OrderedDispatcher dispatcher( client, []( Delivery& delivery ){ return process( delivery.body() ); }, params );
+/// while( !client.stopRequested() )
+/// {
+///      dispatcher.poll( boost::posix_time::milliseconds( 50 ) );
+/// }
+/// dispatcher.finish();
+/// @endcode
+///
+/// @note prefetchCount подписки должен превышать кол-во полос, иначе параллельность ограничивается брокером
+class OrderedDispatcher
+{
+public:
+     /// Источник ключа упорядочения
+     enum class KeySource
+     {
+          RoutingKey,       ///< ключ маршрутизации
+          Header,           ///< значение заголовка Parameters::header
+          MessageIdPrefix   ///< часть message_id до первого символа Parameters::delimiter
+     };
+
+     /// Параметры распределения
+     struct Parameters
+     {
+          Parameters()
+               : lanes( 4 ), laneCapacity( 256 ), key( KeySource::RoutingKey ), delimiter( ':' )
+          {}
+
+          std::size_t lanes;             ///< кол-во полос (рабочих потоков)
+          std::size_t laneCapacity;      ///< максимальная длина очереди полосы
+          KeySource key;                 ///< источник ключа
+          std::string header;            ///< имя заголовка (для KeySource::Header)
+          char delimiter;                ///< разделитель префикса (для KeySource::MessageIdPrefix)
+     };
+
+     /// @brief Обработчик сообщения; вызывается в потоке полосы
+     /// @return true при успешной обработке; false (или исключение) - сообщение передается в SimpleClient::failMessage()
+     typedef std::function< bool( Delivery& ) > Handler;
+
+     /// Конструктор. Запускает потоки полос
+     /// @throw std::invalid_argument при нулевом кол-ве полос или ёмкости полосы
+     OrderedDispatcher( SimpleClient& client, const Handler& handler, const Parameters& = Parameters() );
+
+     /// Останавливает потоки полос; необработанные сообщения не подтверждаются и будут доставлены повторно
+     ~OrderedDispatcher();
+
+     OrderedDispatcher( const OrderedDispatcher& ) = delete;
+     OrderedDispatcher& operator=( const OrderedDispatcher& ) = delete;
+
+     /// @brief Получает одно сообщение (с ожиданием не дольше @a timeout), передает его в полосу и отправляет
+     /// подтверждения обработанных сообщений
+     /// @details Если очередь полосы заполнена, ожидает освобождения места, продолжая отправлять подтверждения.
+     /// Задержка подтверждений не превышает @a timeout, поэтому его следует выбирать небольшим.
+     /// @return true, если сообщение было получено
+     /// @throw ConnectionError в случае ошибок соединения
+     bool poll( const boost::posix_time::time_duration& timeout );
+
+     /// Передает полученное сообщение в полосу его ключа
+     void dispatch( Delivery&& delivery );
+
+     /// @brief Отправляет подтверждения обработанных сообщений, возвращает кол-во подтвержденных сообщений
+     /// @details Если SimpleClient::failMessage() завершается исключением, оно передается вызывающей стороне,
+     /// а еще не учтенные завершения сохраняются и обрабатываются следующим вызовом settle() или finish()
+     std::size_t settle();
+
+     /// Ожидает обработки всех переданных сообщений и отправляет подтверждения
+     void finish();
+
+     /// Кол-во сообщений, переданных в полосы, но еще не подтвержденных
+     std::size_t outstanding() const { return outstanding_.size(); }
+
+private:
+     /// Результат обработки сообщения полосой
+     struct Completion
+     {
+          std::uint64_t deliveryTag;
+          boost::optional< Delivery > failed;     ///< сообщение, обработка которого завершилась ошибкой
+     };
+
+     /// Полоса: очередь сообщений и обрабатывающий ее поток
+     struct Lane
+     {
+          std::deque< Delivery > queue;
+          boost::condition_variable ready;
+          boost::thread thread;
+     };
+
+     /// Возвращает ключ упорядочения сообщения
+     std::string keyOf( const Delivery& delivery ) const;
+
+     /// Тело потока полосы
+     void run( Lane& lane );
+
+     SimpleClient& client_;
+     const Handler handler_;
+     const Parameters params_;
+
+     boost::mutex mutex_;
+     boost::condition_variable completed_;
+     std::vector< std::unique_ptr< Lane > > lanes_;
+     std::deque< Completion > completions_;
+     bool stop_ = false;
+
+     /// Состояние переданного в полосу сообщения
+     enum class State
+     {
+          Pending,     ///< обрабатывается
+          Processed,   ///< обработано, ожидает подтверждения
+          Failed       ///< обработка завершилась ошибкой, сообщение уже передано в SimpleClient::failMessage()
+     };
+
+     /// Переданные в полосы неподтвержденные сообщения в порядке доставки
+     std::deque< std::pair< std::uint64_t, State > > outstanding_;
+};
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
@@ -0,0 +1,194 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/chrono/system_clocks.hpp>
+#include <boost/optional/optional.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/utility/string_ref.hpp>
+#include <rabbitmq_client/simple_client.h>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+
+/// @brief Упаковка нескольких записей в одно сообщение AMQP
+/// @details Формат тела пакета (целые числа - little-endian):
+/// @code
+/// "RMQP" | uint32 кол-во записей | { uint32 длина записи | байты записи } ...
+/// @endcode
+/// Пакет дополнительно помечается заголовком x-packed (кол-во записей), по которому его можно отличить
+/// от обычного сообщения без разбора тела.
+struct Packing
+{
+     /// Имя заголовка-признака пакета
+     static const char* const HEADER;
+
+     /// Размер заголовка тела пакета
+     static const std::size_t PREFIX_SIZE = 8;
+
+     /// Размер служебных данных одной записи
+     static const std::size_t RECORD_OVERHEAD = 4;
+
+     /// Начинает новый пакет в @a body
+     static void begin( std::string& body );
+
+     /// Дописывает запись в пакет и обновляет кол-во записей
+     static void append( std::string& body, boost::string_ref record );
+
+     /// Удаляет из пакета последнюю запись размером @a recordSize (отменяет append())
+     static void dropLast( std::string& body, std::size_t recordSize );
+
+     /// @brief Разбирает тело пакета на записи (без копирования)
+     /// @return false, если @a body не является корректным пакетом
+     static bool unpack( boost::string_ref body, std::vector< boost::string_ref >& records );
+};
+
+
+/// @brief Публикатор, упаковывающий множество небольших записей в одно сообщение
+/// @details Записи накапливаются отдельно для каждой пары (exchange, routing key) и публикуются одним сообщением,
+/// когда пакет достигает ограничения по объему или кол-ву записей либо когда с момента добавления первой записи
+/// пакета проходит время ожидания (linger). Таким образом расходы на кадры AMQP и маршрутизацию в брокере
+/// делятся на все записи пакета ценой задержки не более linger.
+///
+/// Пакеты по времени ожидания публикует фоновый поток; при ошибке публикации пакет сохраняется
+/// и публикуется повторно. Методы класса потокобезопасны.
+///
+/// @see PackedBatch - получение записей пакета
+class PackingPublisher
+{
+public:
+     /// Параметры упаковки
+     struct Parameters
+     {
+          Parameters()
+               : maxBytes( 128 * 1024 ), maxRecords( 1024 ), linger( boost::chrono::milliseconds( 5 ) )
+          {}
+
+          std::size_t maxBytes;                   ///< максимальный объем тела пакета, байт
+          std::size_t maxRecords;                 ///< максимальное кол-во записей в пакете
+          boost::chrono::microseconds linger;     ///< максимальное время ожидания заполнения пакета
+     };
+
+     /// Конструктор. Устанавливает соединение и запускает фоновый поток
+     /// @throw ConnectionError в случае если все попытки подключения закончились неудачей
+     PackingPublisher( const Connection::Parameters&, const Parameters& = Parameters() );
+
+     /// Публикует накопленные пакеты и останавливает фоновый поток
+     ~PackingPublisher();
+
+     PackingPublisher( const PackingPublisher& ) = delete;
+     PackingPublisher& operator=( const PackingPublisher& ) = delete;
+
+     /// @brief Добавляет запись в пакет для (@a exchange, @a routingKey)
+     /// @details Если запись не помещается в текущий пакет, пакет предварительно публикуется в вызывающем потоке.
+     /// Запись, превышающая maxBytes, публикуется отдельным пакетом.
+     /// @throw ConnectionError в случае ошибки публикации заполненного пакета (запись при этом не добавляется)
+     void publish( const std::string& exchange, const std::string& routingKey, boost::string_ref record );
+
+     /// Публикует все накопленные пакеты
+     /// @throw ConnectionError в случае ошибки публикации (неопубликованные пакеты сохраняются)
+     void flush();
+
+private:
+     typedef boost::chrono::steady_clock Clock;
+     typedef std::pair< std::string, std::string > Destination;
+
+     /// Накапливаемый пакет
+     struct Batch
+     {
+          std::string body;
+          std::size_t records = 0;
+          Clock::time_point opened;
+     };
+
+     /// Публикует пакет и очищает его; вызывается под mutex_
+     void publishBatch( const Destination& destination, Batch& batch );
+
+     /// Тело фонового потока
+     void run();
+
+     const Parameters params_;
+     Connection connection_;
+
+     boost::mutex mutex_;
+     boost::condition_variable wakeup_;
+     std::map< Destination, Batch > batches_;
+     bool stop_ = false;
+
+     boost::thread worker_;
+};
+
+
+/// @brief Полученный пакет записей
+/// @details Разбирает тело сообщения на записи без копирования. Сообщение, не являющееся пакетом,
+/// представляется пакетом из одной записи, поэтому получатель может обрабатывать упакованные и обычные
+/// сообщения одинаково.
+///
+/// Подтверждение выполняется для пакета целиком. Если часть записей обработать не удалось, settle()
+/// повторно публикует только их (отдельным пакетом) и после этого подтверждает исходное сообщение.
+class PackedBatch
+{
+public:
+     /// Разбирает сообщение, полученное SimpleClient::consumeMessage()
+     explicit PackedBatch( SimpleClient::Envelope&& envelope );
+
+     /// Разбирает сообщение, полученное SimpleClient::consumeDelivery()
+     explicit PackedBatch( Delivery&& delivery );
+
+     PackedBatch( const PackedBatch& ) = delete;
+     PackedBatch& operator=( const PackedBatch& ) = delete;
+
+     /// Идентификатор доставки сообщения (для подтверждения)
+     std::uint64_t deliveryTag() const { return deliveryTag_; }
+
+     /// Возвращает true, если сообщение является пакетом
+     bool packed() const { return packed_; }
+
+     /// Кол-во записей
+     std::size_t size() const { return records_.size(); }
+
+     /// Запись с индексом @a index (действительна, пока жив объект)
+     boost::string_ref operator[]( std::size_t index ) const { return records_[ index ]; }
+
+     std::vector< boost::string_ref >::const_iterator begin() const { return records_.begin(); }
+     std::vector< boost::string_ref >::const_iterator end() const { return records_.end(); }
+
+     /// @brief Завершает обработку пакета
+     /// @details Записи с индексами @a failed публикуются одним пакетом в (@a retryExchange, @a retryRoutingKey),
+     /// затем пакет подтверждается. Если повторная публикация не удалась, пакет не подтверждается и будет
+     /// доставлен повторно целиком.
+     /// @note При сбое между повторной публикацией и подтверждением неудачные записи будут доставлены дважды
+     /// @throw ConnectionError в случае ошибок соединения
+     void settle(
+          SimpleClient& client,
+          const std::vector< std::size_t >& failed,
+          const std::string& retryExchange,
+          const std::string& retryRoutingKey
+     ) const;
+
+private:
+     void parse( boost::string_ref body );
+
+     std::uint64_t deliveryTag_;
+     std::string message_;
+     boost::optional< Delivery > delivery_;
+     std::vector< boost::string_ref > records_;
+     bool packed_ = false;
+};
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
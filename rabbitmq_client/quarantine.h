@@ -0,0 +1,86 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <rabbitmq_client/delivery.h>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+
+/// @brief Политика обработки сообщений, обработка которых завершается ошибкой (poison messages)
+/// @details Считает попытки доставки сообщения и по их кол-ву решает, вернуть ли сообщение в очередь
+/// или перенаправить в очередь-карантин (parking queue), где оно не мешает обработке остальных сообщений.
+///
+/// Номер попытки определяется как наибольшее из:
+/// - суммы счетчиков count заголовка x-death плюс один (сообщение возвращается в очередь через dead letter
+///   exchange, например при requeue = false и настроенной для очереди схеме повторов);
+/// - кол-ва неудачных попыток, учтенных этим объектом для того же сообщения;
+/// - двух, если сообщение помечено брокером как повторно доставленное (redelivered).
+///
+/// Сообщение идентифицируется по message_id, а при его отсутствии - по хешу ключа маршрутизации и тела.
+/// Учет неудачных попыток ведется в памяти процесса и ограничен Parameters::trackedMessages сообщениями.
+///
+/// @see SimpleClient::failMessage()
+class QuarantinePolicy
+{
+public:
+     /// Действие над сообщением, обработка которого завершилась ошибкой
+     enum class Action
+     {
+          Requeue,      ///< вернуть в очередь (basic.nack, requeue = true)
+          DeadLetter,   ///< отклонить без возврата в очередь (basic.nack, requeue = false): сообщение уходит в DLX очереди
+          Park          ///< опубликовать в очередь-карантин и подтвердить
+     };
+
+     /// Параметры политики
+     struct Parameters
+     {
+          Parameters()
+               : maxAttempts( 5 ), parkingExchange( "" ), parkingRoutingKey( "parking" ), requeue( true ), trackedMessages( 65536 )
+          {}
+
+          std::uint32_t maxAttempts;          ///< кол-во попыток, после которого сообщение помещается в карантин
+          std::string parkingExchange;        ///< точка публикации карантина
+          std::string parkingRoutingKey;      ///< ключ маршрутизации (или имя очереди) карантина
+          bool requeue;                       ///< до помещения в карантин возвращать сообщение в очередь (иначе - в DLX)
+          std::size_t trackedMessages;        ///< максимальное кол-во сообщений, попытки которых учитываются в памяти
+     };
+
+     /// Имена заголовков, добавляемых к сообщению при помещении в карантин
+     static const char* const ATTEMPTS_HEADER;
+     static const char* const REASON_HEADER;
+     static const char* const EXCHANGE_HEADER;
+     static const char* const ROUTING_KEY_HEADER;
+
+     explicit QuarantinePolicy( const Parameters& = Parameters() );
+
+     const Parameters& parameters() const { return params_; }
+
+     /// Номер текущей попытки доставки сообщения (начиная с 1)
+     std::uint32_t attempts( const Delivery& delivery ) const;
+
+     /// Учитывает неудачную попытку обработки и возвращает действие над сообщением
+     Action onFailure( const Delivery& delivery );
+
+     /// Забывает о неудачных попытках успешно обработанного сообщения
+     void onSuccess( const Delivery& delivery );
+
+private:
+     std::string key( const Delivery& delivery ) const;
+
+     const Parameters params_;
+     std::unordered_map< std::string, std::uint32_t > failures_;
+};
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
@@ -0,0 +1,70 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#pragma once
+
+#include <algorithm>
+#include <boost/chrono/system_clocks.hpp>
+#include <boost/thread/lock_guard.hpp>
+#include <boost/thread/mutex.hpp>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+
+/// @brief Ограничитель скорости публикации (token bucket), подстраивающийся под нагрузку на брокер
+/// @details Разрешения на публикацию накапливаются со скоростью текущего лимита, но не более емкости корзины.
+/// Когда брокер сообщает о блокировке соединения (connection.blocked, срабатывание memory или disk alarm),
+/// текущий лимит уменьшается вдвое (но не ниже минимального), а накопленные разрешения сбрасываются.
+/// После снятия блокировки лимит линейно восстанавливается до максимального.
+///
+/// Методы класса потокобезопасны, поэтому один ограничитель может использоваться несколькими клиентами.
+class PublishRateLimiter
+{
+public:
+     /// Параметры ограничителя
+     struct Parameters
+     {
+          explicit Parameters( double rate )
+               : maxRate( rate ), minRate( rate / 100 ), burst( std::max( 1.0, rate / 10 ) ), recovery( rate / 10 )
+          {}
+
+          double maxRate;     ///< максимальная скорость публикации, сообщений в секунду
+          double minRate;     ///< минимальная скорость, до которой снижается лимит при блокировках
+          double burst;       ///< емкость корзины (допустимый всплеск), сообщений
+          double recovery;    ///< скорость восстановления лимита после снятия блокировки, сообщений в секунду за секунду
+     };
+
+     explicit PublishRateLimiter( const Parameters& );
+
+     /// Забирает разрешение на публикацию @a count сообщений. Возвращает false, если разрешений недостаточно
+     bool tryAcquire( double count = 1 );
+
+     /// Сообщает ограничителю об изменении состояния блокировки соединения брокером
+     void setBrokerBlocked( bool blocked );
+
+     /// Возвращает текущий лимит скорости, сообщений в секунду
+     double currentRate() const;
+
+private:
+     typedef boost::chrono::steady_clock Clock;
+
+     /// Начисляет разрешения и восстанавливает лимит за время, прошедшее с предыдущего вызова
+     void refill( Clock::time_point now );
+
+     const Parameters params_;
+
+     mutable boost::mutex mutex_;
+     double rate_;
+     double tokens_;
+     bool blocked_ = false;
+     Clock::time_point last_;
+};
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
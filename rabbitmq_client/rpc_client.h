@@ -0,0 +1,136 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <future>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <amqp.h>
+#include <rabbitmq_client/simple_client.h>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+
+/// @brief Клиент для вызовов вида запрос-ответ поверх псевдо-очереди amq.rabbitmq.reply-to (direct reply-to)
+/// @details Ответы принимаются через псевдо-очередь amq.rabbitmq.reply-to, поэтому на каждый вызов не требуется
+/// объявлять временную очередь: вызов стоит ровно одной публикации запроса и одной доставки ответа.
+/// Ответ сопоставляется с запросом по correlation_id через таблицу ожидающих вызовов, что позволяет
+/// выполнять множество вызовов одновременно. Для каждого вызова задается собственный срок ожидания.
+///
+/// Соединением владеет отдельный поток ввода-вывода: он отправляет запросы, принимает ответы и завершает
+/// просроченные вызовы. Поток ожидает одновременно данных из сокета и сигнала о новых запросах,
+/// поэтому новый запрос отправляется без задержки на опрос.
+///
+/// При разрыве соединения все ожидающие вызовы завершаются исключением ConnectionError, после чего
+/// соединение восстанавливается.
+///
+/// Сервер должен публиковать ответ в точку публикации по умолчанию (пустая строка) с ключом маршрутизации
+/// из свойства reply_to запроса, скопировав в ответ свойство correlation_id.
+///
+/// Методы класса потокобезопасны.
+class RpcClient
+{
+public:
+     /// Конструктор. Устанавливает соединение и подписывается на псевдо-очередь ответов
+     /// @throw ConnectionError в случае если все попытки подключения закончились неудачей
+     /// @throw std::runtime_error во всех остальных случаях
+     explicit RpcClient( const Connection::Parameters& );
+
+     /// Останавливает поток ввода-вывода; незавершенные вызовы получают исключение std::future_error (broken_promise)
+     ~RpcClient();
+
+     RpcClient( const RpcClient& ) = delete;
+     RpcClient& operator=( const RpcClient& ) = delete;
+
+     /// @brief Выполняет асинхронный вызов
+     /// @param exchange точка публикации запроса
+     /// @param routingKey ключ маршрутизации (или имя очереди) запроса
+     /// @param request тело запроса
+     /// @param timeout срок ожидания ответа
+     /// @return future с телом ответа; при истечении срока ожидания содержит исключение TimeoutError,
+     /// при разрыве соединения - ConnectionError
+     std::future< std::string > call(
+          const std::string& exchange,
+          const std::string& routingKey,
+          const std::string& request,
+          const boost::posix_time::time_duration& timeout
+     );
+
+     /// Возвращает кол-во вызовов, ожидающих ответа
+     std::size_t inFlight() const;
+
+private:
+     /// Запрос, ожидающий отправки потоком ввода-вывода
+     struct Request
+     {
+          std::string exchange;
+          std::string routingKey;
+          std::string body;
+          std::string correlationId;
+     };
+
+     /// Сроки ожидания вызовов по возрастанию -> correlation_id
+     typedef std::multimap< boost::posix_time::ptime, std::string > Deadlines;
+
+     /// Вызов, ожидающий ответа
+     struct Call
+     {
+          std::promise< std::string > promise;
+          Deadlines::iterator deadline;      ///< удаляется вместе с вызовом
+     };
+
+     /// Тело потока ввода-вывода
+     void run();
+
+     /// Подписывается на псевдо-очередь ответов
+     void startConsuming();
+
+     /// Отправляет накопленные запросы
+     void sendRequests();
+
+     /// Ожидает данных из сокета, сигнала о новых запросах или ближайшего срока ожидания
+     void waitForActivity();
+
+     /// Принимает все поступившие ответы и завершает соответствующие вызовы
+     void dispatchReplies();
+
+     /// Завершает просроченные вызовы исключением TimeoutError
+     void expireCalls();
+
+     /// Завершает все ожидающие вызовы исключением @a error
+     void failAll( const std::exception_ptr& error );
+
+     /// Пробуждает поток ввода-вывода
+     void wakeup();
+
+     Connection connection_;
+     const std::string idPrefix_;
+
+     mutable boost::mutex mutex_;
+     std::uint64_t nextId_ = 0;
+     std::vector< Request > requests_;
+     std::unordered_map< std::string, Call > calls_;     ///< ожидающие ответа вызовы по correlation_id
+     Deadlines deadlines_;
+
+     int wakeupFd_ = -1;
+     std::atomic< bool > stop_;
+
+     boost::thread worker_;
+};
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
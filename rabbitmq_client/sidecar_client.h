@@ -0,0 +1,146 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/optional/optional.hpp>
+#include <rabbitmq_client/simple_client.h>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+
+/// @brief Клиент, работающий с брокером через локальный мультиплексор (SidecarServer)
+/// @details Повторяет интерфейс SimpleClient для публикации, объявления очередей, подписки, получения
+/// и подтверждения сообщений, поэтому код приложения переводится на мультиплексор заменой типа клиента.
+/// Вместо TCP-соединения с брокером клиент подключается к Unix domain socket мультиплексора, что для
+/// короткоживущих процессов исключает установку соединения, аутентификацию и открытие канала.
+///
+/// Публикации и подтверждения передаются без ожидания ответа. При заданном Parameters::batchBytes они
+/// накапливаются и отправляются одной записью в сокет при заполнении буфера, вызове любого метода,
+/// ожидающего данных от мультиплексора (объявление очереди, подписка, получение сообщений), вызове flush()
+/// и уничтожении клиента. Ошибки их выполнения на стороне мультиплексора генерируются при следующем
+/// вызове метода клиента.
+///
+/// @note В отличие от SimpleClient подписка переживает переподключение мультиплексора к брокеру.
+/// Доступно только тело сообщения (SimpleClient::Envelope), свойства и заголовки сообщения не передаются.
+/// Класс не является потокобезопасным.
+class SidecarClient
+{
+public:
+     /// Параметры клиента
+     struct Parameters
+     {
+          Parameters()
+               : batchBytes( 0 )
+          {}
+
+          std::size_t batchBytes;    ///< объем накапливаемых публикаций и подтверждений, байт (0 - без накопления)
+     };
+
+     /// @brief Подключается к мультиплексору через @a socketPath
+     /// @throw ConnectionError если мультиплексор недоступен
+     explicit SidecarClient( const std::string& socketPath, const Parameters& = Parameters() );
+
+     /// Отправляет накопленные публикации и подтверждения и отключается от мультиплексора
+     ~SidecarClient();
+
+     SidecarClient( const SidecarClient& ) = delete;
+     SidecarClient& operator=( const SidecarClient& ) = delete;
+
+     /// @see SimpleClient::publishMessage()
+     void publishMessage( const std::string& exchange, const std::string& routingKey, const std::string& message );
+
+     /// @see SimpleClient::publishMessage()
+     void publishMessage( const SimpleClient::QueueParameters& params, const std::string& message );
+
+     /// @see SimpleClient::bind()
+     void bind( const std::string& exchange, const std::string& queueName, const std::string& routingKey = "" );
+
+     /// @see SimpleClient::bind()
+     void bind( const SimpleClient::QueueParameters& params );
+
+     /// @see SimpleClient::bind()
+     /// @throw std::invalid_argument если заданы аргументы подписки (arguments) или подписка без подтверждений (noAck),
+     /// не поддерживаемые мультиплексором
+     void bind( const SimpleClient::QueueParameters& params, const SimpleClient::ConsumerParameters& consumer );
+
+     /// @see SimpleClient::declareQueue()
+     /// @throw std::invalid_argument если заданы аргументы объявления (arguments), не поддерживаемые мультиплексором
+     std::string declareQueue( const SimpleClient::QueueDeclaration& declaration );
+
+     /// @see SimpleClient::consumeMessage()
+     boost::optional< SimpleClient::Envelope > consumeMessage(
+          boost::optional< boost::posix_time::time_duration > timeout = boost::none
+     );
+
+     /// @see SimpleClient::consumeMessages()
+     std::size_t consumeMessages(
+          std::vector< SimpleClient::Envelope >& envelopes,
+          std::size_t maxCount,
+          boost::optional< boost::posix_time::time_duration > timeout = boost::none
+     );
+
+     /// @see SimpleClient::ackMessage()
+     void ackMessage( std::uint64_t deliveryTag, bool multiple = false );
+
+     /// @see SimpleClient::nackMessage()
+     void nackMessage( std::uint64_t deliveryTag, bool multiple = false, bool requeue = true );
+
+     /// @see SimpleClient::rejectMessage()
+     void rejectMessage( std::uint64_t deliveryTag, bool requeue = true );
+
+     /// @brief Отправляет накопленные публикации и подтверждения
+     /// @throw ConnectionError в случае разрыва соединения с мультиплексором
+     void flush();
+
+     /// @brief Переподключается к мультиплексору
+     /// @details Подписки и неподтвержденные сообщения прежнего подключения теряются (сообщения возвращаются
+     /// мультиплексором в очередь), как и при SimpleClient::reconnect()
+     void reconnect();
+
+private:
+     void connect();
+
+     /// Дописывает кадр в буфер отправки и отправляет буфер при его заполнении
+     void enqueue( std::size_t frameStart );
+
+     /// Отправляет запрос, ожидает ответ и возвращает строку результата
+     /// @throw std::runtime_error если мультиплексор вернул ошибку
+     std::string request( std::size_t frameStart );
+
+     /// @brief Ожидает доставку не дольше @a timeout (boost::none - без ограничения)
+     /// @return false, если доставок нет
+     bool waitForDelivery( const boost::optional< boost::posix_time::time_duration >& timeout );
+
+     /// @brief Читает из сокета не дольше @a timeoutMs (-1 - без ограничения) и разбирает полученные кадры
+     /// @return false, если данные не получены
+     bool receive( int timeoutMs );
+
+     /// Генерирует ошибку, полученную от мультиплексора кадром Failure
+     void throwFailure();
+
+     const std::string socketPath_;
+     const Parameters params_;
+     int fd_ = -1;
+
+     std::string out_;
+     std::string in_;
+     std::deque< SimpleClient::Envelope > deliveries_;
+     boost::optional< std::string > reply_;
+     boost::optional< std::string > error_;
+     boost::optional< std::string > failure_;
+};
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
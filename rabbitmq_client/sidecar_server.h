@@ -0,0 +1,110 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <rabbitmq_client/simple_client.h>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+
+/// @brief Локальный мультиплексор соединений с брокером (sidecar)
+/// @details Держит небольшое число постоянных соединений с брокером и обслуживает через них локальные процессы,
+/// подключающиеся по Unix domain socket (см. SidecarClient). Процессы не устанавливают собственных TCP-соединений,
+/// не проходят аутентификацию и не открывают каналы, а брокер не испытывает нагрузки от частых подключений
+/// и отключений короткоживущих процессов.
+///
+/// Каждое соединение с брокером обслуживается отдельным потоком, который закрепляется за частью локальных
+/// клиентов (новый клиент назначается наименее загруженному соединению). Поток читает кадры клиентов пачками,
+/// выполняет их на своем соединении и отправляет клиенту накопленные доставки одной записью в сокет.
+///
+/// Подписки клиентов соединения разделяют один канал; идентификаторы доставок транслируются в собственные
+/// идентификаторы клиента, поэтому подтверждение с флагом multiple затрагивает только сообщения этого клиента.
+/// После переподключения к брокеру подписки клиентов восстанавливаются; неподтвержденные до разрыва сообщения
+/// брокер доставляет повторно, а их подтверждения игнорируются. При отключении клиента его подписки отменяются,
+/// а неподтвержденные сообщения возвращаются в очередь.
+///
+/// Доставки, которые клиент не успевает читать, накапливаются в буфере его сокета. Когда объем неотправленных
+/// клиенту данных достигает Parameters::maxPendingBytes, подписки клиента отменяются (сообщения, полученные
+/// после отмены, возвращаются в очередь) и восстанавливаются после отправки клиенту всего буфера. Медленный
+/// клиент не увеличивает память мультиплексора и не задерживает доставки остальным клиентам соединения.
+///
+/// @note Эксклюзивные очереди и очереди с автоудалением принадлежат соединению мультиплексора, а не клиенту:
+/// эксклюзивная очередь существует до разрыва этого соединения, очередь с автоудалением удаляется
+/// после отмены последней подписки на нее (в т.ч. при отключении клиента).
+class SidecarServer
+{
+public:
+     /// Параметры мультиплексора
+     struct Parameters
+     {
+          Parameters()
+               : connections( 2 )
+               , maxPendingBytes( 8 * 1024 * 1024 )
+          {}
+
+          std::size_t connections;          ///< кол-во соединений с брокером
+          std::size_t maxPendingBytes;      ///< объем неотправленных клиенту данных, приостанавливающий его подписки
+     };
+
+     /// Счетчики мультиплексора
+     struct Statistics
+     {
+          std::size_t clients = 0;          ///< подключенных клиентов
+          std::uint64_t published = 0;      ///< опубликовано сообщений
+          std::uint64_t delivered = 0;      ///< доставлено сообщений клиентам
+          std::uint64_t reconnects = 0;     ///< переподключений к брокеру
+     };
+
+     /// @brief Устанавливает соединения с брокером и начинает прием клиентов на @a socketPath
+     /// @details Существующий файл @a socketPath (оставшийся от предыдущего запуска) удаляется
+     /// @throw ConnectionError в случае если подключиться к брокеру не удалось
+     /// @throw std::runtime_error в случае ошибок создания сокета
+     SidecarServer( const std::string& socketPath, const Connection::Parameters&, const Parameters& = Parameters() );
+
+     /// Отключает клиентов, закрывает соединения с брокером и удаляет файл сокета
+     ~SidecarServer();
+
+     SidecarServer( const SidecarServer& ) = delete;
+     SidecarServer& operator=( const SidecarServer& ) = delete;
+
+     /// Принимает подключения клиентов до вызова stop()
+     void run();
+
+     /// @brief Прерывает run()
+     /// @note Может вызываться из другого потока и из обработчика сигнала
+     void stop();
+
+     /// Текущие значения счетчиков
+     Statistics statistics() const;
+
+private:
+     class Upstream;
+
+     /// Доступ к закрытой части соединения для потоков соединений
+     static int socketOf( const Connection& connection );
+     static bool hasBufferedData( const Connection& connection );
+     static std::string consumerTagOf( const Connection& connection );
+
+     /// Отменяет подписку @a consumerTag (basic.cancel)
+     static void cancel( const Connection& connection, const std::string& consumerTag );
+
+     const std::string socketPath_;
+     int listener_ = -1;
+     int stopFd_ = -1;
+     std::vector< std::unique_ptr< Upstream > > upstreams_;
+};
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
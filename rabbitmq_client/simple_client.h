@@ -4,11 +4,21 @@
 
 #pragma once
 
+#include <atomic>
 #include <cstdint>
+#include <exception>
+#include <functional>
 #include <memory>
+#include <unordered_map>
+#include <vector>
 #include <boost/optional/optional.hpp>
 #include <boost/date_time/posix_time/posix_time_duration.hpp>
 #include <amqp.h>
+#include <rabbitmq_client/codec.h>
+#include <rabbitmq_client/delivery.h>
+#include <rabbitmq_client/field_table.h>
+#include <rabbitmq_client/quarantine.h>
+#include <rabbitmq_client/timing_wheel.h>
 
 
 namespace edi {
@@ -16,6 +26,14 @@ namespace ts {
 namespace rabbitmq_client {
 
 
+class ClaimCheck;
+class DeduplicationFilter;
+class PayloadCipher;
+class PublishRateLimiter;
+class SidecarServer;
+class Topology;
+
+
 /// Класс описывает подключение к очереди RabbitMQ
 class Connection
 {
@@ -66,6 +84,17 @@ public:
      /// Инициирует переподключение к очереди посредством вызова метода connect()
      void reconnect();
 
+     /// @brief Возвращает true, если брокер заблокировал соединение (connection.blocked)
+     /// @details Брокер блокирует публикующие соединения при срабатывании memory или disk alarm; публикация
+     /// в заблокированное соединение останавливается на записи в сокет до снятия блокировки.
+     /// Состояние обновляется при получении сообщений, а на соединении без подписки - только вызовом
+     /// SimpleClient::pollConnectionEvents() (его выполняют SimpleClient::tryPublishMessage() и SpoolingPublisher);
+     /// SimpleClient::publishMessage() состояние не обновляет.
+     bool blocked() const;
+
+     /// Возвращает причину блокировки соединения брокером
+     std::string blockedReason() const;
+
 private:
      /// Реализует подключение к очереди
      /// @throw ConnectionError в случае ошибок связанных с сетевым соединением
@@ -78,6 +107,10 @@ private:
      std::unique_ptr< Impl > impl_;
 
      friend class SimpleClient;
+     friend class RpcClient;
+     friend class ConcurrentPublisher;
+     friend class SidecarServer;
+     friend class Topology;
 };
 
 
@@ -88,6 +121,10 @@ private:
 /// Статический интерфейс не обеспечивает попыток переподключения при работе с очередью.
 /// Ряд методов обычного интерфейса обеспечивают перехват исключения при разрыве соединения и инициализируют
 /// попытку переподключения к очереди.
+///
+/// @note Оба интерфейса сохраняются для совместимости. Единый интерфейс без дублирования, настраиваемый на этапе
+/// компиляции, предоставляет BasicClient (basic_client.h): ReliableClient соответствует обычному интерфейсу
+/// без дополнительных возможностей, DirectClient - статическому.
 class SimpleClient
 {
 public:
@@ -108,10 +145,85 @@ public:
           std::string queueName;   ///< имя очереди
      };
 
+     /// Тип очереди (аргумент x-queue-type)
+     enum class QueueType
+     {
+          Classic,  ///< классическая очередь
+          Quorum,   ///< реплицируемая очередь на основе Raft
+          Stream    ///< поток (журнал сообщений с неразрушающим чтением)
+     };
+
+     /// Поведение очереди при достижении ограничения длины (аргумент x-overflow)
+     enum class Overflow
+     {
+          DropHead,          ///< отбрасывать самые старые сообщения
+          RejectPublish,     ///< отклонять новые сообщения
+          RejectPublishDlx   ///< отклонять новые сообщения с передачей их в dead letter exchange
+     };
+
+     /// @brief Структура, описывающая объявление очереди
+     /// @note Реплицируемые очереди и потоки должны быть долговременными, неэксклюзивными и не удаляемыми автоматически
+     struct QueueDeclaration
+     {
+          explicit QueueDeclaration( const std::string& qname )
+               : queueName( qname )
+          {}
+          std::string queueName;                         ///< имя очереди (пустая строка - имя назначается брокером)
+          QueueType type = QueueType::Classic;           ///< тип очереди
+          bool durable = true;                           ///< очередь переживает перезапуск брокера
+          bool exclusive = false;                        ///< очередь доступна только объявившему ее соединению
+          bool autoDelete = false;                       ///< очередь удаляется после отключения последнего подписчика
+          boost::optional< std::int64_t > maxLength;     ///< ограничение кол-ва сообщений (x-max-length)
+          boost::optional< std::int64_t > maxLengthBytes;///< ограничение суммарного объема сообщений (x-max-length-bytes)
+          boost::optional< Overflow > overflow;          ///< поведение при достижении ограничения (x-overflow)
+          bool lazy = false;                             ///< хранить сообщения на диске (x-queue-mode=lazy), только для классических очередей
+          bool singleActiveConsumer = false;             ///< доставлять сообщения только одному подписчику (x-single-active-consumer)
+          FieldTable arguments;                          ///< дополнительные аргументы объявления
+     };
+
+     /// @brief Начальная позиция чтения потока (аргумент подписки x-stream-offset)
+     /// @note Смещение - порядковый номер сообщения в потоке; каждое сообщение потока доставляется
+     /// с заголовком x-stream-offset
+     struct StreamOffset
+     {
+          enum class Kind
+          {
+               First,     ///< с первого сохраненного сообщения
+               Last,      ///< с последнего блока (chunk) сообщений
+               Next,      ///< только новые сообщения
+               Offset,    ///< с сообщения с указанным смещением
+               Timestamp  ///< с первого блока, записанного не раньше указанного времени
+          };
+
+          static StreamOffset first() { return StreamOffset( Kind::First, 0 ); }
+          static StreamOffset last() { return StreamOffset( Kind::Last, 0 ); }
+          static StreamOffset next() { return StreamOffset( Kind::Next, 0 ); }
+          static StreamOffset offset( std::uint64_t offset ) { return StreamOffset( Kind::Offset, offset ); }
+
+          /// @param seconds время в секундах от начала эпохи UNIX
+          static StreamOffset timestamp( std::uint64_t seconds ) { return StreamOffset( Kind::Timestamp, seconds ); }
+
+          Kind kind;
+          std::uint64_t value;   ///< смещение или время (для Kind::Offset и Kind::Timestamp)
+
+     private:
+          StreamOffset( Kind k, std::uint64_t v ) : kind( k ), value( v ) {}
+     };
+
+     /// Структура, описывающая параметры подписки на очередь
+     struct ConsumerParameters
+     {
+          boost::optional< std::int32_t > priority;      ///< приоритет подписчика (x-priority)
+          boost::optional< std::uint16_t > prefetchCount;///< ограничение кол-ва неподтвержденных сообщений (basic.qos)
+          bool exclusive = false;                        ///< эксклюзивная подписка
+          bool noAck = false;                            ///< доставки без подтверждения (no_ack, не более одного раза)
+          boost::optional< StreamOffset > streamOffset;  ///< позиция чтения потока (x-stream-offset), требует prefetchCount
+          FieldTable arguments;                          ///< дополнительные аргументы подписки
+     };
+
      /// Конверт, используемый для получения сообщений из очереди
-     /// @note возвращаемое из очереди сообщение содержит большое кол-во потенциально полезных данных
-     /// (таких как exchange, routing_key и т.п.); если в будущем они понадобятся - их следует просто добавлять
-     /// в эту структуру, т.о. остальной код останется работоспособным
+     /// @note конверт содержит только тело сообщения и идентификатор доставки; для доступа к остальным данным
+     /// доставки (exchange, routing_key, свойства и заголовки сообщения) следует использовать consumeDelivery()
      struct Envelope
      {
           Envelope( std::string&& m, const std::uint64_t tag )
@@ -176,6 +288,69 @@ public:
           , const std::string& message
      );
 
+     /// @brief Публикует сообщение в очередь с указанием свойств сообщения (correlation_id, reply_to, заголовки и т.п.)
+     /// @see static void publishMessage()
+     /// @param properties свойства сообщения в терминах rabbitmq-c (установленные поля отмечаются в _flags)
+     static void publishMessage(
+          const Connection& connection
+          , const std::string& exchange
+          , const std::string& routingKey
+          , const std::string& message
+          , const amqp_basic_properties_t& properties
+     );
+
+     /// @brief Публикует объект @a value, закодированный кодеком Codec< T > (см. codec.h)
+     /// @details Тело сообщения формируется кодеком без промежуточной строки: rabbitmq-c записывает в кадры тела
+     /// непосредственно байты объекта (PodCodec, std::string) или буфер кодирования, повторно используемый
+     /// публикациями потока (protobuf, FlatBuffers). Свойство content_type задается кодеком.
+     /// @see static void publishMessage()
+     template< typename T >
+     static void publish(
+          const Connection& connection
+          , const std::string& exchange
+          , const std::string& routingKey
+          , const T& value
+     )
+     {
+          amqp_basic_properties_t properties;
+          properties._flags = 0;
+          publish( connection, exchange, routingKey, value, properties );
+     }
+
+     /// @brief Публикует объект @a value с указанием свойств сообщения
+     /// @details Свойство content_type в @a properties заменяется значением кодека
+     /// @see static void publish()
+     template< typename T >
+     static void publish(
+          const Connection& connection
+          , const std::string& exchange
+          , const std::string& routingKey
+          , const T& value
+          , amqp_basic_properties_t properties
+     )
+     {
+          const auto body = Codec< T >::encode( value, codecBuffer< T >() );
+          setContentType( properties, Codec< T >::contentType() );
+          publishBody( connection, exchange, routingKey, body, &properties );
+     }
+
+     /// @brief Объявляет очередь (создает ее или проверяет, что существующая очередь объявлена с теми же параметрами)
+     /// @details Позволяет владеющему очередью сервису выбирать поведение брокера, влияющее на производительность:
+     /// тип очереди, ограничение длины и поведение при переполнении, хранение сообщений на диске и режим
+     /// единственного активного подписчика.
+     /// @return имя очереди (в т.ч. назначенное брокером, если @a declaration.queueName пусто)
+     /// @throw ConnectionError в случае разрыва или ошибок соединения
+     /// @throw std::runtime_error в случае недопустимого сочетания параметров и во всех остальных случаях
+     static std::string declareQueue( const Connection&, const QueueDeclaration& declaration );
+
+     /// @brief Формирует аргументы объявления очереди (тип, ограничения длины, режим хранения) из @a declaration
+     /// @throw std::runtime_error в случае недопустимого сочетания параметров
+     static FieldTable queueArguments( const QueueDeclaration& declaration );
+
+     /// @brief Формирует аргументы подписки (приоритет, позиция чтения потока) из @a consumer
+     /// @throw std::invalid_argument если задана позиция чтения потока без ограничения prefetchCount
+     static FieldTable consumerArguments( const ConsumerParameters& consumer );
+
      /// @brief Связывает точку публикации @a exchange с конкретной очередью @a queueName. Также может быть указан @a routingKey
      /// @note Используется только для прослушивания очереди
      /// @attention К моменту вызова метода и точка публикации @a exchange, и очередь @a queueName должны существовать.
@@ -188,6 +363,18 @@ public:
           const std::string& queueName,
           const std::string& routingKey = "" );
 
+     /// @brief Связывает точку публикации с очередью и подписывается на нее с указанными параметрами подписки
+     /// @details При пустом @a exchange выполняется только подписка: со стандартной точкой публикации очередь
+     /// связана брокером автоматически (явное связывание с ней запрещено).
+     /// @see static void bind()
+     /// @throw std::invalid_argument если задана позиция чтения потока без ограничения prefetchCount
+     static void bind(
+          const Connection&,
+          const std::string& exchange,
+          const std::string& queueName,
+          const std::string& routingKey,
+          const ConsumerParameters& consumer );
+
      /// @brief Получает сообщение из очереди @a queueName с блокировкой вызывающего потока до получения сообщения или до истечения времени @a timeout
      ///
      /// @note Требует предварительного вызова метода bind()
@@ -289,10 +476,135 @@ public:
           const boost::optional< boost::posix_time::time_duration >& timeout = boost::none
      );
 
+     /// @brief Получает сообщение из очереди вместе со всеми данными доставки
+     /// @details Аналогичен consumeMessage(), но возвращает Delivery, дающий доступ к exchange, routing key,
+     /// признаку повторной доставки, свойствам и заголовкам сообщения. Метаданные разбираются только
+     /// при первом обращении к ним, тело сообщения не копируется.
+     /// @see static boost::optional< Envelope > consumeMessage()
+     /// @return Delivery с сообщением или boost::none при таймауте
+     /// @throw ConnectionError в случае разрыва или ошибок соединения
+     /// @throw std::runtime_error во всех остальных случаях
+     static boost::optional< Delivery > consumeDelivery(
+          const Connection& connection,
+          const boost::optional< boost::posix_time::time_duration >& timeout = boost::none
+     );
+
+     /// @brief Получает сообщение и разбирает его тело кодеком Codec< T > (см. codec.h)
+     /// @details Тело разбирается непосредственно из буфера доставки. Свойство content_type сообщения, если оно
+     /// задано, должно совпадать со значением кодека.
+     /// @see static boost::optional< Delivery > consumeDelivery()
+     /// @return сообщение с разобранным телом или boost::none при таймауте
+     /// @throw CodecError если content_type не совпадает или тело не разбирается кодеком (сообщение не подтверждается)
+     template< typename T >
+     static boost::optional< TypedDelivery< T > > consume(
+          const Connection& connection,
+          const boost::optional< boost::posix_time::time_duration >& timeout = boost::none
+     )
+     {
+          auto delivery = consumeDelivery( connection, timeout );
+          if( !delivery )
+          {
+               return boost::none;
+          }
+          return decode< T >( std::move( *delivery ) );
+     }
+
+     /// @brief Получает пачку сообщений из очереди
+     /// @details Ожидание (не дольше @a timeout) выполняется только до получения первого сообщения; далее
+     /// в пачку забираются сообщения, уже принятые из сети (не более @a maxCount), без повторного ожидания.
+     /// Совместно с ограничением prefetch позволяет обрабатывать сообщения пачками (например, для пакетной
+     /// записи в БД), распределяя накладные расходы на получение по всем сообщениям пачки.
+     ///
+     /// @note Требует предварительного вызова метода bind()
+     ///
+     /// @param envelopes контейнер для сообщений; очищается перед заполнением, выделенная в нем память
+     /// переиспользуется между вызовами
+     /// @param maxCount максимальное кол-во сообщений в пачке
+     /// @param timeout время ожидания первого сообщения (boost::none - бесконечное ожидание)
+     /// @return кол-во полученных сообщений (0 при таймауте)
+     /// @throw ConnectionError в случае разрыва или ошибок соединения
+     /// @throw std::runtime_error во всех остальных случаях
+     static std::size_t consumeMessages(
+          const Connection& connection,
+          std::vector< Envelope >& envelopes,
+          std::size_t maxCount,
+          const boost::optional< boost::posix_time::time_duration >& timeout = boost::none
+     );
+
+     /// @brief Низкоуровневое получение сообщения из очереди в структуру @a envelope библиотеки rabbitmq-c
+     /// @details В отличие от consumeMessage() не освобождает буферы соединения перед ожиданием
+     /// (это остается на вызывающей стороне, см. amqp_maybe_release_buffers()) и дает доступ ко всем полям
+     /// доставки, включая свойства сообщения.
+     /// @return false при таймауте; при возврате true освобождение @a envelope (amqp_destroy_envelope())
+     /// возлагается на вызывающую сторону
+     /// @throw ConnectionError в случае разрыва или ошибок соединения
+     /// @throw std::runtime_error во всех остальных случаях
+     static bool consumeEnvelope(
+          const Connection& connection,
+          const boost::optional< boost::posix_time::time_duration >& timeout,
+          amqp_envelope_t& envelope
+     );
+
+     /// Возвращает true, если в соединении есть уже принятые, но еще не разобранные данные
+     static bool hasBufferedData( const Connection& );
+
+     /// @brief Дескриптор сокета соединения для ожидания данных вне вызовов клиента (poll())
+     /// @note Дескриптор действителен до переподключения (Connection::reconnect())
+     static int socketDescriptor( const Connection& );
+
+     /// @brief Обрабатывает уже поступившие служебные кадры (блокировка соединения, закрытие канала и т.п.)
+     /// на соединениях без подписки, где их некому прочитать
+     /// @details Обновляет Connection::blocked(). Выполняется не чаще раза в 10 мс; на соединении с подпиской
+     /// ничего не делает (кадры обрабатывает цикл получения сообщений)
+     /// @throw ConnectionError в случае разрыва соединения или закрытия канала брокером
+     static void pollConnectionEvents( const Connection& );
+
      /// Подтверждает получение сообщения
      /// @param deliveryTag идентификатор сообщения (извлекается из очереди вместе с сообщением в составе Envelope)
+     /// @param multiple подтвердить также все неподтвержденные сообщения с меньшими идентификаторами
+     /// @throw std::runtime_error во всех остальных случаях
+     static void ackMessage( const Connection&, std::uint64_t deliveryTag, bool multiple = false );
+
+     /// @brief Отрицательно подтверждает получение сообщения (basic.nack, расширение RabbitMQ)
+     /// @param deliveryTag идентификатор сообщения
+     /// @param multiple отклонить также все неподтвержденные сообщения с меньшими идентификаторами
+     /// @param requeue вернуть сообщения в очередь; иначе брокер отбрасывает их или направляет в dead letter exchange
+     /// очереди (с добавлением заголовка x-death)
+     /// @throw std::runtime_error во всех остальных случаях
+     static void nackMessage( const Connection&, std::uint64_t deliveryTag, bool multiple = false, bool requeue = true );
+
+     /// @brief Отклоняет сообщение (basic.reject)
+     /// @details В отличие от nackMessage() входит в стандарт AMQP 0-9-1 и отклоняет только одно сообщение
+     /// @param deliveryTag идентификатор сообщения
+     /// @param requeue вернуть сообщение в очередь
      /// @throw std::runtime_error во всех остальных случаях
-     static void ackMessage( const Connection&, std::uint64_t deliveryTag );
+     static void rejectMessage( const Connection&, std::uint64_t deliveryTag, bool requeue = true );
+
+     /// Обработчик сообщений, полученных во время остановки подписчика
+     typedef std::function< void( Delivery& ) > DrainHandler;
+
+     /// @brief Корректно останавливает подписчика за ограниченное время
+     /// @details Последовательно выполняет:
+     /// 1. отмену подписки (basic.cancel), после которой брокер прекращает выдачу новых сообщений;
+     /// 2. обработку сообщений, уже выданных подписчику до отмены (prefetch): каждое передается в @a handler
+     ///    и подтверждается;
+     /// 3. доставку подтверждений брокеру;
+     /// 4. закрытие канала.
+     ///
+     /// Если время @a deadline истекает, оставшиеся шаги прерываются; неподтвержденные сообщения брокер вернет
+     /// в очередь при закрытии канала или соединения. Так при плановом перезапуске сервиса повторно доставляются
+     /// только сообщения, которые не успели обработать, а не весь prefetch.
+     ///
+     /// @param deadline максимальное время остановки
+     /// @param handler обработчик сообщений (пустой - сообщения не обрабатываются и возвращаются в очередь)
+     /// @return true, если подписка отменена и канал закрыт до истечения @a deadline
+     /// @throw ConnectionError в случае разрыва соединения
+     /// @note После вызова соединение пригодно только для переподключения (Connection::reconnect())
+     static bool drainAndStop(
+          const Connection& connection,
+          const boost::posix_time::time_duration& deadline,
+          const DrainHandler& handler
+     );
 
      /// Конструкторы. Создают внутри себя подключение к очереди посредством вызова конструктора Connection()
      SimpleClient(
@@ -305,31 +617,282 @@ public:
 
      explicit SimpleClient( const Connection::Parameters& );
 
+     ~SimpleClient();
+
+     SimpleClient( const SimpleClient& ) = delete;
+     SimpleClient& operator=( const SimpleClient& ) = delete;
+
      /// @see static void publishMessage()
+     /// @note При заданном setClaimCheck() большое тело сообщения передается через разделяемую память
      void publishMessage( const std::string& exchange, const std::string& routingKey, const std::string& message );
 
      /// @see static void publishMessage()
      void publishMessage( const QueueParameters& params, const std::string& message );
 
+     /// @see static void publishMessage()
+     /// @note Заголовки шифрования, контрольной суммы и разделяемой памяти добавляются к заголовкам @a properties
+     void publishMessage(
+          const std::string& exchange,
+          const std::string& routingKey,
+          const std::string& message,
+          const amqp_basic_properties_t& properties
+     );
+
+     /// @see static void publish()
+     /// @note Закодированное тело проходит ту же обработку, что и в publishMessage(): шифрование,
+     /// контрольную сумму и передачу через разделяемую память (setEncryption(), setIntegrityCheck(), setClaimCheck())
+     template< typename T >
+     void publish( const std::string& exchange, const std::string& routingKey, const T& value )
+     {
+          amqp_basic_properties_t properties;
+          properties._flags = 0;
+          publish( exchange, routingKey, value, properties );
+     }
+
+     /// @see static void publish()
+     template< typename T >
+     void publish( const std::string& exchange, const std::string& routingKey, const T& value, amqp_basic_properties_t properties )
+     {
+          const auto body = Codec< T >::encode( value, codecBuffer< T >() );
+          setContentType( properties, Codec< T >::contentType() );
+          sealAndPublish( exchange, routingKey, body, &properties );
+     }
+
+     /// @brief Публикует сообщение, если это возможно без ожидания
+     /// @details Возвращает false, не публикуя сообщение, если брокер заблокировал соединение или
+     /// (при заданном ограничителе) исчерпан лимит скорости публикации. Позволяет публикующей стороне
+     /// отбросить или отложить нагрузку вместо блокировки потока на записи в сокет.
+     /// @see static void publishMessage()
+     bool tryPublishMessage( const std::string& exchange, const std::string& routingKey, const std::string& message );
+
+     /// @brief Возвращает true, если брокер заблокировал соединение клиента
+     /// @details Состояние обновляется методами получения сообщений и tryPublishMessage()
+     /// @see Connection::blocked()
+     bool blocked() const;
+
+     /// @brief Задает ограничитель скорости для tryPublishMessage()
+     /// @param limiter ограничитель (nullptr - без ограничения скорости)
+     void setRateLimiter( const std::shared_ptr< PublishRateLimiter >& limiter );
+
      /// @see static void bind()
      void bind( const std::string& exchange, const std::string& queueName, const std::string& routingKey = "" );
 
      /// @see static void bind()
      void bind( const QueueParameters& params );
 
+     /// @see static void bind()
+     void bind( const QueueParameters& params, const ConsumerParameters& consumer );
+
+     /// @see static std::string declareQueue()
+     std::string declareQueue( const QueueDeclaration& declaration );
+
      /// @see static boost::optional< Envelope > consumeMessage()
+     /// @note Ожидание прерывается вызовом requestStop() из другого потока (возвращается boost::none)
      boost::optional< Envelope > consumeMessage(
-          const boost::optional< boost::posix_time::time_duration >& timeout = boost::none
+          boost::optional< boost::posix_time::time_duration > timeout = boost::none
+     );
+
+     /// @see static boost::optional< Delivery > consumeDelivery()
+     /// @note Ожидание прерывается вызовом requestStop() из другого потока (возвращается boost::none)
+     boost::optional< Delivery > consumeDelivery(
+          boost::optional< boost::posix_time::time_duration > timeout = boost::none
+     );
+
+     /// @see static boost::optional< TypedDelivery< T > > consume()
+     /// @note Тело разбирается после обработки сообщения-ссылки, расшифровки и проверки контрольной суммы
+     /// @throw IntegrityError если задано шифрование, а сообщение не зашифровано (см. setEncryption())
+     template< typename T >
+     boost::optional< TypedDelivery< T > > consume(
+          boost::optional< boost::posix_time::time_duration > timeout = boost::none
+     )
+     {
+          auto delivery = consumeDelivery( timeout );
+          if( !delivery )
+          {
+               return boost::none;
+          }
+          return decode< T >( std::move( *delivery ) );
+     }
+
+     /// @see static std::size_t consumeMessages()
+     /// @note Ожидание прерывается вызовом requestStop() из другого потока (возвращается 0)
+     std::size_t consumeMessages(
+          std::vector< Envelope >& envelopes,
+          std::size_t maxCount,
+          boost::optional< boost::posix_time::time_duration > timeout = boost::none
      );
 
      /// @see static void ackMessage()
-     void ackMessage( std::uint64_t deliveryTag );
+     void ackMessage( std::uint64_t deliveryTag, bool multiple = false );
+
+     /// @see static void nackMessage()
+     /// @note Отпечаток ключа сообщения в фильтр повторов не запоминается, сегмент сообщения-ссылки не освобождается:
+     /// сообщение может быть доставлено повторно
+     void nackMessage( std::uint64_t deliveryTag, bool multiple = false, bool requeue = true );
+
+     /// @see static void rejectMessage()
+     /// @note Аналогично nackMessage() не изменяет фильтр повторов и сегменты сообщений-ссылок
+     void rejectMessage( std::uint64_t deliveryTag, bool requeue = true );
+
+     /// @brief Публикует сообщение не раньше чем через @a delay (отложенная публикация, повтор с задержкой)
+     /// @details Сообщение публикуется методом publishMessage() в потоке-владельце клиента: при ожидании сообщений
+     /// в consumeMessage(), consumeDelivery(), consumeMessages() или при вызове processTimers(). Ожидание
+     /// сообщений ограничивается ближайшим таймером, поэтому отдельные потоки, sleep в обработчиках и очереди
+     /// с TTL не нужны (см. TimingWheel). Ошибка публикации генерируется методом, в котором сработал таймер.
+     /// @return идентификатор для cancelTimer()
+     /// @note Не опубликованные к моменту уничтожения клиента сообщения теряются
+     TimingWheel::TimerId publishAfter(
+          const boost::posix_time::time_duration& delay,
+          const std::string& exchange,
+          const std::string& routingKey,
+          const std::string& message
+     );
+
+     /// @brief Отрицательно подтверждает сообщение не раньше чем через @a delay (задержка перед повторной доставкой)
+     /// @details Выполняется так же, как publishAfter(). До срабатывания таймера сообщение остается
+     /// неподтвержденным и занимает место в окне prefetch. Если до срабатывания клиент переподключился
+     /// (reconnect()), таймер ничего не делает: при разрыве брокер уже вернул сообщение в очередь.
+     /// @return идентификатор для cancelTimer()
+     TimingWheel::TimerId nackAfter( const boost::posix_time::time_duration& delay, std::uint64_t deliveryTag, bool requeue = true );
+
+     /// Отменяет отложенную операцию. Возвращает false, если она уже выполнена или отменена
+     bool cancelTimer( TimingWheel::TimerId id );
+
+     /// @brief Выполняет наступившие отложенные операции
+     /// @details Нужен клиентам, не получающим сообщений; время до следующего вызова - nextTimer()
+     /// @return кол-во выполненных операций
+     std::size_t processTimers();
+
+     /// Время до ближайшей обработки отложенных операций (boost::none - операций нет)
+     boost::optional< boost::posix_time::time_duration > nextTimer() const;
+
+     /// @brief Задает политику обработки сообщений, обработка которых завершилась ошибкой
+     /// @param policy политика (nullptr - сообщения всегда возвращаются в очередь)
+     /// @see failMessage()
+     void setQuarantinePolicy( const std::shared_ptr< QuarantinePolicy >& policy );
+
+     /// @brief Завершает обработку сообщения, которую не удалось выполнить
+     /// @details По решению политики (setQuarantinePolicy()) сообщение возвращается в очередь, направляется
+     /// в dead letter exchange очереди или, после исчерпания попыток, публикуется в очередь-карантин
+     /// с исходными свойствами и заголовками, дополненными заголовками QuarantinePolicy (номер попытки,
+     /// причина @a reason, исходные exchange и routing key), после чего подтверждается.
+     /// @return выполненное действие
+     /// @note При сбое между публикацией в карантин и подтверждением сообщение окажется и в карантине,
+     /// и в исходной очереди
+     /// @throw ConnectionError в случае ошибок соединения
+     QuarantinePolicy::Action failMessage( const Delivery& delivery, const std::string& reason = "" );
+
+     /// @brief Включает фильтрацию повторно доставленных сообщений
+     /// @details Сообщения, ключ которых уже есть в фильтре, подтверждаются автоматически и из consumeMessage()
+     /// не возвращаются. Ключ сообщения запоминается в фильтре при вызове ackMessage(), т.е. только после
+     /// того, как сообщение было обработано.
+     /// @param filter фильтр повторов (nullptr - фильтрация отключена)
+     void setDeduplicationFilter( const std::shared_ptr< DeduplicationFilter >& filter );
+
+     /// @brief Включает передачу больших сообщений через разделяемую память (claim-check)
+     /// @details publishMessage() записывает тело размером не меньше порога в сегмент разделяемой памяти
+     /// и публикует ссылку на него. consumeMessage(), consumeDelivery() и consumeMessages() подставляют
+     /// вместо сообщения-ссылки тело из сегмента (consumeDelivery() - без копирования), а ackMessage()
+     /// освобождает сегмент. Если тело недоступно, сообщение не возвращается и не подтверждается: генерируется
+     /// ClaimCheckError с идентификатором доставки (в consumeMessages() - так же, как IntegrityError).
+     /// @param claimCheck параметры передачи (nullptr - передача через разделяемую память отключена)
+     /// @see ClaimCheck
+     void setClaimCheck( const std::shared_ptr< ClaimCheck >& claimCheck );
+
+     /// @brief Включает контроль целостности тела сообщений
+     /// @details publishMessage() добавляет к сообщению контрольную сумму тела (заголовок Integrity::HEADER),
+     /// а consumeMessage(), consumeDelivery() и consumeMessages() проверяют ее у сообщений, в которых она есть.
+     /// Сообщение с несовпадающей суммой не возвращается и не подтверждается: генерируется IntegrityError
+     /// с идентификатором доставки. Если искажение обнаружено в consumeMessages() после уже полученных
+     /// сообщений, они возвращаются, а исключение генерируется при следующем вызове метода получения
+     /// до ожидания сообщений (в том числе после reconnect()).
+     /// @see Integrity
+     void setIntegrityCheck( bool enabled );
+
+     /// @brief Включает шифрование тела сообщений
+     /// @details publishMessage() шифрует тело активным ключом и передает идентификатор ключа в заголовке
+     /// PayloadCipher::KEY_ID_HEADER; consumeMessage(), consumeDelivery(), consumeMessages() и consume()
+     /// расшифровывают сообщения с этим заголовком. Сообщение без заголовка (переданное открытым текстом) или
+     /// сообщение, которое не удалось расшифровать (неизвестный ключ или искажение), обрабатывается так же,
+     /// как при несовпадении контрольной суммы (см. setIntegrityCheck()).
+     /// @param cipher ключи шифрования (nullptr - шифрование отключено)
+     /// @see PayloadCipher
+     void setEncryption( const std::shared_ptr< PayloadCipher >& cipher );
 
      /// Инициирует переподключение к очереди посредством вызова Connection::reconnect()
      /// @see Connection::reconnect()
      void reconnect();
 
+     /// @brief Запрашивает остановку получения сообщений
+     /// @details Единственный потокобезопасный метод класса: может вызываться из любого потока (например,
+     /// из потока обработки сигналов завершения). Прерывает ожидание в consumeMessage() и аналогичных методах,
+     /// после чего они сразу возвращают управление без сообщения. Саму остановку выполняет поток-подписчик
+     /// вызовом drainAndStop().
+     void requestStop();
+
+     /// Возвращает true, если была запрошена остановка (requestStop() или drainAndStop())
+     bool stopRequested() const;
+
+     /// @see static bool drainAndStop()
+     /// @details Сообщения проходят ту же обработку, что и в consumeDelivery(): подстановку тела сообщения-ссылки,
+     /// проверку контрольной суммы и расшифрование
+     /// @return false также в случае разрыва соединения во время остановки
+     /// @throw IntegrityError если тело сообщения повреждено или не расшифровывается; сообщение не подтверждается,
+     /// остановку можно продолжить повторным вызовом
+     bool drainAndStop( const boost::posix_time::time_duration& deadline, const DrainHandler& handler );
+
 private:
+     /// Публикует сообщение; @a properties может быть nullptr
+     static void publishBody(
+          const Connection& connection
+          , const std::string& exchange
+          , const std::string& routingKey
+          , boost::string_ref body
+          , const amqp_basic_properties_t* properties
+     );
+
+     /// @brief Публикует сообщение с переподключением при разрыве соединения
+     /// @details Тело шифруется, снабжается контрольной суммой и при необходимости передается через разделяемую
+     /// память (setEncryption(), setIntegrityCheck(), setClaimCheck()); заголовки этих шагов добавляются
+     /// к заголовкам @a properties. @a properties может быть nullptr
+     void sealAndPublish(
+          const std::string& exchange
+          , const std::string& routingKey
+          , boost::string_ref plain
+          , const amqp_basic_properties_t* properties
+     );
+
+     /// Буфер кодирования сообщений типа @a T, повторно используемый публикациями потока
+     template< typename T >
+     static typename Codec< T >::Buffer& codecBuffer()
+     {
+          static thread_local typename Codec< T >::Buffer buffer;
+          return buffer;
+     }
+
+     /// Устанавливает свойство content_type (@a contentType должна быть статической строкой)
+     static void setContentType( amqp_basic_properties_t& properties, const char* contentType );
+
+     /// @brief Разбирает тело доставки кодеком Codec< T >
+     /// @throw CodecError если content_type не совпадает или тело не разбирается кодеком
+     template< typename T >
+     static TypedDelivery< T > decode( Delivery&& delivery )
+     {
+          checkContentType( delivery, Codec< T >::contentType() );
+
+          T value;
+          if( !Codec< T >::decode( delivery.body(), value ) )
+          {
+               throwCodecError( delivery, "cannot decode message body" );
+          }
+          return TypedDelivery< T >( std::move( delivery ), std::move( value ) );
+     }
+
+     /// @throw CodecError если свойство content_type доставки задано и не совпадает с @a contentType
+     static void checkContentType( const Delivery& delivery, const char* contentType );
+
+     [[noreturn]] static void throwCodecError( const Delivery& delivery, const std::string& what );
+
      /// Возвращает true, если ожидание сообщений прерывается по таймауту
      static bool isTimedOutError( const amqp_rpc_reply_t& );
 
@@ -341,7 +904,93 @@ private:
      /// @note код взят из примера example/amqp_consumer.c библиотеки rabbitmq-c
      static void handleUnexpectedFrameStateError( const Connection& );
 
+     /// Обрабатывает служебный кадр, полученный вне доставки сообщения
+     static void handleFrame( const Connection&, const amqp_frame_t& );
+
+     /// Закрывает канал, ожидая подтверждения брокера не дольше @a timeout. Возвращает true при получении подтверждения
+     static bool closeChannel( const Connection&, const boost::posix_time::time_duration& timeout );
+
+     /// @brief Ожидает поступления данных в сокет соединения или запроса остановки, выполняя наступающие
+     /// отложенные операции
+     /// @return false по истечении @a timeout или при запросе остановки; иначе true, а @a timeout уменьшается
+     /// на время ожидания
+     bool waitForDelivery( boost::optional< boost::posix_time::time_duration >& timeout );
+
+     /// @brief Получает сообщение, пропуская повторно доставленные (при включенном фильтре повторов)
+     /// @return false при таймауте; при возврате true освобождение @a envelope возлагается на вызывающую сторону
+     bool consumeFiltered(
+          const boost::optional< boost::posix_time::time_duration >& timeout,
+          amqp_envelope_t& envelope
+     );
+
+     /// @brief Проверяет сообщение фильтром повторов
+     /// @details Повторно доставленное сообщение подтверждается, и метод возвращает true; для остальных
+     /// сообщений запоминается отпечаток ключа до вызова ackMessage()
+     bool skipDuplicate( const amqp_envelope_t& );
+
+     /// @brief Отображает тело сообщения-ссылки из разделяемой памяти
+     /// @return nullptr, если сообщение не является ссылкой (или claim-check не включен)
+     /// @throw ClaimCheckError если сегмент не существует или поврежден
+     std::shared_ptr< ClaimCheckPayload > openClaim( const amqp_envelope_t& ) const;
+
+     /// @brief Отображает тело сообщения-ссылки из разделяемой памяти (openClaim())
+     /// @return nullptr, если сообщение не является ссылкой (или claim-check не включен); иначе сегмент
+     /// запоминается до вызова ackMessage()
+     /// @throw ClaimCheckError если сегмент не существует или поврежден
+     std::shared_ptr< ClaimCheckPayload > claimPayload( const amqp_envelope_t& );
+
+     /// @brief Проверяет контрольную сумму тела @a body сообщения @a envelope (при включенном контроле целостности)
+     /// @throw IntegrityError при несовпадении
+     void verifyIntegrity( const amqp_envelope_t& envelope, boost::string_ref body ) const;
+
+     /// @brief Проверяет контрольную сумму и расшифровывает тело @a body сообщения @a envelope
+     /// @return true, если сообщение было зашифровано (расшифрованное тело записывается в @a plain)
+     /// @throw IntegrityError при несовпадении контрольной суммы, а также если задано шифрование, но сообщение
+     /// не зашифровано или его невозможно расшифровать
+     bool openBody( const amqp_envelope_t& envelope, boost::string_ref body, std::string& plain );
+
+     /// Возвращает true, если полученные сообщения требуют обработки (фильтр повторов, claim-check и т.п.)
+     bool processesEnvelopes() const;
+
+     /// Генерирует IntegrityError (ClaimCheckError), отложенный consumeMessages()
+     void throwDeferredIntegrityError();
+
+     /// Забывает сведения о сообщении @a deliveryTag (и о предшествующих ему при @a multiple), отклоненном без подтверждения
+     void forgetPending( std::uint64_t deliveryTag, bool multiple );
+
+     /// Публикует копию сообщения в очередь-карантин
+     void park( const Delivery& delivery, std::uint32_t attempts, const std::string& reason );
+
      Connection connection_;
+
+     std::shared_ptr< DeduplicationFilter > dedup_;
+     std::shared_ptr< PublishRateLimiter > limiter_;
+     std::shared_ptr< ClaimCheck > claimCheck_;
+     std::shared_ptr< QuarantinePolicy > quarantine_;
+     bool integrity_;
+     std::shared_ptr< PayloadCipher > cipher_;
+
+     /// Буфер зашифрованного тела, переиспользуемый при публикации
+     std::string sealed_;
+
+     /// Ошибка тела сообщения (IntegrityError), обнаруженная consumeMessages() после уже полученных сообщений
+     std::exception_ptr deferredError_;
+
+     /// Сегменты полученных, но еще не подтвержденных сообщений-ссылок (по deliveryTag)
+     std::unordered_map< std::uint64_t, std::shared_ptr< ClaimCheckPayload > > pendingClaims_;
+
+     /// Отпечатки ключей полученных, но еще не подтвержденных сообщений (по deliveryTag)
+     std::unordered_map< std::uint64_t, std::uint64_t > pendingFingerprints_;
+
+     /// Запрос остановки и eventfd для прерывания ожидания сообщений из другого потока
+     std::atomic< bool > stopRequested_;
+     const int wakeupFd_;
+
+     /// Отложенные операции (publishAfter(), nackAfter())
+     TimingWheel timers_;
+
+     /// Номер подключения, увеличиваемый reconnect(): идентификаторы доставки прежних подключений недействительны
+     std::uint64_t epoch_;
 };
 
 
@@ -0,0 +1,150 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/date_time/posix_time/posix_time_duration.hpp>
+#include <rabbitmq_client/mapped_file.h>
+#include <rabbitmq_client/simple_client.h>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+
+/// @brief Журнал неотправленных сообщений на локальном диске
+/// @details Журнал представляет собой файл ограниченного размера, отображенный в память. Сообщения дописываются
+/// в конец журнала и извлекаются из его начала строго в порядке записи. Позиции чтения и записи хранятся
+/// в заголовке файла, поэтому неотправленные сообщения переживают перезапуск процесса.
+/// Когда журнал полностью вычитан, позиции сбрасываются на начало файла; при нехватке места в конце
+/// невычитанный остаток переносится в начало файла.
+///
+/// @note Запись в журнал не сопровождается синхронным сбросом на диск (это сделало бы публикацию
+/// миллисекундной); данные переживают аварийное завершение процесса, но не отказ питания узла.
+/// Для явного сброса предусмотрен метод flush().
+///
+/// Методы класса потокобезопасны.
+class PublishSpool
+{
+public:
+     /// Запись журнала
+     struct Record
+     {
+          std::string exchange;
+          std::string routingKey;
+          std::string message;
+     };
+
+     /// @param path путь к файлу журнала
+     /// @param capacity максимальный размер файла журнала в байтах
+     /// @throw std::runtime_error в случае ошибок открытия файла или если файл содержит не журнал
+     PublishSpool( const std::string& path, std::size_t capacity );
+
+     /// @brief Дописывает сообщение в конец журнала
+     /// @throw SpoolOverflowError если в журнале недостаточно места
+     void append( const std::string& exchange, const std::string& routingKey, const std::string& message );
+
+     /// Копирует первую запись журнала в @a record. Возвращает false, если журнал пуст
+     bool front( Record& record ) const;
+
+     /// Удаляет первую запись журнала
+     void pop();
+
+     /// Возвращает true, если журнал пуст
+     bool empty() const;
+
+     /// Возвращает кол-во записей в журнале
+     std::uint64_t size() const;
+
+     /// Синхронно сбрасывает журнал на диск
+     void flush();
+
+private:
+     struct Header;
+
+     Header& header() const;
+
+     /// Переносит невычитанные записи в начало файла
+     void compact();
+
+     MappedFile file_;
+     mutable boost::mutex mutex_;
+};
+
+
+/// @brief Публикатор сообщений с буферизацией в локальном журнале на время недоступности брокера
+/// @details Если сообщение не может быть отправлено немедленно (соединение отсутствует, занято фоновой
+/// отправкой или в журнале уже есть неотправленные сообщения), оно записывается в журнал PublishSpool,
+/// и вызов сразу возвращает управление. Фоновый поток восстанавливает соединение и отправляет сообщения
+/// из журнала в порядке их записи. Таким образом время публикации для вызывающей стороны не зависит
+/// от доступности брокера, а порядок сообщений сохраняется.
+///
+/// Соединение устанавливается фоновым потоком, поэтому конструктор не блокируется при недоступном брокере.
+///
+/// Методы класса потокобезопасны.
+class SpoolingPublisher
+{
+public:
+     /// Параметры журнала
+     struct SpoolParameters
+     {
+          SpoolParameters( const std::string& p, std::size_t cap )
+               : path( p ), capacity( cap )
+          {}
+
+          std::string path;                  ///< путь к файлу журнала
+          std::size_t capacity = 0;          ///< максимальный размер файла журнала в байтах
+          boost::posix_time::time_duration retryInterval = boost::posix_time::seconds( 1 ); ///< интервал между попытками переподключения и отправки журнала заблокированному брокеру
+     };
+
+     SpoolingPublisher( const Connection::Parameters&, const SpoolParameters& );
+
+     /// Останавливает фоновый поток; неотправленные сообщения остаются в журнале до следующего запуска
+     ~SpoolingPublisher();
+
+     /// @brief Публикует сообщение или записывает его в журнал
+     /// @details Сообщение, которое не удалось опубликовать по любой причине, записывается в журнал
+     /// @see SimpleClient::publishMessage()
+     /// @throw SpoolOverflowError если сообщение не удалось отправить и в журнале недостаточно места
+     void publishMessage( const std::string& exchange, const std::string& routingKey, const std::string& message );
+
+     /// @see SimpleClient::publishMessage()
+     void publishMessage( const SimpleClient::QueueParameters& params, const std::string& message );
+
+     /// Возвращает кол-во сообщений, ожидающих отправки в журнале
+     std::uint64_t spooledCount() const;
+
+private:
+     /// Тело фонового потока отправки сообщений из журнала
+     void drain();
+
+     /// @brief Отправляет сообщения из журнала, пока он не опустеет или не оборвется соединение
+     /// @return false, если отправка отложена (соединение оборвано или заблокировано брокером)
+     bool replaySpool();
+
+     const Connection::Parameters params_;
+     const boost::posix_time::time_duration retryInterval_;
+     PublishSpool spool_;
+
+     std::unique_ptr< Connection > connection_;
+     boost::mutex connectionMutex_;
+
+     boost::mutex drainMutex_;
+     boost::condition_variable drainCondition_;
+     bool stop_ = false;
+
+     boost::thread drainer_;
+};
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
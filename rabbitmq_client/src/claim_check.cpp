@@ -0,0 +1,279 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#include <rabbitmq_client/claim_check.h>
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <boost/throw_exception.hpp>
+#include <rabbitmq_client/delivery.h>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+namespace {
+namespace aux {
+
+
+const std::uint64_t MAGIC = 0x4b43484b4c43514dULL;
+
+/// Заголовок сегмента; тело сообщения начинается со смещения DATA_OFFSET
+struct SegmentHeader
+{
+     std::uint64_t magic;
+     std::atomic< std::uint32_t > refs;      ///< кол-во получателей, еще не подтвердивших сообщение
+     std::uint32_t reserved;
+     std::uint64_t size;                     ///< размер тела сообщения
+};
+
+const std::size_t DATA_OFFSET = 64;
+
+static_assert( sizeof( SegmentHeader ) <= DATA_OFFSET, "claim check segment header does not fit" );
+static_assert( ATOMIC_INT_LOCK_FREE == 2, "reference counter in shared memory must be lock-free" );
+
+
+void systemError( const std::string& message, const std::string& name )
+{
+     BOOST_THROW_EXCEPTION( std::runtime_error( message + " " + name + ": " + std::strerror( errno ) ) );
+}
+
+
+std::string makeNamePrefix( const std::string& prefix )
+{
+     std::random_device rd;
+     std::ostringstream ostr;
+     ostr << '/' << prefix << '-' << ::getpid() << '-' << std::hex << rd() << '-';
+     return ostr.str();
+}
+
+
+} // namespace aux
+} // namespace {unnamed}
+
+
+const char* const ClaimCheck::HEADER = "x-claim-check";
+const char* const ClaimCheck::SIZE_HEADER = "x-claim-check-size";
+
+
+ClaimCheckPayload::ClaimCheckPayload( const std::string& name, char* base, std::size_t mapped )
+     : name_( name )
+     , base_( base )
+     , mapped_( mapped )
+{}
+
+
+ClaimCheckPayload::~ClaimCheckPayload()
+{
+     ::munmap( base_, mapped_ );
+}
+
+
+boost::string_ref ClaimCheckPayload::body() const
+{
+     const auto header = reinterpret_cast< const aux::SegmentHeader* >( base_ );
+     return boost::string_ref( base_ + aux::DATA_OFFSET, header->size );
+}
+
+
+void ClaimCheckPayload::release()
+{
+     if( released_ )
+     {
+          return;
+     }
+     released_ = true;
+
+     auto header = reinterpret_cast< aux::SegmentHeader* >( base_ );
+     if( header->refs.fetch_sub( 1 ) == 1 )
+     {
+          ::shm_unlink( name_.c_str() );
+     }
+}
+
+
+ClaimCheck::ClaimCheck( const Parameters& params )
+     : params_( params )
+     , namePrefix_( aux::makeNamePrefix( params.prefix ) )
+     , counter_( 0 )
+{
+     if( params.prefix.empty() || params.prefix.find( '/' ) != std::string::npos )
+     {
+          BOOST_THROW_EXCEPTION( std::invalid_argument( "invalid claim check segment prefix: " + params.prefix ) );
+     }
+}
+
+
+std::string ClaimCheck::store( boost::string_ref body )
+{
+     const auto name = namePrefix_ + std::to_string( ++counter_ );
+     const auto mapped = aux::DATA_OFFSET + body.size();
+
+     const int fd = ::shm_open( name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600 );
+     if( fd < 0 )
+     {
+          aux::systemError( "cannot create shared memory segment", name );
+     }
+
+     if( ::ftruncate( fd, mapped ) != 0 )
+     {
+          ::close( fd );
+          ::shm_unlink( name.c_str() );
+          aux::systemError( "cannot resize shared memory segment", name );
+     }
+
+     void* addr = ::mmap( nullptr, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+     ::close( fd );
+     if( addr == MAP_FAILED )
+     {
+          ::shm_unlink( name.c_str() );
+          aux::systemError( "cannot map shared memory segment", name );
+     }
+
+     auto base = static_cast< char* >( addr );
+     auto header = new ( base ) aux::SegmentHeader;
+     header->refs.store( params_.consumers );
+     header->reserved = 0;
+     header->size = body.size();
+     std::memcpy( base + aux::DATA_OFFSET, body.data(), body.size() );
+
+     /// Признак целостности записывается последним: получатель не примет недописанный сегмент
+     std::atomic_thread_fence( std::memory_order_release );
+     header->magic = aux::MAGIC;
+
+     ::munmap( addr, mapped );
+     return name;
+}
+
+
+void ClaimCheck::discard( const std::string& name )
+{
+     ::shm_unlink( name.c_str() );
+}
+
+
+boost::optional< std::string > ClaimCheck::reference( const amqp_basic_properties_t& properties ) const
+{
+     if( !( properties._flags & AMQP_BASIC_HEADERS_FLAG ) )
+     {
+          return boost::none;
+     }
+
+     const auto& headers = properties.headers;
+     for( int i = 0; i < headers.num_entries; ++i )
+     {
+          const auto& entry = headers.entries[ i ];
+          if( entry.key.len != std::strlen( HEADER ) || std::memcmp( entry.key.bytes, HEADER, entry.key.len ) != 0 )
+          {
+               continue;
+          }
+
+          const auto value = decodeField( entry.value );
+          const auto name = boost::get< std::string >( &value.value );
+
+          /// Имя должно иметь вид /<prefix>-..., без вложенных '/'
+          const auto expected = '/' + params_.prefix + '-';
+          if( !name || name->compare( 0, expected.size(), expected ) != 0 || name->find( '/', 1 ) != std::string::npos )
+          {
+               return boost::none;
+          }
+          return *name;
+     }
+
+     return boost::none;
+}
+
+
+std::shared_ptr< ClaimCheckPayload > ClaimCheck::open( const std::string& name ) const
+{
+     const int fd = ::shm_open( name.c_str(), O_RDWR, 0 );
+     if( fd < 0 )
+     {
+          aux::systemError( "cannot open shared memory segment", name );
+     }
+
+     struct stat st = {};
+     if( ::fstat( fd, &st ) != 0 )
+     {
+          ::close( fd );
+          aux::systemError( "cannot stat shared memory segment", name );
+     }
+
+     const std::size_t mapped = st.st_size;
+     if( mapped < aux::DATA_OFFSET )
+     {
+          ::close( fd );
+          BOOST_THROW_EXCEPTION( std::runtime_error( "shared memory segment is corrupted: " + name ) );
+     }
+
+     void* addr = ::mmap( nullptr, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+     ::close( fd );
+     if( addr == MAP_FAILED )
+     {
+          aux::systemError( "cannot map shared memory segment", name );
+     }
+
+     std::shared_ptr< ClaimCheckPayload > payload( new ClaimCheckPayload( name, static_cast< char* >( addr ), mapped ) );
+
+     const auto header = reinterpret_cast< const aux::SegmentHeader* >( addr );
+     /// Размер из сегмента не складывается со смещением: сумма могла бы переполниться
+     if( header->magic != aux::MAGIC || header->size > mapped - aux::DATA_OFFSET )
+     {
+          BOOST_THROW_EXCEPTION( std::runtime_error( "shared memory segment is corrupted: " + name ) );
+     }
+     std::atomic_thread_fence( std::memory_order_acquire );
+
+     return payload;
+}
+
+
+std::size_t ClaimCheck::purge( unsigned maxAge ) const
+{
+     /// Сегменты POSIX shared memory в Linux представлены файлами каталога /dev/shm (имя без ведущего '/')
+     const std::string directory = "/dev/shm";
+     const auto prefix = params_.prefix + '-';
+     const auto oldest = std::time( nullptr ) - static_cast< std::time_t >( maxAge );
+
+     std::unique_ptr< DIR, int(*)( DIR* ) > dir( ::opendir( directory.c_str() ), ::closedir );
+     if( !dir )
+     {
+          aux::systemError( "cannot open directory", directory );
+     }
+
+     std::size_t removed = 0;
+     while( const auto entry = ::readdir( dir.get() ) )
+     {
+          const std::string file = entry->d_name;
+          if( file.compare( 0, prefix.size(), prefix ) != 0 )
+          {
+               continue;
+          }
+
+          struct stat st = {};
+          if( ::stat( ( directory + '/' + file ).c_str(), &st ) == 0 && st.st_mtime < oldest )
+          {
+               if( ::shm_unlink( ( '/' + file ).c_str() ) == 0 )
+               {
+                    ++removed;
+               }
+          }
+     }
+
+     return removed;
+}
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
@@ -0,0 +1,184 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#include <rabbitmq_client/concurrent_publisher.h>
+
+#include <iostream>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <rabbitmq_client/error.h>
+#include <rabbitmq_client/src/connection_impl.h>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+
+ConcurrentPublisher::ConcurrentPublisher( const Connection::Parameters& params, const Parameters& publisherParams )
+     : connection_( params )
+     , batchSize_( publisherParams.batchSize )
+     , ring_( publisherParams.capacity )
+     , stop_( false )
+     , sleeping_( false )
+     , worker_( [ this ](){ run(); } )
+{}
+
+
+ConcurrentPublisher::~ConcurrentPublisher()
+{
+     stop_ = true;
+     {
+          boost::lock_guard< boost::mutex > lock( sleepMutex_ );
+          sleepCondition_.notify_one();
+     }
+     worker_.join();
+}
+
+
+bool ConcurrentPublisher::tryPublish( std::string exchange, std::string routingKey, std::string message )
+{
+     Message msg{ std::move( exchange ), std::move( routingKey ), std::move( message ), nullptr };
+     return enqueue( msg );
+}
+
+
+std::future< void > ConcurrentPublisher::publish( std::string exchange, std::string routingKey, std::string message )
+{
+     std::unique_ptr< std::promise< void > > promise( new std::promise< void > );
+     auto result = promise->get_future();
+
+     Message msg{ std::move( exchange ), std::move( routingKey ), std::move( message ), std::move( promise ) };
+     if( !enqueue( msg ) )
+     {
+          msg.result->set_exception( std::make_exception_ptr( std::runtime_error( "publisher queue is full or stopped" ) ) );
+     }
+
+     return result;
+}
+
+
+bool ConcurrentPublisher::enqueue( Message& message )
+{
+     if( stop_ || !ring_.push( message ) )
+     {
+          return false;
+     }
+
+     /// Пара барьеров с run() исключает потерю пробуждения: либо поток ввода-вывода увидит сообщение
+     /// при проверке очереди, либо писатель увидит признак ожидания
+     std::atomic_thread_fence( std::memory_order_seq_cst );
+     if( sleeping_ )
+     {
+          boost::lock_guard< boost::mutex > lock( sleepMutex_ );
+          sleepCondition_.notify_one();
+     }
+
+     return true;
+}
+
+
+void ConcurrentPublisher::run()
+{
+     while( true )
+     {
+          if( publishBatch() > 0 )
+          {
+               continue;
+          }
+
+          boost::unique_lock< boost::mutex > lock( sleepMutex_ );
+          sleeping_ = true;
+          std::atomic_thread_fence( std::memory_order_seq_cst );
+
+          if( ring_.empty() )
+          {
+               if( stop_ )
+               {
+                    return;
+               }
+               sleepCondition_.wait_for( lock, boost::chrono::milliseconds( 100 ) );
+          }
+          sleeping_ = false;
+     }
+}
+
+
+std::size_t ConcurrentPublisher::publishBatch()
+{
+     Message message;
+     std::size_t published = 0;
+
+     if( !ring_.pop( message ) )
+     {
+          return 0;
+     }
+
+     cork( true );
+     do
+     {
+          publishOne( message );
+          ++published;
+     }
+     while( published < batchSize_ && ring_.pop( message ) );
+     cork( false );
+
+     return published;
+}
+
+
+void ConcurrentPublisher::publishOne( Message& message )
+{
+     try
+     {
+          try
+          {
+               SimpleClient::publishMessage( connection_, message.exchange, message.routingKey, message.body );
+          }
+          catch( const ConnectionError& )
+          {
+               connection_.reconnect();
+               cork( true );
+               SimpleClient::publishMessage( connection_, message.exchange, message.routingKey, message.body );
+          }
+
+          if( message.result )
+          {
+               message.result->set_value();
+          }
+     }
+     catch( const std::exception& e )
+     {
+          if( message.result )
+          {
+               message.result->set_exception( std::current_exception() );
+          }
+          else
+          {
+               std::cerr << "concurrent publisher: message dropped: " << e.what() << "\n";
+          }
+     }
+
+     message.result.reset();
+}
+
+
+void ConcurrentPublisher::cork( bool enable )
+{
+     const int fd = amqp_get_sockfd( connection_.impl_->connection );
+     if( fd < 0 )
+     {
+          return;
+     }
+
+     /// Ошибка здесь не критична: без TCP_CORK кадры просто уйдут отдельными сегментами
+     const int value = enable ? 1 : 0;
+     ::setsockopt( fd, IPPROTO_TCP, TCP_CORK, &value, sizeof( value ) );
+}
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
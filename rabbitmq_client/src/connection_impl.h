@@ -0,0 +1,90 @@
+/// @file
+/// @brief Закрытая часть класса Connection, общая для единиц трансляции библиотеки
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#pragma once
+
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <amqp.h>
+#include <amqp_tcp_socket.h>
+#include <boost/throw_exception.hpp>
+#include <boost/chrono/system_clocks.hpp>
+#include <rabbitmq_client/simple_client.h>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+
+struct Connection::Impl
+{
+     static amqp_connection_state_t initConnection()
+     {
+          return amqp_new_connection();
+     }
+
+
+     static amqp_socket_t* initSocket( const amqp_connection_state_t& conn )
+     {
+          const auto sock = amqp_tcp_socket_new( conn );
+          if( !sock )
+          {
+               BOOST_THROW_EXCEPTION( std::runtime_error( "cannot create amqp socket" ) );
+          }
+          return sock;
+     }
+
+     Impl()
+          : connection( Impl::initConnection() )
+          , socket( Impl::initSocket( connection ) )
+     {}
+
+     ~Impl()
+     {
+          for( auto& envelope : deliveries )
+          {
+               amqp_destroy_envelope( &envelope );
+          }
+          if( channelOpenned )
+          {
+               amqp_channel_close( connection, 1, AMQP_REPLY_SUCCESS );
+               channelOpenned = false;
+          }
+          if( socket )
+          {
+               amqp_connection_close( connection, AMQP_REPLY_SUCCESS );
+          }
+          amqp_destroy_connection( connection );
+     }
+
+     amqp_connection_state_t connection = nullptr;
+     amqp_socket_t* socket = nullptr;
+     bool channelOpenned = false;
+
+     /// Кадры соединения читает цикл получения сообщений (на канале есть подписка)
+     bool consuming = false;
+
+     /// Метка подписчика, назначенная брокером при подписке (basic.consume-ok)
+     std::string consumerTag;
+
+     /// Сообщения, принятые при настройке (Topology::apply()); выдаются SimpleClient::consumeEnvelope() первыми
+     std::deque< amqp_envelope_t > deliveries;
+
+     /// Подписка отменена (получен basic.cancel-ok либо basic.cancel от брокера)
+     bool cancelled = false;
+
+     /// Соединение заблокировано брокером (connection.blocked)
+     bool blocked = false;
+     std::string blockedReason;
+
+     /// Время последней проверки входящих служебных кадров при публикации
+     boost::chrono::steady_clock::time_point lastEventsPoll;
+};
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
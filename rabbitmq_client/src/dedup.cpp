@@ -0,0 +1,218 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#include <rabbitmq_client/dedup.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <boost/throw_exception.hpp>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+namespace {
+namespace aux {
+
+
+/// Сигнатура файла таблицы ("RMQDEDUP")
+const std::uint64_t DEDUP_MAGIC = 0x5055444551514d52ull;
+
+/// Кол-во отпечатков в корзине (8 * 8 байт = одна строка кэша)
+const std::uint64_t BUCKET_WAYS = 8;
+
+/// Размер строки кэша; начало таблицы выравнивается по нему
+const std::size_t CACHE_LINE = 64;
+
+/// Размер заголовка таблицы (кратен строке кэша, чтобы корзины начинались с границы строки)
+const std::size_t HEADER_SIZE = CACHE_LINE;
+
+
+std::uint64_t hashBytes( const void* data, std::size_t len )
+{
+     /// FNV-1a с финальным перемешиванием (splitmix64) для равномерного распределения младших битов
+     std::uint64_t h = 0xcbf29ce484222325ull;
+     const auto bytes = static_cast< const unsigned char* >( data );
+     for( std::size_t i = 0; i < len; ++i )
+     {
+          h ^= bytes[ i ];
+          h *= 0x100000001b3ull;
+     }
+     h ^= h >> 30;
+     h *= 0xbf58476d1ce4e5b9ull;
+     h ^= h >> 27;
+     h *= 0x94d049bb133111ebull;
+     h ^= h >> 31;
+
+     /// Нулевое значение обозначает пустую ячейку
+     return h ? h : 1;
+}
+
+
+boost::optional< std::uint64_t > hashField( const amqp_field_value_t& value )
+{
+     switch( value.kind )
+     {
+          case AMQP_FIELD_KIND_UTF8:
+          case AMQP_FIELD_KIND_BYTES:
+               return hashBytes( value.value.bytes.bytes, value.value.bytes.len );
+          case AMQP_FIELD_KIND_I32:
+               return hashBytes( &value.value.i32, sizeof( value.value.i32 ) );
+          case AMQP_FIELD_KIND_U32:
+               return hashBytes( &value.value.u32, sizeof( value.value.u32 ) );
+          case AMQP_FIELD_KIND_I64:
+          case AMQP_FIELD_KIND_TIMESTAMP:
+               return hashBytes( &value.value.i64, sizeof( value.value.i64 ) );
+          case AMQP_FIELD_KIND_U64:
+               return hashBytes( &value.value.u64, sizeof( value.value.u64 ) );
+          default:
+               return boost::none;
+     }
+}
+
+
+std::uint64_t roundUpPow2( std::uint64_t value )
+{
+     std::uint64_t result = 1;
+     while( result < value )
+     {
+          result <<= 1;
+     }
+     return result;
+}
+
+
+} // namespace aux
+} // namespace {unnamed}
+
+
+struct DeduplicationFilter::Header
+{
+     std::uint64_t magic;
+     std::uint64_t bucketCount;
+};
+
+
+DeduplicationFilter::DeduplicationFilter( const Parameters& params )
+     : header_( params.header )
+     , bucketCount_( aux::roundUpPow2( ( params.capacity + aux::BUCKET_WAYS - 1 ) / aux::BUCKET_WAYS ) )
+     , memory_( nullptr, std::free )
+{
+     const std::size_t size = aux::HEADER_SIZE
+          + bucketCount_ * aux::BUCKET_WAYS * sizeof( std::uint64_t )
+          + bucketCount_;
+
+     if( params.persistPath.empty() )
+     {
+          /// Отображенный файл выровнен по границе страницы, память таблицы выравнивается явно
+          void* memory = nullptr;
+          if( ::posix_memalign( &memory, aux::CACHE_LINE, size ) != 0 )
+          {
+               BOOST_THROW_EXCEPTION( std::bad_alloc() );
+          }
+          memory_.reset( memory );
+          std::memset( memory, 0, size );
+          initTable( static_cast< char* >( memory ), true );
+     }
+     else
+     {
+          file_.reset( new MappedFile( params.persistPath, size ) );
+          initTable( file_->data(), file_->created() );
+     }
+}
+
+
+void DeduplicationFilter::initTable( char* data, bool created )
+{
+     auto& h = *reinterpret_cast< Header* >( data );
+     if( created && h.magic != aux::DEDUP_MAGIC )
+     {
+          h.magic = aux::DEDUP_MAGIC;
+          h.bucketCount = bucketCount_;
+     }
+     else if( h.magic != aux::DEDUP_MAGIC || h.bucketCount != bucketCount_ )
+     {
+          BOOST_THROW_EXCEPTION( std::runtime_error( "deduplication table format or capacity mismatch" ) );
+     }
+
+     buckets_ = reinterpret_cast< std::uint64_t* >( data + aux::HEADER_SIZE );
+     cursors_ = reinterpret_cast< std::uint8_t* >( buckets_ + bucketCount_ * aux::BUCKET_WAYS );
+}
+
+
+boost::optional< std::uint64_t > DeduplicationFilter::fingerprint( const amqp_basic_properties_t& props ) const
+{
+     if( header_.empty() )
+     {
+          if( props._flags & AMQP_BASIC_MESSAGE_ID_FLAG && props.message_id.len )
+          {
+               return aux::hashBytes( props.message_id.bytes, props.message_id.len );
+          }
+          return boost::none;
+     }
+
+     if( !( props._flags & AMQP_BASIC_HEADERS_FLAG ) )
+     {
+          return boost::none;
+     }
+
+     for( int i = 0; i < props.headers.num_entries; ++i )
+     {
+          const auto& entry = props.headers.entries[ i ];
+          if( entry.key.len == header_.size()
+               && std::memcmp( entry.key.bytes, header_.data(), header_.size() ) == 0 )
+          {
+               return aux::hashField( entry.value );
+          }
+     }
+
+     return boost::none;
+}
+
+
+bool DeduplicationFilter::contains( std::uint64_t fingerprint ) const
+{
+     const auto bucket = buckets_ + ( fingerprint & ( bucketCount_ - 1 ) ) * aux::BUCKET_WAYS;
+     for( std::uint64_t i = 0; i < aux::BUCKET_WAYS; ++i )
+     {
+          if( bucket[ i ] == fingerprint )
+          {
+               return true;
+          }
+     }
+     return false;
+}
+
+
+void DeduplicationFilter::insert( std::uint64_t fingerprint )
+{
+     const auto index = fingerprint & ( bucketCount_ - 1 );
+     const auto bucket = buckets_ + index * aux::BUCKET_WAYS;
+
+     for( std::uint64_t i = 0; i < aux::BUCKET_WAYS; ++i )
+     {
+          if( bucket[ i ] == fingerprint )
+          {
+               return;
+          }
+          if( bucket[ i ] == 0 )
+          {
+               bucket[ i ] = fingerprint;
+               return;
+          }
+     }
+
+     /// Корзина заполнена - вытесняем самый старый отпечаток
+     auto& cursor = cursors_[ index ];
+     bucket[ cursor ] = fingerprint;
+     cursor = ( cursor + 1 ) % aux::BUCKET_WAYS;
+}
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
@@ -0,0 +1,271 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#include <rabbitmq_client/delivery.h>
+
+#include <cstring>
+#include <rabbitmq_client/claim_check.h>
+#include <rabbitmq_client/utils.h>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+namespace {
+namespace aux {
+
+
+boost::optional< std::string > optionalString( const amqp_basic_properties_t& props, amqp_flags_t flag, const amqp_bytes_t& bytes )
+{
+     if( props._flags & flag )
+     {
+          return toString( bytes );
+     }
+     return boost::none;
+}
+
+
+template< typename T >
+boost::optional< T > optionalValue( const amqp_basic_properties_t& props, amqp_flags_t flag, const T& value )
+{
+     if( props._flags & flag )
+     {
+          return value;
+     }
+     return boost::none;
+}
+
+
+} // namespace aux
+} // namespace {unnamed}
+
+
+HeaderValue decodeField( const amqp_field_value_t& field )
+{
+     HeaderValue result;
+
+     switch( field.kind )
+     {
+          case AMQP_FIELD_KIND_BOOLEAN:   result.value = field.value.boolean != 0; break;
+          case AMQP_FIELD_KIND_I8:        result.value = static_cast< std::int64_t >( field.value.i8 ); break;
+          case AMQP_FIELD_KIND_U8:        result.value = static_cast< std::uint64_t >( field.value.u8 ); break;
+          case AMQP_FIELD_KIND_I16:       result.value = static_cast< std::int64_t >( field.value.i16 ); break;
+          case AMQP_FIELD_KIND_U16:       result.value = static_cast< std::uint64_t >( field.value.u16 ); break;
+          case AMQP_FIELD_KIND_I32:       result.value = static_cast< std::int64_t >( field.value.i32 ); break;
+          case AMQP_FIELD_KIND_U32:       result.value = static_cast< std::uint64_t >( field.value.u32 ); break;
+          case AMQP_FIELD_KIND_I64:       result.value = static_cast< std::int64_t >( field.value.i64 ); break;
+          case AMQP_FIELD_KIND_U64:       result.value = static_cast< std::uint64_t >( field.value.u64 ); break;
+          case AMQP_FIELD_KIND_TIMESTAMP: result.value = static_cast< std::uint64_t >( field.value.u64 ); break;
+          case AMQP_FIELD_KIND_F32:       result.value = static_cast< double >( field.value.f32 ); break;
+          case AMQP_FIELD_KIND_F64:       result.value = field.value.f64; break;
+          case AMQP_FIELD_KIND_UTF8:
+          case AMQP_FIELD_KIND_BYTES:     result.value = toString( field.value.bytes ); break;
+          case AMQP_FIELD_KIND_TABLE:     result.value = decodeTable( field.value.table ); break;
+          case AMQP_FIELD_KIND_ARRAY:
+          {
+               HeaderArray array;
+               array.reserve( field.value.array.num_entries );
+               for( int i = 0; i < field.value.array.num_entries; ++i )
+               {
+                    array.push_back( decodeField( field.value.array.entries[ i ] ) );
+               }
+               result.value = std::move( array );
+               break;
+          }
+          default:
+               break;
+     }
+
+     return result;
+}
+
+
+HeaderTable decodeTable( const amqp_table_t& table )
+{
+     HeaderTable result;
+     for( int i = 0; i < table.num_entries; ++i )
+     {
+          result.emplace( toString( table.entries[ i ].key ), decodeField( table.entries[ i ].value ) );
+     }
+     return result;
+}
+
+
+Delivery::Delivery( const amqp_envelope_t& envelope )
+     : envelope_( envelope )
+{}
+
+
+Delivery::~Delivery()
+{
+     release();
+}
+
+
+Delivery::Delivery( Delivery&& rhs )
+     : envelope_( rhs.envelope_ )
+     , owned_( rhs.owned_ )
+     , exchange_( std::move( rhs.exchange_ ) )
+     , routingKey_( std::move( rhs.routingKey_ ) )
+     , consumerTag_( std::move( rhs.consumerTag_ ) )
+     , properties_( std::move( rhs.properties_ ) )
+     , headers_( std::move( rhs.headers_ ) )
+     , payload_( std::move( rhs.payload_ ) )
+     , body_( std::move( rhs.body_ ) )
+     , epoch_( rhs.epoch_ )
+{
+     rhs.owned_ = false;
+}
+
+
+Delivery& Delivery::operator=( Delivery&& rhs )
+{
+     if( this != &rhs )
+     {
+          release();
+          envelope_ = rhs.envelope_;
+          owned_ = rhs.owned_;
+          exchange_ = std::move( rhs.exchange_ );
+          routingKey_ = std::move( rhs.routingKey_ );
+          consumerTag_ = std::move( rhs.consumerTag_ );
+          properties_ = std::move( rhs.properties_ );
+          headers_ = std::move( rhs.headers_ );
+          payload_ = std::move( rhs.payload_ );
+          body_ = std::move( rhs.body_ );
+          epoch_ = rhs.epoch_;
+          rhs.owned_ = false;
+     }
+     return *this;
+}
+
+
+void Delivery::release()
+{
+     if( owned_ )
+     {
+          amqp_destroy_envelope( &envelope_ );
+          owned_ = false;
+     }
+}
+
+
+boost::string_ref Delivery::body() const
+{
+     if( body_ )
+     {
+          return *body_;
+     }
+     if( payload_ )
+     {
+          return payload_->body();
+     }
+     return boost::string_ref( static_cast< const char* >( envelope_.message.body.bytes ), envelope_.message.body.len );
+}
+
+
+std::string Delivery::message() const
+{
+     return body().to_string();
+}
+
+
+const std::string& Delivery::exchange() const
+{
+     if( !exchange_ )
+     {
+          exchange_ = toString( envelope_.exchange );
+     }
+     return *exchange_;
+}
+
+
+const std::string& Delivery::routingKey() const
+{
+     if( !routingKey_ )
+     {
+          routingKey_ = toString( envelope_.routing_key );
+     }
+     return *routingKey_;
+}
+
+
+const std::string& Delivery::consumerTag() const
+{
+     if( !consumerTag_ )
+     {
+          consumerTag_ = toString( envelope_.consumer_tag );
+     }
+     return *consumerTag_;
+}
+
+
+const MessageProperties& Delivery::properties() const
+{
+     if( !properties_ )
+     {
+          const auto& p = envelope_.message.properties;
+
+          MessageProperties result;
+          result.contentType = aux::optionalString( p, AMQP_BASIC_CONTENT_TYPE_FLAG, p.content_type );
+          result.contentEncoding = aux::optionalString( p, AMQP_BASIC_CONTENT_ENCODING_FLAG, p.content_encoding );
+          result.deliveryMode = aux::optionalValue( p, AMQP_BASIC_DELIVERY_MODE_FLAG, p.delivery_mode );
+          result.priority = aux::optionalValue( p, AMQP_BASIC_PRIORITY_FLAG, p.priority );
+          result.correlationId = aux::optionalString( p, AMQP_BASIC_CORRELATION_ID_FLAG, p.correlation_id );
+          result.replyTo = aux::optionalString( p, AMQP_BASIC_REPLY_TO_FLAG, p.reply_to );
+          result.expiration = aux::optionalString( p, AMQP_BASIC_EXPIRATION_FLAG, p.expiration );
+          result.messageId = aux::optionalString( p, AMQP_BASIC_MESSAGE_ID_FLAG, p.message_id );
+          result.timestamp = aux::optionalValue( p, AMQP_BASIC_TIMESTAMP_FLAG, p.timestamp );
+          result.type = aux::optionalString( p, AMQP_BASIC_TYPE_FLAG, p.type );
+          result.userId = aux::optionalString( p, AMQP_BASIC_USER_ID_FLAG, p.user_id );
+          result.appId = aux::optionalString( p, AMQP_BASIC_APP_ID_FLAG, p.app_id );
+          result.clusterId = aux::optionalString( p, AMQP_BASIC_CLUSTER_ID_FLAG, p.cluster_id );
+
+          properties_ = std::move( result );
+     }
+     return *properties_;
+}
+
+
+const HeaderTable& Delivery::headers() const
+{
+     if( !headers_ )
+     {
+          const auto& p = envelope_.message.properties;
+          headers_ = ( p._flags & AMQP_BASIC_HEADERS_FLAG ) ? decodeTable( p.headers ) : HeaderTable();
+     }
+     return *headers_;
+}
+
+
+boost::optional< HeaderValue > Delivery::header( const std::string& name ) const
+{
+     if( headers_ )
+     {
+          const auto found = headers_->find( name );
+          return found != headers_->end() ? boost::make_optional( found->second ) : boost::none;
+     }
+
+     const auto& p = envelope_.message.properties;
+     if( !( p._flags & AMQP_BASIC_HEADERS_FLAG ) )
+     {
+          return boost::none;
+     }
+
+     for( int i = 0; i < p.headers.num_entries; ++i )
+     {
+          const auto& entry = p.headers.entries[ i ];
+          if( entry.key.len == name.size() && std::memcmp( entry.key.bytes, name.data(), name.size() ) == 0 )
+          {
+               return decodeField( entry.value );
+          }
+     }
+
+     return boost::none;
+}
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
@@ -0,0 +1,204 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#include <rabbitmq_client/encryption.h>
+
+#include <stdexcept>
+#include <boost/throw_exception.hpp>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+namespace {
+namespace aux {
+
+
+void opensslError( const std::string& operation )
+{
+     BOOST_THROW_EXCEPTION( std::runtime_error( "openssl error: " + operation ) );
+}
+
+
+typedef std::unique_ptr< EVP_CIPHER_CTX, void(*)( EVP_CIPHER_CTX* ) > CipherContext;
+
+
+CipherContext makeContext( const std::string& key, bool encrypt )
+{
+     CipherContext ctx( EVP_CIPHER_CTX_new(), EVP_CIPHER_CTX_free );
+     if( !ctx )
+     {
+          opensslError( "cannot allocate cipher context" );
+     }
+
+     /// Ключ разворачивается один раз; для каждого сообщения затем устанавливается только nonce
+     const auto ok = EVP_CipherInit_ex(
+          ctx.get(),
+          EVP_aes_256_gcm(),
+          nullptr,
+          reinterpret_cast< const unsigned char* >( key.data() ),
+          nullptr,
+          encrypt ? 1 : 0
+     );
+     if( ok != 1 )
+     {
+          opensslError( "cannot initialize cipher context" );
+     }
+     return ctx;
+}
+
+
+} // namespace aux
+} // namespace {unnamed}
+
+
+/// Ключ с контекстами шифрования и расшифрования
+struct PayloadCipher::Key
+{
+     Key( const std::string& id_, const std::string& key )
+          : id( id_ )
+          , encryptor( aux::makeContext( key, true ) )
+          , decryptor( aux::makeContext( key, false ) )
+     {}
+
+     std::string id;
+     aux::CipherContext encryptor;
+     aux::CipherContext decryptor;
+};
+
+
+const char* const PayloadCipher::KEY_ID_HEADER = "x-key-id";
+
+
+PayloadCipher::PayloadCipher() = default;
+
+
+PayloadCipher::~PayloadCipher() = default;
+
+
+void PayloadCipher::addKey( const std::string& keyId, const std::string& key )
+{
+     if( keyId.empty() || key.size() != KEY_SIZE )
+     {
+          BOOST_THROW_EXCEPTION( std::invalid_argument( "invalid payload encryption key: " + keyId ) );
+     }
+
+     std::unique_ptr< Key > entry( new Key( keyId, key ) );
+     auto& slot = keys_[ keyId ];
+     const bool wasActive = slot && slot.get() == active_;
+     slot = std::move( entry );
+
+     if( !active_ || wasActive )
+     {
+          active_ = slot.get();
+     }
+}
+
+
+void PayloadCipher::setActiveKey( const std::string& keyId )
+{
+     const auto found = keys_.find( keyId );
+     if( found == keys_.end() )
+     {
+          BOOST_THROW_EXCEPTION( std::invalid_argument( "unknown payload encryption key: " + keyId ) );
+     }
+     active_ = found->second.get();
+}
+
+
+void PayloadCipher::removeKey( const std::string& keyId )
+{
+     const auto found = keys_.find( keyId );
+     if( found == keys_.end() )
+     {
+          return;
+     }
+     if( found->second.get() == active_ )
+     {
+          active_ = nullptr;
+     }
+     keys_.erase( found );
+}
+
+
+const std::string& PayloadCipher::activeKey() const
+{
+     static const std::string none;
+     return active_ ? active_->id : none;
+}
+
+
+const std::string& PayloadCipher::encrypt( boost::string_ref plain, std::string& sealed )
+{
+     if( !active_ )
+     {
+          BOOST_THROW_EXCEPTION( std::logic_error( "no active payload encryption key" ) );
+     }
+
+     auto& key = *active_;
+     auto ctx = key.encryptor.get();
+
+     sealed.resize( NONCE_SIZE + plain.size() + TAG_SIZE );
+     auto out = reinterpret_cast< unsigned char* >( &sealed[ 0 ] );
+
+     /// Nonce выбирается случайно для каждого сообщения: префикс со счетчиком повторялся бы
+     /// у разных объектов с одним ключом, что для GCM раскрывает ключ аутентификации
+     if( RAND_bytes( out, NONCE_SIZE ) != 1 )
+     {
+          aux::opensslError( "cannot generate nonce" );
+     }
+
+     int len = 0;
+     if( EVP_EncryptInit_ex( ctx, nullptr, nullptr, nullptr, out ) != 1
+          || EVP_EncryptUpdate( ctx, nullptr, &len, reinterpret_cast< const unsigned char* >( key.id.data() ), key.id.size() ) != 1
+          || EVP_EncryptUpdate( ctx, out + NONCE_SIZE, &len, reinterpret_cast< const unsigned char* >( plain.data() ), plain.size() ) != 1
+          || EVP_EncryptFinal_ex( ctx, out + NONCE_SIZE + len, &len ) != 1
+          || EVP_CIPHER_CTX_ctrl( ctx, EVP_CTRL_GCM_GET_TAG, TAG_SIZE, out + NONCE_SIZE + plain.size() ) != 1 )
+     {
+          aux::opensslError( "cannot encrypt payload" );
+     }
+
+     return key.id;
+}
+
+
+bool PayloadCipher::decrypt( const std::string& keyId, boost::string_ref sealed, std::string& plain )
+{
+     const auto found = keys_.find( keyId );
+     if( found == keys_.end() || sealed.size() < NONCE_SIZE + TAG_SIZE )
+     {
+          return false;
+     }
+
+     auto& key = *found->second;
+     auto ctx = key.decryptor.get();
+
+     const auto in = reinterpret_cast< const unsigned char* >( sealed.data() );
+     const auto size = sealed.size() - NONCE_SIZE - TAG_SIZE;
+
+     plain.resize( size );
+     auto out = reinterpret_cast< unsigned char* >( &plain[ 0 ] );
+
+     /// Тег передается до завершения расшифрования; EVP_DecryptFinal_ex() проверяет его
+     int len = 0;
+     const bool ok = EVP_DecryptInit_ex( ctx, nullptr, nullptr, nullptr, in ) == 1
+          && EVP_DecryptUpdate( ctx, nullptr, &len, reinterpret_cast< const unsigned char* >( key.id.data() ), key.id.size() ) == 1
+          && EVP_DecryptUpdate( ctx, out, &len, in + NONCE_SIZE, size ) == 1
+          && EVP_CIPHER_CTX_ctrl( ctx, EVP_CTRL_GCM_SET_TAG, TAG_SIZE, const_cast< unsigned char* >( in + NONCE_SIZE + size ) ) == 1
+          && EVP_DecryptFinal_ex( ctx, out + len, &len ) == 1;
+
+     if( !ok )
+     {
+          plain.clear();
+     }
+     return ok;
+}
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
@@ -0,0 +1,302 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#include <rabbitmq_client/fair_consumer.h>
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <boost/throw_exception.hpp>
+#include <rabbitmq_client/error.h>
+#include <rabbitmq_client/topology.h>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+namespace {
+namespace aux {
+
+
+/// Проверяет параметры до установки соединения
+const FairConsumer::Parameters& validated( const FairConsumer::Parameters& params )
+{
+     if( params.queues.empty() )
+     {
+          BOOST_THROW_EXCEPTION( std::invalid_argument( "no queues to consume" ) );
+     }
+     if( params.quantum == 0 )
+     {
+          BOOST_THROW_EXCEPTION( std::invalid_argument( "zero scheduling quantum" ) );
+     }
+     for( const auto& queue : params.queues )
+     {
+          if( queue.weight == 0 )
+          {
+               BOOST_THROW_EXCEPTION( std::invalid_argument( "zero weight of queue " + queue.queueName ) );
+          }
+     }
+     return params;
+}
+
+
+} // namespace aux
+} // namespace {unnamed}
+
+
+FairConsumer::FairConsumer( const Connection::Parameters& connectionParams, const Parameters& params )
+     : params_( aux::validated( params ) )
+     , connection_( connectionParams )
+     , states_( params.queues.size() )
+{
+     const auto& queues = params_.queues;
+
+     std::uint64_t totalWeight = 0;
+     for( const auto& queue : queues )
+     {
+          totalWeight += queue.weight;
+     }
+
+     std::map< std::int32_t, Level, std::greater< std::int32_t > > levels;
+     for( std::size_t i = 0; i < queues.size(); ++i )
+     {
+          const auto share = params_.prefetchBudget * queues[ i ].weight / totalWeight;
+          prefetch_.push_back( queues[ i ].prefetchCount
+               ? *queues[ i ].prefetchCount
+               : static_cast< std::uint16_t >( std::min< std::uint64_t >( std::max< std::uint64_t >( share, 1 ), std::numeric_limits< std::uint16_t >::max() ) ) );
+
+          levels[ queues[ i ].priority ].queues.push_back( i );
+     }
+     for( auto& level : levels )
+     {
+          levels_.push_back( std::move( level.second ) );
+     }
+
+     subscribe();
+}
+
+
+boost::optional< Delivery > FairConsumer::consume( const boost::optional< boost::posix_time::time_duration >& timeout )
+{
+     try
+     {
+          collect();
+          if( buffered() == 0 )
+          {
+               auto delivery = SimpleClient::consumeDelivery( connection_, timeout );
+               if( !delivery )
+               {
+                    return boost::none;
+               }
+               enqueue( std::move( *delivery ) );
+
+               /// Доставки, принятые вместе с первой, участвуют в выборе наравне с ней
+               collect();
+          }
+          return schedule();
+     }
+     catch( const ConnectionError& )
+     {}
+
+     reconnect();
+     collect();
+     if( buffered() == 0 )
+     {
+          if( auto delivery = SimpleClient::consumeDelivery( connection_, timeout ) )
+          {
+               enqueue( std::move( *delivery ) );
+          }
+     }
+     return schedule();
+}
+
+
+const std::string& FairConsumer::queueOf( const Delivery& delivery ) const
+{
+     const auto found = tags_.find( delivery.consumerTag() );
+     if( found == tags_.end() )
+     {
+          BOOST_THROW_EXCEPTION( std::invalid_argument( "delivery of unknown consumer " + delivery.consumerTag() ) );
+     }
+     return params_.queues[ found->second ].queueName;
+}
+
+
+void FairConsumer::ack( const Delivery& delivery )
+{
+     ensureCurrent( delivery );
+     try
+     {
+          SimpleClient::ackMessage( connection_, delivery.deliveryTag() );
+     }
+     catch( const ConnectionError& )
+     {
+          reconnect();
+          throw;
+     }
+}
+
+
+void FairConsumer::nack( const Delivery& delivery, bool requeue )
+{
+     ensureCurrent( delivery );
+     try
+     {
+          SimpleClient::nackMessage( connection_, delivery.deliveryTag(), false, requeue );
+     }
+     catch( const ConnectionError& )
+     {
+          reconnect();
+          throw;
+     }
+}
+
+
+std::size_t FairConsumer::buffered() const
+{
+     std::size_t count = 0;
+     for( const auto& state : states_ )
+     {
+          count += state.buffer.size();
+     }
+     return count;
+}
+
+
+void FairConsumer::reconnect()
+{
+     /// Доставки прежнего соединения подтвердить нельзя: брокер вернул их в очереди при разрыве
+     for( auto& state : states_ )
+     {
+          state.buffer.clear();
+          state.deficit = 0;
+          state.inTurn = false;
+     }
+     tags_.clear();
+     ++epoch_;
+
+     connection_.reconnect();
+     subscribe();
+}
+
+
+void FairConsumer::subscribe()
+{
+     Topology topology;
+     for( std::size_t i = 0; i < params_.queues.size(); ++i )
+     {
+          SimpleClient::ConsumerParameters consumer;
+          consumer.prefetchCount = prefetch_[ i ];
+          topology.consume( params_.queues[ i ].queueName, consumer );
+     }
+
+     const auto report = topology.apply( connection_ );
+     for( std::size_t i = 0; i < report.consumers.size(); ++i )
+     {
+          const auto& outcome = report.consumers[ i ];
+          if( !outcome.ok )
+          {
+               BOOST_THROW_EXCEPTION( std::runtime_error( "cannot consume queue " + params_.queues[ i ].queueName + ": " + outcome.error ) );
+          }
+          tags_[ outcome.value ] = i;
+     }
+}
+
+
+void FairConsumer::collect()
+{
+     /// Объем принятых данных ограничен суммой prefetchCount подписок
+     while( auto delivery = SimpleClient::consumeDelivery( connection_, boost::posix_time::time_duration() ) )
+     {
+          enqueue( std::move( *delivery ) );
+     }
+}
+
+
+void FairConsumer::enqueue( Delivery&& delivery )
+{
+     const auto found = tags_.find( delivery.consumerTag() );
+     if( found == tags_.end() )
+     {
+          /// Доставка подписки, не созданной подписчиком, возвращается в очередь
+          SimpleClient::nackMessage( connection_, delivery.deliveryTag(), false, true );
+          return;
+     }
+     delivery.stampEpoch( epoch_ );
+     states_[ found->second ].buffer.push_back( std::move( delivery ) );
+}
+
+
+void FairConsumer::ensureCurrent( const Delivery& delivery ) const
+{
+     if( delivery.epoch() != epoch_ )
+     {
+          BOOST_THROW_EXCEPTION( ConnectionError( "delivery " + std::to_string( delivery.deliveryTag() )
+               + " belongs to a previous connection and will be redelivered" ) );
+     }
+}
+
+
+boost::optional< Delivery > FairConsumer::schedule()
+{
+     for( auto& level : levels_ )
+     {
+          const auto pending = std::any_of( level.queues.begin(), level.queues.end(),
+               [ this ]( std::size_t queue ){ return !states_[ queue ].buffer.empty(); } );
+          if( !pending )
+          {
+               continue;
+          }
+
+          /// Цикл завершается: дефицит непустой очереди растет на каждом круге, пока не покроет ее первое сообщение
+          while( true )
+          {
+               const auto queue = level.queues[ level.cursor ];
+               auto& state = states_[ queue ];
+
+               if( state.buffer.empty() )
+               {
+                    /// Опустевшая очередь не накапливает дефицит
+                    state.deficit = 0;
+                    state.inTurn = false;
+                    level.cursor = ( level.cursor + 1 ) % level.queues.size();
+                    continue;
+               }
+
+               if( !state.inTurn )
+               {
+                    state.deficit += params_.quantum * params_.queues[ queue ].weight;
+                    state.inTurn = true;
+               }
+
+               const auto size = std::max< std::size_t >( state.buffer.front().body().size(), 1 );
+               if( size <= state.deficit )
+               {
+                    state.deficit -= size;
+                    auto delivery = std::move( state.buffer.front() );
+                    state.buffer.pop_front();
+
+                    if( state.buffer.empty() )
+                    {
+                         state.deficit = 0;
+                         state.inTurn = false;
+                         level.cursor = ( level.cursor + 1 ) % level.queues.size();
+                    }
+                    return delivery;
+               }
+
+               state.inTurn = false;
+               level.cursor = ( level.cursor + 1 ) % level.queues.size();
+          }
+     }
+
+     return boost::none;
+}
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
@@ -0,0 +1,186 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#include <rabbitmq_client/field_table.h>
+
+#include <algorithm>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+namespace {
+namespace aux {
+
+
+amqp_bytes_t toBytes( const std::string& str )
+{
+     amqp_bytes_t bytes;
+     bytes.len = str.size();
+     bytes.bytes = const_cast< char* >( str.data() );
+     return bytes;
+}
+
+
+} // namespace aux
+} // namespace {unnamed}
+
+
+FieldTable::FieldTable( const FieldTable& rhs )
+     : fields_( rhs.fields_ )
+     , timestamps_( rhs.timestamps_ )
+{}
+
+
+FieldTable& FieldTable::operator=( const FieldTable& rhs )
+{
+     if( this != &rhs )
+     {
+          fields_ = rhs.fields_;
+          timestamps_ = rhs.timestamps_;
+          tables_.clear();
+          arrays_.clear();
+     }
+     return *this;
+}
+
+
+FieldTable& FieldTable::set( const std::string& key, const HeaderValue::Value& value )
+{
+     timestamps_.erase( std::remove( timestamps_.begin(), timestamps_.end(), key ), timestamps_.end() );
+
+     for( auto& each: fields_ )
+     {
+          if( each.first == key )
+          {
+               each.second.value = value;
+               return *this;
+          }
+     }
+
+     fields_.emplace_back( key, HeaderValue{ value } );
+     return *this;
+}
+
+
+FieldTable& FieldTable::setTimestamp( const std::string& key, std::uint64_t seconds )
+{
+     set( key, seconds );
+     timestamps_.push_back( key );
+     return *this;
+}
+
+
+amqp_table_t FieldTable::native() const
+{
+     tables_.clear();
+     arrays_.clear();
+
+     std::vector< std::pair< const std::string*, const HeaderValue* > > fields;
+     fields.reserve( fields_.size() );
+     for( const auto& each: fields_ )
+     {
+          fields.emplace_back( &each.first, &each.second );
+     }
+
+     auto table = encodeTable( fields );
+
+     /// Значение timestamp хранится как std::uint64_t и отличается от него только типом поля
+     for( int i = 0; i < table.num_entries; ++i )
+     {
+          const std::string& key = *fields[ i ].first;
+          if( std::find( timestamps_.begin(), timestamps_.end(), key ) != timestamps_.end() )
+          {
+               table.entries[ i ].value.kind = AMQP_FIELD_KIND_TIMESTAMP;
+          }
+     }
+     return table;
+}
+
+
+amqp_table_t FieldTable::encodeTable( const std::vector< std::pair< const std::string*, const HeaderValue* > >& fields ) const
+{
+     if( fields.empty() )
+     {
+          return amqp_empty_table;
+     }
+
+     tables_.emplace_back( fields.size() );
+     auto& entries = tables_.back();
+
+     for( std::size_t i = 0; i < fields.size(); ++i )
+     {
+          entries[ i ].key = aux::toBytes( *fields[ i ].first );
+          encode( *fields[ i ].second, entries[ i ].value );
+     }
+
+     amqp_table_t table;
+     table.num_entries = static_cast< int >( entries.size() );
+     table.entries = entries.data();
+     return table;
+}
+
+
+void FieldTable::encode( const HeaderValue& value, amqp_field_value_t& out ) const
+{
+     const auto& v = value.value;
+
+     if( const auto b = boost::get< bool >( &v ) )
+     {
+          out.kind = AMQP_FIELD_KIND_BOOLEAN;
+          out.value.boolean = *b;
+     }
+     else if( const auto i = boost::get< std::int64_t >( &v ) )
+     {
+          out.kind = AMQP_FIELD_KIND_I64;
+          out.value.i64 = *i;
+     }
+     else if( const auto u = boost::get< std::uint64_t >( &v ) )
+     {
+          out.kind = AMQP_FIELD_KIND_U64;
+          out.value.u64 = *u;
+     }
+     else if( const auto d = boost::get< double >( &v ) )
+     {
+          out.kind = AMQP_FIELD_KIND_F64;
+          out.value.f64 = *d;
+     }
+     else if( const auto s = boost::get< std::string >( &v ) )
+     {
+          out.kind = AMQP_FIELD_KIND_UTF8;
+          out.value.bytes = aux::toBytes( *s );
+     }
+     else if( const auto t = boost::get< HeaderTable >( &v ) )
+     {
+          std::vector< std::pair< const std::string*, const HeaderValue* > > fields;
+          for( const auto& each: *t )
+          {
+               fields.emplace_back( &each.first, &each.second );
+          }
+          out.kind = AMQP_FIELD_KIND_TABLE;
+          out.value.table = encodeTable( fields );
+     }
+     else if( const auto a = boost::get< HeaderArray >( &v ) )
+     {
+          arrays_.emplace_back( a->size() );
+          auto& items = arrays_.back();
+          for( std::size_t i = 0; i < a->size(); ++i )
+          {
+               encode( ( *a )[ i ], items[ i ] );
+          }
+          out.kind = AMQP_FIELD_KIND_ARRAY;
+          out.value.array.num_entries = static_cast< int >( items.size() );
+          out.value.array.entries = items.data();
+     }
+     else
+     {
+          out.kind = AMQP_FIELD_KIND_VOID;
+     }
+}
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
@@ -0,0 +1,163 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#include <rabbitmq_client/integrity.h>
+
+#include <cstring>
+
+#if defined( __x86_64__ ) && defined( __GNUC__ )
+#include <nmmintrin.h>
+#define RABBITMQ_CLIENT_HAS_SSE42_CRC 1
+#endif
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+namespace {
+namespace aux {
+
+
+/// Отраженный полином CRC-32C
+const std::uint32_t POLY = 0x82f63b78;
+
+
+/// Таблицы slicing-by-8: table[ k ][ b ] - сумма байта b, за которым следуют k нулевых байт
+struct Tables
+{
+     Tables()
+     {
+          for( std::uint32_t b = 0; b < 256; ++b )
+          {
+               std::uint32_t crc = b;
+               for( int i = 0; i < 8; ++i )
+               {
+                    crc = ( crc >> 1 ) ^ ( POLY & ( 0 - ( crc & 1 ) ) );
+               }
+               table[ 0 ][ b ] = crc;
+          }
+          for( std::uint32_t b = 0; b < 256; ++b )
+          {
+               for( int k = 1; k < 8; ++k )
+               {
+                    table[ k ][ b ] = ( table[ k - 1 ][ b ] >> 8 ) ^ table[ 0 ][ table[ k - 1 ][ b ] & 0xff ];
+               }
+          }
+     }
+
+     std::uint32_t table[ 8 ][ 256 ];
+};
+
+
+std::uint32_t crc32cSoftware( const char* data, std::size_t size, std::uint32_t crc )
+{
+     static const Tables tables;
+     const auto& t = tables.table;
+
+     const auto bytes = reinterpret_cast< const unsigned char* >( data );
+     std::size_t i = 0;
+
+     for( ; size - i >= 8; i += 8 )
+     {
+          std::uint32_t lo;
+          std::uint32_t hi;
+          std::memcpy( &lo, bytes + i, 4 );
+          std::memcpy( &hi, bytes + i + 4, 4 );
+          lo ^= crc;
+          crc = t[ 7 ][ lo & 0xff ] ^ t[ 6 ][ ( lo >> 8 ) & 0xff ] ^ t[ 5 ][ ( lo >> 16 ) & 0xff ] ^ t[ 4 ][ lo >> 24 ]
+               ^ t[ 3 ][ hi & 0xff ] ^ t[ 2 ][ ( hi >> 8 ) & 0xff ] ^ t[ 1 ][ ( hi >> 16 ) & 0xff ] ^ t[ 0 ][ hi >> 24 ];
+     }
+     for( ; i < size; ++i )
+     {
+          crc = ( crc >> 8 ) ^ t[ 0 ][ ( crc ^ bytes[ i ] ) & 0xff ];
+     }
+     return crc;
+}
+
+
+#ifdef RABBITMQ_CLIENT_HAS_SSE42_CRC
+
+__attribute__(( target( "sse4.2" ) ))
+std::uint32_t crc32cHardware( const char* data, std::size_t size, std::uint32_t crc32 )
+{
+     std::uint64_t crc = crc32;
+     std::size_t i = 0;
+
+     /// Четыре независимых загрузки на итерацию скрывают задержку чтения; сама инструкция crc32
+     /// выполняется последовательно с пропускной способностью 8 байт за такт
+     for( ; size - i >= 32; i += 32 )
+     {
+          std::uint64_t words[ 4 ];
+          std::memcpy( words, data + i, sizeof( words ) );
+          crc = _mm_crc32_u64( crc, words[ 0 ] );
+          crc = _mm_crc32_u64( crc, words[ 1 ] );
+          crc = _mm_crc32_u64( crc, words[ 2 ] );
+          crc = _mm_crc32_u64( crc, words[ 3 ] );
+     }
+     for( ; size - i >= 8; i += 8 )
+     {
+          std::uint64_t word;
+          std::memcpy( &word, data + i, sizeof( word ) );
+          crc = _mm_crc32_u64( crc, word );
+     }
+
+     auto result = static_cast< std::uint32_t >( crc );
+     for( ; i < size; ++i )
+     {
+          result = _mm_crc32_u8( result, static_cast< unsigned char >( data[ i ] ) );
+     }
+     return result;
+}
+
+
+bool detectHardware()
+{
+     return __builtin_cpu_supports( "sse4.2" );
+}
+
+#else
+
+std::uint32_t crc32cHardware( const char* data, std::size_t size, std::uint32_t crc )
+{
+     return crc32cSoftware( data, size, crc );
+}
+
+
+bool detectHardware()
+{
+     return false;
+}
+
+#endif
+
+
+} // namespace aux
+} // namespace {unnamed}
+
+
+const char* const Integrity::HEADER = "x-crc32c";
+
+
+std::uint32_t Integrity::crc32c( boost::string_ref data, std::uint32_t crc )
+{
+     static const bool hardware = aux::detectHardware();
+
+     crc = ~crc;
+     crc = hardware
+          ? aux::crc32cHardware( data.data(), data.size(), crc )
+          : aux::crc32cSoftware( data.data(), data.size(), crc );
+     return ~crc;
+}
+
+
+bool Integrity::hardwareAccelerated()
+{
+     return aux::detectHardware();
+}
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
@@ -0,0 +1,104 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#include <rabbitmq_client/mapped_file.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <boost/throw_exception.hpp>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+
+namespace {
+namespace throw_exception {
+
+
+void systemError( const std::string& message, const std::string& path )
+{
+     BOOST_THROW_EXCEPTION( std::runtime_error( message + " " + path + ": " + std::strerror( errno ) ) );
+}
+
+
+} // namespace throw_exception
+} // namespace {unnamed}
+
+
+MappedFile::MappedFile( const std::string& path, std::size_t size, Mode mode )
+     : path_( path )
+     , size_( size )
+{
+     const bool readOnly = mode == Mode::ReadOnly;
+
+     fd_ = readOnly ? ::open( path.c_str(), O_RDONLY ) : ::open( path.c_str(), O_RDWR | O_CREAT, 0644 );
+     if( fd_ < 0 )
+     {
+          throw_exception::systemError( "cannot open file", path );
+     }
+
+     struct stat st = {};
+     if( ::fstat( fd_, &st ) != 0 )
+     {
+          ::close( fd_ );
+          throw_exception::systemError( "cannot stat file", path );
+     }
+
+     if( static_cast< std::size_t >( st.st_size ) < size )
+     {
+          if( readOnly )
+          {
+               ::close( fd_ );
+               BOOST_THROW_EXCEPTION( std::runtime_error( "file is too small: " + path ) );
+          }
+          if( ::ftruncate( fd_, size ) != 0 )
+          {
+               ::close( fd_ );
+               throw_exception::systemError( "cannot resize file", path );
+          }
+          created_ = true;
+     }
+
+     void* addr = ::mmap( nullptr, size, readOnly ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0 );
+     if( addr == MAP_FAILED )
+     {
+          ::close( fd_ );
+          throw_exception::systemError( "cannot map file", path );
+     }
+     data_ = static_cast< char* >( addr );
+}
+
+
+MappedFile::~MappedFile()
+{
+     if( data_ )
+     {
+          ::munmap( data_, size_ );
+     }
+     if( fd_ >= 0 )
+     {
+          ::close( fd_ );
+     }
+}
+
+
+void MappedFile::flush()
+{
+     if( ::msync( data_, size_, MS_SYNC ) != 0 )
+     {
+          throw_exception::systemError( "cannot flush file", path_ );
+     }
+}
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
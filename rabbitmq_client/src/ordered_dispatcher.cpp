@@ -0,0 +1,263 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#include <rabbitmq_client/ordered_dispatcher.h>
+
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <boost/throw_exception.hpp>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+
+OrderedDispatcher::OrderedDispatcher( SimpleClient& client, const Handler& handler, const Parameters& params )
+     : client_( client )
+     , handler_( handler )
+     , params_( params )
+{
+     if( !params.lanes || !params.laneCapacity )
+     {
+          BOOST_THROW_EXCEPTION( std::invalid_argument( "dispatcher lanes count and capacity must be positive" ) );
+     }
+
+     lanes_.reserve( params.lanes );
+     for( std::size_t i = 0; i < params.lanes; ++i )
+     {
+          lanes_.emplace_back( new Lane );
+     }
+     for( auto& each: lanes_ )
+     {
+          auto lane = each.get();
+          lane->thread = boost::thread( [ this, lane ](){ run( *lane ); } );
+     }
+}
+
+
+OrderedDispatcher::~OrderedDispatcher()
+{
+     {
+          boost::lock_guard< boost::mutex > lock( mutex_ );
+          stop_ = true;
+          for( auto& each: lanes_ )
+          {
+               each->ready.notify_one();
+          }
+     }
+     for( auto& each: lanes_ )
+     {
+          each->thread.join();
+     }
+}
+
+
+bool OrderedDispatcher::poll( const boost::posix_time::time_duration& timeout )
+{
+     settle();
+
+     auto delivery = client_.consumeDelivery( timeout );
+     if( delivery )
+     {
+          dispatch( std::move( *delivery ) );
+     }
+
+     settle();
+     return !!delivery;
+}
+
+
+void OrderedDispatcher::dispatch( Delivery&& delivery )
+{
+     const auto tag = delivery.deliveryTag();
+     auto& lane = *lanes_[ std::hash< std::string >()( keyOf( delivery ) ) % lanes_.size() ];
+
+     while( true )
+     {
+          {
+               boost::unique_lock< boost::mutex > lock( mutex_ );
+               if( lane.queue.size() < params_.laneCapacity )
+               {
+                    outstanding_.emplace_back( tag, State::Pending );
+                    lane.queue.push_back( std::move( delivery ) );
+                    lane.ready.notify_one();
+                    return;
+               }
+
+               /// Полоса заполнена: ждем завершения обработки любого сообщения и отправляем подтверждения вне блокировки
+               completed_.wait( lock );
+          }
+          settle();
+     }
+}
+
+
+std::size_t OrderedDispatcher::settle()
+{
+     std::deque< Completion > completions;
+     {
+          boost::lock_guard< boost::mutex > lock( mutex_ );
+          completions.swap( completions_ );
+     }
+
+     for( auto each = completions.begin(); each != completions.end(); ++each )
+     {
+          /// Неудачные сообщения завершаются по отдельности до подтверждения с флагом multiple, иначе оно бы их захватило
+          if( each->failed )
+          {
+               try
+               {
+                    client_.failMessage( *each->failed );
+               }
+               catch( ... )
+               {
+                    /// Необработанные завершения (включая текущее) возвращаются в очередь, иначе их сообщения
+                    /// навсегда остались бы в outstanding_ в состоянии Pending и finish() не завершился бы
+                    boost::lock_guard< boost::mutex > lock( mutex_ );
+                    completions_.insert( completions_.begin(),
+                         std::make_move_iterator( each ), std::make_move_iterator( completions.end() ) );
+                    throw;
+               }
+          }
+
+          const auto found = std::lower_bound(
+               outstanding_.begin(),
+               outstanding_.end(),
+               each->deliveryTag,
+               []( const std::pair< std::uint64_t, State >& lhs, std::uint64_t rhs ){ return lhs.first < rhs; }
+          );
+          if( found != outstanding_.end() && found->first == each->deliveryTag )
+          {
+               found->second = each->failed ? State::Failed : State::Processed;
+          }
+     }
+
+     std::size_t settled = 0;
+     boost::optional< std::uint64_t > ackTag;
+
+     while( !outstanding_.empty() && outstanding_.front().second != State::Pending )
+     {
+          /// Подтверждение с флагом multiple должно указывать на неподтвержденное сообщение, поэтому
+          /// в качестве его идентификатора берется последнее успешно обработанное
+          if( outstanding_.front().second == State::Processed )
+          {
+               ackTag = outstanding_.front().first;
+          }
+          outstanding_.pop_front();
+          ++settled;
+     }
+
+     if( ackTag )
+     {
+          client_.ackMessage( *ackTag, true );
+     }
+     return settled;
+}
+
+
+void OrderedDispatcher::finish()
+{
+     while( !outstanding_.empty() )
+     {
+          {
+               boost::unique_lock< boost::mutex > lock( mutex_ );
+               while( completions_.empty() )
+               {
+                    completed_.wait( lock );
+               }
+          }
+          settle();
+     }
+}
+
+
+std::string OrderedDispatcher::keyOf( const Delivery& delivery ) const
+{
+     switch( params_.key )
+     {
+          case KeySource::RoutingKey:
+               return delivery.routingKey();
+
+          case KeySource::Header:
+          {
+               const auto header = delivery.header( params_.header );
+               if( !header )
+               {
+                    return std::string();
+               }
+               if( const auto s = boost::get< std::string >( &header->value ) )
+               {
+                    return *s;
+               }
+               if( const auto i = boost::get< std::int64_t >( &header->value ) )
+               {
+                    return std::to_string( *i );
+               }
+               if( const auto u = boost::get< std::uint64_t >( &header->value ) )
+               {
+                    return std::to_string( *u );
+               }
+               return std::string();
+          }
+
+          case KeySource::MessageIdPrefix:
+          {
+               const auto& props = delivery.native().message.properties;
+               if( !( props._flags & AMQP_BASIC_MESSAGE_ID_FLAG ) )
+               {
+                    return std::string();
+               }
+               const std::string id( static_cast< const char* >( props.message_id.bytes ), props.message_id.len );
+               return id.substr( 0, id.find( params_.delimiter ) );
+          }
+     }
+     return std::string();
+}
+
+
+void OrderedDispatcher::run( Lane& lane )
+{
+     while( true )
+     {
+          boost::optional< Delivery > delivery;
+          {
+               boost::unique_lock< boost::mutex > lock( mutex_ );
+               while( !stop_ && lane.queue.empty() )
+               {
+                    lane.ready.wait( lock );
+               }
+               if( stop_ )
+               {
+                    return;
+               }
+               delivery = std::move( lane.queue.front() );
+               lane.queue.pop_front();
+          }
+
+          bool processed = false;
+          try
+          {
+               processed = handler_( *delivery );
+          }
+          catch( ... )
+          {}
+
+          Completion completion{ delivery->deliveryTag(), boost::none };
+          if( !processed )
+          {
+               completion.failed = std::move( delivery );
+          }
+
+          boost::lock_guard< boost::mutex > lock( mutex_ );
+          completions_.push_back( std::move( completion ) );
+          completed_.notify_all();
+     }
+}
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
@@ -0,0 +1,349 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#include <rabbitmq_client/packing.h>
+
+#include <cstring>
+#include <iostream>
+#include <rabbitmq_client/error.h>
+#include <rabbitmq_client/field_table.h>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+namespace {
+namespace aux {
+
+
+const char MAGIC[ 4 ] = { 'R', 'M', 'Q', 'P' };
+
+
+void putUint32( char* dest, std::uint32_t value )
+{
+     for( int i = 0; i < 4; ++i )
+     {
+          dest[ i ] = static_cast< char >( value >> ( 8 * i ) );
+     }
+}
+
+
+std::uint32_t getUint32( const char* src )
+{
+     std::uint32_t value = 0;
+     for( int i = 0; i < 4; ++i )
+     {
+          value |= static_cast< std::uint32_t >( static_cast< unsigned char >( src[ i ] ) ) << ( 8 * i );
+     }
+     return value;
+}
+
+
+/// Формирует свойства сообщения-пакета; заголовки ссылаются на @a headers
+amqp_basic_properties_t packedProperties( FieldTable& headers, std::size_t records )
+{
+     headers.set( Packing::HEADER, static_cast< std::int64_t >( records ) );
+
+     amqp_basic_properties_t props;
+     props._flags = AMQP_BASIC_HEADERS_FLAG;
+     props.headers = headers.native();
+     return props;
+}
+
+
+} // namespace aux
+} // namespace {unnamed}
+
+
+const char* const Packing::HEADER = "x-packed";
+
+
+void Packing::begin( std::string& body )
+{
+     body.assign( aux::MAGIC, sizeof( aux::MAGIC ) );
+     body.append( 4, '\0' );
+}
+
+
+void Packing::append( std::string& body, boost::string_ref record )
+{
+     const auto count = aux::getUint32( &body[ 4 ] ) + 1;
+
+     char length[ 4 ];
+     aux::putUint32( length, record.size() );
+     body.append( length, sizeof( length ) );
+     body.append( record.data(), record.size() );
+
+     aux::putUint32( &body[ 4 ], count );
+}
+
+
+void Packing::dropLast( std::string& body, std::size_t recordSize )
+{
+     body.resize( body.size() - RECORD_OVERHEAD - recordSize );
+     aux::putUint32( &body[ 4 ], aux::getUint32( &body[ 4 ] ) - 1 );
+}
+
+
+bool Packing::unpack( boost::string_ref body, std::vector< boost::string_ref >& records )
+{
+     records.clear();
+
+     if( body.size() < PREFIX_SIZE || std::memcmp( body.data(), aux::MAGIC, sizeof( aux::MAGIC ) ) != 0 )
+     {
+          return false;
+     }
+
+     const auto count = aux::getUint32( body.data() + 4 );
+     std::size_t offset = PREFIX_SIZE;
+
+     /// Кол-во записей ограничено объемом тела, поэтому резервирование не может быть чрезмерным
+     records.reserve( std::min< std::size_t >( count, body.size() / RECORD_OVERHEAD ) );
+
+     for( std::uint32_t i = 0; i < count; ++i )
+     {
+          if( body.size() - offset < RECORD_OVERHEAD )
+          {
+               records.clear();
+               return false;
+          }
+
+          const auto length = aux::getUint32( body.data() + offset );
+          offset += RECORD_OVERHEAD;
+
+          if( body.size() - offset < length )
+          {
+               records.clear();
+               return false;
+          }
+
+          records.push_back( body.substr( offset, length ) );
+          offset += length;
+     }
+
+     if( offset != body.size() )
+     {
+          records.clear();
+          return false;
+     }
+     return true;
+}
+
+
+PackingPublisher::PackingPublisher( const Connection::Parameters& params, const Parameters& packingParams )
+     : params_( packingParams )
+     , connection_( params )
+     , worker_( [ this ](){ run(); } )
+{}
+
+
+PackingPublisher::~PackingPublisher()
+{
+     {
+          boost::lock_guard< boost::mutex > lock( mutex_ );
+          stop_ = true;
+          wakeup_.notify_one();
+     }
+     worker_.join();
+}
+
+
+void PackingPublisher::publish( const std::string& exchange, const std::string& routingKey, boost::string_ref record )
+{
+     const Destination destination( exchange, routingKey );
+     const auto recordSize = Packing::RECORD_OVERHEAD + record.size();
+
+     boost::lock_guard< boost::mutex > lock( mutex_ );
+
+     auto& batch = batches_[ destination ];
+
+     if( batch.records
+          && ( batch.body.size() + recordSize > params_.maxBytes || batch.records >= params_.maxRecords ) )
+     {
+          publishBatch( destination, batch );
+     }
+
+     if( !batch.records )
+     {
+          Packing::begin( batch.body );
+          batch.opened = Clock::now();
+
+          /// Фоновый поток пересчитывает ближайший срок публикации
+          wakeup_.notify_one();
+     }
+
+     Packing::append( batch.body, record );
+     ++batch.records;
+
+     if( batch.body.size() >= params_.maxBytes || batch.records >= params_.maxRecords )
+     {
+          try
+          {
+               publishBatch( destination, batch );
+          }
+          catch( ... )
+          {
+               /// Запись, о неудаче добавления которой сообщено вызывающей стороне, не должна попасть в пакет:
+               /// иначе при повторном вызове она была бы опубликована дважды. Прежние записи пакета сохраняются
+               Packing::dropLast( batch.body, record.size() );
+               --batch.records;
+               throw;
+          }
+     }
+}
+
+
+void PackingPublisher::flush()
+{
+     boost::lock_guard< boost::mutex > lock( mutex_ );
+
+     for( auto& each: batches_ )
+     {
+          if( each.second.records )
+          {
+               publishBatch( each.first, each.second );
+          }
+     }
+}
+
+
+void PackingPublisher::publishBatch( const Destination& destination, Batch& batch )
+{
+     FieldTable headers;
+     const auto props = aux::packedProperties( headers, batch.records );
+
+     try
+     {
+          SimpleClient::publishMessage( connection_, destination.first, destination.second, batch.body, props );
+     }
+     catch( const ConnectionError& )
+     {
+          connection_.reconnect();
+          SimpleClient::publishMessage( connection_, destination.first, destination.second, batch.body, props );
+     }
+
+     batch.body.clear();
+     batch.records = 0;
+}
+
+
+void PackingPublisher::run()
+{
+     boost::unique_lock< boost::mutex > lock( mutex_ );
+
+     while( true )
+     {
+          const auto now = Clock::now();
+          auto nextDue = Clock::time_point::max();
+
+          for( auto& each: batches_ )
+          {
+               auto& batch = each.second;
+               if( !batch.records )
+               {
+                    continue;
+               }
+
+               const auto due = batch.opened + params_.linger;
+               if( stop_ || due <= now )
+               {
+                    try
+                    {
+                         publishBatch( each.first, batch );
+                         continue;
+                    }
+                    catch( const std::exception& e )
+                    {
+                         /// Пакет сохраняется и публикуется повторно через linger
+                         std::cerr << "packing publisher: cannot publish batch: " << e.what() << "\n";
+                         batch.opened = now;
+                         if( stop_ )
+                         {
+                              continue;
+                         }
+                    }
+               }
+               nextDue = std::min( nextDue, batch.opened + params_.linger );
+          }
+
+          if( stop_ )
+          {
+               return;
+          }
+
+          if( nextDue == Clock::time_point::max() )
+          {
+               wakeup_.wait( lock );
+          }
+          else
+          {
+               wakeup_.wait_until( lock, nextDue );
+          }
+     }
+}
+
+
+PackedBatch::PackedBatch( SimpleClient::Envelope&& envelope )
+     : deliveryTag_( envelope.deliveryTag )
+     , message_( std::move( envelope.message ) )
+{
+     parse( message_ );
+}
+
+
+PackedBatch::PackedBatch( Delivery&& delivery )
+     : deliveryTag_( delivery.deliveryTag() )
+     , delivery_( std::move( delivery ) )
+{
+     /// Для доставки признак пакета проверяется по заголовку: обычное сообщение, тело которого случайно
+     /// совпало с форматом пакета, не будет разобрано на записи
+     if( delivery_->header( Packing::HEADER ) )
+     {
+          parse( delivery_->body() );
+     }
+     else
+     {
+          records_.assign( 1, delivery_->body() );
+     }
+}
+
+
+void PackedBatch::parse( boost::string_ref body )
+{
+     packed_ = Packing::unpack( body, records_ );
+     if( !packed_ )
+     {
+          records_.assign( 1, body );
+     }
+}
+
+
+void PackedBatch::settle(
+     SimpleClient& client,
+     const std::vector< std::size_t >& failed,
+     const std::string& retryExchange,
+     const std::string& retryRoutingKey
+) const
+{
+     if( !failed.empty() )
+     {
+          std::string body;
+          Packing::begin( body );
+          for( const auto index: failed )
+          {
+               Packing::append( body, records_.at( index ) );
+          }
+
+          FieldTable headers;
+          client.publishMessage( retryExchange, retryRoutingKey, body, aux::packedProperties( headers, failed.size() ) );
+     }
+
+     client.ackMessage( deliveryTag_ );
+}
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
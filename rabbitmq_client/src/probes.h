@@ -0,0 +1,51 @@
+/// @file
+/// @brief Статические точки трассировки (USDT) библиотеки
+/// @details Точки провайдера rabbitmq_client встраиваются макросами sys/sdt.h (SystemTap SDT) и в неактивном
+/// состоянии стоят одну инструкцию nop; трассировщик (bpftrace, perf probe, SystemTap) активирует их в работающем
+/// процессе без пересборки и перезапуска. Аргументы точек вычисляются всегда, поэтому в них передаются
+/// только уже вычисленные значения: размеры, идентификаторы доставки, указатели на строки.
+///
+/// Точки и их аргументы:
+/// - publish__start( exchange, routing_key, size ) - перед публикацией сообщения;
+/// - publish__done( size, status ) - после публикации, status - код rabbitmq-c (0 - успех);
+/// - consume__poll( timeout_us ) - клиент ожидает поступления данных в сокет (-1 - без ограничения);
+/// - consume__wait( timeout_us ) - начало чтения доставки (-1 - без ограничения);
+/// - consume__deliver( delivery_tag, size ) - получена доставка;
+/// - ack( delivery_tag, multiple ), nack( delivery_tag, multiple, requeue ), reject( delivery_tag, requeue );
+/// - connect__attempt( attempt, host, port ) - попытка подключения к брокеру;
+/// - connect__done( attempt, ok ) - результат попытки (ok = 1 - подключено);
+/// - reconnect() - начало переподключения.
+///
+/// Библиотека собирается статически, поэтому в трассировщике указывается исполняемый файл приложения, например:
+/// bpftrace -e 'usdt:./producer:rabbitmq_client:publish__start { @s[tid] = nsecs; }
+///     usdt:./producer:rabbitmq_client:publish__done /@s[tid]/ { @us = hist( ( nsecs - @s[tid] ) / 1000 ); }'
+///
+/// Без sys/sdt.h (пакет systemtap-sdt-dev / systemtap-sdt-devel) или при определенном RABBITMQ_CLIENT_NO_USDT
+/// точки не компилируются.
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#pragma once
+
+#if !defined( RABBITMQ_CLIENT_NO_USDT ) && defined( __has_include )
+#if __has_include( <sys/sdt.h> )
+#define RABBITMQ_CLIENT_HAS_USDT 1
+#endif
+#endif
+
+#ifdef RABBITMQ_CLIENT_HAS_USDT
+
+#include <sys/sdt.h>
+
+#define RABBITMQ_CLIENT_PROBE( name ) DTRACE_PROBE( rabbitmq_client, name )
+#define RABBITMQ_CLIENT_PROBE1( name, a1 ) DTRACE_PROBE1( rabbitmq_client, name, a1 )
+#define RABBITMQ_CLIENT_PROBE2( name, a1, a2 ) DTRACE_PROBE2( rabbitmq_client, name, a1, a2 )
+#define RABBITMQ_CLIENT_PROBE3( name, a1, a2, a3 ) DTRACE_PROBE3( rabbitmq_client, name, a1, a2, a3 )
+
+#else
+
+#define RABBITMQ_CLIENT_PROBE( name ) do {} while( 0 )
+#define RABBITMQ_CLIENT_PROBE1( name, a1 ) do {} while( 0 )
+#define RABBITMQ_CLIENT_PROBE2( name, a1, a2 ) do {} while( 0 )
+#define RABBITMQ_CLIENT_PROBE3( name, a1, a2, a3 ) do {} while( 0 )
+
+#endif
@@ -0,0 +1,155 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#include <rabbitmq_client/quarantine.h>
+
+#include <algorithm>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+namespace {
+namespace aux {
+
+
+std::uint64_t fnv1a( boost::string_ref data, std::uint64_t hash = 0xcbf29ce484222325ULL )
+{
+     for( const auto each: data )
+     {
+          hash ^= static_cast< unsigned char >( each );
+          hash *= 0x100000001b3ULL;
+     }
+     return hash;
+}
+
+
+/// Извлекает целое число из значения заголовка
+std::uint64_t toCount( const HeaderValue& value )
+{
+     if( const auto i = boost::get< std::int64_t >( &value.value ) )
+     {
+          return *i > 0 ? *i : 0;
+     }
+     if( const auto u = boost::get< std::uint64_t >( &value.value ) )
+     {
+          return *u;
+     }
+     return 0;
+}
+
+
+/// Суммирует счетчики count всех записей заголовка x-death
+std::uint64_t deathCount( const Delivery& delivery )
+{
+     const auto xdeath = delivery.header( "x-death" );
+     if( !xdeath )
+     {
+          return 0;
+     }
+
+     const auto entries = boost::get< HeaderArray >( &xdeath->value );
+     if( !entries )
+     {
+          return 0;
+     }
+
+     std::uint64_t total = 0;
+     for( const auto& each: *entries )
+     {
+          if( const auto entry = boost::get< HeaderTable >( &each.value ) )
+          {
+               const auto count = entry->find( "count" );
+               if( count != entry->end() )
+               {
+                    total += toCount( count->second );
+               }
+          }
+     }
+     return total;
+}
+
+
+} // namespace aux
+} // namespace {unnamed}
+
+
+const char* const QuarantinePolicy::ATTEMPTS_HEADER = "x-quarantine-attempts";
+const char* const QuarantinePolicy::REASON_HEADER = "x-quarantine-reason";
+const char* const QuarantinePolicy::EXCHANGE_HEADER = "x-original-exchange";
+const char* const QuarantinePolicy::ROUTING_KEY_HEADER = "x-original-routing-key";
+
+
+QuarantinePolicy::QuarantinePolicy( const Parameters& params )
+     : params_( params )
+{}
+
+
+std::uint32_t QuarantinePolicy::attempts( const Delivery& delivery ) const
+{
+     std::uint64_t result = aux::deathCount( delivery ) + 1;
+
+     const auto found = failures_.find( key( delivery ) );
+     if( found != failures_.end() )
+     {
+          result = std::max< std::uint64_t >( result, found->second + 1 );
+     }
+
+     if( delivery.redelivered() )
+     {
+          result = std::max< std::uint64_t >( result, 2 );
+     }
+
+     return static_cast< std::uint32_t >( std::min< std::uint64_t >( result, UINT32_MAX ) );
+}
+
+
+QuarantinePolicy::Action QuarantinePolicy::onFailure( const Delivery& delivery )
+{
+     const auto attempt = attempts( delivery );
+
+     if( attempt >= params_.maxAttempts )
+     {
+          failures_.erase( key( delivery ) );
+          return Action::Park;
+     }
+
+     /// Учет ограничен по объему: при переполнении сбрасывается целиком (худший случай - лишние попытки)
+     if( failures_.size() >= params_.trackedMessages )
+     {
+          failures_.clear();
+     }
+     failures_[ key( delivery ) ] = attempt;
+
+     return params_.requeue ? Action::Requeue : Action::DeadLetter;
+}
+
+
+void QuarantinePolicy::onSuccess( const Delivery& delivery )
+{
+     if( !failures_.empty() )
+     {
+          failures_.erase( key( delivery ) );
+     }
+}
+
+
+std::string QuarantinePolicy::key( const Delivery& delivery ) const
+{
+     const auto& props = delivery.native().message.properties;
+     if( ( props._flags & AMQP_BASIC_MESSAGE_ID_FLAG ) && props.message_id.len )
+     {
+          return std::string( "id:" ) + std::string( static_cast< const char* >( props.message_id.bytes ), props.message_id.len );
+     }
+
+     const auto& rk = delivery.native().routing_key;
+     const auto hash = aux::fnv1a( delivery.body(), aux::fnv1a( boost::string_ref( static_cast< const char* >( rk.bytes ), rk.len ) ) );
+     return std::string( "h:" ) + std::to_string( hash );
+}
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
@@ -0,0 +1,78 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#include <rabbitmq_client/rate_limiter.h>
+
+#include <algorithm>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+
+PublishRateLimiter::PublishRateLimiter( const Parameters& params )
+     : params_( params )
+     , rate_( params.maxRate )
+     , tokens_( params.burst )
+     , last_( Clock::now() )
+{}
+
+
+bool PublishRateLimiter::tryAcquire( double count )
+{
+     boost::lock_guard< boost::mutex > lock( mutex_ );
+
+     refill( Clock::now() );
+
+     if( blocked_ || tokens_ < count )
+     {
+          return false;
+     }
+
+     tokens_ -= count;
+     return true;
+}
+
+
+void PublishRateLimiter::setBrokerBlocked( bool blocked )
+{
+     boost::lock_guard< boost::mutex > lock( mutex_ );
+
+     refill( Clock::now() );
+
+     if( blocked && !blocked_ )
+     {
+          rate_ = std::max( params_.minRate, rate_ / 2 );
+          tokens_ = 0;
+     }
+     blocked_ = blocked;
+}
+
+
+double PublishRateLimiter::currentRate() const
+{
+     boost::lock_guard< boost::mutex > lock( mutex_ );
+     return blocked_ ? 0 : rate_;
+}
+
+
+void PublishRateLimiter::refill( Clock::time_point now )
+{
+     const double elapsed = boost::chrono::duration< double >( now - last_ ).count();
+     last_ = now;
+
+     if( blocked_ )
+     {
+          return;
+     }
+
+     rate_ = std::min( params_.maxRate, rate_ + params_.recovery * elapsed );
+     tokens_ = std::min( params_.burst, tokens_ + rate_ * elapsed );
+}
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
@@ -0,0 +1,319 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#include <rabbitmq_client/rpc_client.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <boost/throw_exception.hpp>
+#include <boost/lexical_cast.hpp>
+#include <rabbitmq_client/error.h>
+#include <rabbitmq_client/utils.h>
+#include <rabbitmq_client/src/connection_impl.h>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+namespace {
+namespace aux {
+
+
+/// Имя псевдо-очереди для получения ответов (direct reply-to)
+const char* const REPLY_TO_QUEUE = "amq.rabbitmq.reply-to";
+
+
+/// Формирует уникальный для клиента префикс идентификаторов вызовов
+std::string makeIdPrefix()
+{
+     std::random_device rd;
+     std::ostringstream ostr;
+     ostr << std::hex << rd() << rd() << '-';
+     return ostr.str();
+}
+
+
+int makeEventFd()
+{
+     const int fd = ::eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+     if( fd < 0 )
+     {
+          BOOST_THROW_EXCEPTION( std::runtime_error( std::string( "cannot create eventfd: " ) + std::strerror( errno ) ) );
+     }
+     return fd;
+}
+
+
+} // namespace aux
+} // namespace {unnamed}
+
+
+RpcClient::RpcClient( const Connection::Parameters& params )
+     : connection_( params )
+     , idPrefix_( aux::makeIdPrefix() )
+     , wakeupFd_( aux::makeEventFd() )
+     , stop_( false )
+{
+     try
+     {
+          startConsuming();
+          worker_ = boost::thread( [ this ](){ run(); } );
+     }
+     catch( ... )
+     {
+          ::close( wakeupFd_ );
+          throw;
+     }
+}
+
+
+RpcClient::~RpcClient()
+{
+     stop_ = true;
+     wakeup();
+     worker_.interrupt();
+     worker_.join();
+     ::close( wakeupFd_ );
+}
+
+
+std::future< std::string > RpcClient::call(
+     const std::string& exchange,
+     const std::string& routingKey,
+     const std::string& request,
+     const boost::posix_time::time_duration& timeout
+)
+{
+     std::future< std::string > result;
+     {
+          boost::lock_guard< boost::mutex > lock( mutex_ );
+
+          auto correlationId = idPrefix_ + boost::lexical_cast< std::string >( ++nextId_ );
+
+          std::promise< std::string > promise;
+          result = promise.get_future();
+
+          const auto deadline = deadlines_.emplace( boost::posix_time::microsec_clock::universal_time() + timeout, correlationId );
+          calls_.emplace( correlationId, Call{ std::move( promise ), deadline } );
+          requests_.push_back( Request{ exchange, routingKey, request, std::move( correlationId ) } );
+     }
+
+     wakeup();
+     return result;
+}
+
+
+std::size_t RpcClient::inFlight() const
+{
+     boost::lock_guard< boost::mutex > lock( mutex_ );
+     return calls_.size();
+}
+
+
+void RpcClient::run()
+{
+     bool reconnectionRequired = false;
+
+     while( !stop_ )
+     {
+          try
+          {
+               if( reconnectionRequired )
+               {
+                    connection_.reconnect();
+                    startConsuming();
+                    reconnectionRequired = false;
+               }
+
+               sendRequests();
+               expireCalls();
+               waitForActivity();
+               dispatchReplies();
+          }
+          catch( const boost::thread_interrupted& )
+          {
+               return;
+          }
+          catch( const std::exception& e )
+          {
+               std::cerr << "rpc client: " << e.what() << "\n";
+               failAll( std::make_exception_ptr( ConnectionError( e.what() ) ) );
+               reconnectionRequired = true;
+          }
+     }
+}
+
+
+void RpcClient::startConsuming()
+{
+     /// Подписка на псевдо-очередь ответов должна предшествовать первой публикации запроса
+     /// и выполняется строго в режиме без подтверждений (no_ack)
+     amqp_basic_consume(
+          connection_.impl_->connection,          /* amqp_connection_state_t state        */
+          1,                                      /* amqp_channel_t          channel      */
+          amqp_cstring_bytes( aux::REPLY_TO_QUEUE ), /* amqp_bytes_t         queue        */
+          amqp_empty_bytes,                       /* amqp_bytes_t            consumer_tag */
+          0,                                      /* amqp_boolean_t          no_local     */
+          1,                                      /* amqp_boolean_t          no_ack       */
+          0,                                      /* amqp_boolean_t          exclusive    */
+          amqp_empty_table                        /* amqp_table_t            arguments    */
+     );
+     ensureNoErrors( amqp_get_rpc_reply( connection_.impl_->connection ), "consume reply-to queue" );
+     connection_.impl_->consuming = true;
+}
+
+
+void RpcClient::sendRequests()
+{
+     std::vector< Request > requests;
+     {
+          boost::lock_guard< boost::mutex > lock( mutex_ );
+          requests.swap( requests_ );
+     }
+
+     for( const auto& each: requests )
+     {
+          amqp_basic_properties_t props;
+          props._flags = AMQP_BASIC_REPLY_TO_FLAG | AMQP_BASIC_CORRELATION_ID_FLAG;
+          props.reply_to = amqp_cstring_bytes( aux::REPLY_TO_QUEUE );
+          props.correlation_id = fromString( each.correlationId );
+
+          SimpleClient::publishMessage( connection_, each.exchange, each.routingKey, each.body, props );
+     }
+}
+
+
+void RpcClient::waitForActivity()
+{
+     if( SimpleClient::hasBufferedData( connection_ ) )
+     {
+          return;
+     }
+
+     int timeoutMs = -1;
+     {
+          boost::lock_guard< boost::mutex > lock( mutex_ );
+          if( !requests_.empty() )
+          {
+               return;
+          }
+          if( !deadlines_.empty() )
+          {
+               const auto left = deadlines_.begin()->first - boost::posix_time::microsec_clock::universal_time();
+               timeoutMs = left.is_negative()
+                    ? 0
+                    : static_cast< int >( std::min< std::int64_t >( left.total_milliseconds(), std::numeric_limits< int >::max() - 1 ) ) + 1;
+          }
+     }
+
+     pollfd fds[ 2 ] = {
+          { amqp_get_sockfd( connection_.impl_->connection ), POLLIN, 0 },
+          { wakeupFd_, POLLIN, 0 }
+     };
+
+     if( ::poll( fds, 2, timeoutMs ) < 0 && errno != EINTR )
+     {
+          BOOST_THROW_EXCEPTION( std::runtime_error( std::string( "poll failed: " ) + std::strerror( errno ) ) );
+     }
+
+     if( fds[ 1 ].revents & POLLIN )
+     {
+          eventfd_t value = 0;
+          ::eventfd_read( wakeupFd_, &value );
+     }
+     if( fds[ 0 ].revents & ( POLLERR | POLLHUP ) )
+     {
+          BOOST_THROW_EXCEPTION( ConnectionError( "rpc connection socket closed" ) );
+     }
+}
+
+
+void RpcClient::dispatchReplies()
+{
+     static const boost::optional< boost::posix_time::time_duration > noWait = boost::posix_time::time_duration();
+
+     amqp_maybe_release_buffers( connection_.impl_->connection );
+
+     do
+     {
+          amqp_envelope_t envelope = { 0 };
+
+          if( !SimpleClient::consumeEnvelope( connection_, noWait, envelope ) )
+          {
+               return;
+          }
+
+          std::unique_ptr< amqp_envelope_t, void(*)( amqp_envelope_t* ) > autocleaner( &envelope, amqp_destroy_envelope );
+
+          const auto& props = envelope.message.properties;
+          if( !( props._flags & AMQP_BASIC_CORRELATION_ID_FLAG ) )
+          {
+               continue;
+          }
+
+          boost::lock_guard< boost::mutex > lock( mutex_ );
+
+          /// Ответ на уже просроченный вызов отбрасывается
+          const auto found = calls_.find( toString( props.correlation_id ) );
+          if( found != calls_.end() )
+          {
+               found->second.promise.set_value( toString( envelope.message.body ) );
+               deadlines_.erase( found->second.deadline );
+               calls_.erase( found );
+          }
+     }
+     while( SimpleClient::hasBufferedData( connection_ ) );
+}
+
+
+void RpcClient::expireCalls()
+{
+     const auto now = boost::posix_time::microsec_clock::universal_time();
+
+     boost::lock_guard< boost::mutex > lock( mutex_ );
+
+     /// Сроки завершенных вызовов удаляются вместе с ними, поэтому каждому сроку соответствует вызов
+     while( !deadlines_.empty() && deadlines_.begin()->first <= now )
+     {
+          const auto found = calls_.find( deadlines_.begin()->second );
+          found->second.promise.set_exception(
+               std::make_exception_ptr( TimeoutError( "rpc call timed out: " + found->first ) ) );
+          calls_.erase( found );
+          deadlines_.erase( deadlines_.begin() );
+     }
+}
+
+
+void RpcClient::failAll( const std::exception_ptr& error )
+{
+     boost::lock_guard< boost::mutex > lock( mutex_ );
+
+     for( auto& each: calls_ )
+     {
+          each.second.promise.set_exception( error );
+     }
+     calls_.clear();
+     requests_.clear();
+     deadlines_.clear();
+}
+
+
+void RpcClient::wakeup()
+{
+     ::eventfd_write( wakeupFd_, 1 );
+}
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
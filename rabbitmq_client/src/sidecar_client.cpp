@@ -0,0 +1,403 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#include <rabbitmq_client/sidecar_client.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <boost/throw_exception.hpp>
+#include <rabbitmq_client/error.h>
+#include <rabbitmq_client/src/sidecar_protocol.h>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+namespace {
+namespace aux {
+
+
+/// Объем данных, читаемых из сокета за одну операцию
+const std::size_t READ_CHUNK = 64 * 1024;
+
+
+void connectionLost( const std::string& operation )
+{
+     BOOST_THROW_EXCEPTION( ConnectionError( "sidecar " + operation + ": " + std::strerror( errno ) ) );
+}
+
+
+} // namespace aux
+} // namespace {unnamed}
+
+
+SidecarClient::SidecarClient( const std::string& socketPath, const Parameters& params )
+     : socketPath_( socketPath )
+     , params_( params )
+{
+     connect();
+}
+
+
+SidecarClient::~SidecarClient()
+{
+     try
+     {
+          flush();
+     }
+     catch( ... )
+     {}
+     ::close( fd_ );
+}
+
+
+void SidecarClient::publishMessage( const std::string& exchange, const std::string& routingKey, const std::string& message )
+{
+     throwFailure();
+
+     const auto start = SidecarProtocol::begin( out_, SidecarProtocol::Frame::Publish );
+     SidecarProtocol::putString( out_, exchange );
+     SidecarProtocol::putString( out_, routingKey );
+     SidecarProtocol::putString( out_, message );
+     enqueue( start );
+}
+
+
+void SidecarClient::publishMessage( const SimpleClient::QueueParameters& params, const std::string& message )
+{
+     publishMessage( params.exchange, params.routingKey, message );
+}
+
+
+void SidecarClient::bind( const std::string& exchange, const std::string& queueName, const std::string& routingKey )
+{
+     bind( SimpleClient::QueueParameters( exchange, routingKey, queueName ), SimpleClient::ConsumerParameters() );
+}
+
+
+void SidecarClient::bind( const SimpleClient::QueueParameters& params )
+{
+     bind( params, SimpleClient::ConsumerParameters() );
+}
+
+
+void SidecarClient::bind( const SimpleClient::QueueParameters& params, const SimpleClient::ConsumerParameters& consumer )
+{
+     throwFailure();
+
+     /// Параметры подписки проверяются до начала кадра, чтобы при ошибке в буфере не остался неполный кадр
+     std::string encoded;
+     SidecarProtocol::putConsumer( encoded, consumer );
+
+     const auto start = SidecarProtocol::begin( out_, SidecarProtocol::Frame::Bind );
+     SidecarProtocol::putString( out_, params.exchange );
+     SidecarProtocol::putString( out_, params.queueName );
+     SidecarProtocol::putString( out_, params.routingKey );
+     out_ += encoded;
+     request( start );
+}
+
+
+std::string SidecarClient::declareQueue( const SimpleClient::QueueDeclaration& declaration )
+{
+     throwFailure();
+
+     std::string encoded;
+     SidecarProtocol::putDeclaration( encoded, declaration );
+
+     const auto start = SidecarProtocol::begin( out_, SidecarProtocol::Frame::DeclareQueue );
+     out_ += encoded;
+     return request( start );
+}
+
+
+boost::optional< SimpleClient::Envelope > SidecarClient::consumeMessage( boost::optional< boost::posix_time::time_duration > timeout )
+{
+     flush();
+     throwFailure();
+
+     if( !waitForDelivery( timeout ) )
+     {
+          return boost::none;
+     }
+
+     boost::optional< SimpleClient::Envelope > envelope( std::move( deliveries_.front() ) );
+     deliveries_.pop_front();
+     return envelope;
+}
+
+
+std::size_t SidecarClient::consumeMessages(
+     std::vector< SimpleClient::Envelope >& envelopes,
+     std::size_t maxCount,
+     boost::optional< boost::posix_time::time_duration > timeout
+)
+{
+     envelopes.clear();
+     flush();
+     throwFailure();
+
+     if( !waitForDelivery( timeout ) )
+     {
+          return 0;
+     }
+
+     /// Доставки, уже находящиеся в сокете, забираются без ожидания
+     if( deliveries_.size() < maxCount )
+     {
+          receive( 0 );
+     }
+
+     while( !deliveries_.empty() && envelopes.size() < maxCount )
+     {
+          envelopes.push_back( std::move( deliveries_.front() ) );
+          deliveries_.pop_front();
+     }
+     return envelopes.size();
+}
+
+
+void SidecarClient::ackMessage( std::uint64_t deliveryTag, bool multiple )
+{
+     throwFailure();
+
+     const auto start = SidecarProtocol::begin( out_, SidecarProtocol::Frame::Ack );
+     SidecarProtocol::putVarint( out_, deliveryTag );
+     SidecarProtocol::putVarint( out_, multiple );
+     enqueue( start );
+}
+
+
+void SidecarClient::nackMessage( std::uint64_t deliveryTag, bool multiple, bool requeue )
+{
+     throwFailure();
+
+     const auto start = SidecarProtocol::begin( out_, SidecarProtocol::Frame::Nack );
+     SidecarProtocol::putVarint( out_, deliveryTag );
+     SidecarProtocol::putVarint( out_, multiple );
+     SidecarProtocol::putVarint( out_, requeue );
+     enqueue( start );
+}
+
+
+void SidecarClient::rejectMessage( std::uint64_t deliveryTag, bool requeue )
+{
+     throwFailure();
+
+     const auto start = SidecarProtocol::begin( out_, SidecarProtocol::Frame::Reject );
+     SidecarProtocol::putVarint( out_, deliveryTag );
+     SidecarProtocol::putVarint( out_, requeue );
+     enqueue( start );
+}
+
+
+void SidecarClient::flush()
+{
+     std::size_t written = 0;
+     while( written < out_.size() )
+     {
+          const auto sent = ::send( fd_, out_.data() + written, out_.size() - written, MSG_NOSIGNAL );
+          if( sent < 0 )
+          {
+               if( errno == EINTR )
+               {
+                    continue;
+               }
+               out_.clear();
+               aux::connectionLost( "write failed" );
+          }
+          written += sent;
+     }
+     out_.clear();
+}
+
+
+void SidecarClient::reconnect()
+{
+     ::close( fd_ );
+     fd_ = -1;
+
+     out_.clear();
+     in_.clear();
+     deliveries_.clear();
+     reply_ = boost::none;
+     error_ = boost::none;
+     failure_ = boost::none;
+
+     connect();
+}
+
+
+void SidecarClient::connect()
+{
+     sockaddr_un address;
+     std::memset( &address, 0, sizeof( address ) );
+     if( socketPath_.size() >= sizeof( address.sun_path ) )
+     {
+          BOOST_THROW_EXCEPTION( std::invalid_argument( "sidecar socket path is too long: " + socketPath_ ) );
+     }
+     address.sun_family = AF_UNIX;
+     std::memcpy( address.sun_path, socketPath_.c_str(), socketPath_.size() );
+
+     fd_ = ::socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+     if( fd_ < 0 )
+     {
+          aux::connectionLost( "socket creation failed" );
+     }
+     if( ::connect( fd_, reinterpret_cast< const sockaddr* >( &address ), sizeof( address ) ) != 0 )
+     {
+          const auto error = errno;
+          ::close( fd_ );
+          fd_ = -1;
+          errno = error;
+          aux::connectionLost( "is not available at " + socketPath_ );
+     }
+}
+
+
+void SidecarClient::enqueue( std::size_t frameStart )
+{
+     SidecarProtocol::end( out_, frameStart );
+     if( out_.size() >= params_.batchBytes )
+     {
+          flush();
+     }
+}
+
+
+std::string SidecarClient::request( std::size_t frameStart )
+{
+     SidecarProtocol::end( out_, frameStart );
+     flush();
+
+     reply_ = boost::none;
+     error_ = boost::none;
+
+     /// Ответы приходят в порядке запросов; доставки, полученные до ответа, сохраняются
+     while( !reply_ && !error_ )
+     {
+          receive( -1 );
+     }
+
+     if( error_ )
+     {
+          const auto message = *error_;
+          error_ = boost::none;
+          BOOST_THROW_EXCEPTION( std::runtime_error( "sidecar: " + message ) );
+     }
+
+     auto result = std::move( *reply_ );
+     reply_ = boost::none;
+     return result;
+}
+
+
+bool SidecarClient::waitForDelivery( const boost::optional< boost::posix_time::time_duration >& timeout )
+{
+     using boost::posix_time::microsec_clock;
+
+     const auto deadline = microsec_clock::universal_time() + ( timeout ? *timeout : boost::posix_time::time_duration() );
+
+     while( deliveries_.empty() )
+     {
+          int timeoutMs = -1;
+          if( timeout )
+          {
+               const auto left = deadline - microsec_clock::universal_time();
+               timeoutMs = left.is_negative() ? 0 : static_cast< int >( left.total_milliseconds() );
+          }
+
+          if( !receive( timeoutMs ) && timeoutMs >= 0 && deadline <= microsec_clock::universal_time() )
+          {
+               break;
+          }
+     }
+     return !deliveries_.empty();
+}
+
+
+bool SidecarClient::receive( int timeoutMs )
+{
+     pollfd fds = { fd_, POLLIN, 0 };
+     const auto ready = ::poll( &fds, 1, timeoutMs );
+     if( ready < 0 && errno != EINTR )
+     {
+          BOOST_THROW_EXCEPTION( std::runtime_error( std::string( "poll failed: " ) + std::strerror( errno ) ) );
+     }
+     if( ready <= 0 )
+     {
+          return false;
+     }
+
+     const auto size = in_.size();
+     in_.resize( size + aux::READ_CHUNK );
+     const auto received = ::recv( fd_, &in_[ size ], aux::READ_CHUNK, 0 );
+     in_.resize( size + std::max< ssize_t >( received, 0 ) );
+
+     if( received == 0 )
+     {
+          BOOST_THROW_EXCEPTION( ConnectionError( "sidecar closed the connection" ) );
+     }
+     if( received < 0 )
+     {
+          if( errno == EINTR || errno == EAGAIN )
+          {
+               return false;
+          }
+          aux::connectionLost( "read failed" );
+     }
+
+     std::size_t offset = 0;
+     SidecarProtocol::Frame type;
+     boost::string_ref payload;
+     while( SidecarProtocol::next( in_, offset, type, payload ) )
+     {
+          SidecarProtocol::Reader reader( payload );
+          switch( type )
+          {
+               case SidecarProtocol::Frame::Deliver:
+               {
+                    const auto tag = reader.varint();
+                    deliveries_.emplace_back( reader.string().to_string(), tag );
+                    break;
+               }
+               case SidecarProtocol::Frame::Reply:
+                    reply_ = reader.string().to_string();
+                    break;
+               case SidecarProtocol::Frame::Error:
+                    error_ = reader.string().to_string();
+                    break;
+               case SidecarProtocol::Frame::Failure:
+                    failure_ = reader.string().to_string();
+                    break;
+               default:
+                    BOOST_THROW_EXCEPTION( std::runtime_error( "unexpected sidecar frame type " + std::to_string( static_cast< int >( type ) ) ) );
+          }
+     }
+     in_.erase( 0, offset );
+     return true;
+}
+
+
+void SidecarClient::throwFailure()
+{
+     if( failure_ )
+     {
+          const auto message = *failure_;
+          failure_ = boost::none;
+          BOOST_THROW_EXCEPTION( ConnectionError( "sidecar: " + message ) );
+     }
+}
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
@@ -0,0 +1,273 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#include <rabbitmq_client/src/sidecar_protocol.h>
+
+#include <cstring>
+#include <stdexcept>
+#include <boost/throw_exception.hpp>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+namespace {
+namespace aux {
+
+
+/// Признаки объявления очереди и подписки
+enum : std::uint64_t
+{
+     DURABLE = 1 << 0,
+     EXCLUSIVE = 1 << 1,
+     AUTO_DELETE = 1 << 2,
+     LAZY = 1 << 3,
+     SINGLE_ACTIVE_CONSUMER = 1 << 4,
+     MAX_LENGTH = 1 << 5,
+     MAX_LENGTH_BYTES = 1 << 6,
+     OVERFLOW_MODE = 1 << 7,
+
+     PREFETCH = 1 << 0,
+     PRIORITY = 1 << 1,
+     STREAM_OFFSET = 1 << 2,
+     EXCLUSIVE_CONSUMER = 1 << 3
+};
+
+
+std::uint64_t zigzag( std::int64_t value )
+{
+     return ( static_cast< std::uint64_t >( value ) << 1 ) ^ static_cast< std::uint64_t >( value >> 63 );
+}
+
+
+std::int64_t unzigzag( std::uint64_t value )
+{
+     return static_cast< std::int64_t >( value >> 1 ) ^ -static_cast< std::int64_t >( value & 1 );
+}
+
+
+void malformed()
+{
+     BOOST_THROW_EXCEPTION( std::runtime_error( "malformed sidecar frame" ) );
+}
+
+
+} // namespace aux
+} // namespace {unnamed}
+
+
+std::size_t SidecarProtocol::begin( std::string& out, Frame type )
+{
+     const auto start = out.size();
+     out.append( 4, '\0' );
+     out.push_back( static_cast< char >( type ) );
+     return start;
+}
+
+
+void SidecarProtocol::end( std::string& out, std::size_t start )
+{
+     const auto length = static_cast< std::uint32_t >( out.size() - start - 4 );
+     for( std::size_t i = 0; i < 4; ++i )
+     {
+          out[ start + i ] = static_cast< char >( length >> ( 8 * i ) );
+     }
+}
+
+
+void SidecarProtocol::putVarint( std::string& out, std::uint64_t value )
+{
+     while( value >= 0x80 )
+     {
+          out.push_back( static_cast< char >( value | 0x80 ) );
+          value >>= 7;
+     }
+     out.push_back( static_cast< char >( value ) );
+}
+
+
+void SidecarProtocol::putString( std::string& out, boost::string_ref value )
+{
+     putVarint( out, value.size() );
+     out.append( value.data(), value.size() );
+}
+
+
+void SidecarProtocol::putDeclaration( std::string& out, const SimpleClient::QueueDeclaration& declaration )
+{
+     if( !declaration.arguments.empty() )
+     {
+          BOOST_THROW_EXCEPTION( std::invalid_argument( "queue declaration arguments are not supported by sidecar" ) );
+     }
+
+     std::uint64_t flags = 0;
+     if( declaration.durable ) flags |= aux::DURABLE;
+     if( declaration.exclusive ) flags |= aux::EXCLUSIVE;
+     if( declaration.autoDelete ) flags |= aux::AUTO_DELETE;
+     if( declaration.lazy ) flags |= aux::LAZY;
+     if( declaration.singleActiveConsumer ) flags |= aux::SINGLE_ACTIVE_CONSUMER;
+     if( declaration.maxLength ) flags |= aux::MAX_LENGTH;
+     if( declaration.maxLengthBytes ) flags |= aux::MAX_LENGTH_BYTES;
+     if( declaration.overflow ) flags |= aux::OVERFLOW_MODE;
+
+     putString( out, declaration.queueName );
+     putVarint( out, static_cast< std::uint64_t >( declaration.type ) );
+     putVarint( out, flags );
+     if( declaration.maxLength ) putVarint( out, aux::zigzag( *declaration.maxLength ) );
+     if( declaration.maxLengthBytes ) putVarint( out, aux::zigzag( *declaration.maxLengthBytes ) );
+     if( declaration.overflow ) putVarint( out, static_cast< std::uint64_t >( *declaration.overflow ) );
+}
+
+
+void SidecarProtocol::putConsumer( std::string& out, const SimpleClient::ConsumerParameters& consumer )
+{
+     if( !consumer.arguments.empty() )
+     {
+          BOOST_THROW_EXCEPTION( std::invalid_argument( "consumer arguments are not supported by sidecar" ) );
+     }
+     if( consumer.noAck )
+     {
+          BOOST_THROW_EXCEPTION( std::invalid_argument( "no-ack consumers are not supported by sidecar" ) );
+     }
+
+     std::uint64_t flags = 0;
+     if( consumer.prefetchCount ) flags |= aux::PREFETCH;
+     if( consumer.priority ) flags |= aux::PRIORITY;
+     if( consumer.streamOffset ) flags |= aux::STREAM_OFFSET;
+     if( consumer.exclusive ) flags |= aux::EXCLUSIVE_CONSUMER;
+
+     putVarint( out, flags );
+     if( consumer.prefetchCount ) putVarint( out, *consumer.prefetchCount );
+     if( consumer.priority ) putVarint( out, aux::zigzag( *consumer.priority ) );
+     if( consumer.streamOffset )
+     {
+          putVarint( out, static_cast< std::uint64_t >( consumer.streamOffset->kind ) );
+          putVarint( out, consumer.streamOffset->value );
+     }
+}
+
+
+bool SidecarProtocol::next( boost::string_ref buffer, std::size_t& offset, Frame& type, boost::string_ref& payload )
+{
+     if( buffer.size() - offset < HEADER_SIZE )
+     {
+          return false;
+     }
+
+     const auto bytes = reinterpret_cast< const unsigned char* >( buffer.data() + offset );
+     const std::uint32_t length = bytes[ 0 ] | ( bytes[ 1 ] << 8 ) | ( bytes[ 2 ] << 16 ) | ( std::uint32_t( bytes[ 3 ] ) << 24 );
+     if( length < 1 || length > MAX_FRAME_SIZE )
+     {
+          BOOST_THROW_EXCEPTION( std::runtime_error( "invalid sidecar frame length: " + std::to_string( length ) ) );
+     }
+     if( buffer.size() - offset - 4 < length )
+     {
+          return false;
+     }
+
+     type = static_cast< Frame >( bytes[ 4 ] );
+     payload = buffer.substr( offset + HEADER_SIZE, length - 1 );
+     offset += 4 + length;
+     return true;
+}
+
+
+std::uint64_t SidecarProtocol::Reader::varint()
+{
+     std::uint64_t value = 0;
+     for( unsigned shift = 0; shift < 64; shift += 7 )
+     {
+          if( payload_.empty() )
+          {
+               aux::malformed();
+          }
+          const auto byte = static_cast< unsigned char >( payload_.front() );
+          payload_.remove_prefix( 1 );
+
+          value |= static_cast< std::uint64_t >( byte & 0x7f ) << shift;
+          if( !( byte & 0x80 ) )
+          {
+               return value;
+          }
+     }
+     aux::malformed();
+     return 0;
+}
+
+
+boost::string_ref SidecarProtocol::Reader::string()
+{
+     const auto size = varint();
+     if( size > payload_.size() )
+     {
+          aux::malformed();
+     }
+     const auto value = payload_.substr( 0, size );
+     payload_.remove_prefix( size );
+     return value;
+}
+
+
+SimpleClient::QueueDeclaration SidecarProtocol::Reader::declaration()
+{
+     SimpleClient::QueueDeclaration declaration( string().to_string() );
+
+     const auto type = varint();
+     if( type > static_cast< std::uint64_t >( SimpleClient::QueueType::Stream ) )
+     {
+          aux::malformed();
+     }
+     declaration.type = static_cast< SimpleClient::QueueType >( type );
+
+     const auto flags = varint();
+     declaration.durable = flags & aux::DURABLE;
+     declaration.exclusive = flags & aux::EXCLUSIVE;
+     declaration.autoDelete = flags & aux::AUTO_DELETE;
+     declaration.lazy = flags & aux::LAZY;
+     declaration.singleActiveConsumer = flags & aux::SINGLE_ACTIVE_CONSUMER;
+     if( flags & aux::MAX_LENGTH ) declaration.maxLength = aux::unzigzag( varint() );
+     if( flags & aux::MAX_LENGTH_BYTES ) declaration.maxLengthBytes = aux::unzigzag( varint() );
+     if( flags & aux::OVERFLOW_MODE )
+     {
+          const auto overflow = varint();
+          if( overflow > static_cast< std::uint64_t >( SimpleClient::Overflow::RejectPublishDlx ) )
+          {
+               aux::malformed();
+          }
+          declaration.overflow = static_cast< SimpleClient::Overflow >( overflow );
+     }
+     return declaration;
+}
+
+
+SimpleClient::ConsumerParameters SidecarProtocol::Reader::consumer()
+{
+     SimpleClient::ConsumerParameters consumer;
+
+     const auto flags = varint();
+     consumer.exclusive = flags & aux::EXCLUSIVE_CONSUMER;
+     if( flags & aux::PREFETCH ) consumer.prefetchCount = static_cast< std::uint16_t >( varint() );
+     if( flags & aux::PRIORITY ) consumer.priority = static_cast< std::int32_t >( aux::unzigzag( varint() ) );
+     if( flags & aux::STREAM_OFFSET )
+     {
+          const auto kind = varint();
+          const auto value = varint();
+          switch( static_cast< SimpleClient::StreamOffset::Kind >( kind ) )
+          {
+               case SimpleClient::StreamOffset::Kind::First: consumer.streamOffset = SimpleClient::StreamOffset::first(); break;
+               case SimpleClient::StreamOffset::Kind::Last: consumer.streamOffset = SimpleClient::StreamOffset::last(); break;
+               case SimpleClient::StreamOffset::Kind::Next: consumer.streamOffset = SimpleClient::StreamOffset::next(); break;
+               case SimpleClient::StreamOffset::Kind::Offset: consumer.streamOffset = SimpleClient::StreamOffset::offset( value ); break;
+               case SimpleClient::StreamOffset::Kind::Timestamp: consumer.streamOffset = SimpleClient::StreamOffset::timestamp( value ); break;
+               default: aux::malformed();
+          }
+     }
+     return consumer;
+}
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
@@ -0,0 +1,91 @@
+/// @file
+/// @brief Протокол обмена клиента SidecarClient с локальным мультиплексором SidecarServer
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <boost/utility/string_ref.hpp>
+#include <rabbitmq_client/simple_client.h>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+
+/// @brief Кадры протокола мультиплексора
+/// @details Формат кадра (целые числа заголовка - little-endian):
+/// @code
+/// uint32 длина (тип + данные) | uint8 тип | данные
+/// @endcode
+/// Целые числа в данных кодируются varint, строки - длиной (varint) и байтами строки. Кадры не выравниваются
+/// и следуют в потоке вплотную, поэтому множество кадров передается и разбирается одной операцией записи
+/// и чтения.
+///
+/// На запросы (DeclareQueue, Bind) мультиплексор отвечает в порядке их получения кадром Reply или Error.
+/// Публикация и подтверждения не подтверждаются; ошибка их выполнения передается кадром Failure.
+struct SidecarProtocol
+{
+     enum class Frame : std::uint8_t
+     {
+          Publish = 1,        ///< exchange, routing key, тело
+          DeclareQueue = 2,   ///< объявление очереди (см. putDeclaration()); ответ - имя очереди
+          Bind = 3,           ///< exchange, очередь, routing key, параметры подписки (см. putConsumer())
+          Ack = 4,            ///< идентификатор, multiple
+          Nack = 5,           ///< идентификатор, multiple, requeue
+          Reject = 6,         ///< идентификатор, requeue
+
+          Reply = 16,         ///< успешный ответ на запрос: строка результата
+          Error = 17,         ///< ошибка выполнения запроса: текст ошибки
+          Failure = 18,       ///< ошибка публикации или подтверждения: текст ошибки
+          Deliver = 19        ///< идентификатор доставки, тело сообщения
+     };
+
+     static const std::size_t HEADER_SIZE = 5;
+     static const std::size_t MAX_FRAME_SIZE = 128 * 1024 * 1024;
+
+     /// Начинает кадр в @a out; возвращает позицию начала кадра для end()
+     static std::size_t begin( std::string& out, Frame type );
+
+     /// Записывает длину кадра, начатого в позиции @a start
+     static void end( std::string& out, std::size_t start );
+
+     static void putVarint( std::string& out, std::uint64_t value );
+     static void putString( std::string& out, boost::string_ref value );
+
+     /// @throw std::invalid_argument если объявление содержит аргументы (arguments), не передаваемые протоколом
+     static void putDeclaration( std::string& out, const SimpleClient::QueueDeclaration& declaration );
+
+     /// @throw std::invalid_argument если параметры подписки содержат аргументы (arguments)
+     static void putConsumer( std::string& out, const SimpleClient::ConsumerParameters& consumer );
+
+     /// @brief Выделяет из @a buffer, начиная с позиции @a offset, очередной полный кадр и сдвигает @a offset за него
+     /// @return false, если кадр получен не полностью
+     /// @throw std::runtime_error если длина кадра недопустима
+     static bool next( boost::string_ref buffer, std::size_t& offset, Frame& type, boost::string_ref& payload );
+
+     /// @brief Последовательное чтение полей кадра
+     /// @throw std::runtime_error если данные кадра короче ожидаемых
+     class Reader
+     {
+     public:
+          explicit Reader( boost::string_ref payload ) : payload_( payload ) {}
+
+          std::uint64_t varint();
+          boost::string_ref string();
+          bool flag() { return varint() != 0; }
+
+          SimpleClient::QueueDeclaration declaration();
+          SimpleClient::ConsumerParameters consumer();
+
+     private:
+          boost::string_ref payload_;
+     };
+};
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
@@ -0,0 +1,846 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#include <rabbitmq_client/sidecar_server.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <list>
+#include <map>
+#include <stdexcept>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <boost/throw_exception.hpp>
+#include <boost/thread/lock_guard.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <rabbitmq_client/error.h>
+#include <rabbitmq_client/src/connection_impl.h>
+#include <rabbitmq_client/src/sidecar_protocol.h>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+namespace {
+namespace aux {
+
+
+/// Объем данных, читаемых из сокета клиента за одну операцию
+const std::size_t READ_CHUNK = 64 * 1024;
+
+/// Наибольшее кол-во доставок, передаваемых клиентам за одну итерацию цикла обслуживания;
+/// ограничение не дает потоку доставок задерживать обработку кадров клиентов
+const std::size_t DELIVERY_BATCH = 1024;
+
+
+void systemError( const std::string& message )
+{
+     BOOST_THROW_EXCEPTION( std::runtime_error( message + ": " + std::strerror( errno ) ) );
+}
+
+
+int makeEventFd()
+{
+     const int fd = ::eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+     if( fd < 0 )
+     {
+          systemError( "cannot create eventfd" );
+     }
+     return fd;
+}
+
+
+void notify( int fd )
+{
+     const std::uint64_t one = 1;
+     const auto written = ::write( fd, &one, sizeof( one ) );
+     static_cast< void >( written );
+}
+
+
+void drain( int fd )
+{
+     std::uint64_t value;
+     while( ::read( fd, &value, sizeof( value ) ) > 0 )
+     {}
+}
+
+
+} // namespace aux
+} // namespace {unnamed}
+
+
+/// Соединение с брокером и обслуживающий его поток
+class SidecarServer::Upstream
+{
+public:
+     Upstream( const Connection::Parameters& params, std::size_t maxPendingBytes )
+          : connection_( params )
+          , maxPendingBytes_( maxPendingBytes )
+          , wakeupFd_( aux::makeEventFd() )
+          , stop_( false )
+          , clients_( 0 )
+          , published_( 0 )
+          , delivered_( 0 )
+          , reconnects_( 0 )
+     {
+          thread_ = boost::thread( [ this ](){ run(); } );
+     }
+
+     ~Upstream()
+     {
+          stop_ = true;
+          aux::notify( wakeupFd_ );
+          thread_.join();
+
+          for( const auto& each: sessions_ )
+          {
+               ::close( each.fd );
+          }
+          for( const auto fd: incoming_ )
+          {
+               ::close( fd );
+          }
+          ::close( wakeupFd_ );
+     }
+
+     /// Передает потоку соединения подключившегося клиента
+     void attach( int fd )
+     {
+          boost::lock_guard< boost::mutex > lock( mutex_ );
+          incoming_.push_back( fd );
+          ++clients_;
+          aux::notify( wakeupFd_ );
+     }
+
+     std::size_t clients() const { return clients_; }
+
+     void collect( Statistics& statistics ) const
+     {
+          statistics.clients += clients_;
+          statistics.published += published_;
+          statistics.delivered += delivered_;
+          statistics.reconnects += reconnects_;
+     }
+
+private:
+     typedef SidecarProtocol::Frame Frame;
+
+     struct Subscription
+     {
+          std::string exchange;
+          std::string queue;
+          std::string routingKey;
+          SimpleClient::ConsumerParameters consumer;
+          std::string consumerTag;
+     };
+
+     struct Session
+     {
+          explicit Session( int fd_ ) : fd( fd_ ) {}
+
+          int fd;
+          std::string in;
+          std::string out;
+          std::size_t written = 0;
+          std::vector< Subscription > subscriptions;
+          std::map< std::uint64_t, std::uint64_t > unacked;   ///< идентификатор доставки клиента -> брокера
+          std::uint64_t lastTag = 0;
+          bool paused = false;     ///< подписки отменены до отправки клиенту накопленных данных
+     };
+
+     void run();
+     void acceptIncoming();
+     bool receive( Session& session );
+     void execute( Session& session, Frame type, SidecarProtocol::Reader& reader );
+     void publish( Session& session, SidecarProtocol::Reader& reader );
+     void settle( Session& session, Frame type, SidecarProtocol::Reader& reader );
+     void subscribe( Session& session, Subscription& subscription );
+     void deliver();
+     void pause( Session& session );
+     void resume( Session& session );
+     bool flush( Session& session );
+     void detach( std::list< Session >::iterator session );
+     void recover();
+     void send( Session& session, Frame type, boost::string_ref text );
+
+     /// Выполняет запрос клиента и отправляет ему результат или ошибку
+     template< typename Request >
+     void request( Session& session, Request&& op )
+     {
+          try
+          {
+               send( session, Frame::Reply, op() );
+          }
+          catch( const ConnectionError& e )
+          {
+               recover();
+               send( session, Frame::Error, e.what() );
+          }
+          catch( const std::exception& e )
+          {
+               send( session, Frame::Error, e.what() );
+          }
+     }
+
+     Connection connection_;
+     const std::size_t maxPendingBytes_;
+     const int wakeupFd_;
+
+     std::list< Session > sessions_;
+     std::map< std::string, Session* > consumers_;       ///< метка подписчика -> клиент
+     std::map< std::uint64_t, Session* > outstanding_;   ///< неподтвержденные доставки соединения
+
+     boost::mutex mutex_;
+     std::vector< int > incoming_;
+
+     std::atomic< bool > stop_;
+     std::atomic< std::size_t > clients_;
+     std::atomic< std::uint64_t > published_;
+     std::atomic< std::uint64_t > delivered_;
+     std::atomic< std::uint64_t > reconnects_;
+
+     boost::thread thread_;
+};
+
+
+void SidecarServer::Upstream::run()
+{
+     std::vector< pollfd > fds;
+
+     while( !stop_ )
+     {
+          acceptIncoming();
+
+          /// Данные, уже принятые rabbitmq-c, не видны poll(): в этом случае опрос выполняется без ожидания
+          const bool buffered = SidecarServer::hasBufferedData( connection_ );
+
+          fds.clear();
+          fds.push_back( pollfd{ wakeupFd_, POLLIN, 0 } );
+          fds.push_back( pollfd{ SidecarServer::socketOf( connection_ ), POLLIN, 0 } );
+          for( const auto& each: sessions_ )
+          {
+               fds.push_back( pollfd{ each.fd, static_cast< short >( POLLIN | ( each.written < each.out.size() ? POLLOUT : 0 ) ), 0 } );
+          }
+
+          if( ::poll( fds.data(), fds.size(), buffered ? 0 : -1 ) < 0 )
+          {
+               continue;
+          }
+          if( fds[ 0 ].revents )
+          {
+               aux::drain( wakeupFd_ );
+          }
+
+          std::size_t i = 2;
+          for( auto it = sessions_.begin(); it != sessions_.end(); ++i )
+          {
+               if( ( fds[ i ].revents & ( POLLIN | POLLHUP | POLLERR ) ) && !receive( *it ) )
+               {
+                    detach( it++ );
+               }
+               else
+               {
+                    ++it;
+               }
+          }
+
+          if( buffered || fds[ 1 ].revents )
+          {
+               try
+               {
+                    deliver();
+               }
+               catch( const ConnectionError& e )
+               {
+                    std::cerr << "sidecar: broker connection lost: " << e.what() << "\n";
+                    recover();
+               }
+          }
+
+          /// Ответы и доставки, накопленные за итерацию, передаются каждому клиенту одной записью
+          for( auto it = sessions_.begin(); it != sessions_.end(); )
+          {
+               if( !flush( *it ) )
+               {
+                    detach( it++ );
+                    continue;
+               }
+
+               if( it->paused && it->out.empty() )
+               {
+                    try
+                    {
+                         resume( *it );
+                    }
+                    catch( const ConnectionError& e )
+                    {
+                         std::cerr << "sidecar: broker connection lost: " << e.what() << "\n";
+                         recover();
+                    }
+               }
+               ++it;
+          }
+     }
+}
+
+
+void SidecarServer::Upstream::acceptIncoming()
+{
+     std::vector< int > incoming;
+     {
+          boost::lock_guard< boost::mutex > lock( mutex_ );
+          incoming.swap( incoming_ );
+     }
+     for( const auto fd: incoming )
+     {
+          sessions_.emplace_back( fd );
+     }
+}
+
+
+bool SidecarServer::Upstream::receive( Session& session )
+{
+     const auto size = session.in.size();
+     session.in.resize( size + aux::READ_CHUNK );
+
+     const auto received = ::recv( session.fd, &session.in[ size ], aux::READ_CHUNK, 0 );
+     session.in.resize( size + std::max< ssize_t >( received, 0 ) );
+
+     if( received == 0 )
+     {
+          return false;
+     }
+     if( received < 0 )
+     {
+          return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+     }
+
+     std::size_t offset = 0;
+     try
+     {
+          Frame type;
+          boost::string_ref payload;
+          while( SidecarProtocol::next( session.in, offset, type, payload ) )
+          {
+               SidecarProtocol::Reader reader( payload );
+               execute( session, type, reader );
+          }
+     }
+     catch( const std::exception& e )
+     {
+          std::cerr << "sidecar: client protocol error: " << e.what() << "\n";
+          return false;
+     }
+
+     session.in.erase( 0, offset );
+     return true;
+}
+
+
+void SidecarServer::Upstream::execute( Session& session, Frame type, SidecarProtocol::Reader& reader )
+{
+     switch( type )
+     {
+          case Frame::Publish:
+               publish( session, reader );
+               return;
+
+          case Frame::DeclareQueue:
+          {
+               const auto declaration = reader.declaration();
+               request( session, [ & ](){ return SimpleClient::declareQueue( connection_, declaration ); } );
+               return;
+          }
+
+          case Frame::Bind:
+          {
+               Subscription subscription;
+               subscription.exchange = reader.string().to_string();
+               subscription.queue = reader.string().to_string();
+               subscription.routingKey = reader.string().to_string();
+               subscription.consumer = reader.consumer();
+
+               request(
+                    session,
+                    [ & ]()
+                    {
+                         subscribe( session, subscription );
+                         session.subscriptions.push_back( subscription );
+                         return std::string();
+                    }
+               );
+               return;
+          }
+
+          case Frame::Ack:
+          case Frame::Nack:
+          case Frame::Reject:
+               settle( session, type, reader );
+               return;
+
+          default:
+               BOOST_THROW_EXCEPTION( std::runtime_error( "unexpected sidecar frame type " + std::to_string( static_cast< int >( type ) ) ) );
+     }
+}
+
+
+void SidecarServer::Upstream::publish( Session& session, SidecarProtocol::Reader& reader )
+{
+     const auto exchange = reader.string().to_string();
+     const auto routingKey = reader.string().to_string();
+     const auto body = reader.string().to_string();
+
+     /// Как и SimpleClient, после разрыва соединения публикация повторяется однократно
+     for( int attempt = 0; ; ++attempt )
+     {
+          try
+          {
+               SimpleClient::publishMessage( connection_, exchange, routingKey, body );
+               ++published_;
+               return;
+          }
+          catch( const ConnectionError& e )
+          {
+               recover();
+               if( attempt > 0 )
+               {
+                    send( session, Frame::Failure, std::string( "publish failed: " ) + e.what() );
+                    return;
+               }
+          }
+     }
+}
+
+
+void SidecarServer::Upstream::settle( Session& session, Frame type, SidecarProtocol::Reader& reader )
+{
+     const auto tag = reader.varint();
+     const bool multiple = type != Frame::Reject && reader.flag();
+     const bool requeue = type != Frame::Ack && reader.flag();
+
+     /// Идентификаторы доставок, полученных до переподключения к брокеру, уже отсутствуют: эти сообщения
+     /// брокер доставит повторно
+     std::vector< std::uint64_t > tags;
+     const auto first = session.unacked.begin();
+     const auto last = multiple ? session.unacked.upper_bound( tag ) : session.unacked.find( tag );
+     if( multiple )
+     {
+          for( auto it = first; it != last; ++it )
+          {
+               tags.push_back( it->second );
+          }
+          session.unacked.erase( first, last );
+     }
+     else if( last != session.unacked.end() )
+     {
+          tags.push_back( last->second );
+          session.unacked.erase( last );
+     }
+     if( tags.empty() )
+     {
+          return;
+     }
+
+     /// Идентификаторы брокера возрастают в порядке доставки. Одно подтверждение с флагом multiple допустимо,
+     /// только если все неподтвержденные доставки соединения до последней подтверждаемой принадлежат клиенту
+     const bool prefix = multiple
+          && !outstanding_.empty()
+          && outstanding_.begin()->first == tags.front()
+          && static_cast< std::size_t >( std::distance( outstanding_.begin(), outstanding_.upper_bound( tags.back() ) ) ) == tags.size();
+
+     for( const auto each: tags )
+     {
+          outstanding_.erase( each );
+     }
+
+     const auto settleOne = [ & ]( std::uint64_t deliveryTag, bool many )
+     {
+          switch( type )
+          {
+               case Frame::Ack: SimpleClient::ackMessage( connection_, deliveryTag, many ); break;
+               case Frame::Nack: SimpleClient::nackMessage( connection_, deliveryTag, many, requeue ); break;
+               default: SimpleClient::rejectMessage( connection_, deliveryTag, requeue ); break;
+          }
+     };
+
+     try
+     {
+          if( prefix )
+          {
+               settleOne( tags.back(), true );
+          }
+          else
+          {
+               for( const auto each: tags )
+               {
+                    settleOne( each, false );
+               }
+          }
+     }
+     catch( const ConnectionError& e )
+     {
+          recover();
+          send( session, Frame::Failure, std::string( "settlement failed: " ) + e.what() );
+     }
+}
+
+
+void SidecarServer::Upstream::subscribe( Session& session, Subscription& subscription )
+{
+     SimpleClient::bind( connection_, subscription.exchange, subscription.queue, subscription.routingKey, subscription.consumer );
+     subscription.consumerTag = SidecarServer::consumerTagOf( connection_ );
+     consumers_[ subscription.consumerTag ] = &session;
+}
+
+
+void SidecarServer::Upstream::deliver()
+{
+     for( std::size_t i = 0; i < aux::DELIVERY_BATCH; ++i )
+     {
+          const auto delivery = SimpleClient::consumeDelivery( connection_, boost::posix_time::time_duration() );
+          if( !delivery )
+          {
+               return;
+          }
+
+          const auto found = consumers_.find( delivery->consumerTag() );
+          if( found == consumers_.end() )
+          {
+               /// Доставка по подписке отключившегося клиента, полученная до отмены подписки
+               SimpleClient::nackMessage( connection_, delivery->deliveryTag(), false, true );
+               continue;
+          }
+
+          auto& session = *found->second;
+          const auto tag = ++session.lastTag;
+          session.unacked.emplace( tag, delivery->deliveryTag() );
+          outstanding_.emplace( delivery->deliveryTag(), &session );
+
+          const auto start = SidecarProtocol::begin( session.out, Frame::Deliver );
+          SidecarProtocol::putVarint( session.out, tag );
+          SidecarProtocol::putString( session.out, delivery->body() );
+          SidecarProtocol::end( session.out, start );
+
+          ++delivered_;
+
+          if( !session.paused && session.out.size() - session.written >= maxPendingBytes_ )
+          {
+               pause( session );
+          }
+     }
+}
+
+
+void SidecarServer::Upstream::pause( Session& session )
+{
+     /// Доставки отмененных подписок, уже принятые из соединения, возвращаются в очередь (см. deliver())
+     session.paused = true;
+     for( const auto& each: session.subscriptions )
+     {
+          consumers_.erase( each.consumerTag );
+          SidecarServer::cancel( connection_, each.consumerTag );
+     }
+}
+
+
+void SidecarServer::Upstream::resume( Session& session )
+{
+     session.paused = false;
+
+     /// Подписка, которую восстановить не удалось (например, очередь удалена), отбрасывается с уведомлением клиента
+     auto& subscriptions = session.subscriptions;
+     for( auto it = subscriptions.begin(); it != subscriptions.end(); )
+     {
+          try
+          {
+               subscribe( session, *it );
+               ++it;
+          }
+          catch( const ConnectionError& )
+          {
+               throw;
+          }
+          catch( const std::exception& e )
+          {
+               send( session, Frame::Failure, "cannot resume subscription to " + it->queue + ": " + e.what() );
+               it = subscriptions.erase( it );
+          }
+     }
+}
+
+
+bool SidecarServer::Upstream::flush( Session& session )
+{
+     while( session.written < session.out.size() )
+     {
+          const auto sent = ::send(
+               session.fd,
+               session.out.data() + session.written,
+               session.out.size() - session.written,
+               MSG_NOSIGNAL | MSG_DONTWAIT
+          );
+          if( sent < 0 )
+          {
+               return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+          }
+          session.written += sent;
+     }
+
+     session.out.clear();
+     session.written = 0;
+     return true;
+}
+
+
+void SidecarServer::Upstream::detach( std::list< Session >::iterator session )
+{
+     /// Подписки приостановленного клиента уже отменены
+     std::vector< std::string > consumerTags;
+     for( const auto& each: session->subscriptions )
+     {
+          if( !session->paused )
+          {
+               consumerTags.push_back( each.consumerTag );
+          }
+          consumers_.erase( each.consumerTag );
+     }
+     std::vector< std::uint64_t > unacked;
+     for( const auto& each: session->unacked )
+     {
+          unacked.push_back( each.second );
+          outstanding_.erase( each.second );
+     }
+
+     ::close( session->fd );
+     sessions_.erase( session );
+     --clients_;
+
+     /// Подписки отменяются до возврата сообщений в очередь, иначе брокер мог бы выдать их этому же подписчику
+     try
+     {
+          for( const auto& each: consumerTags )
+          {
+               SidecarServer::cancel( connection_, each );
+          }
+          for( const auto each: unacked )
+          {
+               SimpleClient::nackMessage( connection_, each, false, true );
+          }
+     }
+     catch( const ConnectionError& )
+     {
+          recover();
+     }
+}
+
+
+void SidecarServer::Upstream::recover()
+{
+     ++reconnects_;
+
+     bool restored = false;
+     while( !restored && !stop_ )
+     {
+          consumers_.clear();
+          outstanding_.clear();
+          for( auto& each: sessions_ )
+          {
+               each.unacked.clear();
+          }
+
+          try
+          {
+               connection_.reconnect();
+          }
+          catch( const std::exception& e )
+          {
+               std::cerr << "sidecar: reconnection failed: " << e.what() << "\n";
+               continue;
+          }
+
+          /// Подписка, которую восстановить не удалось (например, очередь удалена), отбрасывается с уведомлением
+          /// клиента. Ошибка закрывает канал, поэтому остальные подписки восстанавливаются на новом соединении
+          restored = true;
+          for( auto session = sessions_.begin(); restored && session != sessions_.end(); ++session )
+          {
+               /// Приостановленный клиент подписывается заново после отправки ему накопленных данных
+               if( session->paused )
+               {
+                    continue;
+               }
+
+               auto& subscriptions = session->subscriptions;
+               for( auto it = subscriptions.begin(); restored && it != subscriptions.end(); )
+               {
+                    try
+                    {
+                         subscribe( *session, *it );
+                         ++it;
+                    }
+                    catch( const std::exception& e )
+                    {
+                         send( *session, Frame::Failure, "cannot restore subscription to " + it->queue + ": " + e.what() );
+                         it = subscriptions.erase( it );
+                         restored = false;
+                    }
+               }
+          }
+     }
+}
+
+
+void SidecarServer::Upstream::send( Session& session, Frame type, boost::string_ref text )
+{
+     const auto start = SidecarProtocol::begin( session.out, type );
+     SidecarProtocol::putString( session.out, text );
+     SidecarProtocol::end( session.out, start );
+}
+
+
+SidecarServer::SidecarServer( const std::string& socketPath, const Connection::Parameters& connection, const Parameters& params )
+     : socketPath_( socketPath )
+{
+     if( !params.connections )
+     {
+          BOOST_THROW_EXCEPTION( std::invalid_argument( "sidecar requires at least one broker connection" ) );
+     }
+
+     sockaddr_un address;
+     std::memset( &address, 0, sizeof( address ) );
+     if( socketPath.size() >= sizeof( address.sun_path ) )
+     {
+          BOOST_THROW_EXCEPTION( std::invalid_argument( "sidecar socket path is too long: " + socketPath ) );
+     }
+     address.sun_family = AF_UNIX;
+     std::memcpy( address.sun_path, socketPath.c_str(), socketPath.size() );
+
+     for( std::size_t i = 0; i < params.connections; ++i )
+     {
+          upstreams_.emplace_back( new Upstream( connection, params.maxPendingBytes ) );
+     }
+
+     stopFd_ = aux::makeEventFd();
+     listener_ = ::socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+     if( listener_ < 0 )
+     {
+          ::close( stopFd_ );
+          aux::systemError( "cannot create sidecar socket" );
+     }
+
+     ::unlink( socketPath.c_str() );
+     if( ::bind( listener_, reinterpret_cast< const sockaddr* >( &address ), sizeof( address ) ) != 0
+          || ::listen( listener_, SOMAXCONN ) != 0 )
+     {
+          const auto error = errno;
+          ::close( listener_ );
+          ::close( stopFd_ );
+          errno = error;
+          aux::systemError( "cannot listen on " + socketPath );
+     }
+}
+
+
+SidecarServer::~SidecarServer()
+{
+     ::close( listener_ );
+     ::unlink( socketPath_.c_str() );
+     ::close( stopFd_ );
+}
+
+
+void SidecarServer::run()
+{
+     pollfd fds[ 2 ] = {
+          { listener_, POLLIN, 0 },
+          { stopFd_, POLLIN, 0 }
+     };
+
+     while( true )
+     {
+          if( ::poll( fds, 2, -1 ) < 0 )
+          {
+               if( errno == EINTR )
+               {
+                    continue;
+               }
+               aux::systemError( "sidecar poll" );
+          }
+          if( fds[ 1 ].revents )
+          {
+               aux::drain( stopFd_ );
+               return;
+          }
+
+          const int fd = ::accept4( listener_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC );
+          if( fd < 0 )
+          {
+               continue;
+          }
+
+          auto target = upstreams_.front().get();
+          for( const auto& each: upstreams_ )
+          {
+               if( each->clients() < target->clients() )
+               {
+                    target = each.get();
+               }
+          }
+          target->attach( fd );
+     }
+}
+
+
+void SidecarServer::stop()
+{
+     aux::notify( stopFd_ );
+}
+
+
+SidecarServer::Statistics SidecarServer::statistics() const
+{
+     Statistics statistics;
+     for( const auto& each: upstreams_ )
+     {
+          each->collect( statistics );
+     }
+     return statistics;
+}
+
+
+int SidecarServer::socketOf( const Connection& connection )
+{
+     return amqp_get_sockfd( connection.impl_->connection );
+}
+
+
+bool SidecarServer::hasBufferedData( const Connection& connection )
+{
+     return amqp_frames_enqueued( connection.impl_->connection )
+          || amqp_data_in_buffer( connection.impl_->connection );
+}
+
+
+std::string SidecarServer::consumerTagOf( const Connection& connection )
+{
+     return connection.impl_->consumerTag;
+}
+
+
+void SidecarServer::cancel( const Connection& connection, const std::string& consumerTag )
+{
+     amqp_basic_cancel( connection.impl_->connection, 1, amqp_cstring_bytes( consumerTag.c_str() ) );
+     ensureNoErrors( amqp_get_rpc_reply( connection.impl_->connection ), "basic cancel" );
+}
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
@@ -4,12 +4,26 @@
 
 #include <rabbitmq_client/simple_client.h>
 
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
 #include <stdexcept>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 #include <amqp.h>
-#include <amqp_tcp_socket.h>
 #include <boost/lexical_cast.hpp>
 #include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <rabbitmq_client/claim_check.h>
+#include <rabbitmq_client/dedup.h>
+#include <rabbitmq_client/encryption.h>
+#include <rabbitmq_client/src/connection_impl.h>
+#include <rabbitmq_client/src/probes.h>
 #include <rabbitmq_client/error.h>
+#include <rabbitmq_client/integrity.h>
+#include <rabbitmq_client/rate_limiter.h>
 #include <rabbitmq_client/utils.h>
 
 
@@ -45,51 +59,92 @@ void doReconnectOnError( NetworkOp&& networkOp, ReconnectionOp&& reconnectionOp
 }
 
 
-} // namespace aux
-} // namespace {unnamed}
-
-
-struct Connection::Impl
+/// @brief Извлекает из @a pending записи сообщения @a deliveryTag (и предшествующих ему при @a multiple),
+/// передавая значения в @a settle
+template< typename PendingMap, typename SettleOp >
+void settlePending( PendingMap& pending, std::uint64_t deliveryTag, bool multiple, SettleOp&& settle )
 {
-     static amqp_connection_state_t initConnection()
+     if( !multiple )
      {
-          return amqp_new_connection();
+          const auto found = pending.find( deliveryTag );
+          if( found != pending.end() )
+          {
+               settle( found->second );
+               pending.erase( found );
+          }
+          return;
      }
 
-
-     static amqp_socket_t* initSocket( const amqp_connection_state_t& conn )
+     for( auto it = pending.begin(); it != pending.end(); )
      {
-          const auto sock = amqp_tcp_socket_new( conn );
-          if( !sock )
+          if( it->first <= deliveryTag )
           {
-               BOOST_THROW_EXCEPTION( std::runtime_error( "cannot create amqp socket" ) );
+               settle( it->second );
+               it = pending.erase( it );
+          }
+          else
+          {
+               ++it;
           }
-          return sock;
      }
+}
+
+
+/// Тело сообщения rabbitmq-c без копирования
+boost::string_ref bodyOf( const amqp_envelope_t& envelope )
+{
+     return boost::string_ref( static_cast< const char* >( envelope.message.body.bytes ), envelope.message.body.len );
+}
 
-     Impl()
-          : connection( Impl::initConnection() )
-          , socket( Impl::initSocket( connection ) )
-     {}
 
-     ~Impl()
+/// Находит заголовок @a name в свойствах сообщения rabbitmq-c
+const amqp_field_value_t* findHeader( const amqp_basic_properties_t& props, const char* name )
+{
+     if( !( props._flags & AMQP_BASIC_HEADERS_FLAG ) )
      {
-          if( channelOpenned )
-          {
-               amqp_channel_close( connection, 1, AMQP_REPLY_SUCCESS );
-               channelOpenned = false;
-          }
-          if( socket )
+          return nullptr;
+     }
+
+     const auto size = std::strlen( name );
+     for( int i = 0; i < props.headers.num_entries; ++i )
+     {
+          const auto& entry = props.headers.entries[ i ];
+          if( entry.key.len == size && std::memcmp( entry.key.bytes, name, size ) == 0 )
           {
-               amqp_connection_close( connection, AMQP_REPLY_SUCCESS );
+               return &entry.value;
           }
-          amqp_destroy_connection( connection );
      }
+     return nullptr;
+}
+
+
+std::unique_ptr< timeval > makeTimeval( const boost::optional< boost::posix_time::time_duration >& duration )
+{
+     if( duration )
+     {
+          std::unique_ptr< timeval > tv( new timeval );
+          tv->tv_sec = duration->total_seconds();
+          tv->tv_usec = duration->fractional_seconds();
+          return tv;
+     }
+
+     return nullptr;
+}
+
+
+int makeEventFd()
+{
+     const int fd = ::eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+     if( fd < 0 )
+     {
+          BOOST_THROW_EXCEPTION( std::runtime_error( std::string( "cannot create eventfd: " ) + std::strerror( errno ) ) );
+     }
+     return fd;
+}
 
-     amqp_connection_state_t connection = nullptr;
-     amqp_socket_t* socket = nullptr;
-     bool channelOpenned = false;
-};
+
+} // namespace aux
+} // namespace {unnamed}
 
 
 Connection::Connection(
@@ -120,17 +175,22 @@ void Connection::connect()
 {
      int attemptsLeft = 5;
      int delayMs = 300;
+     int attempt = 0;
 
      while( true )
      {
+          ++attempt;
+          RABBITMQ_CLIENT_PROBE3( connect__attempt, attempt, params_.hostname.c_str(), params_.port );
           try
           {
                std::cout << "Trying connect...\n";
                connect_();
+               RABBITMQ_CLIENT_PROBE2( connect__done, attempt, 1 );
                break;
           }
           catch( const std::exception& e )
           {
+               RABBITMQ_CLIENT_PROBE2( connect__done, attempt, 0 );
                --attemptsLeft;
                delayMs *= 2;
                std::cout << "Failed (reason: " << e.what() << "). Attempts left: " << attemptsLeft << "\n";
@@ -156,13 +216,24 @@ void Connection::connect_()
           "opening TCP socket"
      );
 
+     /// Брокер уведомляет о блокировке соединения (connection.blocked) и об отмене подписки с его стороны
+     /// (basic.cancel) только клиентов, заявивших о поддержке этих возможностей
+     HeaderTable capabilities;
+     capabilities[ "connection.blocked" ].value = true;
+     capabilities[ "consumer_cancel_notify" ].value = true;
+
+     FieldTable clientProperties;
+     clientProperties.set( "capabilities", capabilities );
+     const auto properties = clientProperties.native();
+
      ensureNoErrors(
-          amqp_login(
+          amqp_login_with_properties(
                impl_->connection,
                params_.virtualHost.c_str(),
                AMQP_DEFAULT_MAX_CHANNELS,
                AMQP_DEFAULT_FRAME_SIZE,
                AMQP_DEFAULT_HEARTBEAT,
+               &properties,
                AMQP_SASL_METHOD_PLAIN,
                params_.username.c_str(),
                params_.password.c_str()
@@ -177,15 +248,58 @@ void Connection::connect_()
 
 void Connection::reconnect()
 {
+     RABBITMQ_CLIENT_PROBE( reconnect );
      impl_.reset();
      impl_ = std::move( make_unique< Connection::Impl >() );
      connect();
 }
 
 
+bool Connection::blocked() const
+{
+     return impl_->blocked;
+}
+
+
+std::string Connection::blockedReason() const
+{
+     return impl_->blockedReason;
+}
+
+
 void SimpleClient::publishMessage( const Connection& connection, const std::string& exchange, const std::string& routingKey, const std::string& message )
 {
-     ensureNoErrors(
+     publishBody( connection, exchange, routingKey, message, nullptr );
+}
+
+
+void SimpleClient::publishMessage(
+     const Connection& connection
+     , const std::string& exchange
+     , const std::string& routingKey
+     , const std::string& message
+     , const amqp_basic_properties_t& properties
+)
+{
+     publishBody( connection, exchange, routingKey, message, &properties );
+}
+
+
+void SimpleClient::publishBody(
+     const Connection& connection
+     , const std::string& exchange
+     , const std::string& routingKey
+     , boost::string_ref body
+     , const amqp_basic_properties_t* properties
+)
+{
+     RABBITMQ_CLIENT_PROBE3( publish__start, exchange.c_str(), routingKey.c_str(), body.size() );
+
+     amqp_bytes_t bytes;
+     bytes.len = body.size();
+     bytes.bytes = const_cast< char* >( body.data() );
+
+     const auto status =
           amqp_basic_publish(
                connection.impl_->connection, /* amqp_connection_state_t                 state       */
                1,                            /* amqp_channel_t                          channel     */
@@ -193,252 +307,1535 @@ void SimpleClient::publishMessage( const Connection& connection, const std::stri
                fromString( routingKey ),     /* amqp_bytes_t                            routing_key */
                0,                            /* amqp_boolean_t                          mandatory   */
                0,                            /* amqp_boolean_t                          immediate   */
-               nullptr,                      /* struct amqp_basic_properties_t_ const * properties  */
-               fromString( message )         /* amqp_bytes_t                            body        */
-          ),
-          "basic publish"
-     );
+               properties,                   /* struct amqp_basic_properties_t_ const * properties  */
+               bytes                         /* amqp_bytes_t                            body        */
+          );
+
+     RABBITMQ_CLIENT_PROBE2( publish__done, body.size(), status );
+     ensureNoErrors( status, "basic publish" );
 }
 
 
-void SimpleClient::bind( const Connection& connection, const std::string& exchange, const std::string& queueName, const std::string& routingKey )
+void SimpleClient::setContentType( amqp_basic_properties_t& properties, const char* contentType )
 {
-     amqp_queue_bind(
-          connection.impl_->connection,      /* amqp_connection_state_t state       */
-          1,                                 /* amqp_channel_t          channel     */
-          fromString( queueName.c_str() ),   /* amqp_bytes_t            queue       */
-          fromString( exchange.c_str() ),    /* amqp_bytes_t            exchange    */
-          fromString( routingKey.c_str() ),  /* amqp_bytes_t            routing_key */
-          amqp_empty_table                   /* amqp_table_t            argument    */
-     );
-     ensureNoErrors( amqp_get_rpc_reply( connection.impl_->connection ), "bind queue" );
-
-     amqp_basic_consume(
-          connection.impl_->connection, /* amqp_connection_state_t state        */
-          1,                            /* amqp_channel_t          channel      */
-          fromString( queueName ),      /* amqp_bytes_t            queue        */
-          amqp_empty_bytes,             /* amqp_bytes_t            consumer_tag */
-          0,                            /* amqp_boolean_t          no_local     */
-          0,                            /* amqp_boolean_t          no_ack       */
-          0,                            /* amqp_boolean_t          exclusive    */
-          amqp_empty_table              /* amqp_table_t            arguments    */
-     );
-     ensureNoErrors( amqp_get_rpc_reply( connection.impl_->connection ), "basic consume" );
+     properties._flags |= AMQP_BASIC_CONTENT_TYPE_FLAG;
+     properties.content_type = amqp_cstring_bytes( contentType );
 }
 
 
-boost::optional< SimpleClient::Envelope > SimpleClient::consumeMessage(
-     const Connection& connection,
-     const boost::optional< boost::posix_time::time_duration >& timeout
-)
+void SimpleClient::checkContentType( const Delivery& delivery, const char* contentType )
 {
-     static auto makeTimeval =
-          []( const boost::optional< boost::posix_time::time_duration >& duration ) -> std::unique_ptr< timeval >
-          {
-               if( duration )
-               {
-                    std::unique_ptr< timeval > tv( new timeval );
-                    tv->tv_sec = duration->total_seconds();
-                    tv->tv_usec = duration->fractional_seconds();
-                    return tv;
-               }
+     /// Сравнивается исходное свойство доставки, без разбора остальных свойств в MessageProperties
+     const auto& properties = delivery.native().message.properties;
+     if( !( properties._flags & AMQP_BASIC_CONTENT_TYPE_FLAG ) )
+     {
+          return;
+     }
 
-               return nullptr;
-          };
+     const auto length = std::strlen( contentType );
+     if( properties.content_type.len != length || std::memcmp( properties.content_type.bytes, contentType, length ) != 0 )
+     {
+          throwCodecError( delivery, "unexpected content type " + toString( properties.content_type ) + ", expected " + contentType );
+     }
+}
 
-     amqp_maybe_release_buffers( connection.impl_->connection );
 
-     amqp_envelope_t envelope = { 0 };
+void SimpleClient::throwCodecError( const Delivery& delivery, const std::string& what )
+{
+     BOOST_THROW_EXCEPTION(
+          CodecError( what + ", delivery tag: " + boost::lexical_cast< std::string >( delivery.deliveryTag() ), delivery.deliveryTag() )
+     );
+}
 
-     const auto timer = makeTimeval( timeout );
 
-     const auto reply =
-          amqp_consume_message(
-               connection.impl_->connection,
-               &envelope,
-               timer ? boost::addressof( *timer ) : nullptr,
-               0
-          );
+FieldTable SimpleClient::queueArguments( const QueueDeclaration& declaration )
+{
+     FieldTable arguments( declaration.arguments );
 
-     if( isTimedOutError( reply ) )
+     if( declaration.type != QueueType::Classic )
      {
-          return boost::none;
+          if( !declaration.durable || declaration.exclusive || declaration.autoDelete )
+          {
+               BOOST_THROW_EXCEPTION(
+                    std::runtime_error( "quorum queues and streams must be durable, non-exclusive and non-auto-delete: "
+                         + declaration.queueName ) );
+          }
+          if( declaration.lazy )
+          {
+               BOOST_THROW_EXCEPTION(
+                    std::runtime_error( "lazy mode is supported by classic queues only: " + declaration.queueName ) );
+          }
+          arguments.set( "x-queue-type", std::string( declaration.type == QueueType::Quorum ? "quorum" : "stream" ) );
      }
-     else if( isUnexpectedFrameStateError( reply ) )
+
+     if( declaration.maxLength )
      {
-          handleUnexpectedFrameStateError( connection );
-          return boost::none;
+          arguments.set( "x-max-length", *declaration.maxLength );
      }
-     else
+     if( declaration.maxLengthBytes )
      {
-          ensureNoErrors( reply, "consume message" );
+          arguments.set( "x-max-length-bytes", *declaration.maxLengthBytes );
+     }
+     if( declaration.overflow )
+     {
+          static const char* const overflowNames[] = { "drop-head", "reject-publish", "reject-publish-dlx" };
+          arguments.set( "x-overflow", std::string( overflowNames[ static_cast< int >( *declaration.overflow ) ] ) );
+     }
+     if( declaration.lazy )
+     {
+          arguments.set( "x-queue-mode", std::string( "lazy" ) );
+     }
+     if( declaration.singleActiveConsumer )
+     {
+          arguments.set( "x-single-active-consumer", true );
      }
 
-     std::unique_ptr< amqp_envelope_t, void(*)( amqp_envelope_t* ) > autocleaner( &envelope, amqp_destroy_envelope );
-
-     return SimpleClient::Envelope( toString( envelope.message.body ), envelope.delivery_tag );
+     return arguments;
 }
 
 
-void SimpleClient::ackMessage( const Connection& connection, std::uint64_t deliveryTag )
+std::string SimpleClient::declareQueue( const Connection& connection, const QueueDeclaration& declaration )
 {
-     const auto ret =
-          amqp_basic_ack(
-               connection.impl_->connection, /* amqp_connection_state_t state        */
-               1,                            /* amqp_channel_t          channel      */
-               deliveryTag,                  /* uint64_t                delivery_tag */
-               0                             /* amqp_boolean_t          multiple     */
+     const auto arguments = queueArguments( declaration );
+
+     const auto declared =
+          amqp_queue_declare(
+               connection.impl_->connection,      /* amqp_connection_state_t state       */
+               1,                                 /* amqp_channel_t          channel     */
+               fromString( declaration.queueName ),/* amqp_bytes_t           queue       */
+               0,                                 /* amqp_boolean_t          passive     */
+               declaration.durable,               /* amqp_boolean_t          durable     */
+               declaration.exclusive,             /* amqp_boolean_t          exclusive   */
+               declaration.autoDelete,            /* amqp_boolean_t          auto_delete */
+               arguments.native()                 /* amqp_table_t            arguments   */
           );
+     ensureNoErrors( amqp_get_rpc_reply( connection.impl_->connection ), "declare queue" );
 
-     if( ret )
-     {
-          BOOST_THROW_EXCEPTION(
-               std::runtime_error( "broker error while acknowledge message with delivery tag: "
-                    + boost::lexical_cast< std::string >( deliveryTag ) ) );
-     }
+     return declared ? toString( declared->queue ) : declaration.queueName;
 }
 
 
-bool SimpleClient::isTimedOutError( const amqp_rpc_reply_t& reply )
+FieldTable SimpleClient::consumerArguments( const ConsumerParameters& consumer )
 {
-     return reply.reply_type == AMQP_RESPONSE_LIBRARY_EXCEPTION
-          && reply.library_error == AMQP_STATUS_TIMEOUT;
+     /// Брокер не выдает сообщения потока подписчику без ограничения кол-ва неподтвержденных сообщений
+     if( consumer.streamOffset && !consumer.prefetchCount )
+     {
+          BOOST_THROW_EXCEPTION( std::invalid_argument( "stream consumer requires prefetch count" ) );
+     }
+
+     FieldTable arguments( consumer.arguments );
+     if( consumer.priority )
+     {
+          arguments.set( "x-priority", static_cast< std::int64_t >( *consumer.priority ) );
+     }
+     if( consumer.streamOffset )
+     {
+          const auto& offset = *consumer.streamOffset;
+          switch( offset.kind )
+          {
+               case StreamOffset::Kind::First:
+                    arguments.set( "x-stream-offset", std::string( "first" ) );
+                    break;
+               case StreamOffset::Kind::Last:
+                    arguments.set( "x-stream-offset", std::string( "last" ) );
+                    break;
+               case StreamOffset::Kind::Next:
+                    arguments.set( "x-stream-offset", std::string( "next" ) );
+                    break;
+               case StreamOffset::Kind::Offset:
+                    arguments.set( "x-stream-offset", static_cast< std::int64_t >( offset.value ) );
+                    break;
+               case StreamOffset::Kind::Timestamp:
+                    arguments.setTimestamp( "x-stream-offset", offset.value );
+                    break;
+          }
+     }
+
+     return arguments;
 }
 
 
-bool SimpleClient::isUnexpectedFrameStateError( const amqp_rpc_reply_t& reply )
+void SimpleClient::bind( const Connection& connection, const std::string& exchange, const std::string& queueName, const std::string& routingKey )
 {
-     return reply.reply_type == AMQP_RESPONSE_LIBRARY_EXCEPTION
-          && reply.library_error == AMQP_STATUS_UNEXPECTED_STATE;
+     SimpleClient::bind( connection, exchange, queueName, routingKey, ConsumerParameters() );
 }
 
 
-void SimpleClient::handleUnexpectedFrameStateError( const Connection& connection )
+void SimpleClient::bind(
+     const Connection& connection,
+     const std::string& exchange,
+     const std::string& queueName,
+     const std::string& routingKey,
+     const ConsumerParameters& consumer
+)
 {
-     amqp_frame_t frame;
+     /// Аргументы формируются (и проверяются) до изменения состояния канала
+     const auto arguments = consumerArguments( consumer );
 
-     if( amqp_simple_wait_frame( connection.impl_->connection, &frame ) != AMQP_STATUS_OK )
+     if( consumer.prefetchCount )
      {
-          return;
+          amqp_basic_qos(
+               connection.impl_->connection, /* amqp_connection_state_t state          */
+               1,                            /* amqp_channel_t          channel        */
+               0,                            /* uint32_t                prefetch_size  */
+               *consumer.prefetchCount,      /* uint16_t                prefetch_count */
+               0                             /* amqp_boolean_t          global         */
+          );
+          ensureNoErrors( amqp_get_rpc_reply( connection.impl_->connection ), "basic qos" );
      }
 
-     if( frame.frame_type != AMQP_FRAME_METHOD )
-          return;
-
-     switch( frame.payload.method.id )
+     if( !exchange.empty() )
      {
-          /// if we've turned publisher confirms on, and we've published a message
-          /// here is a message being confirmed
-          ///
-          case AMQP_BASIC_ACK_METHOD:
-               BOOST_THROW_EXCEPTION( std::runtime_error( "unexpected frame state AMQP_BASIC_ACK_METHOD: not implemented" ) );
-               break;
+          amqp_queue_bind(
+               connection.impl_->connection,      /* amqp_connection_state_t state       */
+               1,                                 /* amqp_channel_t          channel     */
+               fromString( queueName.c_str() ),   /* amqp_bytes_t            queue       */
+               fromString( exchange.c_str() ),    /* amqp_bytes_t            exchange    */
+               fromString( routingKey.c_str() ),  /* amqp_bytes_t            routing_key */
+               amqp_empty_table                   /* amqp_table_t            argument    */
+          );
+          ensureNoErrors( amqp_get_rpc_reply( connection.impl_->connection ), "bind queue" );
+     }
 
-          /// if a published message couldn't be routed and the mandatory flag was set
-          /// this is what would be returned. The message then needs to be read.
-          ///
-          case AMQP_BASIC_RETURN_METHOD:
-               {
-                    amqp_message_t message;
-                    const auto ret = amqp_read_message( connection.impl_->connection, frame.channel, &message, 0 );
-                    if( ret.reply_type == AMQP_RESPONSE_NORMAL )
-                    {
-                         amqp_destroy_message( &message );
-                    }
+     const auto consumed =
+          amqp_basic_consume(
+               connection.impl_->connection, /* amqp_connection_state_t state        */
+               1,                            /* amqp_channel_t          channel      */
+               fromString( queueName ),      /* amqp_bytes_t            queue        */
+               amqp_empty_bytes,             /* amqp_bytes_t            consumer_tag */
+               0,                            /* amqp_boolean_t          no_local     */
+               consumer.noAck,               /* amqp_boolean_t          no_ack       */
+               consumer.exclusive,           /* amqp_boolean_t          exclusive    */
+               arguments.native()            /* amqp_table_t            arguments    */
+          );
+     ensureNoErrors( amqp_get_rpc_reply( connection.impl_->connection ), "basic consume" );
+     connection.impl_->consuming = true;
+     connection.impl_->cancelled = false;
+     connection.impl_->consumerTag = consumed ? toString( consumed->consumer_tag ) : std::string();
+}
 
-               }
-               break;
 
-          /// a channel.close method happens when a channel exception occurs, this
-          /// can happen by publishing to an exchange that doesn't exist for example
-          ///
-          /// In this case you would need to open another channel redeclare any queues
-          /// that were declared auto-delete, and restart any consumers that were attached
-          /// to the previous channel
-          ///
-          case AMQP_CHANNEL_CLOSE_METHOD:
-               BOOST_THROW_EXCEPTION( ConnectionError( "channel closed" ) );
-               break;;
+boost::optional< SimpleClient::Envelope > SimpleClient::consumeMessage(
+     const Connection& connection,
+     const boost::optional< boost::posix_time::time_duration >& timeout
+)
+{
+     amqp_maybe_release_buffers( connection.impl_->connection );
 
-          /// a connection.close method happens when a connection exception occurs,
-          /// this can happen by trying to use a channel that isn't open for example.
-          ///
-          /// In this case the whole connection must be restarted.
-          ///
-          case AMQP_CONNECTION_CLOSE_METHOD:
-               BOOST_THROW_EXCEPTION( ConnectionError( "connection closed" ) );
-               break;
+     amqp_envelope_t envelope = { 0 };
 
-          default:
-               BOOST_THROW_EXCEPTION(
-                    std::runtime_error( "unexpected frame method id "
-                         + boost::lexical_cast< std::string >( frame.payload.method.id ) ) );
+     if( !consumeEnvelope( connection, timeout, envelope ) )
+     {
+          return boost::none;
      }
+
+     std::unique_ptr< amqp_envelope_t, void(*)( amqp_envelope_t* ) > autocleaner( &envelope, amqp_destroy_envelope );
+
+     return SimpleClient::Envelope( toString( envelope.message.body ), envelope.delivery_tag );
 }
 
 
-SimpleClient::SimpleClient(
-     const std::string& host,
-     int port,
-     const std::string& user,
-     const std::string& pwd,
-     const std::string& vhost
+boost::optional< Delivery > SimpleClient::consumeDelivery(
+     const Connection& connection,
+     const boost::optional< boost::posix_time::time_duration >& timeout
 )
-     : SimpleClient( Connection::Parameters( host, port, user, pwd, vhost ) )
-{}
+{
+     amqp_maybe_release_buffers( connection.impl_->connection );
 
-SimpleClient::SimpleClient( const Connection::Parameters& params )
-     : connection_( params )
-{}
+     amqp_envelope_t envelope = { 0 };
 
+     if( !consumeEnvelope( connection, timeout, envelope ) )
+     {
+          return boost::none;
+     }
 
-void SimpleClient::publishMessage( const std::string& exchange, const std::string& routingKey, const std::string& message )
-{
-     aux::doReconnectOnError(
-          [ & ](){ SimpleClient::publishMessage( connection_, exchange, routingKey, message ); },
-          [ this ](){ reconnect(); }
-     );
+     return Delivery( envelope );
 }
 
 
-void SimpleClient::publishMessage( const QueueParameters& params, const std::string& message )
+std::size_t SimpleClient::consumeMessages(
+     const Connection& connection,
+     std::vector< Envelope >& envelopes,
+     std::size_t maxCount,
+     const boost::optional< boost::posix_time::time_duration >& timeout
+)
 {
-     publishMessage( params.exchange, params.routingKey, message );
-}
-
+     envelopes.clear();
 
+     /// Буферы освобождаются однократно на всю пачку, а не перед каждым сообщением
+     amqp_maybe_release_buffers( connection.impl_->connection );
 
-void SimpleClient::bind( const std::string& exchange, const std::string& queueName, const std::string& routingKey )
-{
-     SimpleClient::bind( connection_, exchange, queueName, routingKey );
-}
+     while( envelopes.size() < maxCount )
+     {
+          amqp_envelope_t envelope = { 0 };
+
+          /// Ожидание допускается только для первого сообщения пачки, остальные забираются из уже принятых данных
+          const auto wait = envelopes.empty() ? timeout : boost::make_optional( boost::posix_time::time_duration() );
+
+          if( !consumeEnvelope( connection, wait, envelope ) )
+          {
+               break;
+          }
+
+          std::unique_ptr< amqp_envelope_t, void(*)( amqp_envelope_t* ) > autocleaner( &envelope, amqp_destroy_envelope );
+
+          envelopes.emplace_back( toString( envelope.message.body ), envelope.delivery_tag );
+
+          if( !hasBufferedData( connection ) )
+          {
+               break;
+          }
+     }
+
+     return envelopes.size();
+}
+
+
+bool SimpleClient::consumeEnvelope(
+     const Connection& connection,
+     const boost::optional< boost::posix_time::time_duration >& timeout,
+     amqp_envelope_t& envelope
+)
+{
+     auto& deliveries = connection.impl_->deliveries;
+     if( !deliveries.empty() )
+     {
+          envelope = deliveries.front();
+          deliveries.pop_front();
+          RABBITMQ_CLIENT_PROBE2( consume__deliver, envelope.delivery_tag, envelope.message.body.len );
+          return true;
+     }
+
+     const auto timer = aux::makeTimeval( timeout );
+
+     RABBITMQ_CLIENT_PROBE1( consume__wait, timeout ? timeout->total_microseconds() : std::int64_t( -1 ) );
+
+     const auto reply =
+          amqp_consume_message(
+               connection.impl_->connection,
+               &envelope,
+               timer ? boost::addressof( *timer ) : nullptr,
+               0
+          );
+
+     if( isTimedOutError( reply ) )
+     {
+          return false;
+     }
+     else if( isUnexpectedFrameStateError( reply ) )
+     {
+          handleUnexpectedFrameStateError( connection );
+          return false;
+     }
+     else
+     {
+          ensureNoErrors( reply, "consume message" );
+     }
+
+     RABBITMQ_CLIENT_PROBE2( consume__deliver, envelope.delivery_tag, envelope.message.body.len );
+     return true;
+}
+
+
+bool SimpleClient::drainAndStop(
+     const Connection& connection,
+     const boost::posix_time::time_duration& deadline,
+     const DrainHandler& handler
+)
+{
+     using boost::posix_time::microsec_clock;
+
+     const auto expires = microsec_clock::universal_time() + deadline;
+     const auto remaining = [ & ]()
+          {
+               return std::max( expires - microsec_clock::universal_time(), boost::posix_time::time_duration() );
+          };
+
+     auto& impl = *connection.impl_;
+
+     if( impl.consuming && !impl.cancelled && !impl.consumerTag.empty() )
+     {
+          /// 1. Отмена подписки. Ответ (basic.cancel-ok) не ожидается синхронно: до него брокер может прислать
+          /// еще несколько доставок, и их необходимо прочитать из того же потока кадров
+          amqp_basic_cancel_t cancel;
+          cancel.consumer_tag = fromString( impl.consumerTag );
+          cancel.nowait = 0;
+          ensureNoErrors( amqp_send_method( impl.connection, 1, AMQP_BASIC_CANCEL_METHOD, &cancel ), "basic cancel" );
+
+          /// 2. Обработка сообщений, уже выданных подписчику (prefetch). После basic.cancel-ok новых доставок не будет;
+          /// флаг cancelled устанавливает handleFrame()
+          while( !impl.cancelled )
+          {
+               const auto left = remaining();
+               if( left <= boost::posix_time::time_duration() )
+               {
+                    break;
+               }
+
+               amqp_maybe_release_buffers( impl.connection );
+
+               amqp_envelope_t envelope = { 0 };
+               if( !consumeEnvelope( connection, left, envelope ) )
+               {
+                    continue;
+               }
+
+               Delivery delivery( envelope );
+
+               /// Без обработчика сообщение не подтверждается и возвращается в очередь при закрытии канала
+               if( handler )
+               {
+                    handler( delivery );
+                    ackMessage( connection, delivery.deliveryTag() );
+               }
+          }
+     }
+
+     const bool drained = !impl.consuming || impl.cancelled;
+     impl.consuming = false;
+
+     /// 3. Подтверждения уже записаны в сокет вызовами amqp_basic_ack(); брокер обрабатывает кадры канала по порядку,
+     /// поэтому получение channel.close-ok означает, что все подтверждения приняты.
+     /// 4. Закрытие канала (с ограничением времени ожидания ответа)
+     const bool closed = closeChannel( connection, remaining() );
+
+     return drained && closed;
+}
+
+
+bool SimpleClient::closeChannel( const Connection& connection, const boost::posix_time::time_duration& timeout )
+{
+     using boost::posix_time::microsec_clock;
+
+     auto& impl = *connection.impl_;
+     if( !impl.channelOpenned )
+     {
+          return true;
+     }
+
+     amqp_channel_close_t close;
+     close.reply_code = AMQP_REPLY_SUCCESS;
+     close.reply_text = amqp_empty_bytes;
+     close.class_id = 0;
+     close.method_id = 0;
+     ensureNoErrors( amqp_send_method( impl.connection, 1, AMQP_CHANNEL_CLOSE_METHOD, &close ), "channel close" );
+
+     /// Канал считается закрытым независимо от ответа брокера: повторно его закрывать при разрушении соединения не нужно
+     impl.channelOpenned = false;
+
+     const auto expires = microsec_clock::universal_time() + timeout;
+     while( true )
+     {
+          const auto left = expires - microsec_clock::universal_time();
+          if( left <= boost::posix_time::time_duration() )
+          {
+               return false;
+          }
+
+          amqp_frame_t frame;
+          const auto timer = aux::makeTimeval( left );
+
+          const auto status = amqp_simple_wait_frame_noblock( impl.connection, &frame, timer.get() );
+          if( status == AMQP_STATUS_TIMEOUT )
+          {
+               return false;
+          }
+          ensureNoErrors( status, "waiting channel close-ok" );
+
+          /// Доставки, пришедшие после истечения времени отмены подписки, пропускаются:
+          /// брокер вернет их в очередь при закрытии канала
+          if( frame.frame_type == AMQP_FRAME_METHOD && frame.payload.method.id == AMQP_CHANNEL_CLOSE_OK_METHOD )
+          {
+               return true;
+          }
+     }
+}
+
+
+void SimpleClient::ackMessage( const Connection& connection, std::uint64_t deliveryTag, bool multiple )
+{
+     RABBITMQ_CLIENT_PROBE2( ack, deliveryTag, multiple );
+
+     const auto ret =
+          amqp_basic_ack(
+               connection.impl_->connection, /* amqp_connection_state_t state        */
+               1,                            /* amqp_channel_t          channel      */
+               deliveryTag,                  /* uint64_t                delivery_tag */
+               multiple                      /* amqp_boolean_t          multiple     */
+          );
+
+     if( ret )
+     {
+          BOOST_THROW_EXCEPTION(
+               std::runtime_error( "broker error while acknowledge message with delivery tag: "
+                    + boost::lexical_cast< std::string >( deliveryTag ) ) );
+     }
+}
+
+
+void SimpleClient::nackMessage( const Connection& connection, std::uint64_t deliveryTag, bool multiple, bool requeue )
+{
+     RABBITMQ_CLIENT_PROBE3( nack, deliveryTag, multiple, requeue );
+
+     const auto ret =
+          amqp_basic_nack(
+               connection.impl_->connection, /* amqp_connection_state_t state        */
+               1,                            /* amqp_channel_t          channel      */
+               deliveryTag,                  /* uint64_t                delivery_tag */
+               multiple,                     /* amqp_boolean_t          multiple     */
+               requeue                       /* amqp_boolean_t          requeue      */
+          );
+
+     if( ret )
+     {
+          BOOST_THROW_EXCEPTION(
+               std::runtime_error( "broker error while negative acknowledge message with delivery tag: "
+                    + boost::lexical_cast< std::string >( deliveryTag ) ) );
+     }
+}
+
+
+void SimpleClient::rejectMessage( const Connection& connection, std::uint64_t deliveryTag, bool requeue )
+{
+     RABBITMQ_CLIENT_PROBE2( reject, deliveryTag, requeue );
+
+     const auto ret =
+          amqp_basic_reject(
+               connection.impl_->connection, /* amqp_connection_state_t state        */
+               1,                            /* amqp_channel_t          channel      */
+               deliveryTag,                  /* uint64_t                delivery_tag */
+               requeue                       /* amqp_boolean_t          requeue      */
+          );
+
+     if( ret )
+     {
+          BOOST_THROW_EXCEPTION(
+               std::runtime_error( "broker error while reject message with delivery tag: "
+                    + boost::lexical_cast< std::string >( deliveryTag ) ) );
+     }
+}
+
+
+bool SimpleClient::hasBufferedData( const Connection& connection )
+{
+     return !connection.impl_->deliveries.empty()
+          || amqp_frames_enqueued( connection.impl_->connection )
+          || amqp_data_in_buffer( connection.impl_->connection );
+}
+
+
+int SimpleClient::socketDescriptor( const Connection& connection )
+{
+     return amqp_get_sockfd( connection.impl_->connection );
+}
+
+
+bool SimpleClient::isTimedOutError( const amqp_rpc_reply_t& reply )
+{
+     return reply.reply_type == AMQP_RESPONSE_LIBRARY_EXCEPTION
+          && reply.library_error == AMQP_STATUS_TIMEOUT;
+}
+
+
+bool SimpleClient::isUnexpectedFrameStateError( const amqp_rpc_reply_t& reply )
+{
+     return reply.reply_type == AMQP_RESPONSE_LIBRARY_EXCEPTION
+          && reply.library_error == AMQP_STATUS_UNEXPECTED_STATE;
+}
+
+
+void SimpleClient::handleUnexpectedFrameStateError( const Connection& connection )
+{
+     amqp_frame_t frame;
+
+     if( amqp_simple_wait_frame( connection.impl_->connection, &frame ) != AMQP_STATUS_OK )
+     {
+          return;
+     }
+
+     handleFrame( connection, frame );
+}
+
+
+void SimpleClient::pollConnectionEvents( const Connection& connection )
+{
+     auto& impl = *connection.impl_;
+
+     /// При наличии подписки служебные кадры обрабатывает цикл получения сообщений
+     if( impl.consuming )
+     {
+          return;
+     }
+
+     /// Проверка выполняется не чаще раза в 10 мс, чтобы не добавлять системный вызов к каждой публикации
+     const auto now = boost::chrono::steady_clock::now();
+     if( now - impl.lastEventsPoll < boost::chrono::milliseconds( 10 ) )
+     {
+          return;
+     }
+     impl.lastEventsPoll = now;
+
+     while( true )
+     {
+          amqp_frame_t frame;
+          timeval noWait = { 0, 0 };
+
+          const auto status = amqp_simple_wait_frame_noblock( impl.connection, &frame, &noWait );
+          if( status == AMQP_STATUS_TIMEOUT )
+          {
+               return;
+          }
+          ensureNoErrors( status, "reading connection events" );
+
+          handleFrame( connection, frame );
+     }
+}
+
+
+void SimpleClient::handleFrame( const Connection& connection, const amqp_frame_t& frame )
+{
+     if( frame.frame_type != AMQP_FRAME_METHOD )
+          return;
+
+     switch( frame.payload.method.id )
+     {
+          /// if we've turned publisher confirms on, and we've published a message
+          /// here is a message being confirmed
+          ///
+          case AMQP_BASIC_ACK_METHOD:
+               BOOST_THROW_EXCEPTION( std::runtime_error( "unexpected frame state AMQP_BASIC_ACK_METHOD: not implemented" ) );
+               break;
+
+          /// if a published message couldn't be routed and the mandatory flag was set
+          /// this is what would be returned. The message then needs to be read.
+          ///
+          case AMQP_BASIC_RETURN_METHOD:
+               {
+                    amqp_message_t message;
+                    const auto ret = amqp_read_message( connection.impl_->connection, frame.channel, &message, 0 );
+                    if( ret.reply_type == AMQP_RESPONSE_NORMAL )
+                    {
+                         amqp_destroy_message( &message );
+                    }
+
+               }
+               break;
+
+          /// a channel.close method happens when a channel exception occurs, this
+          /// can happen by publishing to an exchange that doesn't exist for example
+          ///
+          /// In this case you would need to open another channel redeclare any queues
+          /// that were declared auto-delete, and restart any consumers that were attached
+          /// to the previous channel
+          ///
+          case AMQP_CHANNEL_CLOSE_METHOD:
+               BOOST_THROW_EXCEPTION( ConnectionError( "channel closed" ) );
+               break;;
+
+          /// a connection.close method happens when a connection exception occurs,
+          /// this can happen by trying to use a channel that isn't open for example.
+          ///
+          /// In this case the whole connection must be restarted.
+          ///
+          case AMQP_CONNECTION_CLOSE_METHOD:
+               BOOST_THROW_EXCEPTION( ConnectionError( "connection closed" ) );
+               break;
+
+          /// the broker has raised a resource alarm (memory or disk) and stopped reading
+          /// from the connection; publishes will block in socket writes until connection.unblocked
+          ///
+          case AMQP_CONNECTION_BLOCKED_METHOD:
+               {
+                    connection.impl_->blocked = true;
+                    const auto details = static_cast< const amqp_connection_blocked_t* >( frame.payload.method.decoded );
+                    connection.impl_->blockedReason = details ? toString( details->reason ) : std::string();
+                    std::cerr << "connection blocked by broker: " << connection.impl_->blockedReason << "\n";
+               }
+               break;
+
+          /// the consumer has been cancelled: either in response to our basic.cancel
+          /// or by the broker (the queue has been deleted, the node has failed etc.)
+          ///
+          case AMQP_BASIC_CANCEL_OK_METHOD:
+          case AMQP_BASIC_CANCEL_METHOD:
+               connection.impl_->cancelled = true;
+               break;
+
+          case AMQP_CONNECTION_UNBLOCKED_METHOD:
+               connection.impl_->blocked = false;
+               connection.impl_->blockedReason.clear();
+               std::cerr << "connection unblocked by broker\n";
+               break;
+
+          default:
+               BOOST_THROW_EXCEPTION(
+                    std::runtime_error( "unexpected frame method id "
+                         + boost::lexical_cast< std::string >( frame.payload.method.id ) ) );
+     }
+}
+
+
+SimpleClient::SimpleClient(
+     const std::string& host,
+     int port,
+     const std::string& user,
+     const std::string& pwd,
+     const std::string& vhost
+)
+     : SimpleClient( Connection::Parameters( host, port, user, pwd, vhost ) )
+{}
+
+SimpleClient::SimpleClient( const Connection::Parameters& params )
+     : connection_( params )
+     , integrity_( false )
+     , stopRequested_( false )
+     , wakeupFd_( aux::makeEventFd() )
+     , epoch_( 0 )
+{}
+
+
+SimpleClient::~SimpleClient()
+{
+     ::close( wakeupFd_ );
+}
+
+
+void SimpleClient::publishMessage( const std::string& exchange, const std::string& routingKey, const std::string& plain )
+{
+     sealAndPublish( exchange, routingKey, plain, nullptr );
+}
+
+
+void SimpleClient::sealAndPublish(
+     const std::string& exchange,
+     const std::string& routingKey,
+     boost::string_ref plain,
+     const amqp_basic_properties_t* properties
+)
+{
+     FieldTable headers;
+
+     /// Шифрование выполняется первым: контрольная сумма и разделяемая память относятся к передаваемому шифртексту
+     boost::string_ref message = plain;
+     if( cipher_ )
+     {
+          headers.set( PayloadCipher::KEY_ID_HEADER, cipher_->encrypt( plain, sealed_ ) );
+          message = sealed_;
+     }
+
+     if( integrity_ )
+     {
+          headers.set( Integrity::HEADER, static_cast< std::int64_t >( Integrity::crc32c( message ) ) );
+     }
+
+     std::string segment;
+     if( claimCheck_ && claimCheck_->applies( message.size() ) )
+     {
+          segment = claimCheck_->store( message );
+
+          headers.set( ClaimCheck::HEADER, segment );
+          headers.set( ClaimCheck::SIZE_HEADER, static_cast< std::int64_t >( message.size() ) );
+          message = boost::string_ref();
+     }
+
+     amqp_basic_properties_t props;
+     props._flags = 0;
+     if( properties )
+     {
+          props = *properties;
+     }
+
+     /// Заголовки конвейера добавляются к заголовкам, заданным вызывающей стороной
+     std::vector< amqp_table_entry_t > entries;
+     if( !headers.empty() )
+     {
+          const auto added = headers.native();
+          if( props._flags & AMQP_BASIC_HEADERS_FLAG )
+          {
+               entries.assign( props.headers.entries, props.headers.entries + props.headers.num_entries );
+               entries.insert( entries.end(), added.entries, added.entries + added.num_entries );
+               props.headers.num_entries = static_cast< int >( entries.size() );
+               props.headers.entries = entries.data();
+          }
+          else
+          {
+               props.headers = added;
+          }
+          props._flags |= AMQP_BASIC_HEADERS_FLAG;
+     }
+
+     try
+     {
+          aux::doReconnectOnError(
+               [ & ](){ SimpleClient::publishBody( connection_, exchange, routingKey, message, props._flags ? &props : nullptr ); },
+               [ this ](){ reconnect(); }
+          );
+     }
+     catch( ... )
+     {
+          if( !segment.empty() )
+          {
+               claimCheck_->discard( segment );
+          }
+          throw;
+     }
+}
+
+
+void SimpleClient::publishMessage( const QueueParameters& params, const std::string& message )
+{
+     publishMessage( params.exchange, params.routingKey, message );
+}
+
+
+void SimpleClient::publishMessage(
+     const std::string& exchange,
+     const std::string& routingKey,
+     const std::string& message,
+     const amqp_basic_properties_t& properties
+)
+{
+     sealAndPublish( exchange, routingKey, message, &properties );
+}
+
+
+bool SimpleClient::tryPublishMessage( const std::string& exchange, const std::string& routingKey, const std::string& message )
+{
+     pollConnectionEvents( connection_ );
+
+     if( limiter_ )
+     {
+          limiter_->setBrokerBlocked( connection_.blocked() );
+          if( !limiter_->tryAcquire() )
+          {
+               return false;
+          }
+     }
+     else if( connection_.blocked() )
+     {
+          return false;
+     }
+
+     publishMessage( exchange, routingKey, message );
+     return true;
+}
+
+
+bool SimpleClient::blocked() const
+{
+     return connection_.blocked();
+}
+
+
+void SimpleClient::setRateLimiter( const std::shared_ptr< PublishRateLimiter >& limiter )
+{
+     limiter_ = limiter;
+}
+
+
+
+void SimpleClient::bind( const std::string& exchange, const std::string& queueName, const std::string& routingKey )
+{
+     SimpleClient::bind( connection_, exchange, queueName, routingKey );
+}
 
 
 void SimpleClient::bind( const QueueParameters& params )
 {
-     bind( params.exchange, params.queueName, params.routingKey );
+     bind( params.exchange, params.queueName, params.routingKey );
+}
+
+
+void SimpleClient::bind( const QueueParameters& params, const ConsumerParameters& consumer )
+{
+     SimpleClient::bind( connection_, params.exchange, params.queueName, params.routingKey, consumer );
+}
+
+
+std::string SimpleClient::declareQueue( const QueueDeclaration& declaration )
+{
+     return SimpleClient::declareQueue( connection_, declaration );
+}
+
+
+boost::optional< SimpleClient::Envelope > SimpleClient::consumeMessage(
+     boost::optional< boost::posix_time::time_duration > timeout
+)
+{
+     throwDeferredIntegrityError();
+
+     if( !waitForDelivery( timeout ) )
+     {
+          return boost::none;
+     }
+
+     if( !processesEnvelopes() )
+     {
+          return SimpleClient::consumeMessage( connection_, timeout );
+     }
+
+     amqp_envelope_t envelope = { 0 };
+
+     if( !consumeFiltered( timeout, envelope ) )
+     {
+          return boost::none;
+     }
+
+     std::unique_ptr< amqp_envelope_t, void(*)( amqp_envelope_t* ) > autocleaner( &envelope, amqp_destroy_envelope );
+
+     const auto payload = claimPayload( envelope );
+     const auto body = payload ? payload->body() : aux::bodyOf( envelope );
+
+     std::string plain;
+     if( openBody( envelope, body, plain ) )
+     {
+          return SimpleClient::Envelope( std::move( plain ), envelope.delivery_tag );
+     }
+     return SimpleClient::Envelope( body.to_string(), envelope.delivery_tag );
+}
+
+
+boost::optional< Delivery > SimpleClient::consumeDelivery(
+     boost::optional< boost::posix_time::time_duration > timeout
+)
+{
+     throwDeferredIntegrityError();
+
+     if( !waitForDelivery( timeout ) )
+     {
+          return boost::none;
+     }
+
+     if( !processesEnvelopes() )
+     {
+          return SimpleClient::consumeDelivery( connection_, timeout );
+     }
+
+     amqp_envelope_t envelope = { 0 };
+
+     if( !consumeFiltered( timeout, envelope ) )
+     {
+          return boost::none;
+     }
+
+     Delivery delivery( envelope );
+     delivery.attachPayload( claimPayload( envelope ) );
+
+     std::string plain;
+     if( openBody( envelope, delivery.body(), plain ) )
+     {
+          delivery.replaceBody( std::move( plain ) );
+     }
+     return delivery;
+}
+
+
+bool SimpleClient::consumeFiltered(
+     const boost::optional< boost::posix_time::time_duration >& timeout,
+     amqp_envelope_t& envelope
+)
+{
+     using boost::posix_time::microsec_clock;
+
+     const auto deadline = timeout
+          ? boost::make_optional( microsec_clock::universal_time() + *timeout )
+          : boost::none;
+
+     while( true )
+     {
+          boost::optional< boost::posix_time::time_duration > remaining;
+          if( deadline )
+          {
+               remaining = std::max( *deadline - microsec_clock::universal_time(), boost::posix_time::time_duration() );
+          }
+
+          amqp_maybe_release_buffers( connection_.impl_->connection );
+
+          envelope = amqp_envelope_t();
+
+          if( !consumeEnvelope( connection_, remaining, envelope ) )
+          {
+               return false;
+          }
+
+          if( !skipDuplicate( envelope ) )
+          {
+               return true;
+          }
+
+          amqp_destroy_envelope( &envelope );
+     }
+}
+
+
+std::size_t SimpleClient::consumeMessages(
+     std::vector< Envelope >& envelopes,
+     std::size_t maxCount,
+     boost::optional< boost::posix_time::time_duration > timeout
+)
+{
+     throwDeferredIntegrityError();
+
+     if( !waitForDelivery( timeout ) )
+     {
+          envelopes.clear();
+          return 0;
+     }
+
+     if( !processesEnvelopes() )
+     {
+          return SimpleClient::consumeMessages( connection_, envelopes, maxCount, timeout );
+     }
+
+     envelopes.clear();
+
+     /// Повторы пропускаются в пределах общего таймаута; остальные сообщения пакета забираются без ожидания
+     while( envelopes.size() < maxCount )
+     {
+          amqp_envelope_t envelope = { 0 };
+
+          const auto wait = envelopes.empty() ? timeout : boost::make_optional( boost::posix_time::time_duration() );
+
+          if( !consumeFiltered( wait, envelope ) )
+          {
+               break;
+          }
+
+          std::unique_ptr< amqp_envelope_t, void(*)( amqp_envelope_t* ) > autocleaner( &envelope, amqp_destroy_envelope );
+
+          boost::string_ref body;
+          std::string plain;
+          bool opened = false;
+          try
+          {
+               const auto payload = claimPayload( envelope );
+               body = payload ? payload->body() : aux::bodyOf( envelope );
+               opened = openBody( envelope, body, plain );
+          }
+          catch( const IntegrityError& )
+          {
+               if( envelopes.empty() )
+               {
+                    throw;
+               }
+               deferredError_ = std::current_exception();
+               break;
+          }
+
+          envelopes.emplace_back( opened ? std::move( plain ) : body.to_string(), envelope.delivery_tag );
+
+          if( !hasBufferedData( connection_ ) )
+          {
+               break;
+          }
+     }
+
+     return envelopes.size();
+}
+
+
+void SimpleClient::verifyIntegrity( const amqp_envelope_t& envelope, boost::string_ref body ) const
+{
+     const auto header = integrity_ ? aux::findHeader( envelope.message.properties, Integrity::HEADER ) : nullptr;
+     if( !header )
+     {
+          return;
+     }
+
+     const auto expected = decodeField( *header );
+     const auto value = boost::get< std::int64_t >( &expected.value );
+     if( !value || static_cast< std::uint32_t >( *value ) != Integrity::crc32c( body ) )
+     {
+          BOOST_THROW_EXCEPTION(
+               IntegrityError( "message body checksum mismatch, delivery tag: "
+                    + boost::lexical_cast< std::string >( envelope.delivery_tag ), envelope.delivery_tag ) );
+     }
 }
 
 
-boost::optional< SimpleClient::Envelope > SimpleClient::consumeMessage(
-     const boost::optional< boost::posix_time::time_duration >& timeout
+bool SimpleClient::openBody( const amqp_envelope_t& envelope, boost::string_ref body, std::string& plain )
+{
+     verifyIntegrity( envelope, body );
+
+     if( !cipher_ )
+     {
+          return false;
+     }
+
+     const auto header = aux::findHeader( envelope.message.properties, PayloadCipher::KEY_ID_HEADER );
+     if( !header )
+     {
+          BOOST_THROW_EXCEPTION(
+               IntegrityError( "message is not encrypted, delivery tag: "
+                    + boost::lexical_cast< std::string >( envelope.delivery_tag ), envelope.delivery_tag ) );
+     }
+
+     const auto keyId = decodeField( *header );
+     const auto id = boost::get< std::string >( &keyId.value );
+     if( !id || !cipher_->decrypt( *id, body, plain ) )
+     {
+          BOOST_THROW_EXCEPTION(
+               IntegrityError( "cannot decrypt message (unknown key or authentication failure), delivery tag: "
+                    + boost::lexical_cast< std::string >( envelope.delivery_tag ), envelope.delivery_tag ) );
+     }
+     return true;
+}
+
+
+void SimpleClient::throwDeferredIntegrityError()
+{
+     if( deferredError_ )
+     {
+          const auto error = deferredError_;
+          deferredError_ = nullptr;
+          std::rethrow_exception( error );
+     }
+}
+
+
+bool SimpleClient::skipDuplicate( const amqp_envelope_t& envelope )
+{
+     if( !dedup_ )
+     {
+          return false;
+     }
+
+     const auto fingerprint = dedup_->fingerprint( envelope.message.properties );
+     if( !fingerprint )
+     {
+          return false;
+     }
+
+     if( dedup_->contains( *fingerprint ) )
+     {
+          /// Сообщение уже обработано ранее - подтверждаем его, не возвращая вызывающей стороне
+          SimpleClient::ackMessage( connection_, envelope.delivery_tag );
+          return true;
+     }
+
+     pendingFingerprints_[ envelope.delivery_tag ] = *fingerprint;
+     return false;
+}
+
+
+void SimpleClient::ackMessage( std::uint64_t deliveryTag, bool multiple )
+{
+     if( dedup_ )
+     {
+          aux::settlePending( pendingFingerprints_, deliveryTag, multiple,
+               [ this ]( std::uint64_t fingerprint ){ dedup_->insert( fingerprint ); } );
+     }
+
+     aux::doReconnectOnError(
+          [ & ](){ SimpleClient::ackMessage( connection_, deliveryTag, multiple ); },
+          [ this ](){ reconnect(); }
+     );
+
+     /// Сегмент освобождается только после подтверждения: при сбое до него сообщение будет доставлено повторно
+     /// и должно найти свое тело
+     aux::settlePending( pendingClaims_, deliveryTag, multiple,
+          []( const std::shared_ptr< ClaimCheckPayload >& payload ){ payload->release(); } );
+}
+
+
+void SimpleClient::nackMessage( std::uint64_t deliveryTag, bool multiple, bool requeue )
+{
+     aux::doReconnectOnError(
+          [ & ](){ SimpleClient::nackMessage( connection_, deliveryTag, multiple, requeue ); },
+          [ this ](){ reconnect(); }
+     );
+     forgetPending( deliveryTag, multiple );
+}
+
+
+void SimpleClient::rejectMessage( std::uint64_t deliveryTag, bool requeue )
+{
+     aux::doReconnectOnError(
+          [ & ](){ SimpleClient::rejectMessage( connection_, deliveryTag, requeue ); },
+          [ this ](){ reconnect(); }
+     );
+     forgetPending( deliveryTag, false );
+}
+
+
+TimingWheel::TimerId SimpleClient::publishAfter(
+     const boost::posix_time::time_duration& delay,
+     const std::string& exchange,
+     const std::string& routingKey,
+     const std::string& message
 )
 {
-     return SimpleClient::consumeMessage( connection_, timeout );
+     return timers_.schedule( delay,
+          [ this, exchange, routingKey, message ](){ publishMessage( exchange, routingKey, message ); } );
+}
+
+
+TimingWheel::TimerId SimpleClient::nackAfter( const boost::posix_time::time_duration& delay, std::uint64_t deliveryTag, bool requeue )
+{
+     const auto epoch = epoch_;
+     return timers_.schedule( delay,
+          [ this, epoch, deliveryTag, requeue ]()
+          {
+               if( epoch == epoch_ )
+               {
+                    nackMessage( deliveryTag, false, requeue );
+               }
+          } );
+}
+
+
+bool SimpleClient::cancelTimer( TimingWheel::TimerId id )
+{
+     return timers_.cancel( id );
+}
+
+
+std::size_t SimpleClient::processTimers()
+{
+     return timers_.advance();
+}
+
+
+boost::optional< boost::posix_time::time_duration > SimpleClient::nextTimer() const
+{
+     return timers_.nextExpiry();
+}
+
+
+void SimpleClient::forgetPending( std::uint64_t deliveryTag, bool multiple )
+{
+     aux::settlePending( pendingFingerprints_, deliveryTag, multiple, []( std::uint64_t ){} );
+     aux::settlePending( pendingClaims_, deliveryTag, multiple, []( const std::shared_ptr< ClaimCheckPayload >& ){} );
+}
+
+
+void SimpleClient::setQuarantinePolicy( const std::shared_ptr< QuarantinePolicy >& policy )
+{
+     quarantine_ = policy;
+}
+
+
+QuarantinePolicy::Action SimpleClient::failMessage( const Delivery& delivery, const std::string& reason )
+{
+     if( !quarantine_ )
+     {
+          nackMessage( delivery.deliveryTag(), false, true );
+          return QuarantinePolicy::Action::Requeue;
+     }
+
+     const auto attempts = quarantine_->attempts( delivery );
+     const auto action = quarantine_->onFailure( delivery );
+
+     switch( action )
+     {
+          case QuarantinePolicy::Action::Requeue:
+               nackMessage( delivery.deliveryTag(), false, true );
+               break;
+
+          case QuarantinePolicy::Action::DeadLetter:
+               nackMessage( delivery.deliveryTag(), false, false );
+               break;
+
+          case QuarantinePolicy::Action::Park:
+               /// Подтверждение только после публикации: при сбое сообщение не теряется, а доставляется повторно
+               park( delivery, attempts, reason );
+               ackMessage( delivery.deliveryTag() );
+               break;
+     }
+
+     return action;
 }
 
 
-void SimpleClient::ackMessage( std::uint64_t deliveryTag )
+void SimpleClient::park( const Delivery& delivery, std::uint32_t attempts, const std::string& reason )
 {
+     const auto& params = quarantine_->parameters();
+
+     /// Тело публикуется целиком, поэтому ссылка на сегмент разделяемой памяти исходному сообщению не переносится
+     FieldTable headers;
+     for( const auto& each: delivery.headers() )
+     {
+          if( each.first != ClaimCheck::HEADER && each.first != ClaimCheck::SIZE_HEADER )
+          {
+               headers.set( each.first, each.second.value );
+          }
+     }
+     headers.set( QuarantinePolicy::ATTEMPTS_HEADER, static_cast< std::int64_t >( attempts ) );
+     headers.set( QuarantinePolicy::EXCHANGE_HEADER, delivery.exchange() );
+     headers.set( QuarantinePolicy::ROUTING_KEY_HEADER, delivery.routingKey() );
+     if( !reason.empty() )
+     {
+          headers.set( QuarantinePolicy::REASON_HEADER, reason );
+     }
+
+     amqp_basic_properties_t props = delivery.native().message.properties;
+     props._flags |= AMQP_BASIC_HEADERS_FLAG;
+     props.headers = headers.native();
+
+     /// Публикуется тело в переданном виде (зашифрованное, если сообщение было зашифровано): заголовки ключа
+     /// и контрольной суммы остаются действительными, а расшифрованные данные не попадают в брокер.
+     /// Поэтому тело не проходит повторное шифрование в sealAndPublish()
+     const auto body = delivery.payload() ? delivery.payload()->body() : aux::bodyOf( delivery.native() );
      aux::doReconnectOnError(
-          [ & ](){ SimpleClient::ackMessage( connection_, deliveryTag ); },
+          [ & ](){ SimpleClient::publishBody( connection_, params.parkingExchange, params.parkingRoutingKey, body, &props ); },
           [ this ](){ reconnect(); }
      );
 }
 
 
+void SimpleClient::requestStop()
+{
+     stopRequested_ = true;
+     ::eventfd_write( wakeupFd_, 1 );
+}
+
+
+bool SimpleClient::stopRequested() const
+{
+     return stopRequested_;
+}
+
+
+bool SimpleClient::drainAndStop( const boost::posix_time::time_duration& deadline, const DrainHandler& handler )
+{
+     /// Сегменты подтвержденных сообщений-ссылок. Сегмент сообщения, переданного обработчику последним,
+     /// переносится сюда только после его подтверждения (обработчик вызывается для следующего сообщения
+     /// или остановка завершилась без ошибки): неподтвержденное сообщение будет доставлено повторно
+     std::vector< std::shared_ptr< ClaimCheckPayload > > claims;
+     std::shared_ptr< ClaimCheckPayload > current;
+
+     const auto releaseClaims = [ &claims ]()
+          {
+               for( const auto& each: claims )
+               {
+                    each->release();
+               }
+               claims.clear();
+          };
+
+     /// Отпечатки обработанных при остановке сообщений также запоминаются в фильтре повторов,
+     /// а тела сообщений-ссылок подставляются, проверяются и расшифровываются так же, как в consumeDelivery()
+     const auto process = [ this, &handler, &claims, &current ]( Delivery& delivery )
+          {
+               if( current )
+               {
+                    claims.push_back( std::move( current ) );
+                    current.reset();
+               }
+
+               if( const auto payload = openClaim( delivery.native() ) )
+               {
+                    delivery.attachPayload( payload );
+                    current = payload;
+               }
+
+               std::string plain;
+               if( openBody( delivery.native(), delivery.body(), plain ) )
+               {
+                    delivery.replaceBody( std::move( plain ) );
+               }
+
+               handler( delivery );
+               if( dedup_ )
+               {
+                    if( const auto fingerprint = dedup_->fingerprint( delivery.native().message.properties ) )
+                    {
+                         dedup_->insert( *fingerprint );
+                    }
+               }
+          };
+
+     stopRequested_ = true;
+     pendingFingerprints_.clear();
+     pendingClaims_.clear();
+
+     try
+     {
+          const bool stopped = SimpleClient::drainAndStop( connection_, deadline, handler ? DrainHandler( process ) : DrainHandler() );
+
+          /// Все переданные обработчику сообщения к этому моменту подтверждены
+          if( current )
+          {
+               claims.push_back( std::move( current ) );
+          }
+          releaseClaims();
+          return stopped;
+     }
+     catch( const ConnectionError& e )
+     {
+          /// При разрыве соединения неподтвержденные сообщения возвращаются в очередь брокером
+          releaseClaims();
+          std::cerr << "connection lost while draining: " << e.what() << "\n";
+          return false;
+     }
+     catch( ... )
+     {
+          releaseClaims();
+          throw;
+     }
+}
+
+
+bool SimpleClient::waitForDelivery( boost::optional< boost::posix_time::time_duration >& timeout )
+{
+     using boost::posix_time::microsec_clock;
+
+     processTimers();
+
+     if( stopRequested_ )
+     {
+          return false;
+     }
+     if( hasBufferedData( connection_ ) )
+     {
+          return true;
+     }
+
+     const auto started = microsec_clock::universal_time();
+     RABBITMQ_CLIENT_PROBE1( consume__poll, timeout ? timeout->total_microseconds() : std::int64_t( -1 ) );
+
+     while( true )
+     {
+          /// Сокет перечитывается на каждом шаге: операция таймера может переподключить соединение
+          const auto epoch = epoch_;
+          pollfd fds[ 2 ] = {
+               { amqp_get_sockfd( connection_.impl_->connection ), POLLIN, 0 },
+               { wakeupFd_, POLLIN, 0 }
+          };
+
+          /// Ожидание ограничивается ближайшим таймером, наступившие операции выполняются в этом же потоке
+          auto wait = timeout
+               ? boost::make_optional( std::max( *timeout - ( microsec_clock::universal_time() - started ), boost::posix_time::time_duration() ) )
+               : boost::none;
+          const auto timer = timers_.nextExpiry();
+          const bool timerFirst = timer && ( !wait || *timer < *wait );
+
+          int timeoutMs = wait ? static_cast< int >( std::max< std::int64_t >( 0, wait->total_milliseconds() ) ) : -1;
+          if( timerFirst )
+          {
+               /// Округление вверх, чтобы не проснуться до наступления такта колеса
+               timeoutMs = static_cast< int >( ( timer->total_microseconds() + 999 ) / 1000 );
+          }
+
+          const auto ready = ::poll( fds, 2, timeoutMs );
+          if( ready < 0 && errno != EINTR )
+          {
+               BOOST_THROW_EXCEPTION( std::runtime_error( std::string( "poll failed: " ) + std::strerror( errno ) ) );
+          }
+
+          processTimers();
+
+          if( stopRequested_ )
+          {
+               return false;
+          }
+          if( epoch != epoch_ )
+          {
+               /// Результат опроса относится к закрытому сокету прежнего соединения
+               if( hasBufferedData( connection_ ) )
+               {
+                    break;
+               }
+               continue;
+          }
+          if( fds[ 0 ].revents )
+          {
+               break;
+          }
+          if( ready != 0 || !timerFirst )
+          {
+               /// Таймаут или прерывание сигналом
+               return false;
+          }
+     }
+
+     /// Данные в сокете еще не означают получения сообщения целиком: оставшееся время передается в consume
+     if( timeout )
+     {
+          *timeout = std::max( *timeout - ( microsec_clock::universal_time() - started ), boost::posix_time::time_duration() );
+     }
+     return true;
+}
+
+
+void SimpleClient::setDeduplicationFilter( const std::shared_ptr< DeduplicationFilter >& filter )
+{
+     dedup_ = filter;
+     pendingFingerprints_.clear();
+}
+
+
+void SimpleClient::setClaimCheck( const std::shared_ptr< ClaimCheck >& claimCheck )
+{
+     claimCheck_ = claimCheck;
+     pendingClaims_.clear();
+}
+
+
+std::shared_ptr< ClaimCheckPayload > SimpleClient::openClaim( const amqp_envelope_t& envelope ) const
+{
+     if( !claimCheck_ )
+     {
+          return nullptr;
+     }
+
+     const auto segment = claimCheck_->reference( envelope.message.properties );
+     if( !segment )
+     {
+          return nullptr;
+     }
+
+     try
+     {
+          return claimCheck_->open( *segment );
+     }
+     catch( const std::runtime_error& e )
+     {
+          /// Сообщение уже получено из соединения: без идентификатора доставки вызывающая сторона не смогла бы его отклонить
+          BOOST_THROW_EXCEPTION(
+               ClaimCheckError( std::string( e.what() ) + ", delivery tag: "
+                    + boost::lexical_cast< std::string >( envelope.delivery_tag ), envelope.delivery_tag ) );
+     }
+}
+
+
+std::shared_ptr< ClaimCheckPayload > SimpleClient::claimPayload( const amqp_envelope_t& envelope )
+{
+     auto payload = openClaim( envelope );
+     if( payload )
+     {
+          pendingClaims_[ envelope.delivery_tag ] = payload;
+     }
+     return payload;
+}
+
+
+void SimpleClient::setIntegrityCheck( bool enabled )
+{
+     integrity_ = enabled;
+}
+
+
+void SimpleClient::setEncryption( const std::shared_ptr< PayloadCipher >& cipher )
+{
+     cipher_ = cipher;
+}
+
+
+bool SimpleClient::processesEnvelopes() const
+{
+     return dedup_ || claimCheck_ || integrity_ || cipher_;
+}
+
+
 void SimpleClient::reconnect()
 {
+     /// После переподключения идентификаторы доставки начинаются заново; неподтвержденные сообщения-ссылки
+     /// будут доставлены повторно, их сегменты не освобождаются. Отложенная ошибка тела сообщения сохраняется
+     /// и генерируется следующим вызовом метода получения
+     pendingFingerprints_.clear();
+     pendingClaims_.clear();
+     ++epoch_;
      connection_.reconnect();
 }
 
@@ -0,0 +1,383 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#include <rabbitmq_client/spool.h>
+
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <boost/throw_exception.hpp>
+#include <boost/lexical_cast.hpp>
+#include <rabbitmq_client/error.h>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+namespace {
+namespace aux {
+
+
+/// Сигнатура файла журнала ("RMQSPOOL")
+const std::uint64_t SPOOL_MAGIC = 0x4c4f4f5053514d52ull;
+
+/// Смещение первой записи журнала (размер заголовка с выравниванием)
+const std::uint64_t DATA_OFFSET = 64;
+
+
+/// Заголовок записи журнала, за которым следуют exchange, routing key и тело сообщения
+struct RecordHeader
+{
+     std::uint32_t size;           ///< полный размер записи с выравниванием
+     std::uint32_t exchangeLen;
+     std::uint32_t routingKeyLen;
+     std::uint32_t messageLen;
+};
+
+
+std::uint64_t recordSize( const std::string& exchange, const std::string& routingKey, const std::string& message )
+{
+     const std::uint64_t raw = sizeof( RecordHeader ) + exchange.size() + routingKey.size() + message.size();
+     return ( raw + 7 ) & ~std::uint64_t( 7 );
+}
+
+
+} // namespace aux
+} // namespace {unnamed}
+
+
+struct PublishSpool::Header
+{
+     std::uint64_t magic;
+     std::uint64_t capacity;
+     std::uint64_t readOffset;
+     std::uint64_t writeOffset;
+     std::uint64_t count;
+};
+
+
+PublishSpool::PublishSpool( const std::string& path, std::size_t capacity )
+     : file_( path, capacity )
+{
+     if( capacity <= aux::DATA_OFFSET )
+     {
+          BOOST_THROW_EXCEPTION( std::runtime_error( "spool capacity is too small: " + path ) );
+     }
+
+     auto& h = header();
+     if( file_.created() && h.magic != aux::SPOOL_MAGIC )
+     {
+          h.magic = aux::SPOOL_MAGIC;
+          h.readOffset = aux::DATA_OFFSET;
+          h.writeOffset = aux::DATA_OFFSET;
+          h.count = 0;
+     }
+     else if( h.magic != aux::SPOOL_MAGIC )
+     {
+          BOOST_THROW_EXCEPTION( std::runtime_error( "file is not a publish spool: " + path ) );
+     }
+
+     if( h.readOffset < aux::DATA_OFFSET || h.readOffset > h.writeOffset || h.writeOffset > capacity )
+     {
+          BOOST_THROW_EXCEPTION( std::runtime_error( "publish spool is corrupted or larger than capacity: " + path ) );
+     }
+     h.capacity = capacity;
+}
+
+
+PublishSpool::Header& PublishSpool::header() const
+{
+     return *reinterpret_cast< Header* >( file_.data() );
+}
+
+
+void PublishSpool::append( const std::string& exchange, const std::string& routingKey, const std::string& message )
+{
+     const auto size = aux::recordSize( exchange, routingKey, message );
+
+     boost::lock_guard< boost::mutex > lock( mutex_ );
+
+     auto& h = header();
+     if( h.writeOffset + size > h.capacity )
+     {
+          compact();
+          if( h.writeOffset + size > h.capacity )
+          {
+               BOOST_THROW_EXCEPTION(
+                    SpoolOverflowError( "publish spool is full; pending messages: "
+                         + boost::lexical_cast< std::string >( h.count ) ) );
+          }
+     }
+
+     char* const record = file_.data() + h.writeOffset;
+     const aux::RecordHeader rh = {
+          static_cast< std::uint32_t >( size ),
+          static_cast< std::uint32_t >( exchange.size() ),
+          static_cast< std::uint32_t >( routingKey.size() ),
+          static_cast< std::uint32_t >( message.size() )
+     };
+
+     char* out = record + sizeof( rh );
+     std::memcpy( out, exchange.data(), exchange.size() );
+     out += exchange.size();
+     std::memcpy( out, routingKey.data(), routingKey.size() );
+     out += routingKey.size();
+     std::memcpy( out, message.data(), message.size() );
+
+     /// Заголовок записи и позиция записи обновляются последними: запись становится видимой только целиком
+     std::memcpy( record, &rh, sizeof( rh ) );
+     h.writeOffset += size;
+     ++h.count;
+}
+
+
+bool PublishSpool::front( Record& record ) const
+{
+     boost::lock_guard< boost::mutex > lock( mutex_ );
+
+     const auto& h = header();
+     if( h.readOffset == h.writeOffset )
+     {
+          return false;
+     }
+
+     aux::RecordHeader rh;
+     std::memcpy( &rh, file_.data() + h.readOffset, sizeof( rh ) );
+
+     const char* in = file_.data() + h.readOffset + sizeof( rh );
+     record.exchange.assign( in, rh.exchangeLen );
+     in += rh.exchangeLen;
+     record.routingKey.assign( in, rh.routingKeyLen );
+     in += rh.routingKeyLen;
+     record.message.assign( in, rh.messageLen );
+
+     return true;
+}
+
+
+void PublishSpool::pop()
+{
+     boost::lock_guard< boost::mutex > lock( mutex_ );
+
+     auto& h = header();
+     if( h.readOffset == h.writeOffset )
+     {
+          return;
+     }
+
+     aux::RecordHeader rh;
+     std::memcpy( &rh, file_.data() + h.readOffset, sizeof( rh ) );
+
+     h.readOffset += rh.size;
+     --h.count;
+
+     if( h.readOffset == h.writeOffset )
+     {
+          h.readOffset = aux::DATA_OFFSET;
+          h.writeOffset = aux::DATA_OFFSET;
+     }
+}
+
+
+bool PublishSpool::empty() const
+{
+     boost::lock_guard< boost::mutex > lock( mutex_ );
+     return header().count == 0;
+}
+
+
+std::uint64_t PublishSpool::size() const
+{
+     boost::lock_guard< boost::mutex > lock( mutex_ );
+     return header().count;
+}
+
+
+void PublishSpool::flush()
+{
+     boost::lock_guard< boost::mutex > lock( mutex_ );
+     file_.flush();
+}
+
+
+void PublishSpool::compact()
+{
+     auto& h = header();
+     if( h.readOffset == aux::DATA_OFFSET )
+     {
+          return;
+     }
+
+     const auto pending = h.writeOffset - h.readOffset;
+     std::memmove( file_.data() + aux::DATA_OFFSET, file_.data() + h.readOffset, pending );
+     h.readOffset = aux::DATA_OFFSET;
+     h.writeOffset = aux::DATA_OFFSET + pending;
+}
+
+
+SpoolingPublisher::SpoolingPublisher( const Connection::Parameters& params, const SpoolParameters& spoolParams )
+     : params_( params )
+     , retryInterval_( spoolParams.retryInterval )
+     , spool_( spoolParams.path, spoolParams.capacity )
+     , drainer_( [ this ](){ drain(); } )
+{}
+
+
+SpoolingPublisher::~SpoolingPublisher()
+{
+     {
+          boost::lock_guard< boost::mutex > lock( drainMutex_ );
+          stop_ = true;
+     }
+     drainCondition_.notify_one();
+
+     /// Прерываем возможное ожидание между попытками подключения внутри Connection::connect()
+     drainer_.interrupt();
+     drainer_.join();
+}
+
+
+void SpoolingPublisher::publishMessage( const std::string& exchange, const std::string& routingKey, const std::string& message )
+{
+     {
+          /// Если соединение занято фоновым потоком (переподключение или отправка журнала)
+          /// или заблокировано брокером, не ждем его, а сразу пишем в журнал
+          boost::unique_lock< boost::mutex > lock( connectionMutex_, boost::try_to_lock );
+          if( lock && connection_ && spool_.empty() )
+          {
+               try
+               {
+                    /// На соединении нет подписки: уведомление о блокировке само не будет прочитано
+                    SimpleClient::pollConnectionEvents( *connection_ );
+                    if( !connection_->blocked() )
+                    {
+                         SimpleClient::publishMessage( *connection_, exchange, routingKey, message );
+                         return;
+                    }
+               }
+               catch( const std::exception& e )
+               {
+                    /// Любая ошибка публикации (в том числе закрытие канала брокером) ведет к записи в журнал:
+                    /// соединение пересоздается фоновым потоком
+                    std::cerr << "spool: publish failed, message is spooled: " << e.what() << "\n";
+                    connection_.reset();
+               }
+          }
+     }
+
+     spool_.append( exchange, routingKey, message );
+
+     {
+          boost::lock_guard< boost::mutex > lock( drainMutex_ );
+     }
+     drainCondition_.notify_one();
+}
+
+
+void SpoolingPublisher::publishMessage( const SimpleClient::QueueParameters& params, const std::string& message )
+{
+     publishMessage( params.exchange, params.routingKey, message );
+}
+
+
+std::uint64_t SpoolingPublisher::spooledCount() const
+{
+     return spool_.size();
+}
+
+
+void SpoolingPublisher::drain()
+{
+     const boost::chrono::milliseconds retryInterval( retryInterval_.total_milliseconds() );
+
+     /// После неудачной попытки журнал не пуст, поэтому следующая выполняется не раньше чем через retryInterval:
+     /// иначе поток непрерывно занимал бы connectionMutex_ на все время недоступности или блокировки брокера
+     bool retryLater = false;
+
+     try
+     {
+          while( true )
+          {
+               {
+                    boost::unique_lock< boost::mutex > lock( drainMutex_ );
+                    if( retryLater )
+                    {
+                         drainCondition_.wait_for( lock, retryInterval, [ this ](){ return stop_; } );
+                    }
+                    else
+                    {
+                         drainCondition_.wait_for( lock, retryInterval, [ this ](){ return stop_ || !spool_.empty(); } );
+                    }
+                    if( stop_ )
+                    {
+                         return;
+                    }
+               }
+
+               {
+                    boost::lock_guard< boost::mutex > lock( connectionMutex_ );
+                    if( !connection_ )
+                    {
+                         try
+                         {
+                              connection_.reset( new Connection( params_ ) );
+                         }
+                         catch( const std::exception& e )
+                         {
+                              std::cerr << "spool: broker is unreachable (" << e.what() << "), pending messages: "
+                                   << spool_.size() << "\n";
+                              retryLater = true;
+                              continue;
+                         }
+                    }
+               }
+
+               retryLater = !replaySpool();
+          }
+     }
+     catch( const boost::thread_interrupted& )
+     {}
+}
+
+
+bool SpoolingPublisher::replaySpool()
+{
+     PublishSpool::Record record;
+
+     while( spool_.front( record ) )
+     {
+          boost::lock_guard< boost::mutex > lock( connectionMutex_ );
+          if( !connection_ )
+          {
+               return false;
+          }
+
+          try
+          {
+               /// Заблокированное соединение остановило бы поток на записи в сокет: отправка откладывается
+               SimpleClient::pollConnectionEvents( *connection_ );
+               if( connection_->blocked() )
+               {
+                    return false;
+               }
+               SimpleClient::publishMessage( *connection_, record.exchange, record.routingKey, record.message );
+          }
+          catch( const std::exception& e )
+          {
+               /// Сообщение остается в журнале и будет отправлено повторно после переподключения
+               std::cerr << "spool: replay failed: " << e.what() << "\n";
+               connection_.reset();
+               return false;
+          }
+
+          spool_.pop();
+     }
+     return true;
+}
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
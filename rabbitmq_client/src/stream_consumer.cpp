@@ -0,0 +1,191 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#include <rabbitmq_client/stream_consumer.h>
+
+#include <stdexcept>
+#include <boost/throw_exception.hpp>
+#include <rabbitmq_client/error.h>
+#include <rabbitmq_client/mapped_file.h>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+namespace {
+namespace aux {
+
+
+/// Сигнатура файла контрольной точки ("RMQSTRM1")
+const std::uint64_t CHECKPOINT_MAGIC = 0x314d525453514d52ull;
+
+/// Размер файла контрольной точки
+const std::size_t CHECKPOINT_SIZE = 64;
+
+
+/// Содержимое файла контрольной точки
+struct Checkpoint
+{
+     std::uint64_t magic;     ///< записывается вместе с первым смещением; до этого контрольной точки нет
+     std::uint64_t offset;    ///< смещение последнего подтвержденного сообщения
+};
+
+
+boost::posix_time::ptime now()
+{
+     return boost::posix_time::microsec_clock::universal_time();
+}
+
+
+} // namespace aux
+} // namespace {unnamed}
+
+
+StreamConsumer::StreamConsumer( const Connection::Parameters& connectionParams, const Parameters& params )
+     : params_( params )
+     , connection_( connectionParams )
+     , lastCheckpoint_( aux::now() )
+{
+     if( !params.checkpointPath.empty() )
+     {
+          file_.reset( new MappedFile( params.checkpointPath, aux::CHECKPOINT_SIZE ) );
+
+          const auto& checkpoint = *reinterpret_cast< const aux::Checkpoint* >( file_->data() );
+          if( checkpoint.magic == aux::CHECKPOINT_MAGIC )
+          {
+               committed_ = checkpoint.offset;
+          }
+          else if( checkpoint.magic != 0 )
+          {
+               BOOST_THROW_EXCEPTION( std::runtime_error( "stream checkpoint file format mismatch: " + params.checkpointPath ) );
+          }
+     }
+
+     subscribe();
+}
+
+
+StreamConsumer::~StreamConsumer()
+{
+     try
+     {
+          store( true );
+     }
+     catch( ... )
+     {}
+}
+
+
+boost::optional< Delivery > StreamConsumer::consume( const boost::optional< boost::posix_time::time_duration >& timeout )
+{
+     try
+     {
+          return SimpleClient::consumeDelivery( connection_, timeout );
+     }
+     catch( const ConnectionError& )
+     {}
+
+     reconnect();
+     return SimpleClient::consumeDelivery( connection_, timeout );
+}
+
+
+void StreamConsumer::ack( const Delivery& delivery )
+{
+     /// Позиция запоминается до подтверждения: при разрыве соединения подписка возобновится уже после сообщения
+     if( const auto offset = offsetOf( delivery ) )
+     {
+          committed_ = *offset;
+          ++uncommitted_;
+     }
+
+     try
+     {
+          SimpleClient::ackMessage( connection_, delivery.deliveryTag() );
+     }
+     catch( const ConnectionError& )
+     {
+          /// Подтверждение на разорванном соединении не требуется: неподтвержденные сообщения новой подписке
+          /// не выдаются, т.к. она начинается после committed_
+          reconnect();
+          return;
+     }
+
+     if( uncommitted_ >= params_.checkpointInterval
+          || ( uncommitted_ && aux::now() - lastCheckpoint_ >= params_.checkpointPeriod ) )
+     {
+          store( false );
+     }
+}
+
+
+void StreamConsumer::checkpoint()
+{
+     store( true );
+}
+
+
+void StreamConsumer::reconnect()
+{
+     store( false );
+     connection_.reconnect();
+     subscribe();
+}
+
+
+boost::optional< std::uint64_t > StreamConsumer::offsetOf( const Delivery& delivery )
+{
+     const auto header = delivery.header( "x-stream-offset" );
+     if( !header )
+     {
+          return boost::none;
+     }
+
+     if( const auto i = boost::get< std::int64_t >( &header->value ) )
+     {
+          return static_cast< std::uint64_t >( *i );
+     }
+     if( const auto u = boost::get< std::uint64_t >( &header->value ) )
+     {
+          return *u;
+     }
+     return boost::none;
+}
+
+
+void StreamConsumer::subscribe()
+{
+     SimpleClient::ConsumerParameters consumer;
+     consumer.prefetchCount = params_.prefetchCount;
+     consumer.streamOffset = committed_ ? SimpleClient::StreamOffset::offset( *committed_ + 1 ) : params_.start;
+
+     SimpleClient::bind( connection_, "", params_.queueName, "", consumer );
+}
+
+
+void StreamConsumer::store( bool flush )
+{
+     if( file_ && committed_ )
+     {
+          auto& checkpoint = *reinterpret_cast< aux::Checkpoint* >( file_->data() );
+          checkpoint.offset = *committed_;
+          checkpoint.magic = aux::CHECKPOINT_MAGIC;
+
+          /// Периодическая запись только обновляет страницу файла (на диск ее сбрасывает ядро),
+          /// синхронный сброс выполняется явным вызовом checkpoint() и при уничтожении объекта
+          if( flush )
+          {
+               file_->flush();
+          }
+     }
+
+     uncommitted_ = 0;
+     lastCheckpoint_ = aux::now();
+}
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
@@ -0,0 +1,273 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#include <rabbitmq_client/timing_wheel.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <boost/throw_exception.hpp>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+namespace {
+namespace aux {
+
+
+const unsigned LEVELS = 4;
+const unsigned SLOT_BITS = 8;
+const std::int32_t SLOTS = 1 << SLOT_BITS;
+const std::uint64_t MASK = SLOTS - 1;
+
+/// Список наступивших таймеров, следующий за ячейками всех уровней
+const std::int32_t DUE = LEVELS * SLOTS;
+
+
+/// Кол-во тактов, покрываемое уровнями ниже @a level
+std::uint64_t span( unsigned level )
+{
+     return std::uint64_t( 1 ) << ( SLOT_BITS * level );
+}
+
+
+} // namespace aux
+} // namespace {unnamed}
+
+
+TimingWheel::TimingWheel( const Parameters& params )
+     : resolution_( std::max< std::int64_t >( 1, params.resolution.total_microseconds() ) )
+     , origin_( Clock::now() )
+     , heads_( aux::DUE + 1, -1 )
+{}
+
+
+TimingWheel::TimerId TimingWheel::schedule( const boost::posix_time::time_duration& delay, Callback callback )
+{
+     /// Такт срабатывания округляется вверх от момента истечения задержки, поэтому таймер не срабатывает раньше нее
+     const auto delayUs = static_cast< std::uint64_t >( std::max< std::int64_t >( 0, delay.total_microseconds() ) );
+     const auto elapsedUs = static_cast< std::uint64_t >( boost::chrono::duration_cast< boost::chrono::microseconds >( Clock::now() - origin_ ).count() );
+     const auto expires = std::max( ( elapsedUs + delayUs + resolution_ - 1 ) / resolution_, current_ + 1 );
+
+     if( expires - current_ >= aux::span( aux::LEVELS ) )
+     {
+          BOOST_THROW_EXCEPTION( std::invalid_argument( "timer delay exceeds the timing wheel range" ) );
+     }
+
+     std::int32_t index = 0;
+     if( free_.empty() )
+     {
+          index = static_cast< std::int32_t >( nodes_.size() );
+          nodes_.push_back( Node() );
+     }
+     else
+     {
+          index = free_.back();
+          free_.pop_back();
+     }
+
+     auto& node = nodes_[ index ];
+     node.callback = std::move( callback );
+     node.expires = expires;
+     place( index );
+     ++size_;
+
+     return ( static_cast< std::uint64_t >( node.generation ) << 32 ) | static_cast< std::uint32_t >( index + 1 );
+}
+
+
+bool TimingWheel::cancel( TimerId id )
+{
+     const auto index = static_cast< std::int64_t >( static_cast< std::uint32_t >( id ) ) - 1;
+     if( index < 0 || index >= static_cast< std::int64_t >( nodes_.size() ) )
+     {
+          return false;
+     }
+
+     const auto& node = nodes_[ index ];
+     if( node.bucket < 0 || node.generation != static_cast< std::uint32_t >( id >> 32 ) )
+     {
+          return false;
+     }
+
+     unlink( index );
+     release( index );
+     --size_;
+     return true;
+}
+
+
+std::size_t TimingWheel::advance()
+{
+     /// Сначала выполняются таймеры, оставшиеся после исключения в предыдущем вызове
+     auto fired = fire();
+
+     const auto target = tickOf( Clock::now() );
+     while( current_ < target )
+     {
+          if( size_ == 0 )
+          {
+               current_ = target;
+               break;
+          }
+
+          ++current_;
+          for( unsigned level = aux::LEVELS - 1; level > 0; --level )
+          {
+               if( ( current_ & ( aux::span( level ) - 1 ) ) == 0 )
+               {
+                    cascade( level * aux::SLOTS + static_cast< std::int32_t >( ( current_ >> ( aux::SLOT_BITS * level ) ) & aux::MASK ) );
+               }
+          }
+          expire( static_cast< std::int32_t >( current_ & aux::MASK ) );
+          fired += fire();
+     }
+
+     return fired;
+}
+
+
+boost::optional< boost::posix_time::time_duration > TimingWheel::nextExpiry() const
+{
+     if( size_ == 0 )
+     {
+          return boost::none;
+     }
+     if( heads_[ aux::DUE ] >= 0 )
+     {
+          return boost::posix_time::time_duration();
+     }
+
+     /// Поиск ограничен текущим оборотом первого уровня: дальше колесо обрабатывается на такте перераспределения
+     auto tick = current_ + 1;
+     while( ( tick & aux::MASK ) != 0 && heads_[ tick & aux::MASK ] < 0 )
+     {
+          ++tick;
+     }
+
+     const auto at = origin_ + boost::chrono::microseconds( tick * resolution_ );
+     const auto left = boost::chrono::duration_cast< boost::chrono::microseconds >( at - Clock::now() ).count();
+     return boost::posix_time::microseconds( std::max< std::int64_t >( 0, left ) );
+}
+
+
+std::size_t TimingWheel::size() const
+{
+     return size_;
+}
+
+
+std::uint64_t TimingWheel::tickOf( Clock::time_point time ) const
+{
+     return boost::chrono::duration_cast< boost::chrono::microseconds >( time - origin_ ).count() / resolution_;
+}
+
+
+void TimingWheel::place( std::int32_t index )
+{
+     const auto expires = nodes_[ index ].expires;
+     const auto delta = expires > current_ ? expires - current_ : 0;
+
+     unsigned level = 0;
+     while( level + 1 < aux::LEVELS && delta >= aux::span( level + 1 ) )
+     {
+          ++level;
+     }
+
+     link( index, level * aux::SLOTS + static_cast< std::int32_t >( ( expires >> ( aux::SLOT_BITS * level ) ) & aux::MASK ) );
+}
+
+
+void TimingWheel::link( std::int32_t index, std::int32_t bucket )
+{
+     auto& node = nodes_[ index ];
+     node.bucket = bucket;
+     node.prev = -1;
+     node.next = heads_[ bucket ];
+     if( node.next >= 0 )
+     {
+          nodes_[ node.next ].prev = index;
+     }
+     heads_[ bucket ] = index;
+}
+
+
+void TimingWheel::unlink( std::int32_t index )
+{
+     const auto& node = nodes_[ index ];
+     if( node.prev >= 0 )
+     {
+          nodes_[ node.prev ].next = node.next;
+     }
+     else
+     {
+          heads_[ node.bucket ] = node.next;
+     }
+     if( node.next >= 0 )
+     {
+          nodes_[ node.next ].prev = node.prev;
+     }
+}
+
+
+void TimingWheel::release( std::int32_t index )
+{
+     auto& node = nodes_[ index ];
+     node.callback = nullptr;
+     node.bucket = -1;
+     ++node.generation;
+     free_.push_back( index );
+}
+
+
+void TimingWheel::cascade( std::int32_t bucket )
+{
+     auto index = heads_[ bucket ];
+     heads_[ bucket ] = -1;
+     while( index >= 0 )
+     {
+          const auto next = nodes_[ index ].next;
+          place( index );
+          index = next;
+     }
+}
+
+
+void TimingWheel::expire( std::int32_t bucket )
+{
+     auto index = heads_[ bucket ];
+     heads_[ bucket ] = -1;
+     while( index >= 0 )
+     {
+          const auto next = nodes_[ index ].next;
+          link( index, aux::DUE );
+          index = next;
+     }
+}
+
+
+std::size_t TimingWheel::fire()
+{
+     std::size_t fired = 0;
+     while( heads_[ aux::DUE ] >= 0 )
+     {
+          const auto index = heads_[ aux::DUE ];
+          unlink( index );
+
+          /// Узел освобождается до вызова: действие может ставить таймеры, перераспределяя пул
+          auto callback = std::move( nodes_[ index ].callback );
+          release( index );
+          --size_;
+          ++fired;
+
+          callback();
+     }
+     return fired;
+}
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
@@ -0,0 +1,648 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#include <rabbitmq_client/topology.h>
+
+#include <algorithm>
+#include <deque>
+#include <initializer_list>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <unordered_map>
+#include <amqp.h>
+#include <amqp_framing.h>
+#include <boost/throw_exception.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <rabbitmq_client/src/connection_impl.h>
+#include <rabbitmq_client/error.h>
+#include <rabbitmq_client/utils.h>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+namespace {
+namespace aux {
+
+
+/// Канал соединения, из которого SimpleClient получает сообщения
+const amqp_channel_t CONSUMER_CHANNEL = 1;
+
+
+enum class Step
+{
+     Open,
+     Declare,
+     Bind,
+     Qos,
+     Consume,
+     Close
+};
+
+
+/// Запрос, отправленный в канал и ожидающий ответа
+struct Pending
+{
+     Step step;
+     std::size_t index;  ///< индекс элемента набора
+};
+
+
+/// Метод ответа брокера на запрос @a step
+amqp_method_number_t replyOf( Step step )
+{
+     switch( step )
+     {
+          case Step::Open:    return AMQP_CHANNEL_OPEN_OK_METHOD;
+          case Step::Declare: return AMQP_QUEUE_DECLARE_OK_METHOD;
+          case Step::Bind:    return AMQP_QUEUE_BIND_OK_METHOD;
+          case Step::Qos:     return AMQP_BASIC_QOS_OK_METHOD;
+          case Step::Consume: return AMQP_BASIC_CONSUME_OK_METHOD;
+          case Step::Close:   return AMQP_CHANNEL_CLOSE_OK_METHOD;
+     }
+     return 0;
+}
+
+
+bool isReply( amqp_method_number_t id )
+{
+     return id == AMQP_CHANNEL_OPEN_OK_METHOD
+          || id == AMQP_QUEUE_DECLARE_OK_METHOD
+          || id == AMQP_QUEUE_BIND_OK_METHOD
+          || id == AMQP_BASIC_QOS_OK_METHOD
+          || id == AMQP_BASIC_CONSUME_OK_METHOD
+          || id == AMQP_CHANNEL_CLOSE_OK_METHOD;
+}
+
+
+/// @brief Отправляет запросы в каналы без ожидания ответов и сопоставляет ответы запросам
+/// @details Брокер отвечает на запросы канала в порядке их поступления, поэтому ответ относится к первому
+/// ожидающему запросу своего канала. Закрытие канала брокером (channel.close) означает ошибку первого ожидающего
+/// запроса; остальные запросы канала брокер отбрасывает, поэтому они отправляются повторно в открытый заново канал.
+class Pipeline
+{
+public:
+     Pipeline(
+          amqp_connection_state_t state,
+          const std::vector< SimpleClient::QueueDeclaration >& declarations,
+          const std::vector< Topology::Binding >& bindings,
+          const std::vector< Topology::Consumer >& consumers,
+          Topology::Report& report
+     )
+          : state_( state )
+          , declarations_( declarations )
+          , bindings_( bindings )
+          , consumers_( consumers )
+          , report_( report )
+     {
+          /// Канал 1 открыт соединением (Connection::connect())
+          channels_[ CONSUMER_CHANNEL ].open = true;
+     }
+
+     ~Pipeline()
+     {
+          for( auto& envelope : deliveries_ )
+          {
+               amqp_destroy_envelope( &envelope );
+          }
+     }
+
+     Pipeline( const Pipeline& ) = delete;
+     Pipeline& operator=( const Pipeline& ) = delete;
+
+     /// Отправляет запрос в канал
+     void send( amqp_channel_t channel, const Pending& pending )
+     {
+          switch( pending.step )
+          {
+               case Step::Open:
+                    {
+                         amqp_channel_open_t method;
+                         method.out_of_band = amqp_empty_bytes;
+                         ensureNoErrors( amqp_send_method( state_, channel, AMQP_CHANNEL_OPEN_METHOD, &method ), "channel open" );
+                         channels_[ channel ].open = true;
+                    }
+                    break;
+
+               case Step::Declare:
+                    {
+                         const auto& declaration = declarations_[ pending.index ];
+                         const auto arguments = SimpleClient::queueArguments( declaration );
+
+                         amqp_queue_declare_t method;
+                         method.ticket = 0;
+                         method.queue = fromString( declaration.queueName );
+                         method.passive = 0;
+                         method.durable = declaration.durable;
+                         method.exclusive = declaration.exclusive;
+                         method.auto_delete = declaration.autoDelete;
+                         method.nowait = 0;
+                         method.arguments = arguments.native();
+                         ensureNoErrors( amqp_send_method( state_, channel, AMQP_QUEUE_DECLARE_METHOD, &method ), "declare queue" );
+                    }
+                    break;
+
+               case Step::Bind:
+                    {
+                         const auto& binding = bindings_[ pending.index ];
+
+                         amqp_queue_bind_t method;
+                         method.ticket = 0;
+                         method.queue = fromString( binding.queueName );
+                         method.exchange = fromString( binding.exchange );
+                         method.routing_key = fromString( binding.routingKey );
+                         method.nowait = 0;
+                         method.arguments = amqp_empty_table;
+                         ensureNoErrors( amqp_send_method( state_, channel, AMQP_QUEUE_BIND_METHOD, &method ), "bind queue" );
+                    }
+                    break;
+
+               case Step::Qos:
+                    {
+                         amqp_basic_qos_t method;
+                         method.prefetch_size = 0;
+                         method.prefetch_count = *consumers_[ pending.index ].parameters.prefetchCount;
+                         method.global = 0;
+                         ensureNoErrors( amqp_send_method( state_, channel, AMQP_BASIC_QOS_METHOD, &method ), "basic qos" );
+                    }
+                    break;
+
+               case Step::Consume:
+                    {
+                         const auto& consumer = consumers_[ pending.index ];
+                         const auto arguments = SimpleClient::consumerArguments( consumer.parameters );
+
+                         amqp_basic_consume_t method;
+                         method.ticket = 0;
+                         method.queue = fromString( consumer.queueName );
+                         method.consumer_tag = amqp_empty_bytes;
+                         method.no_local = 0;
+                         method.no_ack = consumer.parameters.noAck;
+                         method.exclusive = consumer.parameters.exclusive;
+                         method.nowait = 0;
+                         method.arguments = arguments.native();
+                         ensureNoErrors( amqp_send_method( state_, channel, AMQP_BASIC_CONSUME_METHOD, &method ), "basic consume" );
+                    }
+                    break;
+
+               case Step::Close:
+                    {
+                         amqp_channel_close_t method;
+                         method.reply_code = AMQP_REPLY_SUCCESS;
+                         method.reply_text = amqp_empty_bytes;
+                         method.class_id = 0;
+                         method.method_id = 0;
+                         ensureNoErrors( amqp_send_method( state_, channel, AMQP_CHANNEL_CLOSE_METHOD, &method ), "channel close" );
+                         channels_[ channel ].open = false;
+                    }
+                    break;
+          }
+
+          channels_[ channel ].pending.push_back( pending );
+     }
+
+     /// Отправляет запросы подписки (basic.qos при ограничении prefetchCount и basic.consume)
+     void subscribe( std::size_t index )
+     {
+          if( consumers_[ index ].parameters.prefetchCount )
+          {
+               send( CONSUMER_CHANNEL, Pending{ Step::Qos, index } );
+          }
+          send( CONSUMER_CHANNEL, Pending{ Step::Consume, index } );
+     }
+
+     /// Канал открыт (запрос channel.open отправлен и не отклонен брокером)
+     bool isOpen( amqp_channel_t channel ) const
+     {
+          const auto found = channels_.find( channel );
+          return found != channels_.end() && found->second.open;
+     }
+
+     /// @brief Ожидает ответы на все отправленные запросы
+     /// @throw ConnectionError при истечении времени ожидания
+     void drain( const boost::posix_time::ptime& expires )
+     {
+          using boost::posix_time::microsec_clock;
+
+          while( waiting() )
+          {
+               const auto left = expires - microsec_clock::universal_time();
+               if( left <= boost::posix_time::time_duration() )
+               {
+                    BOOST_THROW_EXCEPTION( ConnectionError( "topology setup timed out" ) );
+               }
+
+               timeval timer;
+               timer.tv_sec = left.total_seconds();
+               timer.tv_usec = left.fractional_seconds();
+
+               amqp_frame_t frame;
+               const auto status = amqp_simple_wait_frame_noblock( state_, &frame, &timer );
+               if( status == AMQP_STATUS_TIMEOUT )
+               {
+                    continue;
+               }
+               ensureNoErrors( status, "waiting topology replies" );
+
+               handleFrame( frame );
+
+               /// Декодированные методы ссылаются на буферы соединения: они освобождаются после обработки кадра
+               amqp_maybe_release_buffers( state_ );
+          }
+     }
+
+     /// Передает сообщения, доставленные до окончания настройки, в очередь доставок соединения
+     void handOver( std::deque< amqp_envelope_t >& deliveries )
+     {
+          deliveries.insert( deliveries.end(), deliveries_.begin(), deliveries_.end() );
+          deliveries_.clear();
+     }
+
+     bool blocked() const { return blocked_; }
+     bool blockEventsReceived() const { return blockEvents_; }
+     const std::string& blockedReason() const { return blockedReason_; }
+
+private:
+     struct Channel
+     {
+          std::deque< Pending > pending;
+          bool open = false;
+     };
+
+     bool waiting() const
+     {
+          for( const auto& channel : channels_ )
+          {
+               if( !channel.second.pending.empty() )
+               {
+                    return true;
+               }
+          }
+          return false;
+     }
+
+     Topology::Outcome* outcomeOf( const Pending& pending )
+     {
+          switch( pending.step )
+          {
+               case Step::Declare: return &report_.declarations[ pending.index ];
+               case Step::Bind:    return &report_.bindings[ pending.index ];
+               case Step::Qos:
+               case Step::Consume: return &report_.consumers[ pending.index ];
+               case Step::Open:
+               case Step::Close:   return nullptr;
+          }
+          return nullptr;
+     }
+
+     void fail( const Pending& pending, const std::string& error )
+     {
+          if( const auto outcome = outcomeOf( pending ) )
+          {
+               outcome->ok = false;
+               outcome->value.clear();
+               outcome->error = error;
+          }
+     }
+
+     void handleFrame( const amqp_frame_t& frame )
+     {
+          /// Заголовки и тела доставок канала 1 читаются вместе с basic.deliver (receive())
+          if( frame.frame_type != AMQP_FRAME_METHOD )
+          {
+               return;
+          }
+
+          const auto id = frame.payload.method.id;
+          const auto decoded = frame.payload.method.decoded;
+
+          if( frame.channel == 0 )
+          {
+               switch( id )
+               {
+                    case AMQP_CONNECTION_CLOSE_METHOD:
+                         {
+                              const auto details = static_cast< const amqp_connection_close_t* >( decoded );
+                              BOOST_THROW_EXCEPTION( ConnectionError( "connection closed: " + ( details ? toString( details->reply_text ) : std::string() ) ) );
+                         }
+                    case AMQP_CONNECTION_BLOCKED_METHOD:
+                         {
+                              const auto details = static_cast< const amqp_connection_blocked_t* >( decoded );
+                              blocked_ = true;
+                              blockEvents_ = true;
+                              blockedReason_ = details ? toString( details->reason ) : std::string();
+                         }
+                         break;
+                    case AMQP_CONNECTION_UNBLOCKED_METHOD:
+                         blocked_ = false;
+                         blockEvents_ = true;
+                         blockedReason_.clear();
+                         break;
+               }
+               return;
+          }
+
+          if( id == AMQP_BASIC_DELIVER_METHOD )
+          {
+               const auto details = static_cast< const amqp_basic_deliver_t* >( decoded );
+               if( frame.channel == CONSUMER_CHANNEL && details )
+               {
+                    receive( *details );
+               }
+               return;
+          }
+
+          if( id == AMQP_CHANNEL_CLOSE_METHOD )
+          {
+               const auto details = static_cast< const amqp_channel_close_t* >( decoded );
+               const auto error = details
+                    ? std::to_string( details->reply_code ) + " " + toString( details->reply_text )
+                    : std::string( "channel closed" );
+               handleChannelClose( frame.channel, error );
+               return;
+          }
+
+          if( !isReply( id ) )
+          {
+               return;
+          }
+
+          auto& pending = channels_[ frame.channel ].pending;
+          if( pending.empty() || replyOf( pending.front().step ) != id )
+          {
+               BOOST_THROW_EXCEPTION( ConnectionError( "unexpected reply on channel " + std::to_string( frame.channel ) ) );
+          }
+
+          const auto head = pending.front();
+          pending.pop_front();
+
+          if( const auto outcome = outcomeOf( head ) )
+          {
+               /// Успех подписки определяет basic.consume-ok, basic.qos-ok лишь подтверждает ограничение
+               if( head.step == Step::Qos )
+               {
+                    return;
+               }
+
+               outcome->ok = true;
+               outcome->error.clear();
+               if( head.step == Step::Declare )
+               {
+                    const auto details = static_cast< const amqp_queue_declare_ok_t* >( decoded );
+                    outcome->value = details ? toString( details->queue ) : declarations_[ head.index ].queueName;
+               }
+               else if( head.step == Step::Consume )
+               {
+                    const auto details = static_cast< const amqp_basic_consume_ok_t* >( decoded );
+                    outcome->value = details ? toString( details->consumer_tag ) : std::string();
+                    if( consumers_[ head.index ].parameters.noAck )
+                    {
+                         autoAck_.insert( outcome->value );
+                    }
+               }
+          }
+     }
+
+     /// @brief Читает сообщение целиком и сохраняет его до окончания настройки
+     /// @details Сообщение сохраняется, а не возвращается в очередь: подписка без подтверждений (noAck) не позволяет
+     /// вернуть сообщение, а подписка, созданная до apply(), неизвестна набору
+     void receive( const amqp_basic_deliver_t& details )
+     {
+          /// Поля метода ссылаются на буферы соединения, которые может освободить чтение тела: они копируются,
+          /// как в amqp_consume_message()
+          amqp_envelope_t envelope = amqp_envelope_t();
+          envelope.channel = CONSUMER_CHANNEL;
+          envelope.consumer_tag = amqp_bytes_malloc_dup( details.consumer_tag );
+          envelope.delivery_tag = details.delivery_tag;
+          envelope.redelivered = details.redelivered;
+          envelope.exchange = amqp_bytes_malloc_dup( details.exchange );
+          envelope.routing_key = amqp_bytes_malloc_dup( details.routing_key );
+
+          const auto reply = amqp_read_message( state_, CONSUMER_CHANNEL, &envelope.message, 0 );
+          if( reply.reply_type != AMQP_RESPONSE_NORMAL )
+          {
+               /// Сообщение освобождается самой amqp_read_message()
+               amqp_bytes_free( envelope.routing_key );
+               amqp_bytes_free( envelope.exchange );
+               amqp_bytes_free( envelope.consumer_tag );
+               ensureNoErrors( reply, "read delivered message" );
+          }
+          deliveries_.push_back( envelope );
+     }
+
+     /// Отбрасывает сообщения закрытого канала 1, кроме доставленных без подтверждений
+     void dropDeliveries()
+     {
+          /// Сообщения подписок с подтверждением брокер вернул в очередь, их идентификаторы недействительны
+          const auto kept = std::stable_partition( deliveries_.begin(), deliveries_.end(),
+               [ this ]( const amqp_envelope_t& envelope ){ return autoAck_.count( toString( envelope.consumer_tag ) ) != 0; } );
+          for( auto envelope = kept; envelope != deliveries_.end(); ++envelope )
+          {
+               amqp_destroy_envelope( &*envelope );
+          }
+          deliveries_.erase( kept, deliveries_.end() );
+     }
+
+     void handleChannelClose( amqp_channel_t channel, const std::string& error )
+     {
+          amqp_channel_close_ok_t closeOk;
+          ensureNoErrors( amqp_send_method( state_, channel, AMQP_CHANNEL_CLOSE_OK_METHOD, &closeOk ), "channel close-ok" );
+
+          auto& state = channels_[ channel ];
+          state.open = false;
+
+          std::deque< Pending > rest;
+          rest.swap( state.pending );
+
+          if( !rest.empty() )
+          {
+               const auto head = rest.front();
+               rest.pop_front();
+               fail( head, error );
+
+               /// Канал не удалось открыть: оставшиеся запросы не выполняются
+               if( head.step == Step::Open )
+               {
+                    for( const auto& pending : rest )
+                    {
+                         fail( pending, error );
+                    }
+                    return;
+               }
+               if( head.step == Step::Close )
+               {
+                    return;
+               }
+               if( head.step == Step::Qos && !rest.empty() && rest.front().step == Step::Consume && rest.front().index == head.index )
+               {
+                    rest.pop_front();
+               }
+          }
+          else if( channel != CONSUMER_CHANNEL )
+          {
+               return;
+          }
+
+          send( channel, Pending{ Step::Open, 0 } );
+
+          if( channel == CONSUMER_CHANNEL )
+          {
+               /// Закрытие канала отменило его подписки
+               dropDeliveries();
+               for( std::size_t i = 0; i < consumers_.size(); ++i )
+               {
+                    if( report_.consumers[ i ].ok )
+                    {
+                         report_.consumers[ i ].ok = false;
+                         subscribe( i );
+                    }
+               }
+          }
+
+          for( const auto& pending : rest )
+          {
+               send( channel, pending );
+          }
+     }
+
+     amqp_connection_state_t state_;
+     const std::vector< SimpleClient::QueueDeclaration >& declarations_;
+     const std::vector< Topology::Binding >& bindings_;
+     const std::vector< Topology::Consumer >& consumers_;
+     Topology::Report& report_;
+
+     std::map< amqp_channel_t, Channel > channels_;
+
+     std::vector< amqp_envelope_t > deliveries_;
+     std::set< std::string > autoAck_;     ///< метки подписок без подтверждений
+
+     bool blocked_ = false;
+     bool blockEvents_ = false;
+     std::string blockedReason_;
+};
+
+
+} // namespace aux
+} // namespace {unnamed}
+
+
+Topology& Topology::declare( const SimpleClient::QueueDeclaration& declaration )
+{
+     /// Недопустимые параметры обнаруживаются при формировании набора, а не при его применении
+     SimpleClient::queueArguments( declaration );
+     declarations_.push_back( declaration );
+     return *this;
+}
+
+
+Topology& Topology::bind( const std::string& exchange, const std::string& queueName, const std::string& routingKey )
+{
+     if( exchange.empty() )
+     {
+          BOOST_THROW_EXCEPTION( std::invalid_argument( "binding to the default exchange is not allowed" ) );
+     }
+     bindings_.push_back( Binding{ exchange, queueName, routingKey } );
+     return *this;
+}
+
+
+Topology& Topology::consume( const std::string& queueName, const SimpleClient::ConsumerParameters& parameters )
+{
+     SimpleClient::consumerArguments( parameters );
+     consumers_.push_back( Consumer{ queueName, parameters } );
+     return *this;
+}
+
+
+Topology::Report Topology::apply( const Connection& connection, const Parameters& params ) const
+{
+     using boost::posix_time::microsec_clock;
+
+     auto& impl = *connection.impl_;
+     const auto expires = microsec_clock::universal_time() + params.timeout;
+
+     Report report;
+     report.declarations.resize( declarations_.size() );
+     report.bindings.resize( bindings_.size() );
+     report.consumers.resize( consumers_.size() );
+
+     aux::Pipeline pipeline( impl.connection, declarations_, bindings_, consumers_, report );
+
+     /// 1. Объявления и связывания: дополнительные каналы открываются и заполняются запросами без ожидания ответов
+     std::vector< amqp_channel_t > channels;
+     const auto items = declarations_.size() + bindings_.size();
+     for( std::size_t i = 0; i < std::min( std::max< std::size_t >( params.channels, 1 ), items ); ++i )
+     {
+          channels.push_back( static_cast< amqp_channel_t >( aux::CONSUMER_CHANNEL + 1 + i ) );
+          pipeline.send( channels.back(), aux::Pending{ aux::Step::Open, 0 } );
+     }
+
+     std::unordered_map< std::string, amqp_channel_t > declaredOn;
+     for( std::size_t i = 0; i < declarations_.size(); ++i )
+     {
+          const auto channel = channels[ i % channels.size() ];
+          declaredOn[ declarations_[ i ].queueName ] = channel;
+          pipeline.send( channel, aux::Pending{ aux::Step::Declare, i } );
+     }
+     for( std::size_t i = 0; i < bindings_.size(); ++i )
+     {
+          const auto found = declaredOn.find( bindings_[ i ].queueName );
+          const auto channel = found != declaredOn.end() ? found->second : channels[ i % channels.size() ];
+          pipeline.send( channel, aux::Pending{ aux::Step::Bind, i } );
+     }
+     pipeline.drain( expires );
+
+     /// 2. Подписки в канале 1 и закрытие дополнительных каналов
+     for( const auto channel : channels )
+     {
+          if( pipeline.isOpen( channel ) )
+          {
+               pipeline.send( channel, aux::Pending{ aux::Step::Close, 0 } );
+          }
+     }
+     for( std::size_t i = 0; i < consumers_.size(); ++i )
+     {
+          pipeline.subscribe( i );
+     }
+     pipeline.drain( expires );
+     pipeline.handOver( impl.deliveries );
+
+     if( pipeline.blockEventsReceived() )
+     {
+          impl.blocked = pipeline.blocked();
+          impl.blockedReason = pipeline.blockedReason();
+     }
+
+     for( const auto* outcomes : { &report.declarations, &report.bindings, &report.consumers } )
+     {
+          report.failures += std::count_if( outcomes->begin(), outcomes->end(), []( const Outcome& outcome ){ return !outcome.ok; } );
+     }
+
+     if( !pipeline.isOpen( aux::CONSUMER_CHANNEL ) )
+     {
+          /// Канал 1 закрывался брокером и не был открыт заново
+          impl.channelOpenned = false;
+          BOOST_THROW_EXCEPTION( std::runtime_error( "cannot reopen channel after consumer failure" ) );
+     }
+
+     for( auto consumer = report.consumers.rbegin(); consumer != report.consumers.rend(); ++consumer )
+     {
+          if( consumer->ok )
+          {
+               impl.consuming = true;
+               impl.cancelled = false;
+               impl.consumerTag = consumer->value;
+               break;
+          }
+     }
+
+     return report;
+}
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
@@ -18,7 +18,16 @@ std::string toString( const amqp_bytes_t& bytes )
 
 amqp_bytes_t fromString( const std::string& str )
 {
-     return str.empty() ? amqp_empty_bytes : amqp_cstring_bytes( str.c_str() );
+     /// Длина берется из строки, а не через strlen(): тело сообщения может содержать нулевые байты
+     if( str.empty() )
+     {
+          return amqp_empty_bytes;
+     }
+
+     amqp_bytes_t bytes;
+     bytes.len = str.size();
+     bytes.bytes = const_cast< char* >( str.data() );
+     return bytes;
 }
 
 
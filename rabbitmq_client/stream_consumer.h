@@ -0,0 +1,107 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <boost/optional/optional.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <rabbitmq_client/simple_client.h>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+
+class MappedFile;
+
+
+/// @brief Подписчик потока RabbitMQ (stream queue) с сохранением позиции чтения
+/// @details В отличие от классической очереди поток не удаляет прочитанные сообщения: каждый подписчик
+/// читает общий журнал со своей позиции, и брокер не копирует сообщение для каждого получателя.
+///
+/// Смещение последнего подтвержденного сообщения (заголовок x-stream-offset) периодически - каждые
+/// checkpointInterval подтверждений или checkpointPeriod времени - записывается в отображенный в память файл
+/// контрольной точки. При создании объекта и после переподключения (в т.ч. автоматического при разрыве
+/// соединения) чтение продолжается со следующего за контрольной точкой сообщения; позиция Parameters::start
+/// используется, только если контрольной точки еще нет.
+///
+/// Гарантия доставки - не менее одного раза: после сбоя повторно доставляются сообщения, подтвержденные
+/// после последней записанной контрольной точки.
+///
+/// @note Сообщения должны подтверждаться в порядке получения (см. также OrderedDispatcher).
+/// Методы класса не являются потокобезопасными.
+class StreamConsumer
+{
+public:
+     /// Параметры подписки
+     struct Parameters
+     {
+          explicit Parameters( const std::string& queue )
+               : queueName( queue )
+          {}
+
+          std::string queueName;                                  ///< имя потока
+          SimpleClient::StreamOffset start = SimpleClient::StreamOffset::first(); ///< позиция чтения без контрольной точки
+          std::uint16_t prefetchCount = 1000;                     ///< ограничение кол-ва неподтвержденных сообщений
+          std::string checkpointPath;                             ///< файл контрольной точки (пустой - не сохраняется)
+          std::uint32_t checkpointInterval = 1000;                ///< кол-во подтверждений между контрольными точками
+          boost::posix_time::time_duration checkpointPeriod = boost::posix_time::seconds( 1 ); ///< период контрольных точек
+     };
+
+     /// Конструктор. Устанавливает соединение и подписывается на поток
+     /// @throw ConnectionError в случае если все попытки подключения закончились неудачей
+     /// @throw std::runtime_error в случае ошибок открытия файла контрольной точки и во всех остальных случаях
+     StreamConsumer( const Connection::Parameters&, const Parameters& );
+
+     /// Записывает контрольную точку
+     ~StreamConsumer();
+
+     StreamConsumer( const StreamConsumer& ) = delete;
+     StreamConsumer& operator=( const StreamConsumer& ) = delete;
+
+     /// @brief Получает следующее сообщение потока
+     /// @details При разрыве соединения переподключается и продолжает чтение с контрольной точки
+     /// @return boost::none при таймауте
+     /// @throw ConnectionError в случае если все попытки переподключения закончились неудачей
+     boost::optional< Delivery > consume( const boost::optional< boost::posix_time::time_duration >& timeout );
+
+     /// Подтверждает сообщение и при необходимости записывает контрольную точку
+     void ack( const Delivery& delivery );
+
+     /// Записывает контрольную точку на диск
+     void checkpoint();
+
+     /// Смещение последнего подтвержденного сообщения (boost::none, если сообщения еще не подтверждались)
+     boost::optional< std::uint64_t > committedOffset() const { return committed_; }
+
+     /// Переподключается и возобновляет подписку со следующего за последним подтвержденным сообщения
+     void reconnect();
+
+     /// Смещение сообщения в потоке (заголовок x-stream-offset) или boost::none, если заголовка нет
+     static boost::optional< std::uint64_t > offsetOf( const Delivery& delivery );
+
+private:
+     /// Подписывается на поток с текущей позиции
+     void subscribe();
+
+     /// Записывает позицию в файл контрольной точки
+     void store( bool flush );
+
+     const Parameters params_;
+     Connection connection_;
+
+     std::unique_ptr< MappedFile > file_;
+     boost::optional< std::uint64_t > committed_;
+     std::uint32_t uncommitted_ = 0;
+     boost::posix_time::ptime lastCheckpoint_;
+};
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
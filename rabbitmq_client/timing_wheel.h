@@ -0,0 +1,127 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <boost/chrono/system_clocks.hpp>
+#include <boost/date_time/posix_time/posix_time_duration.hpp>
+#include <boost/optional/optional.hpp>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+
+/// @brief Иерархическое колесо таймеров
+/// @details Время делится на такты длительностью Parameters::resolution. Таймеры хранятся в четырех уровнях
+/// по 256 ячеек: ячейка первого уровня соответствует одному такту, ячейка каждого следующего уровня -
+/// полному обороту предыдущего. При переходе предыдущего уровня через ноль таймеры очередной ячейки следующего
+/// уровня перераспределяются по нижним уровням. Постановка и отмена таймера выполняются за O(1): узлы таймеров
+/// хранятся в общем пуле и связаны в двусвязные списки ячеек по индексам.
+///
+/// Колесо не имеет собственного потока: таймеры срабатывают в вызове advance() владельца, а nextExpiry()
+/// сообщает, насколько можно заснуть в ожидании ввода-вывода, не пропустив срабатывание. Поэтому колесо
+/// встраивается в цикл ожидания потока, уже владеющего соединением, без дополнительных потоков и пробуждений
+/// на каждый таймер (см. SimpleClient::publishAfter()).
+///
+/// @note Класс не является потокобезопасным
+class TimingWheel
+{
+public:
+     /// Действие, выполняемое при срабатывании таймера
+     typedef std::function< void() > Callback;
+
+     /// Идентификатор таймера для отмены (0 - недействительный идентификатор)
+     typedef std::uint64_t TimerId;
+
+     /// Параметры колеса
+     struct Parameters
+     {
+          Parameters()
+               : resolution( boost::posix_time::milliseconds( 10 ) )
+          {}
+
+          boost::posix_time::time_duration resolution;     ///< длительность такта (точность срабатывания)
+     };
+
+     explicit TimingWheel( const Parameters& = Parameters() );
+
+     TimingWheel( const TimingWheel& ) = delete;
+     TimingWheel& operator=( const TimingWheel& ) = delete;
+
+     /// @brief Ставит таймер, срабатывающий не раньше чем через @a delay
+     /// @details Момент срабатывания округляется вверх до границы такта (не ранее следующего такта)
+     /// @throw std::invalid_argument если задержка превышает диапазон колеса (2^32 тактов)
+     TimerId schedule( const boost::posix_time::time_duration& delay, Callback callback );
+
+     /// @brief Отменяет таймер
+     /// @return false, если таймер уже сработал или был отменен
+     bool cancel( TimerId id );
+
+     /// @brief Выполняет действия всех наступивших таймеров
+     /// @details Действия могут ставить и отменять таймеры. Исключение из действия прерывает обработку
+     /// и передается вызывающему; оставшиеся наступившие таймеры выполняются при следующем вызове.
+     /// @return кол-во выполненных действий
+     std::size_t advance();
+
+     /// @brief Время до ближайшей обработки колеса
+     /// @details Ближайший такт с таймерами первого уровня или такт перераспределения следующего уровня
+     /// (не чаще одного раза за оборот первого уровня)
+     /// @return boost::none, если таймеров нет
+     boost::optional< boost::posix_time::time_duration > nextExpiry() const;
+
+     /// Кол-во поставленных таймеров
+     std::size_t size() const;
+
+private:
+     typedef boost::chrono::steady_clock Clock;
+
+     /// Узел таймера в пуле
+     struct Node
+     {
+          Callback callback;
+          std::uint64_t expires;        ///< такт срабатывания
+          std::uint32_t generation;     ///< поколение узла, отличающее таймеры, занимавшие его ранее
+          std::int32_t bucket;          ///< список, содержащий узел (-1 - узел свободен)
+          std::int32_t prev;
+          std::int32_t next;
+     };
+
+     /// Такт, соответствующий моменту @a time
+     std::uint64_t tickOf( Clock::time_point time ) const;
+
+     /// Помещает узел в ячейку, соответствующую его такту срабатывания
+     void place( std::int32_t index );
+
+     void link( std::int32_t index, std::int32_t bucket );
+     void unlink( std::int32_t index );
+     void release( std::int32_t index );
+
+     /// Перераспределяет таймеры ячейки @a bucket следующего уровня по нижним уровням
+     void cascade( std::int32_t bucket );
+
+     /// Перемещает таймеры ячейки @a bucket первого уровня в список наступивших
+     void expire( std::int32_t bucket );
+
+     /// Выполняет действия наступивших таймеров
+     std::size_t fire();
+
+     const std::uint64_t resolution_;     ///< длительность такта, мкс
+     const Clock::time_point origin_;
+     std::uint64_t current_ = 0;          ///< последний обработанный такт
+     std::size_t size_ = 0;
+
+     std::vector< Node > nodes_;
+     std::vector< std::int32_t > free_;
+     std::vector< std::int32_t > heads_;
+};
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
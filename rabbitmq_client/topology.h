@@ -0,0 +1,126 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <boost/date_time/posix_time/posix_time_duration.hpp>
+#include <rabbitmq_client/simple_client.h>
+
+
+namespace edi {
+namespace ts {
+namespace rabbitmq_client {
+
+
+/// @brief Набор объявлений очередей, связываний и подписок, применяемый к соединению пакетом
+/// @details SimpleClient::declareQueue() и SimpleClient::bind() выполняют каждую операцию синхронно, ожидая
+/// ответ брокера, поэтому время настройки сотен очередей пропорционально их количеству, умноженному на время
+/// передачи запроса и ответа. apply() отправляет запросы, не дожидаясь ответов:
+/// - объявления и связывания распределяются по нескольким дополнительным каналам (Parameters::channels) и
+/// отправляются разом; связывание отправляется в канал объявления своей очереди, поэтому выполняется после него;
+/// - после получения всех ответов дополнительные каналы закрываются, а подписки (basic.qos и basic.consume)
+/// отправляются разом в канал соединения (канал 1), из которого сообщения получает SimpleClient.
+///
+/// Таким образом настройка занимает два обмена с брокером независимо от количества элементов. Ответы
+/// собираются по мере поступления; ошибка элемента (брокер закрывает канал) записывается в отчет,
+/// канал открывается заново и оставшиеся элементы отправляются повторно.
+///
+/// @code
+/// Topology topology;
+/// for( const auto& route : routes )
+/// {
+///      topology.declare( SimpleClient::QueueDeclaration( route.queue ) );
+///      topology.bind( "router", route.queue, route.key );
+///      topology.consume( route.queue );
+/// }
+/// const auto report = topology.apply( connection );
+/// @endcode
+///
+/// @note Сообщения, доставленные в канал 1 до окончания настройки (в том числе подписчикам, созданным до apply()),
+/// сохраняются и выдаются первыми последующими вызовами SimpleClient::consumeMessage() и т.п.
+/// Ошибка подписки закрывает канал 1, что отменяет сделанные ранее подписки этого канала: они выполняются повторно,
+/// а сохраненные сообщения подписок с подтверждением отбрасываются (брокер возвращает их в очередь).
+/// SimpleClient::drain() отменяет только последнюю подписку; остальные отменяются при закрытии канала.
+class Topology
+{
+public:
+     /// Параметры применения
+     struct Parameters
+     {
+          Parameters()
+               : channels( 4 )
+               , timeout( boost::posix_time::seconds( 30 ) )
+          {}
+
+          std::size_t channels;                        ///< кол-во дополнительных каналов для объявлений и связываний
+          boost::posix_time::time_duration timeout;    ///< ограничение времени ожидания всех ответов
+     };
+
+     /// Подписка на очередь
+     struct Consumer
+     {
+          std::string queueName;
+          SimpleClient::ConsumerParameters parameters;
+     };
+
+     /// Связывание точки публикации с очередью
+     struct Binding
+     {
+          std::string exchange;
+          std::string queueName;
+          std::string routingKey;
+     };
+
+     /// Результат выполнения элемента
+     struct Outcome
+     {
+          bool ok = false;
+          std::string value;       ///< имя объявленной очереди или метка подписчика
+          std::string error;       ///< код и текст ошибки брокера
+     };
+
+     /// Результаты в порядке добавления элементов
+     struct Report
+     {
+          std::vector< Outcome > declarations;
+          std::vector< Outcome > bindings;
+          std::vector< Outcome > consumers;
+          std::size_t failures = 0;     ///< кол-во неуспешных элементов
+     };
+
+     /// @brief Добавляет объявление очереди
+     /// @throw std::runtime_error в случае недопустимого сочетания параметров
+     /// @see SimpleClient::declareQueue()
+     Topology& declare( const SimpleClient::QueueDeclaration& declaration );
+
+     /// @brief Добавляет связывание точки публикации @a exchange с очередью @a queueName
+     /// @throw std::invalid_argument если @a exchange пусто (со стандартной точкой публикации очереди связаны автоматически)
+     Topology& bind( const std::string& exchange, const std::string& queueName, const std::string& routingKey = "" );
+
+     /// @brief Добавляет подписку на очередь @a queueName
+     /// @details Ограничение prefetchCount задается для каждого подписчика отдельно (basic.qos с global = 0)
+     /// @throw std::invalid_argument если задана позиция чтения потока без ограничения prefetchCount
+     /// @see SimpleClient::bind()
+     Topology& consume( const std::string& queueName, const SimpleClient::ConsumerParameters& parameters = SimpleClient::ConsumerParameters() );
+
+     /// @brief Применяет набор к соединению
+     /// @details После успешной подписки соединение находится в том же состоянии, что и после SimpleClient::bind():
+     /// сообщения всех подписок получаются методами SimpleClient::consumeMessage() и т.п.
+     /// @return результаты всех элементов
+     /// @throw ConnectionError в случае разрыва соединения, закрытия соединения брокером или истечения времени ожидания
+     /// @throw std::runtime_error если канал 1 не удалось открыть повторно после ошибки подписки
+     Report apply( const Connection& connection, const Parameters& params = Parameters() ) const;
+
+private:
+     std::vector< SimpleClient::QueueDeclaration > declarations_;
+     std::vector< Binding > bindings_;
+     std::vector< Consumer > consumers_;
+};
+
+
+} // namespace rabbitmq_client
+} // namespace ts
+} // namespace edi
@@ -0,0 +1,351 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#include <reconnect_storm/fault_proxy.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <boost/throw_exception.hpp>
+#include <boost/thread/lock_guard.hpp>
+
+
+namespace edi {
+namespace ts {
+namespace reconnect_storm {
+
+namespace {
+namespace aux {
+
+
+/// Предел буферизации данных в одном направлении; при его достижении чтение из источника приостанавливается
+const std::size_t BUFFER_LIMIT = 1024 * 1024;
+
+
+void systemError( const std::string& message )
+{
+     BOOST_THROW_EXCEPTION( std::runtime_error( message + ": " + std::strerror( errno ) ) );
+}
+
+
+/// Закрывает сокет с отправкой RST вместо штатного завершения соединения
+void reset( int fd )
+{
+     const linger option = { 1, 0 };
+     ::setsockopt( fd, SOL_SOCKET, SO_LINGER, &option, sizeof( option ) );
+     ::close( fd );
+}
+
+
+void setNoDelay( int fd )
+{
+     const int on = 1;
+     ::setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof( on ) );
+}
+
+
+short events( bool read, bool write )
+{
+     return ( read ? POLLIN : 0 ) | ( write ? POLLOUT : 0 );
+}
+
+
+} // namespace aux
+} // namespace {unnamed}
+
+
+FaultProxy::FaultProxy( std::uint16_t listenPort, const std::string& brokerHost, std::uint16_t brokerPort )
+     : failed_( false )
+     , stop_( false )
+{
+     addrinfo hints;
+     std::memset( &hints, 0, sizeof( hints ) );
+     hints.ai_family = AF_UNSPEC;
+     hints.ai_socktype = SOCK_STREAM;
+
+     addrinfo* resolved = nullptr;
+     const auto status = ::getaddrinfo( brokerHost.c_str(), std::to_string( brokerPort ).c_str(), &hints, &resolved );
+     if( status != 0 )
+     {
+          BOOST_THROW_EXCEPTION( std::runtime_error( "cannot resolve " + brokerHost + ": " + ::gai_strerror( status ) ) );
+     }
+     std::memcpy( &broker_, resolved->ai_addr, resolved->ai_addrlen );
+     brokerSize_ = resolved->ai_addrlen;
+     ::freeaddrinfo( resolved );
+
+     wakeupFd_ = ::eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+     if( wakeupFd_ < 0 )
+     {
+          aux::systemError( "cannot create eventfd" );
+     }
+
+     listener_ = ::socket( AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+     if( listener_ < 0 )
+     {
+          ::close( wakeupFd_ );
+          aux::systemError( "cannot create listening socket" );
+     }
+
+     const int on = 1;
+     ::setsockopt( listener_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof( on ) );
+
+     sockaddr_in address;
+     std::memset( &address, 0, sizeof( address ) );
+     address.sin_family = AF_INET;
+     address.sin_port = htons( listenPort );
+     address.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+
+     if( ::bind( listener_, reinterpret_cast< const sockaddr* >( &address ), sizeof( address ) ) != 0
+          || ::listen( listener_, SOMAXCONN ) != 0 )
+     {
+          const auto error = errno;
+          ::close( listener_ );
+          ::close( wakeupFd_ );
+          errno = error;
+          aux::systemError( "cannot listen on port " + std::to_string( listenPort ) );
+     }
+
+     thread_ = boost::thread( [ this ](){ run(); } );
+}
+
+
+FaultProxy::~FaultProxy()
+{
+     stop_ = true;
+     wakeup();
+     thread_.join();
+
+     while( !sessions_.empty() )
+     {
+          close( sessions_.begin() );
+     }
+     ::close( listener_ );
+     ::close( wakeupFd_ );
+}
+
+
+void FaultProxy::fail()
+{
+     failed_ = true;
+     wakeup();
+}
+
+
+void FaultProxy::restore()
+{
+     failed_ = false;
+     wakeup();
+}
+
+
+bool FaultProxy::failed() const
+{
+     return failed_;
+}
+
+
+FaultProxy::Statistics FaultProxy::statistics() const
+{
+     boost::lock_guard< boost::mutex > lock( mutex_ );
+     return statistics_;
+}
+
+
+std::vector< FaultProxy::Clock::time_point > FaultProxy::takeAttempts()
+{
+     std::vector< Clock::time_point > attempts;
+     boost::lock_guard< boost::mutex > lock( mutex_ );
+     attempts.swap( attempts_ );
+     return attempts;
+}
+
+
+void FaultProxy::run()
+{
+     std::vector< pollfd > fds;
+
+     while( !stop_ )
+     {
+          if( failed_ && !sessions_.empty() )
+          {
+               dropAll();
+          }
+
+          fds.clear();
+          fds.push_back( pollfd{ wakeupFd_, POLLIN, 0 } );
+          fds.push_back( pollfd{ listener_, POLLIN, 0 } );
+          for( const auto& each: sessions_ )
+          {
+               fds.push_back( pollfd{ each.client, aux::events( each.toBroker.size() < aux::BUFFER_LIMIT, !each.toClient.empty() ), 0 } );
+               fds.push_back( pollfd{ each.broker, aux::events( each.toClient.size() < aux::BUFFER_LIMIT, !each.toBroker.empty() ), 0 } );
+          }
+
+          if( ::poll( fds.data(), fds.size(), -1 ) < 0 )
+          {
+               continue;
+          }
+
+          if( fds[ 0 ].revents )
+          {
+               std::uint64_t value;
+               while( ::read( wakeupFd_, &value, sizeof( value ) ) > 0 )
+               {}
+          }
+
+          std::size_t i = 2;
+          for( auto it = sessions_.begin(); it != sessions_.end(); i += 2 )
+          {
+               const bool alive = transfer( it->client, fds[ i ].revents, it->broker, it->toBroker )
+                    && transfer( it->broker, fds[ i + 1 ].revents, it->client, it->toClient );
+
+               if( alive )
+               {
+                    ++it;
+               }
+               else
+               {
+                    close( it++ );
+               }
+          }
+
+          /// Новые соединения добавляются после обхода, т.к. для них еще нет элементов в fds
+          if( fds[ 1 ].revents & POLLIN )
+          {
+               accept();
+          }
+     }
+}
+
+
+void FaultProxy::accept()
+{
+     while( true )
+     {
+          const int client = ::accept4( listener_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC );
+          if( client < 0 )
+          {
+               return;
+          }
+
+          const auto now = Clock::now();
+          const int broker = failed_ ? -1 : connectBroker();
+
+          boost::lock_guard< boost::mutex > lock( mutex_ );
+          attempts_.push_back( now );
+
+          if( broker < 0 )
+          {
+               aux::reset( client );
+               ++statistics_.rejected;
+               continue;
+          }
+
+          aux::setNoDelay( client );
+          aux::setNoDelay( broker );
+          sessions_.push_back( Session{ client, broker, std::string(), std::string() } );
+          ++statistics_.accepted;
+          ++statistics_.active;
+     }
+}
+
+
+void FaultProxy::dropAll()
+{
+     /// Клиенты получают RST, как при аварийной остановке узла брокера; брокер видит штатное закрытие
+     /// соединения и освобождает ресурсы клиента (очереди exclusive, неподтвержденные сообщения)
+     const auto count = sessions_.size();
+     for( const auto& each: sessions_ )
+     {
+          aux::reset( each.client );
+          ::close( each.broker );
+     }
+     sessions_.clear();
+
+     boost::lock_guard< boost::mutex > lock( mutex_ );
+     statistics_.dropped += count;
+     statistics_.active = 0;
+}
+
+
+void FaultProxy::close( std::list< Session >::iterator session )
+{
+     ::close( session->client );
+     ::close( session->broker );
+     sessions_.erase( session );
+
+     boost::lock_guard< boost::mutex > lock( mutex_ );
+     --statistics_.active;
+}
+
+
+bool FaultProxy::transfer( int from, short revents, int to, std::string& buffer )
+{
+     if( revents & ( POLLIN | POLLHUP | POLLERR ) )
+     {
+          char chunk[ 64 * 1024 ];
+          const auto received = ::recv( from, chunk, sizeof( chunk ), 0 );
+          if( received == 0 )
+          {
+               return false;
+          }
+          if( received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR )
+          {
+               return false;
+          }
+          if( received > 0 )
+          {
+               buffer.append( chunk, received );
+          }
+     }
+
+     if( !buffer.empty() )
+     {
+          const auto sent = ::send( to, buffer.data(), buffer.size(), MSG_NOSIGNAL );
+          if( sent < 0 )
+          {
+               return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+          }
+          buffer.erase( 0, sent );
+     }
+     return true;
+}
+
+
+int FaultProxy::connectBroker() const
+{
+     /// Подключение к брокеру выполняется синхронно: прокси рассчитан на брокер, доступный по локальной сети
+     const int fd = ::socket( broker_.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+     if( fd < 0 )
+     {
+          return -1;
+     }
+     if( ::connect( fd, reinterpret_cast< const sockaddr* >( &broker_ ), brokerSize_ ) != 0 )
+     {
+          ::close( fd );
+          return -1;
+     }
+     ::fcntl( fd, F_SETFL, ::fcntl( fd, F_GETFL ) | O_NONBLOCK );
+     return fd;
+}
+
+
+void FaultProxy::wakeup()
+{
+     const std::uint64_t one = 1;
+     const auto written = ::write( wakeupFd_, &one, sizeof( one ) );
+     static_cast< void >( written );
+}
+
+
+} // namespace reconnect_storm
+} // namespace ts
+} // namespace edi
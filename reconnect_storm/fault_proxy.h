@@ -0,0 +1,111 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <boost/chrono/system_clocks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+
+namespace edi {
+namespace ts {
+namespace reconnect_storm {
+
+
+/// @brief TCP-прокси перед брокером, имитирующий его отказ и восстановление
+/// @details Принимает подключения на локальном порту и передает трафик брокеру в обе стороны.
+/// Вызов fail() имитирует аварийную остановку брокера: все соединения разрываются (RST), новые подключения
+/// принимаются и сразу же сбрасываются. Вызов restore() возобновляет передачу новых подключений брокеру.
+///
+/// Прокси регистрирует время каждой попытки подключения (в том числе сброшенной при отказе), по которым
+/// оценивается нагрузка на брокер при массовом переподключении клиентов.
+///
+/// Вся передача данных выполняется одним потоком на неблокирующих сокетах (poll).
+class FaultProxy
+{
+public:
+     typedef boost::chrono::steady_clock Clock;
+
+     /// Счетчики прокси
+     struct Statistics
+     {
+          std::uint64_t accepted = 0;    ///< подключений, переданных брокеру
+          std::uint64_t rejected = 0;    ///< подключений, сброшенных при отказе (или недоступности брокера)
+          std::uint64_t dropped = 0;     ///< установленных соединений, разорванных вызовом fail()
+          std::size_t active = 0;        ///< установленных соединений
+     };
+
+     /// @brief Начинает прием подключений на 127.0.0.1:@a listenPort
+     /// @throw std::runtime_error если адрес брокера не разрешается или порт занят
+     FaultProxy( std::uint16_t listenPort, const std::string& brokerHost, std::uint16_t brokerPort );
+
+     /// Останавливает прокси и закрывает все соединения
+     ~FaultProxy();
+
+     FaultProxy( const FaultProxy& ) = delete;
+     FaultProxy& operator=( const FaultProxy& ) = delete;
+
+     /// Разрывает все соединения и сбрасывает новые подключения до вызова restore()
+     void fail();
+
+     /// Возобновляет передачу подключений брокеру
+     void restore();
+
+     /// Возвращает true между вызовами fail() и restore()
+     bool failed() const;
+
+     /// Текущие значения счетчиков
+     Statistics statistics() const;
+
+     /// Возвращает время попыток подключения, зарегистрированных с предыдущего вызова
+     std::vector< Clock::time_point > takeAttempts();
+
+private:
+     struct Session
+     {
+          int client;
+          int broker;
+          std::string toClient;
+          std::string toBroker;
+     };
+
+     void run();
+     void accept();
+     void dropAll();
+     void close( std::list< Session >::iterator session );
+
+     /// Передает данные из @a from в @a to через @a buffer; возвращает false, если соединение закрыто
+     bool transfer( int from, short revents, int to, std::string& buffer );
+
+     int connectBroker() const;
+     void wakeup();
+
+     sockaddr_storage broker_;
+     socklen_t brokerSize_ = 0;
+     int listener_ = -1;
+     int wakeupFd_ = -1;
+
+     std::list< Session > sessions_;
+
+     std::atomic< bool > failed_;
+     std::atomic< bool > stop_;
+
+     mutable boost::mutex mutex_;
+     Statistics statistics_;
+     std::vector< Clock::time_point > attempts_;
+
+     boost::thread thread_;
+};
+
+
+} // namespace reconnect_storm
+} // namespace ts
+} // namespace edi
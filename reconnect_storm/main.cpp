@@ -0,0 +1,541 @@
+/// @file
+/// @brief Хаос-тест переподключения: клиенты работают с брокером через прокси, который по расписанию имитирует
+/// отказ и восстановление брокера; измеряются время восстановления клиентов, потерянные и повторно
+/// доставленные сообщения и нагрузка на брокер при массовом переподключении
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#include <atomic>
+#include <csignal>
+#include <cstring>
+#include <stdexcept>
+#include <iostream>
+#include <iomanip>
+#include <unistd.h>
+#include <boost/chrono/system_clocks.hpp>
+#include <boost/exception/diagnostic_information.hpp>
+#include <boost/program_options.hpp>
+#include <boost/thread.hpp>
+#include <rabbitmq_client/error.h>
+#include <rabbitmq_client/field_table.h>
+#include <rabbitmq_client/simple_client.h>
+#include <rabbitmq_client/topology.h>
+#include <reconnect_storm/fault_proxy.h>
+#include <utils/latency_stats.h>
+
+
+namespace {
+
+
+using edi::ts::rabbitmq_client::Connection;
+using edi::ts::rabbitmq_client::ConnectionError;
+using edi::ts::rabbitmq_client::SimpleClient;
+using edi::ts::rabbitmq_client::Topology;
+using edi::ts::reconnect_storm::FaultProxy;
+
+typedef boost::chrono::steady_clock Clock;
+
+
+/// Устанавливается обработчиком сигналов и рабочими потоками при ошибке
+std::atomic< bool > interrupted{ false };
+
+
+void signalHandler( int signo )
+{
+     if( signo == SIGINT || signo == SIGTERM )
+     {
+          interrupted = true;
+     }
+}
+
+
+/// Заголовок тела сообщения: номер публикатора и порядковый номер сообщения
+const std::size_t HEADER_SIZE = sizeof( std::uint32_t ) + sizeof( std::uint64_t );
+
+
+std::uint64_t milliseconds( Clock::duration duration )
+{
+     return boost::chrono::duration_cast< boost::chrono::milliseconds >( duration ).count();
+}
+
+
+/// Общие для всех потоков параметры и счетчики теста
+struct Storm
+{
+     Storm( const Connection::Parameters& p, const SimpleClient::QueueParameters& q, unsigned publishers )
+          : params( p ), queue( q ), received( publishers ), confirmed( publishers )
+     {}
+
+     const Connection::Parameters params;          ///< параметры подключения через прокси
+     const SimpleClient::QueueParameters queue;
+     double ratePerPublisher = 0;
+     std::size_t size = 0;
+
+     std::atomic< bool > publishing{ true };
+     std::atomic< bool > consuming{ true };
+
+     std::atomic< std::uint64_t > published{ 0 };
+     std::atomic< std::uint64_t > publishFailures{ 0 };
+     std::atomic< std::uint64_t > consumed{ 0 };
+
+     /// Номер восстановления брокера; увеличивается после каждого restore()
+     std::atomic< unsigned > epoch{ 0 };
+
+     boost::mutex mutex;
+     Clock::time_point restoredAt;                 ///< время последнего restore()
+     LatencyStats recovery;                        ///< время восстановления клиентов в текущем цикле, мс
+     std::vector< std::vector< std::uint32_t > > received;   ///< кол-во получений каждого сообщения, по публикаторам
+
+     /// Признак успешной публикации каждого сообщения, по публикаторам (заполняется только потоком публикатора)
+     std::vector< std::vector< char > > confirmed;
+};
+
+
+/// @brief Регистрирует первую успешную операцию клиента после восстановления брокера
+/// @param epoch номер восстановления, прочитанный до начала операции: операция, начатая до восстановления,
+/// не считается признаком восстановления клиента
+void recovered( Storm& storm, unsigned& seenEpoch, unsigned epoch )
+{
+     if( epoch == seenEpoch )
+     {
+          return;
+     }
+     seenEpoch = epoch;
+
+     boost::lock_guard< boost::mutex > lock( storm.mutex );
+     storm.recovery.add( milliseconds( Clock::now() - storm.restoredAt ) );
+}
+
+
+void publisher( Storm& storm, std::uint32_t id )
+{
+     auto& confirmed = storm.confirmed[ id ];
+
+     std::string body( std::max( storm.size, HEADER_SIZE ), '\0' );
+     std::memcpy( &body[ 0 ], &id, sizeof( id ) );
+
+     const auto interval = boost::chrono::duration_cast< Clock::duration >( boost::chrono::duration< double >( 1.0 / storm.ratePerPublisher ) );
+     auto due = Clock::now();
+
+     std::unique_ptr< SimpleClient > client;
+     unsigned seenEpoch = storm.epoch;
+
+     for( std::uint64_t seq = 0; storm.publishing && !interrupted; ++seq )
+     {
+          boost::this_thread::sleep_until( due );
+
+          /// Сообщения, не отправленные за время переподключения, не публикуются залпом после него:
+          /// это исказило бы картину нагрузки на брокер сразу после восстановления
+          due = std::max( due + interval, Clock::now() );
+
+          std::memcpy( &body[ sizeof( id ) ], &seq, sizeof( seq ) );
+
+          const unsigned epoch = storm.epoch;
+          bool ok = false;
+          try
+          {
+               if( !client )
+               {
+                    client.reset( new SimpleClient( storm.params ) );
+               }
+               client->publishMessage( storm.queue, body );
+               ok = true;
+          }
+          catch( const ConnectionError& )
+          {
+               ++storm.publishFailures;
+          }
+
+          confirmed.push_back( ok );
+          if( ok )
+          {
+               ++storm.published;
+               recovered( storm, seenEpoch, epoch );
+          }
+     }
+}
+
+
+void consumer( Storm& storm )
+{
+     const boost::posix_time::milliseconds pollInterval( 100 );
+
+     SimpleClient::ConsumerParameters consumerParams;
+     consumerParams.prefetchCount = 1000;
+
+     std::unique_ptr< SimpleClient > client;
+     std::vector< SimpleClient::Envelope > envelopes;
+     unsigned seenEpoch = storm.epoch;
+     bool broken = false;
+     bool subscribed = false;
+
+     while( storm.consuming && !interrupted )
+     {
+          const unsigned epoch = storm.epoch;
+          try
+          {
+               if( !client )
+               {
+                    client.reset( new SimpleClient( storm.params ) );
+               }
+               else if( broken )
+               {
+                    client->reconnect();
+               }
+               broken = false;
+
+               /// Подписка не переживает разрыв соединения и восстанавливается на новом
+               if( !subscribed )
+               {
+                    client->bind( storm.queue, consumerParams );
+                    subscribed = true;
+                    recovered( storm, seenEpoch, epoch );
+               }
+
+               if( !client->consumeMessages( envelopes, 1000, pollInterval ) )
+               {
+                    continue;
+               }
+
+               {
+                    boost::lock_guard< boost::mutex > lock( storm.mutex );
+                    for( const auto& each: envelopes )
+                    {
+                         if( each.message.size() < HEADER_SIZE )
+                         {
+                              continue;
+                         }
+
+                         std::uint32_t id = 0;
+                         std::uint64_t seq = 0;
+                         std::memcpy( &id, each.message.data(), sizeof( id ) );
+                         std::memcpy( &seq, each.message.data() + sizeof( id ), sizeof( seq ) );
+                         if( id >= storm.received.size() )
+                         {
+                              continue;
+                         }
+
+                         auto& counts = storm.received[ id ];
+                         if( counts.size() <= seq )
+                         {
+                              counts.resize( seq + 1, 0 );
+                         }
+                         ++counts[ seq ];
+                    }
+               }
+
+               client->ackMessage( envelopes.back().deliveryTag, true );
+               storm.consumed += envelopes.size();
+          }
+          catch( const ConnectionError& )
+          {
+               /// Неподтвержденные сообщения будут доставлены повторно и учтены как дубликаты
+               broken = true;
+               subscribed = false;
+          }
+     }
+}
+
+
+/// Выполняет тело рабочего потока; ошибка потока завершает тест, не завершая процесс аварийно
+template< typename Body >
+void runGuarded( const char* name, Body body )
+{
+     try
+     {
+          body();
+     }
+     catch( const std::exception& e )
+     {
+          std::cerr << name << " failed: " << boost::diagnostic_information( e ) << "\n";
+          interrupted = true;
+     }
+}
+
+
+/// Ожидание, прерываемое сигналом
+void pause( Clock::duration duration )
+{
+     const auto deadline = Clock::now() + duration;
+     while( !interrupted && Clock::now() < deadline )
+     {
+          boost::this_thread::sleep_for( std::min< Clock::duration >( deadline - Clock::now(), boost::chrono::milliseconds( 100 ) ) );
+     }
+}
+
+
+/// Нагрузка на брокер, создаваемая попытками подключения
+struct Herd
+{
+     std::size_t attempts = 0;       ///< всего попыток подключения
+     std::size_t firstSecond = 0;    ///< попыток в первую секунду
+     std::size_t peak = 0;           ///< наибольшая частота попыток (по окнам 100 мс), в секунду
+};
+
+
+Herd analyse( const std::vector< Clock::time_point >& attempts, Clock::time_point from, Clock::time_point to )
+{
+     const auto window = boost::chrono::milliseconds( 100 );
+
+     Herd herd;
+     std::vector< std::size_t > windows;
+     for( const auto& each: attempts )
+     {
+          if( each < from || each >= to )
+          {
+               continue;
+          }
+
+          ++herd.attempts;
+          if( each - from < boost::chrono::seconds( 1 ) )
+          {
+               ++herd.firstSecond;
+          }
+
+          const std::size_t index = ( each - from ) / window;
+          if( windows.size() <= index )
+          {
+               windows.resize( index + 1, 0 );
+          }
+          herd.peak = std::max( herd.peak, ++windows[ index ] * 10 );
+     }
+     return herd;
+}
+
+
+void printRecovery( const char* title, const LatencyStats& recovery )
+{
+     std::cout << title << " time to recover, ms: "
+          << "p50 " << recovery.percentile( 0.5 )
+          << ", p99 " << recovery.percentile( 0.99 )
+          << ", max " << recovery.max() << "\n";
+}
+
+
+} // namespace {unnamed}
+
+
+int main( int argc, char** argv )
+{
+     namespace po = boost::program_options;
+
+     try
+     {
+          po::options_description options( "Usage: reconnect_storm [options]" );
+          options.add_options()
+               ( "help,h", "show this help" )
+               ( "host", po::value< std::string >()->default_value( "localhost" ), "broker host" )
+               ( "port", po::value< int >()->default_value( 5672 ), "broker port" )
+               ( "user", po::value< std::string >()->default_value( "guest" ), "user name" )
+               ( "password", po::value< std::string >()->default_value( "guest" ), "password" )
+               ( "vhost", po::value< std::string >()->default_value( "/" ), "virtual host" )
+               ( "proxy-port", po::value< int >()->default_value( 5673 ), "local port of the fault-injecting proxy clients connect to" )
+               ( "exchange,e", po::value< std::string >()->default_value( "amq.direct" ), "exchange to publish to" )
+               ( "queue,q", po::value< std::string >(), "queue to publish through and consume from (default - unique temporary queue)" )
+               ( "publishers,p", po::value< unsigned >()->default_value( 50 ), "publishing clients (one connection each)" )
+               ( "consumers,c", po::value< unsigned >()->default_value( 2 ), "consuming clients (one connection each)" )
+               ( "rate", po::value< double >()->default_value( 10 ), "publish rate of each publisher, msg/s" )
+               ( "size", po::value< std::size_t >()->default_value( 64 ), "message size, bytes" )
+               ( "cycles", po::value< unsigned >()->default_value( 3 ), "broker outages to simulate" )
+               ( "uptime", po::value< unsigned >()->default_value( 15 ), "time between outages (and before the first one), s" )
+               ( "outage", po::value< unsigned >()->default_value( 3000 ), "outage duration, ms" )
+               ( "drain", po::value< unsigned >()->default_value( 10 ), "time to wait for in-flight messages after publishing stops, s" );
+
+          po::variables_map vm;
+          po::store( po::parse_command_line( argc, argv, options ), vm );
+
+          if( vm.count( "help" ) )
+          {
+               std::cout << options << "\n";
+               return 0;
+          }
+          po::notify( vm );
+
+          std::signal( SIGINT, signalHandler );
+          std::signal( SIGTERM, signalHandler );
+
+          const Connection::Parameters direct(
+               vm[ "host" ].as< std::string >(),
+               vm[ "port" ].as< int >(),
+               vm[ "user" ].as< std::string >(),
+               vm[ "password" ].as< std::string >(),
+               vm[ "vhost" ].as< std::string >()
+          );
+          const auto proxyPort = vm[ "proxy-port" ].as< int >();
+          const Connection::Parameters proxied( "127.0.0.1", proxyPort, direct.username, direct.password, direct.virtualHost );
+
+          const auto queueName = vm.count( "queue" )
+               ? vm[ "queue" ].as< std::string >()
+               : "reconnect_storm." + std::to_string( ::getpid() );
+          const SimpleClient::QueueParameters queue( vm[ "exchange" ].as< std::string >(), queueName, queueName );
+
+          const auto publishers = vm[ "publishers" ].as< unsigned >();
+          const auto consumers = vm[ "consumers" ].as< unsigned >();
+          const auto cycles = vm[ "cycles" ].as< unsigned >();
+          const auto uptime = boost::chrono::seconds( vm[ "uptime" ].as< unsigned >() );
+          const auto outage = boost::chrono::milliseconds( vm[ "outage" ].as< unsigned >() );
+          const auto drain = boost::chrono::seconds( vm[ "drain" ].as< unsigned >() );
+
+          Storm storm( proxied, queue, publishers );
+          storm.ratePerPublisher = vm[ "rate" ].as< double >();
+          storm.size = vm[ "size" ].as< std::size_t >();
+          if( storm.ratePerPublisher <= 0 )
+          {
+               BOOST_THROW_EXCEPTION( std::invalid_argument( "publish rate must be positive" ) );
+          }
+
+          /// Очередь объявляется и связывается напрямую, минуя прокси: она должна пережить все имитируемые отказы,
+          /// а сообщения первых публикаций - попасть в нее до подписки потребителей.
+          /// Временная очередь удаляется брокером через минуту после завершения теста (x-expires)
+          {
+               SimpleClient::QueueDeclaration declaration( queueName );
+               declaration.durable = false;
+               if( !vm.count( "queue" ) )
+               {
+                    declaration.arguments.set( "x-expires", std::int64_t( 60000 ) );
+               }
+
+               Topology setup;
+               setup.declare( declaration );
+               if( !queue.exchange.empty() )
+               {
+                    setup.bind( queue.exchange, queue.queueName, queue.routingKey );
+               }
+
+               const auto report = setup.apply( Connection( direct ) );
+               if( report.failures )
+               {
+                    const auto& failed = report.declarations[ 0 ].ok ? report.bindings[ 0 ] : report.declarations[ 0 ];
+                    BOOST_THROW_EXCEPTION( std::runtime_error( "cannot set up queue " + queueName + ": " + failed.error ) );
+               }
+          }
+
+          FaultProxy proxy( proxyPort, direct.hostname, direct.port );
+
+          boost::thread_group consumerThreads;
+          for( unsigned i = 0; i < consumers; ++i )
+          {
+               consumerThreads.create_thread( [ &storm ](){ runGuarded( "consumer", [ &storm ](){ consumer( storm ); } ); } );
+          }
+
+          boost::thread_group publisherThreads;
+          for( unsigned i = 0; i < publishers; ++i )
+          {
+               publisherThreads.create_thread( [ &storm, i ](){ runGuarded( "publisher", [ &storm, i ](){ publisher( storm, i ); } ); } );
+          }
+
+          std::cout << std::fixed << std::setprecision( 1 )
+               << "clients: " << publishers << " publishers, " << consumers << " consumers via 127.0.0.1:" << proxyPort
+               << ", queue " << queueName << "\n";
+
+          pause( uptime );
+          proxy.takeAttempts();
+
+          LatencyStats recovery;
+          std::uint64_t unrecovered = 0;
+
+          for( unsigned cycle = 1; cycle <= cycles && !interrupted; ++cycle )
+          {
+               const auto failedAt = Clock::now();
+               proxy.fail();
+               pause( outage );
+               {
+                    boost::lock_guard< boost::mutex > lock( storm.mutex );
+                    storm.restoredAt = Clock::now();
+                    storm.recovery = LatencyStats();
+                    proxy.restore();
+                    ++storm.epoch;
+               }
+               const auto restoredAt = storm.restoredAt;
+
+               pause( uptime );
+
+               LatencyStats cycleRecovery;
+               {
+                    boost::lock_guard< boost::mutex > lock( storm.mutex );
+                    cycleRecovery = storm.recovery;
+               }
+               recovery.merge( cycleRecovery );
+               unrecovered += publishers + consumers - cycleRecovery.count();
+
+               /// Попытки подключения во время отказа - нагрузка, которую получил бы брокер, оставаясь доступным
+               /// по сети (например, при перезапуске приложения брокера); после восстановления - пик переподключения
+               const auto attempts = proxy.takeAttempts();
+               const auto during = analyse( attempts, failedAt, restoredAt );
+               const auto after = analyse( attempts, restoredAt, Clock::now() );
+
+               std::cout << "outage " << cycle << ": recovered " << cycleRecovery.count() << "/" << publishers + consumers << " clients\n";
+               printRecovery( "  ", cycleRecovery );
+               std::cout << "  connection attempts during outage: " << during.attempts
+                    << " (peak " << during.peak << "/s)"
+                    << ", after restore: " << after.attempts
+                    << " (first second " << after.firstSecond << ", peak " << after.peak << "/s)\n";
+          }
+
+          storm.publishing = false;
+          publisherThreads.join_all();
+
+          const auto drainDeadline = Clock::now() + drain;
+          while( consumers && !interrupted && storm.consumed < storm.published && Clock::now() < drainDeadline )
+          {
+               boost::this_thread::sleep_for( boost::chrono::milliseconds( 100 ) );
+          }
+          /// Повторные доставки могут прийти и после получения всех сообщений; даем им время
+          pause( boost::chrono::seconds( 1 ) );
+
+          storm.consuming = false;
+          consumerThreads.join_all();
+
+          std::uint64_t attempted = 0;
+          std::uint64_t lost = 0;
+          std::uint64_t duplicated = 0;
+          std::uint64_t unconfirmed = 0;
+          for( unsigned id = 0; id < publishers; ++id )
+          {
+               const auto& confirmed = storm.confirmed[ id ];
+               const auto& received = storm.received[ id ];
+               attempted += confirmed.size();
+
+               for( std::size_t seq = 0; seq < confirmed.size(); ++seq )
+               {
+                    const auto count = seq < received.size() ? received[ seq ] : 0;
+                    if( confirmed[ seq ] && !count )
+                    {
+                         ++lost;
+                    }
+                    if( !confirmed[ seq ] && count )
+                    {
+                         ++unconfirmed;
+                    }
+                    if( count > 1 )
+                    {
+                         duplicated += count - 1;
+                    }
+               }
+          }
+
+          const auto stats = proxy.statistics();
+
+          std::cout << "\n"
+               << "published: " << storm.published << " of " << attempted << " attempted (" << storm.publishFailures << " failed)\n"
+               << "consumed: " << storm.consumed << "\n"
+               << "lost: " << lost << " (published without error, never consumed)\n"
+               << "duplicated: " << duplicated << " (redundant deliveries)\n"
+               << "delivered despite publish error: " << unconfirmed << "\n";
+          printRecovery( "overall", recovery );
+          std::cout << "clients not recovered within uptime: " << unrecovered << "\n"
+               << "proxy: " << stats.accepted << " connections accepted, " << stats.rejected << " rejected, "
+               << stats.dropped << " dropped by outages\n";
+     }
+     catch( const po::error& e )
+     {
+          std::cerr << e.what() << "\n";
+          return 1;
+     }
+     catch( const std::exception& e )
+     {
+          std::cerr << "exception: " << boost::diagnostic_information( e ) << '\n';
+          return 1;
+     }
+
+     return 0;
+}
@@ -0,0 +1,104 @@
+/// @file
+/// @brief Локальный мультиплексор соединений с брокером для короткоживущих процессов
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#include <csignal>
+#include <stdexcept>
+#include <iostream>
+#include <boost/exception/diagnostic_information.hpp>
+#include <boost/program_options.hpp>
+#include <rabbitmq_client/sidecar_server.h>
+
+
+namespace {
+
+
+using edi::ts::rabbitmq_client::Connection;
+using edi::ts::rabbitmq_client::SidecarServer;
+
+
+SidecarServer* server = nullptr;
+
+
+void signalHandler( int signo )
+{
+     if( ( signo == SIGINT || signo == SIGTERM ) && server )
+     {
+          server->stop();
+     }
+}
+
+
+} // namespace {unnamed}
+
+
+int main( int argc, char** argv )
+{
+     namespace po = boost::program_options;
+
+     try
+     {
+          po::options_description options( "Usage: sidecar [options]" );
+          options.add_options()
+               ( "help,h", "show this help" )
+               ( "socket,s", po::value< std::string >()->default_value( "/tmp/rabbitmq_sidecar.sock" ), "unix socket path for local clients" )
+               ( "host", po::value< std::string >()->default_value( "localhost" ), "broker host" )
+               ( "port", po::value< int >()->default_value( 5672 ), "broker port" )
+               ( "user", po::value< std::string >()->default_value( "guest" ), "user name" )
+               ( "password", po::value< std::string >()->default_value( "guest" ), "password" )
+               ( "vhost", po::value< std::string >()->default_value( "/" ), "virtual host" )
+               ( "connections,c", po::value< std::size_t >()->default_value( 2 ), "broker connections" );
+
+          po::variables_map vm;
+          po::store( po::parse_command_line( argc, argv, options ), vm );
+
+          if( vm.count( "help" ) )
+          {
+               std::cout << options << "\n";
+               return 0;
+          }
+          po::notify( vm );
+
+          const Connection::Parameters params(
+               vm[ "host" ].as< std::string >(),
+               vm[ "port" ].as< int >(),
+               vm[ "user" ].as< std::string >(),
+               vm[ "password" ].as< std::string >(),
+               vm[ "vhost" ].as< std::string >()
+          );
+
+          SidecarServer::Parameters sidecarParams;
+          sidecarParams.connections = vm[ "connections" ].as< std::size_t >();
+
+          SidecarServer sidecar( vm[ "socket" ].as< std::string >(), params, sidecarParams );
+          server = &sidecar;
+          std::signal( SIGINT, signalHandler );
+          std::signal( SIGTERM, signalHandler );
+
+          std::cout << "sidecar: listening on " << vm[ "socket" ].as< std::string >() << std::endl;
+          sidecar.run();
+
+          std::signal( SIGINT, SIG_DFL );
+          std::signal( SIGTERM, SIG_DFL );
+          server = nullptr;
+
+          const auto statistics = sidecar.statistics();
+          std::cout
+               << "clients: " << statistics.clients
+               << ", published: " << statistics.published
+               << ", delivered: " << statistics.delivered
+               << ", reconnects: " << statistics.reconnects << "\n";
+     }
+     catch( const po::error& e )
+     {
+          std::cerr << e.what() << "\n";
+          return 1;
+     }
+     catch( const std::exception& e )
+     {
+          std::cerr << "exception: " << boost::diagnostic_information( e ) << '\n';
+          return 1;
+     }
+
+     return 0;
+}
@@ -0,0 +1,532 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#include <traffic_replay/capture.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <boost/throw_exception.hpp>
+
+
+namespace edi {
+namespace ts {
+namespace traffic_replay {
+
+namespace {
+namespace aux {
+
+
+using rabbitmq_client::HeaderArray;
+using rabbitmq_client::HeaderTable;
+using rabbitmq_client::HeaderValue;
+using rabbitmq_client::MessageProperties;
+
+
+const char MAGIC[ 8 ] = { 'R', 'M', 'Q', 'C', 'A', 'P', '0', '1' };
+
+
+/// Заголовок файла захвата
+struct FileHeader
+{
+     char magic[ 8 ];
+     std::uint64_t records;        ///< кол-во записанных сообщений
+     std::uint64_t dataEnd;        ///< смещение конца записанных данных
+     std::uint64_t startTime;      ///< время начала захвата, мкс от начала эпохи
+};
+
+/// Смещение первой записи от начала файла
+const std::size_t DATA_OFFSET = 64;
+
+static_assert( sizeof( FileHeader ) <= DATA_OFFSET, "capture file header does not fit" );
+
+
+/// Признаки наличия свойств сообщения в записи
+enum PropertyFlag
+{
+     CONTENT_TYPE       = 1 << 0,
+     CONTENT_ENCODING   = 1 << 1,
+     DELIVERY_MODE      = 1 << 2,
+     PRIORITY           = 1 << 3,
+     CORRELATION_ID     = 1 << 4,
+     REPLY_TO           = 1 << 5,
+     EXPIRATION         = 1 << 6,
+     MESSAGE_ID         = 1 << 7,
+     TIMESTAMP          = 1 << 8,
+     TYPE               = 1 << 9,
+     USER_ID            = 1 << 10,
+     APP_ID             = 1 << 11,
+     CLUSTER_ID         = 1 << 12,
+     HEADERS            = 1 << 13
+};
+
+
+/// Типы значений заголовков в записи (соответствуют порядку типов в HeaderValue::Value)
+enum ValueTag
+{
+     TAG_BLANK, TAG_BOOL, TAG_INT, TAG_UINT, TAG_DOUBLE, TAG_STRING, TAG_TABLE, TAG_ARRAY
+};
+
+
+FileHeader& header( rabbitmq_client::MappedFile& file )
+{
+     return *reinterpret_cast< FileHeader* >( file.data() );
+}
+
+
+/// Заголовок файла, открытого только для чтения
+const FileHeader& header( const rabbitmq_client::MappedFile& file )
+{
+     return *reinterpret_cast< const FileHeader* >( file.data() );
+}
+
+
+std::uint64_t now()
+{
+     return std::chrono::duration_cast< std::chrono::microseconds >(
+          std::chrono::system_clock::now().time_since_epoch() ).count();
+}
+
+
+void putVarint( std::string& out, std::uint64_t value )
+{
+     while( value >= 0x80 )
+     {
+          out.push_back( static_cast< char >( value | 0x80 ) );
+          value >>= 7;
+     }
+     out.push_back( static_cast< char >( value ) );
+}
+
+
+void putString( std::string& out, const char* data, std::size_t size )
+{
+     putVarint( out, size );
+     out.append( data, size );
+}
+
+
+void putString( std::string& out, const std::string& str )
+{
+     putString( out, str.data(), str.size() );
+}
+
+
+void putTable( std::string& out, const HeaderTable& table );
+
+
+struct ValueEncoder : boost::static_visitor< void >
+{
+     explicit ValueEncoder( std::string& o ) : out( o ) {}
+
+     void operator()( const boost::blank& ) const
+     {
+          out.push_back( TAG_BLANK );
+     }
+     void operator()( bool value ) const
+     {
+          out.push_back( TAG_BOOL );
+          out.push_back( value ? 1 : 0 );
+     }
+     void operator()( std::int64_t value ) const
+     {
+          /// zigzag: небольшие по модулю отрицательные числа кодируются так же компактно, как положительные
+          out.push_back( TAG_INT );
+          putVarint( out, ( static_cast< std::uint64_t >( value ) << 1 ) ^ static_cast< std::uint64_t >( value >> 63 ) );
+     }
+     void operator()( std::uint64_t value ) const
+     {
+          out.push_back( TAG_UINT );
+          putVarint( out, value );
+     }
+     void operator()( double value ) const
+     {
+          out.push_back( TAG_DOUBLE );
+          out.append( reinterpret_cast< const char* >( &value ), sizeof( value ) );
+     }
+     void operator()( const std::string& value ) const
+     {
+          out.push_back( TAG_STRING );
+          putString( out, value );
+     }
+     void operator()( const HeaderTable& value ) const
+     {
+          out.push_back( TAG_TABLE );
+          putTable( out, value );
+     }
+     void operator()( const HeaderArray& value ) const
+     {
+          out.push_back( TAG_ARRAY );
+          putVarint( out, value.size() );
+          for( const auto& each: value )
+          {
+               boost::apply_visitor( *this, each.value );
+          }
+     }
+
+     std::string& out;
+};
+
+
+void putTable( std::string& out, const HeaderTable& table )
+{
+     putVarint( out, table.size() );
+     for( const auto& each: table )
+     {
+          putString( out, each.first );
+          boost::apply_visitor( ValueEncoder( out ), each.second.value );
+     }
+}
+
+
+std::uint32_t propertyFlags( const MessageProperties& p, const HeaderTable& headers )
+{
+     std::uint32_t flags = 0;
+     if( p.contentType ) flags |= CONTENT_TYPE;
+     if( p.contentEncoding ) flags |= CONTENT_ENCODING;
+     if( p.deliveryMode ) flags |= DELIVERY_MODE;
+     if( p.priority ) flags |= PRIORITY;
+     if( p.correlationId ) flags |= CORRELATION_ID;
+     if( p.replyTo ) flags |= REPLY_TO;
+     if( p.expiration ) flags |= EXPIRATION;
+     if( p.messageId ) flags |= MESSAGE_ID;
+     if( p.timestamp ) flags |= TIMESTAMP;
+     if( p.type ) flags |= TYPE;
+     if( p.userId ) flags |= USER_ID;
+     if( p.appId ) flags |= APP_ID;
+     if( p.clusterId ) flags |= CLUSTER_ID;
+     if( !headers.empty() ) flags |= HEADERS;
+     return flags;
+}
+
+
+void putProperties( std::string& out, const MessageProperties& p, const HeaderTable& headers )
+{
+     putVarint( out, propertyFlags( p, headers ) );
+
+     if( p.contentType ) putString( out, *p.contentType );
+     if( p.contentEncoding ) putString( out, *p.contentEncoding );
+     if( p.deliveryMode ) out.push_back( static_cast< char >( *p.deliveryMode ) );
+     if( p.priority ) out.push_back( static_cast< char >( *p.priority ) );
+     if( p.correlationId ) putString( out, *p.correlationId );
+     if( p.replyTo ) putString( out, *p.replyTo );
+     if( p.expiration ) putString( out, *p.expiration );
+     if( p.messageId ) putString( out, *p.messageId );
+     if( p.timestamp ) putVarint( out, *p.timestamp );
+     if( p.type ) putString( out, *p.type );
+     if( p.userId ) putString( out, *p.userId );
+     if( p.appId ) putString( out, *p.appId );
+     if( p.clusterId ) putString( out, *p.clusterId );
+     if( !headers.empty() ) putTable( out, headers );
+}
+
+
+/// Чтение данных записи с контролем выхода за ее границы
+struct Cursor
+{
+     const char* pos;
+     const char* end;
+
+     void require( std::size_t size ) const
+     {
+          if( static_cast< std::size_t >( end - pos ) < size )
+          {
+               BOOST_THROW_EXCEPTION( std::runtime_error( "capture record is corrupted" ) );
+          }
+     }
+
+     std::uint8_t byte()
+     {
+          require( 1 );
+          return static_cast< std::uint8_t >( *pos++ );
+     }
+
+     std::uint64_t varint()
+     {
+          std::uint64_t value = 0;
+          for( unsigned shift = 0; shift < 64; shift += 7 )
+          {
+               const auto b = byte();
+               value |= static_cast< std::uint64_t >( b & 0x7f ) << shift;
+               if( !( b & 0x80 ) )
+               {
+                    return value;
+               }
+          }
+          BOOST_THROW_EXCEPTION( std::runtime_error( "capture record is corrupted" ) );
+     }
+
+     std::string string()
+     {
+          const auto size = varint();
+          require( size );
+          std::string result( pos, size );
+          pos += size;
+          return result;
+     }
+};
+
+
+HeaderTable getTable( Cursor& in );
+
+
+HeaderValue getValue( Cursor& in )
+{
+     HeaderValue result;
+
+     switch( in.byte() )
+     {
+          case TAG_BLANK:
+               break;
+          case TAG_BOOL:
+               result.value = in.byte() != 0;
+               break;
+          case TAG_INT:
+               {
+                    const auto raw = in.varint();
+                    result.value = static_cast< std::int64_t >( ( raw >> 1 ) ^ ( ~( raw & 1 ) + 1 ) );
+               }
+               break;
+          case TAG_UINT:
+               result.value = in.varint();
+               break;
+          case TAG_DOUBLE:
+               {
+                    double value = 0;
+                    in.require( sizeof( value ) );
+                    std::memcpy( &value, in.pos, sizeof( value ) );
+                    in.pos += sizeof( value );
+                    result.value = value;
+               }
+               break;
+          case TAG_STRING:
+               result.value = in.string();
+               break;
+          case TAG_TABLE:
+               result.value = getTable( in );
+               break;
+          case TAG_ARRAY:
+               {
+                    HeaderArray array( in.varint() );
+                    for( auto& each: array )
+                    {
+                         each = getValue( in );
+                    }
+                    result.value = std::move( array );
+               }
+               break;
+          default:
+               BOOST_THROW_EXCEPTION( std::runtime_error( "capture record is corrupted: unknown value type" ) );
+     }
+
+     return result;
+}
+
+
+HeaderTable getTable( Cursor& in )
+{
+     HeaderTable table;
+     for( auto count = in.varint(); count > 0; --count )
+     {
+          auto key = in.string();
+          table[ std::move( key ) ] = getValue( in );
+     }
+     return table;
+}
+
+
+void getProperties( Cursor& in, MessageProperties& p, HeaderTable& headers )
+{
+     const auto flags = in.varint();
+
+     p = MessageProperties();
+     headers.clear();
+
+     if( flags & CONTENT_TYPE ) p.contentType = in.string();
+     if( flags & CONTENT_ENCODING ) p.contentEncoding = in.string();
+     if( flags & DELIVERY_MODE ) p.deliveryMode = in.byte();
+     if( flags & PRIORITY ) p.priority = in.byte();
+     if( flags & CORRELATION_ID ) p.correlationId = in.string();
+     if( flags & REPLY_TO ) p.replyTo = in.string();
+     if( flags & EXPIRATION ) p.expiration = in.string();
+     if( flags & MESSAGE_ID ) p.messageId = in.string();
+     if( flags & TIMESTAMP ) p.timestamp = in.varint();
+     if( flags & TYPE ) p.type = in.string();
+     if( flags & USER_ID ) p.userId = in.string();
+     if( flags & APP_ID ) p.appId = in.string();
+     if( flags & CLUSTER_ID ) p.clusterId = in.string();
+     if( flags & HEADERS ) headers = getTable( in );
+}
+
+
+} // namespace aux
+} // namespace {unnamed}
+
+
+CaptureWriter::CaptureWriter( const std::string& path, std::size_t capacity )
+     : path_( path )
+     , file_( new rabbitmq_client::MappedFile( path, aux::DATA_OFFSET + capacity ) )
+{
+     auto& header = aux::header( *file_ );
+     std::memcpy( header.magic, aux::MAGIC, sizeof( aux::MAGIC ) );
+     header.records = 0;
+     header.dataEnd = aux::DATA_OFFSET;
+     header.startTime = aux::now();
+}
+
+
+CaptureWriter::~CaptureWriter()
+{
+     try
+     {
+          close();
+     }
+     catch( ... )
+     {
+     }
+}
+
+
+bool CaptureWriter::append( const rabbitmq_client::Delivery& delivery, std::uint64_t timestamp )
+{
+     if( !file_ )
+     {
+          BOOST_THROW_EXCEPTION( std::runtime_error( "capture file is closed" ) );
+     }
+
+     std::string& payload = buffer_;
+     payload.clear();
+
+     aux::putVarint( payload, timestamp - lastTimestamp_ );
+     aux::putString( payload, delivery.exchange() );
+     aux::putString( payload, delivery.routingKey() );
+     aux::putProperties( payload, delivery.properties(), delivery.headers() );
+     aux::putString( payload, delivery.body().data(), delivery.body().size() );
+
+     std::string frame;
+     aux::putVarint( frame, payload.size() );
+
+     auto& header = aux::header( *file_ );
+     if( header.dataEnd + frame.size() + payload.size() > file_->size() )
+     {
+          return false;
+     }
+
+     char* dest = file_->data() + header.dataEnd;
+     std::memcpy( dest, frame.data(), frame.size() );
+     std::memcpy( dest + frame.size(), payload.data(), payload.size() );
+
+     /// Заголовок обновляется после записи данных: прочитанная из заголовка граница всегда указывает на конец
+     /// полностью записанной записи
+     header.dataEnd += frame.size() + payload.size();
+     ++header.records;
+     lastTimestamp_ = timestamp;
+
+     return true;
+}
+
+
+std::uint64_t CaptureWriter::records() const
+{
+     return file_ ? aux::header( *file_ ).records : 0;
+}
+
+
+std::uint64_t CaptureWriter::bytes() const
+{
+     return file_ ? aux::header( *file_ ).dataEnd - aux::DATA_OFFSET : 0;
+}
+
+
+void CaptureWriter::close()
+{
+     if( !file_ )
+     {
+          return;
+     }
+
+     const auto dataEnd = aux::header( *file_ ).dataEnd;
+     file_->flush();
+     file_.reset();
+
+     if( ::truncate( path_.c_str(), dataEnd ) != 0 )
+     {
+          BOOST_THROW_EXCEPTION( std::runtime_error( "cannot truncate capture file " + path_ + ": " + std::strerror( errno ) ) );
+     }
+}
+
+
+CaptureReader::CaptureReader( const std::string& path )
+     : offset_( aux::DATA_OFFSET )
+{
+     struct stat st = {};
+     if( ::stat( path.c_str(), &st ) != 0 )
+     {
+          BOOST_THROW_EXCEPTION( std::runtime_error( "cannot open capture file " + path + ": " + std::strerror( errno ) ) );
+     }
+     if( static_cast< std::size_t >( st.st_size ) < aux::DATA_OFFSET )
+     {
+          BOOST_THROW_EXCEPTION( std::runtime_error( "not a capture file: " + path ) );
+     }
+
+     file_.reset( new rabbitmq_client::MappedFile( path, st.st_size, rabbitmq_client::MappedFile::Mode::ReadOnly ) );
+
+     const auto& header = aux::header( *file_ );
+     if( std::memcmp( header.magic, aux::MAGIC, sizeof( aux::MAGIC ) ) != 0 || header.dataEnd > file_->size() )
+     {
+          BOOST_THROW_EXCEPTION( std::runtime_error( "not a capture file: " + path ) );
+     }
+}
+
+
+std::uint64_t CaptureReader::records() const
+{
+     return aux::header( *file_ ).records;
+}
+
+
+std::uint64_t CaptureReader::startTime() const
+{
+     return aux::header( *file_ ).startTime;
+}
+
+
+bool CaptureReader::next( CapturedMessage& message )
+{
+     const auto dataEnd = aux::header( *file_ ).dataEnd;
+     if( offset_ >= dataEnd )
+     {
+          return false;
+     }
+
+     aux::Cursor frame{ file_->data() + offset_, file_->data() + dataEnd };
+     const auto size = frame.varint();
+     frame.require( size );
+
+     aux::Cursor in{ frame.pos, frame.pos + size };
+     lastTimestamp_ += in.varint();
+     message.timestamp = lastTimestamp_;
+     message.exchange = in.string();
+     message.routingKey = in.string();
+     aux::getProperties( in, message.properties, message.headers );
+     message.body = in.string();
+
+     offset_ = ( frame.pos + size ) - file_->data();
+     return true;
+}
+
+
+void CaptureReader::rewind()
+{
+     offset_ = aux::DATA_OFFSET;
+     lastTimestamp_ = 0;
+}
+
+
+} // namespace traffic_replay
+} // namespace ts
+} // namespace edi
@@ -0,0 +1,104 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <rabbitmq_client/delivery.h>
+#include <rabbitmq_client/mapped_file.h>
+
+
+namespace edi {
+namespace ts {
+namespace traffic_replay {
+
+
+/// Записанное в файл захвата сообщение
+struct CapturedMessage
+{
+     std::uint64_t timestamp = 0;                            ///< время получения, мкс от начала захвата
+     std::string exchange;                                   ///< точка публикации
+     std::string routingKey;                                 ///< ключ маршрутизации
+     rabbitmq_client::MessageProperties properties;          ///< свойства сообщения
+     rabbitmq_client::HeaderTable headers;                   ///< заголовки сообщения
+     std::string body;                                       ///< тело сообщения
+};
+
+
+/// @brief Запись сообщений в файл захвата
+/// @details Файл отображается в память целиком (емкость задается при создании), сообщения дописываются
+/// последовательно. Заголовок файла обновляется после каждой записи, поэтому при аварийном завершении процесса
+/// файл остается пригодным для воспроизведения. При закрытии файл усекается до фактического объема данных.
+///
+/// Формат записи компактный: длины, разности меток времени и целые числа кодируются varint,
+/// отсутствующие свойства сообщения не занимают места.
+class CaptureWriter
+{
+public:
+     /// @throw std::runtime_error в случае ошибок создания файла
+     CaptureWriter( const std::string& path, std::size_t capacity );
+
+     /// Закрывает файл (см. close())
+     ~CaptureWriter();
+
+     CaptureWriter( const CaptureWriter& ) = delete;
+     CaptureWriter& operator=( const CaptureWriter& ) = delete;
+
+     /// @brief Записывает сообщение, полученное через @a timestamp мкс от начала захвата
+     /// @return false, если в файле недостаточно места (сообщение не записано)
+     bool append( const rabbitmq_client::Delivery& delivery, std::uint64_t timestamp );
+
+     /// Кол-во записанных сообщений
+     std::uint64_t records() const;
+
+     /// Объем записанных данных, байт
+     std::uint64_t bytes() const;
+
+     /// Сбрасывает данные на диск и усекает файл до фактического объема данных
+     void close();
+
+private:
+     std::string path_;
+     std::unique_ptr< rabbitmq_client::MappedFile > file_;
+     std::uint64_t lastTimestamp_ = 0;
+     std::string buffer_;
+};
+
+
+/// Последовательное чтение сообщений из файла захвата
+class CaptureReader
+{
+public:
+     /// @throw std::runtime_error если файл не существует или не является файлом захвата
+     explicit CaptureReader( const std::string& path );
+
+     CaptureReader( const CaptureReader& ) = delete;
+     CaptureReader& operator=( const CaptureReader& ) = delete;
+
+     /// Кол-во сообщений в файле
+     std::uint64_t records() const;
+
+     /// Время начала захвата, мкс от начала эпохи (UTC)
+     std::uint64_t startTime() const;
+
+     /// @brief Читает очередное сообщение
+     /// @return false, если сообщения закончились
+     /// @throw std::runtime_error если запись повреждена
+     bool next( CapturedMessage& message );
+
+     /// Возвращается к первому сообщению
+     void rewind();
+
+private:
+     std::unique_ptr< const rabbitmq_client::MappedFile > file_;     ///< отображен только для чтения
+     std::uint64_t offset_;
+     std::uint64_t lastTimestamp_ = 0;
+};
+
+
+} // namespace traffic_replay
+} // namespace ts
+} // namespace edi
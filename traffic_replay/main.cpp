@@ -0,0 +1,324 @@
+/// @file
+/// @brief Запись потока сообщений из очереди в файл захвата и воспроизведение его публикацией в брокер
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#include <csignal>
+#include <stdexcept>
+#include <iostream>
+#include <iomanip>
+#include <boost/chrono/system_clocks.hpp>
+#include <boost/exception/diagnostic_information.hpp>
+#include <boost/program_options.hpp>
+#include <boost/thread/thread.hpp>
+#include <rabbitmq_client/error.h>
+#include <rabbitmq_client/field_table.h>
+#include <rabbitmq_client/simple_client.h>
+#include <rabbitmq_client/utils.h>
+#include <traffic_replay/capture.h>
+#include <utils/latency_stats.h>
+
+
+namespace {
+
+
+using edi::ts::rabbitmq_client::Connection;
+using edi::ts::rabbitmq_client::ConnectionError;
+using edi::ts::rabbitmq_client::FieldTable;
+using edi::ts::rabbitmq_client::SimpleClient;
+using edi::ts::traffic_replay::CaptureReader;
+using edi::ts::traffic_replay::CaptureWriter;
+using edi::ts::traffic_replay::CapturedMessage;
+
+typedef boost::chrono::steady_clock Clock;
+
+
+volatile std::sig_atomic_t stop = 0;
+
+
+void signalHandler( int signo )
+{
+     if( signo == SIGINT || signo == SIGTERM )
+     {
+          stop = 1;
+     }
+}
+
+
+std::uint64_t microseconds( Clock::duration duration )
+{
+     return boost::chrono::duration_cast< boost::chrono::microseconds >( duration ).count();
+}
+
+
+void report( const std::string& title, std::uint64_t messages, std::uint64_t bytes, Clock::duration elapsed, const LatencyStats& latency )
+{
+     const double seconds = std::max( 1e-9, boost::chrono::duration< double >( elapsed ).count() );
+
+     std::cout
+          << std::fixed << std::setprecision( 1 )
+          << "messages: " << messages << ", bytes: " << bytes << ", elapsed: " << seconds << " s\n"
+          << "throughput: " << messages / seconds << " msg/s, " << bytes / seconds / ( 1024 * 1024 ) << " MB/s\n"
+          << title << " latency, us: "
+          << "p50 " << latency.percentile( 0.5 )
+          << ", p99 " << latency.percentile( 0.99 )
+          << ", p999 " << latency.percentile( 0.999 )
+          << ", max " << latency.max()
+          << ", mean " << latency.mean() << "\n";
+}
+
+
+/// Формирует свойства сообщения rabbitmq-c; строки ссылаются на данные @a message, заголовки - на @a headers
+amqp_basic_properties_t nativeProperties( const CapturedMessage& message, FieldTable& headers )
+{
+     using edi::ts::rabbitmq_client::fromString;
+
+     const auto& p = message.properties;
+
+     amqp_basic_properties_t props;
+     props._flags = 0;
+
+     if( p.contentType ) { props._flags |= AMQP_BASIC_CONTENT_TYPE_FLAG; props.content_type = fromString( *p.contentType ); }
+     if( p.contentEncoding ) { props._flags |= AMQP_BASIC_CONTENT_ENCODING_FLAG; props.content_encoding = fromString( *p.contentEncoding ); }
+     if( p.deliveryMode ) { props._flags |= AMQP_BASIC_DELIVERY_MODE_FLAG; props.delivery_mode = *p.deliveryMode; }
+     if( p.priority ) { props._flags |= AMQP_BASIC_PRIORITY_FLAG; props.priority = *p.priority; }
+     if( p.correlationId ) { props._flags |= AMQP_BASIC_CORRELATION_ID_FLAG; props.correlation_id = fromString( *p.correlationId ); }
+     if( p.replyTo ) { props._flags |= AMQP_BASIC_REPLY_TO_FLAG; props.reply_to = fromString( *p.replyTo ); }
+     if( p.expiration ) { props._flags |= AMQP_BASIC_EXPIRATION_FLAG; props.expiration = fromString( *p.expiration ); }
+     if( p.messageId ) { props._flags |= AMQP_BASIC_MESSAGE_ID_FLAG; props.message_id = fromString( *p.messageId ); }
+     if( p.timestamp ) { props._flags |= AMQP_BASIC_TIMESTAMP_FLAG; props.timestamp = *p.timestamp; }
+     if( p.type ) { props._flags |= AMQP_BASIC_TYPE_FLAG; props.type = fromString( *p.type ); }
+     if( p.appId ) { props._flags |= AMQP_BASIC_APP_ID_FLAG; props.app_id = fromString( *p.appId ); }
+
+     /// user_id не воспроизводится: брокер отклоняет сообщения, user_id которых не совпадает с пользователем соединения;
+     /// cluster_id устарел и также отклоняется брокером
+
+     headers = FieldTable();
+     if( !message.headers.empty() )
+     {
+          for( const auto& each: message.headers )
+          {
+               headers.set( each.first, each.second.value );
+          }
+          props._flags |= AMQP_BASIC_HEADERS_FLAG;
+          props.headers = headers.native();
+     }
+
+     return props;
+}
+
+
+int record( const Connection::Parameters& params, const boost::program_options::variables_map& vm )
+{
+     const auto path = vm[ "file" ].as< std::string >();
+     const auto exchange = vm[ "exchange" ].as< std::string >();
+     const auto routingKey = vm[ "routing-key" ].as< std::string >();
+     const auto capacity = vm[ "capacity" ].as< std::size_t >() * 1024 * 1024;
+     const auto duration = vm[ "duration" ].as< unsigned >();
+     const auto limit = vm[ "count" ].as< std::uint64_t >();
+
+     Connection connection( params );
+
+     /// Без явно указанной очереди сообщения снимаются с временной очереди, привязанной к точке публикации,
+     /// т.е. запись не влияет на работу штатных получателей
+     std::string queueName;
+     if( vm.count( "queue" ) )
+     {
+          queueName = vm[ "queue" ].as< std::string >();
+     }
+     else
+     {
+          SimpleClient::QueueDeclaration tap( "" );
+          tap.durable = false;
+          tap.exclusive = true;
+          tap.autoDelete = true;
+          queueName = SimpleClient::declareQueue( connection, tap );
+     }
+
+     SimpleClient::ConsumerParameters consumer;
+     consumer.prefetchCount = 1000;
+     SimpleClient::bind( connection, exchange, queueName, routingKey, consumer );
+
+     CaptureWriter writer( path, capacity );
+     LatencyStats latency;
+
+     std::cout << "recording " << exchange << "/" << routingKey << " via queue " << queueName << " to " << path << "\n";
+
+     const auto started = Clock::now();
+     const auto deadline = started + boost::chrono::seconds( duration );
+     const boost::posix_time::milliseconds pollInterval( 200 );
+
+     while( !stop && ( !duration || Clock::now() < deadline ) && ( !limit || writer.records() < limit ) )
+     {
+          const auto delivery = SimpleClient::consumeDelivery( connection, pollInterval );
+          if( !delivery )
+          {
+               continue;
+          }
+
+          const auto received = Clock::now();
+          if( !writer.append( *delivery, microseconds( received - started ) ) )
+          {
+               std::cerr << "capture file is full, recording stopped\n";
+               break;
+          }
+          SimpleClient::ackMessage( connection, delivery->deliveryTag() );
+
+          latency.add( microseconds( Clock::now() - received ) );
+     }
+
+     const auto elapsed = Clock::now() - started;
+     const auto records = writer.records();
+     const auto bytes = writer.bytes();
+     writer.close();
+
+     report( "capture", records, bytes, elapsed, latency );
+     return 0;
+}
+
+
+int replay( const Connection::Parameters& params, const boost::program_options::variables_map& vm )
+{
+     const auto path = vm[ "file" ].as< std::string >();
+     const auto speed = vm[ "speed" ].as< double >();
+     const auto loops = vm[ "loops" ].as< unsigned >();
+
+     CaptureReader reader( path );
+     Connection connection( params );
+
+     std::cout << "replaying " << reader.records() << " messages from " << path << " at "
+          << ( speed > 0 ? std::to_string( speed ) + "x" : std::string( "max" ) ) << " speed\n";
+
+     LatencyStats publishLatency;
+     LatencyStats scheduleLag;
+     std::uint64_t messages = 0;
+     std::uint64_t bytes = 0;
+
+     CapturedMessage message;
+     FieldTable headers;
+
+     const auto started = Clock::now();
+
+     for( unsigned loop = 0; loop < loops && !stop; ++loop )
+     {
+          reader.rewind();
+
+          const auto loopStarted = Clock::now();
+
+          while( !stop && reader.next( message ) )
+          {
+               /// В режиме масштабирования времени сообщение публикуется с исходным интервалом от начала захвата,
+               /// деленным на коэффициент ускорения; отставание от расписания показывает, успевает ли публикатор
+               if( speed > 0 )
+               {
+                    const auto due = loopStarted + boost::chrono::microseconds( static_cast< std::uint64_t >( message.timestamp / speed ) );
+                    boost::this_thread::sleep_until( due );
+                    scheduleLag.add( microseconds( Clock::now() - due ) );
+               }
+
+               const auto props = nativeProperties( message, headers );
+               const auto publishStarted = Clock::now();
+               try
+               {
+                    SimpleClient::publishMessage( connection, message.exchange, message.routingKey, message.body, props );
+               }
+               catch( const ConnectionError& e )
+               {
+                    std::cerr << "connection error: " << e.what() << ", reconnecting\n";
+                    connection.reconnect();
+                    SimpleClient::publishMessage( connection, message.exchange, message.routingKey, message.body, props );
+               }
+               publishLatency.add( microseconds( Clock::now() - publishStarted ) );
+
+               ++messages;
+               bytes += message.body.size();
+          }
+     }
+
+     report( "publish", messages, bytes, Clock::now() - started, publishLatency );
+     if( speed > 0 )
+     {
+          std::cout << "schedule lag, us: p50 " << scheduleLag.percentile( 0.5 ) << ", p99 " << scheduleLag.percentile( 0.99 )
+               << ", max " << scheduleLag.max() << "\n";
+     }
+     return 0;
+}
+
+
+} // namespace {unnamed}
+
+
+int main( int argc, char** argv )
+{
+     namespace po = boost::program_options;
+
+     try
+     {
+          po::options_description options( "Usage: traffic_replay record|replay [options]" );
+          options.add_options()
+               ( "help,h", "show this help" )
+               ( "mode", po::value< std::string >()->required(), "record or replay" )
+               ( "host", po::value< std::string >()->default_value( "localhost" ), "broker host" )
+               ( "port", po::value< int >()->default_value( 5672 ), "broker port" )
+               ( "user", po::value< std::string >()->default_value( "guest" ), "user name" )
+               ( "password", po::value< std::string >()->default_value( "guest" ), "password" )
+               ( "vhost", po::value< std::string >()->default_value( "/" ), "virtual host" )
+               ( "file,f", po::value< std::string >()->required(), "capture file" )
+               ( "exchange,e", po::value< std::string >()->default_value( "amq.direct" ), "record: exchange to tap" )
+               ( "routing-key,r", po::value< std::string >()->default_value( "" ), "record: binding key" )
+               ( "queue,q", po::value< std::string >(), "record: consume an existing queue instead of a temporary tap queue" )
+               ( "capacity", po::value< std::size_t >()->default_value( 1024 ), "record: capture file capacity, MB" )
+               ( "duration", po::value< unsigned >()->default_value( 0 ), "record: duration, s (0 - until interrupted)" )
+               ( "count", po::value< std::uint64_t >()->default_value( 0 ), "record: messages to record (0 - unlimited)" )
+               ( "speed", po::value< double >()->default_value( 1.0 ), "replay: time scale, 1 - original pace, N - N times faster, 0 - as fast as possible" )
+               ( "loops", po::value< unsigned >()->default_value( 1 ), "replay: how many times to replay the capture" );
+
+          po::positional_options_description positional;
+          positional.add( "mode", 1 );
+
+          po::variables_map vm;
+          po::store( po::command_line_parser( argc, argv ).options( options ).positional( positional ).run(), vm );
+
+          if( vm.count( "help" ) )
+          {
+               std::cout << options << "\n";
+               return 0;
+          }
+          po::notify( vm );
+
+          std::signal( SIGINT, signalHandler );
+          std::signal( SIGTERM, signalHandler );
+
+          const Connection::Parameters params(
+               vm[ "host" ].as< std::string >(),
+               vm[ "port" ].as< int >(),
+               vm[ "user" ].as< std::string >(),
+               vm[ "password" ].as< std::string >(),
+               vm[ "vhost" ].as< std::string >()
+          );
+
+          const auto mode = vm[ "mode" ].as< std::string >();
+          if( mode == "record" )
+          {
+               return record( params, vm );
+          }
+          if( mode == "replay" )
+          {
+               return replay( params, vm );
+          }
+
+          std::cerr << "unknown mode: " << mode << "\n" << options << "\n";
+          return 1;
+     }
+     catch( const po::error& e )
+     {
+          std::cerr << e.what() << "\n";
+          return 1;
+     }
+     catch( const std::exception& e )
+     {
+          std::cerr << "exception: " << boost::diagnostic_information( e ) << '\n';
+          return 1;
+     }
+
+     return 0;
+}
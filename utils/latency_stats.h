@@ -0,0 +1,120 @@
+/// @file
+/// @brief
+/// @copyright Copyright (c) InfoTeCS. All Rights Reserved.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+
+
+/// @brief Гистограмма задержек с логарифмическими интервалами (в духе HdrHistogram)
+/// @details Значения до 64 хранятся точно, большие - с относительной погрешностью не более 1/32.
+/// Объем памяти фиксирован (около 15 КБ) и не зависит от кол-ва измерений, поэтому гистограмму можно
+/// вести на каждом рабочем потоке отдельно и объединять в конце измерения методом merge().
+///
+/// @note Единица измерения выбирается вызывающей стороной (как правило - микросекунды).
+/// Методы класса не являются потокобезопасными.
+class LatencyStats
+{
+public:
+     LatencyStats()
+     {
+          counts_.fill( 0 );
+     }
+
+     /// Добавляет измерение
+     void add( std::uint64_t value )
+     {
+          ++counts_[ indexOf( value ) ];
+          ++total_;
+          sum_ += value;
+          min_ = std::min( min_, value );
+          max_ = std::max( max_, value );
+     }
+
+     /// Добавляет все измерения гистограммы @a other
+     void merge( const LatencyStats& other )
+     {
+          for( std::size_t i = 0; i < BUCKETS; ++i )
+          {
+               counts_[ i ] += other.counts_[ i ];
+          }
+          total_ += other.total_;
+          sum_ += other.sum_;
+          min_ = std::min( min_, other.min_ );
+          max_ = std::max( max_, other.max_ );
+     }
+
+     /// Кол-во измерений
+     std::uint64_t count() const { return total_; }
+
+     /// Минимальное значение (0 при отсутствии измерений)
+     std::uint64_t min() const { return total_ ? min_ : 0; }
+
+     /// Максимальное значение
+     std::uint64_t max() const { return max_; }
+
+     /// Среднее значение
+     double mean() const { return total_ ? static_cast< double >( sum_ ) / total_ : 0; }
+
+     /// Значение, не превышаемое долей @a q (от 0 до 1) измерений
+     std::uint64_t percentile( double q ) const
+     {
+          if( !total_ )
+          {
+               return 0;
+          }
+
+          const auto rank = std::max< std::uint64_t >( 1, static_cast< std::uint64_t >( q * total_ + 0.5 ) );
+
+          std::uint64_t seen = 0;
+          for( std::size_t i = 0; i < BUCKETS; ++i )
+          {
+               seen += counts_[ i ];
+               if( seen >= rank )
+               {
+                    return std::min( max_, upperBoundOf( i ) );
+               }
+          }
+          return max_;
+     }
+
+private:
+     /// Точно хранимые значения [0, 64); далее на каждую степень двойки приходится 32 интервала
+     static constexpr unsigned LINEAR = 64;
+     static constexpr unsigned SUB_BUCKETS = 32;
+     static constexpr std::size_t BUCKETS = SUB_BUCKETS * 60 + LINEAR;
+
+     static std::size_t indexOf( std::uint64_t value )
+     {
+          if( value < LINEAR )
+          {
+               return value;
+          }
+
+          const unsigned msb = 63 - __builtin_clzll( value );
+          const unsigned shift = msb - 5;
+          return SUB_BUCKETS * shift + ( value >> shift );
+     }
+
+     static std::uint64_t upperBoundOf( std::size_t index )
+     {
+          if( index < LINEAR )
+          {
+               return index;
+          }
+
+          const unsigned shift = index / SUB_BUCKETS - 1;
+          const std::uint64_t top = index % SUB_BUCKETS + SUB_BUCKETS;
+          return ( ( top + 1 ) << shift ) - 1;
+     }
+
+     std::array< std::uint64_t, BUCKETS > counts_;
+     std::uint64_t total_ = 0;
+     std::uint64_t sum_ = 0;
+     std::uint64_t min_ = std::numeric_limits< std::uint64_t >::max();
+     std::uint64_t max_ = 0;
+};